@@ -0,0 +1,69 @@
+// Copyright 2016 Jim Pivarski
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//     http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// A consumer for --transport=shm:NAME, for local testing: copies everything in the ring to
+// standard output (the same bytes that --mode=dump writes to a pipe) and reports the rate.
+// 
+//     build/root2avro --mode=dump --transport=shm:test FILE TREE &
+//     build/shmRingCat test > dump.bin
+
+// C includes
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../src/shmRing.h"
+
+int main(int argc, char **argv) {
+  if (argc != 2) {
+    fprintf(stderr, "Usage: shmRingCat NAME > output\n");
+    return -1;
+  }
+
+  // the producer may not have created the segment yet
+  ShmRing *ring = NULL;
+  for (int trial = 0;  ring == NULL  &&  trial < 1000;  trial++) {
+    ring = shmRingOpen(argv[1]);
+    if (ring == NULL  &&  errno != ENOENT  &&  errno != EAGAIN)
+      break;
+    if (ring == NULL)
+      usleep(10000);
+  }
+  if (ring == NULL) {
+    fprintf(stderr, "Could not open shared-memory ring %s: %s\n", argv[1], strerror(errno));
+    return -1;
+  }
+
+  static char buffer[1024 * 1024];
+  size_t total = 0;
+  struct timespec begin, end;
+  clock_gettime(CLOCK_MONOTONIC, &begin);
+
+  size_t size;
+  do {
+    size = shmRingRead(ring, buffer, sizeof(buffer));
+    if (fwrite(buffer, 1, size, stdout) != size)
+      break;
+    total += size;
+  } while (size == sizeof(buffer));
+
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  shmRingClose(ring);
+
+  double seconds = (end.tv_sec - begin.tv_sec) + 1e-9 * (end.tv_nsec - begin.tv_nsec);
+  fprintf(stderr, "%zu bytes in %.3f s (%.1f MB/s)\n", total, seconds, total / seconds / 1e6);
+  return 0;
+}
@@ -0,0 +1,122 @@
+// Copyright 2016 Jim Pivarski
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//     http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Compares encodeVarints, forced to each instruction set this CPU has (scalar, SSE4.1, AVX2),
+// with the scalar loop (they must produce the same bytes) and times each on runs of small,
+// mixed, and large integers. Build and run with "make bench".
+
+// C includes
+#include <stdint.h>
+#include <string.h>
+
+// C++ includes
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <vector>
+
+#include "../src/varintRuns.h"
+
+template <typename T>
+bool check(const std::vector<T> &items) {
+  std::vector<char> expected(10 * items.size() + 8);
+  std::vector<char> actual(10 * items.size() + 8);
+  for (size_t start = 0;  start < 8  &&  start <= items.size();  start++) {    // every alignment and tail
+    int numItems = items.size() - start;
+    size_t expectedSize = encodeVarintsScalar(items.data() + start, numItems, expected.data());
+    size_t actualSize = encodeVarints(items.data() + start, numItems, actual.data());
+    if (expectedSize != actualSize  ||  memcmp(expected.data(), actual.data(), expectedSize) != 0)
+      return false;
+  }
+  return true;
+}
+
+template <typename T, typename ENCODER>
+double megaItemsPerSecond(const std::vector<T> &items, ENCODER encoder, int repeat) {
+  std::vector<char> out(10 * items.size() + 8);
+  size_t total = 0;
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0;  i < repeat;  i++)
+    total += encoder(items.data(), items.size(), out.data());
+  std::chrono::duration<double> seconds = std::chrono::steady_clock::now() - start;
+  if (total == 0)
+    std::cout << "";
+  return items.size() * (double)repeat / seconds.count() / 1e6;
+}
+
+// the scalar loop, then encodeVarints forced to each instruction set
+static const char *candidates[] = {"loop", "scalar", "sse4.1", "avx2"};
+static const int numCandidates = 4;
+static const int numRounds = 5;
+
+template <typename T>
+bool bench(const char *name, T low, T high) {
+  std::mt19937_64 random(12345);
+  std::uniform_int_distribution<int64_t> distribution(low, high);
+  std::vector<T> items(100000);
+  for (size_t i = 0;  i < items.size();  i++)
+    items[i] = distribution(random);
+
+  bool available[numCandidates];
+  bool same[numCandidates];
+  double best[numCandidates];
+  for (int c = 0;  c < numCandidates;  c++) {
+    available[c] = c == 0  ||  forceVarintInstructionSet(candidates[c]);
+    same[c] = c == 0  ||  !available[c]  ||  check(items);
+    best[c] = 0.0;
+  }
+
+  // a warm-up round that isn't counted, then the best of several rounds, taking turns so that
+  // a slow moment (another process, the CPU's clock) doesn't land on one candidate only
+  for (int round = -1;  round < numRounds;  round++)
+    for (int c = 0;  c < numCandidates;  c++) {
+      if (!available[c])
+        continue;
+      double rate;
+      if (c == 0)
+        rate = megaItemsPerSecond(items, [](const T *items, int numItems, char *out) { return encodeVarintsScalar(items, numItems, out); }, 100);
+      else {
+        forceVarintInstructionSet(candidates[c]);
+        rate = megaItemsPerSecond(items, [](const T *items, int numItems, char *out) { return encodeVarints(items, numItems, out); }, 100);
+      }
+      if (round >= 0)
+        best[c] = std::max(best[c], rate);
+    }
+
+  bool ok = true;
+  std::cout << name << "  loop " << best[0] << " M/s";
+  for (int c = 1;  c < numCandidates;  c++) {
+    if (!available[c])
+      std::cout << "  " << candidates[c] << " unavailable";
+    else
+      std::cout << "  " << candidates[c] << " " << best[c] << " M/s (x" << best[c] / best[0] << (same[c] ? "" : ", DIFFERENT") << ")";
+    ok = same[c]  &&  ok;
+  }
+  std::cout << std::endl;
+  return ok;
+}
+
+int main(int argc, char **argv) {
+  bool ok = true;
+  ok = bench<int16_t>("short [-60, 60]         ", -60, 60)  &&  ok;
+  ok = bench<int16_t>("short (all)             ", INT16_MIN, INT16_MAX)  &&  ok;
+  ok = bench<int32_t>("int [-60, 60]           ", -60, 60)  &&  ok;
+  ok = bench<int32_t>("int [-10000, 10000]     ", -10000, 10000)  &&  ok;
+  ok = bench<int32_t>("int (all)               ", INT32_MIN, INT32_MAX)  &&  ok;
+  ok = bench<int64_t>("long [-10000, 10000]    ", -10000, 10000)  &&  ok;
+  ok = bench<int64_t>("long [-2^55, 2^55)      ", -(1LL << 55), (1LL << 55) - 1)  &&  ok;
+  ok = bench<int64_t>("long (all)              ", INT64_MIN, INT64_MAX)  &&  ok;
+  return ok ? 0 : 1;
+}
@@ -18,8 +18,10 @@ import argparse
 import glob
 import json
 import os
+import struct
 import subprocess
 import sys
+import zlib
 
 parser = argparse.ArgumentParser(description="Test root2avro by generating ROOT files of different types and attempting to read them back.")
 parser.add_argument("tests", metavar="N", nargs="*", action="store", help="tests to run (if blank, run everything in tests/*.py)")
@@ -195,6 +197,114 @@ def dumpsExpanded(x):
 def dumpsOneLevel(x):
     return "\n".join(map(json.dumps, x))
 
+def root2avroOutput(command):
+    root2avro = subprocess.Popen(command, stdout=subprocess.PIPE)
+    output = root2avro.communicate()[0]
+    if root2avro.returncode != 0:
+        raise RuntimeError("root2avro failed with exit code %d" % root2avro.returncode)
+    return output
+
+class AvroDecoder:
+    """Just enough of Avro's binary encoding to check root2avro's output against the expected JSON."""
+    def __init__(self, data):
+        self.data = data
+        self.pos = 0
+    def done(self):
+        return self.pos >= len(self.data)
+    def read(self, size):
+        if self.pos + size > len(self.data):
+            raise ValueError("truncated Avro data")
+        out = self.data[self.pos:self.pos + size]
+        self.pos += size
+        return out
+    def long(self):
+        out = shift = 0
+        while True:
+            byte = ord(self.read(1))
+            out |= (byte & 0x7f) << shift
+            shift += 7
+            if not byte & 0x80:
+                return (out >> 1) ^ -(out & 1)
+    def blockCounts(self):
+        # arrays and maps are blocks of items; a negative count is followed by the block's size
+        while True:
+            count = self.long()
+            if count == 0:
+                return
+            if count < 0:
+                self.long()
+                count = -count
+            for i in xrange(count):
+                yield i
+    def datum(self, schema, names):
+        if isinstance(schema, list):
+            return self.datum(schema[self.long()], names)
+        if isinstance(schema, dict) and schema["type"] in ("record", "enum", "fixed"):
+            names[schema["name"]] = schema
+            if "namespace" in schema:
+                names[schema["namespace"] + "." + schema["name"]] = schema
+        if isinstance(schema, dict) and schema["type"] == "record":
+            return dict((field["name"], self.datum(field["type"], names)) for field in schema["fields"])
+        if isinstance(schema, dict) and schema["type"] == "array":
+            return [self.datum(schema["items"], names) for i in self.blockCounts()]
+        if isinstance(schema, dict) and schema["type"] == "map":
+            return dict((self.datum("string", names), self.datum(schema["values"], names)) for i in self.blockCounts())
+        if isinstance(schema, dict) and schema["type"] == "enum":
+            return schema["symbols"][self.long()]
+        if isinstance(schema, dict) and schema["type"] == "fixed":
+            return self.read(schema["size"])
+        if isinstance(schema, dict):
+            return self.datum(schema["type"], names)
+        if schema == "null":
+            return None
+        if schema == "boolean":
+            return self.read(1) != "\x00"
+        if schema in ("int", "long"):
+            return self.long()
+        if schema == "float":
+            return struct.unpack("<f", self.read(4))[0]
+        if schema == "double":
+            return struct.unpack("<d", self.read(8))[0]
+        if schema == "bytes":
+            return self.read(self.long())
+        if schema == "string":
+            return self.read(self.long()).decode("utf-8")
+        return self.datum(names[schema], names)
+
+def readAvroContainer(data):
+    decoder = AvroDecoder(data)
+    if decoder.read(4) != "Obj\x01":
+        raise ValueError("not an Avro container (no \"Obj\" magic)")
+    metadata = dict((decoder.datum("string", {}), decoder.datum("bytes", {})) for i in decoder.blockCounts())
+    schema = json.loads(metadata["avro.schema"])
+    codec = metadata.get("avro.codec", "null")
+    sync = decoder.read(16)
+    records = []
+    while not decoder.done():
+        numRecords = decoder.long()
+        block = decoder.read(decoder.long())
+        if codec == "deflate":
+            block = zlib.decompress(block, -15)
+        elif codec != "null":
+            raise ValueError("codec %s is not decoded by this test" % codec)
+        if decoder.read(16) != sync:
+            raise ValueError("wrong sync marker after block")
+        blockDecoder = AvroDecoder(block)
+        records.extend(blockDecoder.datum(schema, {}) for i in xrange(numRecords))
+        if not blockDecoder.done():
+            raise ValueError("extra bytes after the records in a block")
+    return records
+
+def readAvroStream(data, schema):
+    # --mode=avro-stream: each record is preceded by its entry number
+    decoder = AvroDecoder(data)
+    entries = []
+    records = []
+    while not decoder.done():
+        entries.append(decoder.long())
+        records.append(decoder.datum(schema, {}))
+    return entries, records
+
 class TerminalColor:
     HEADER = "\033[95m"
     OKBLUE = "\033[94m"
@@ -305,6 +415,69 @@ for test in tests:
         if not same(dataResultJson, test["json"] + test["json"], 1e-5):
             raise RuntimeError("root2avro produced the wrong JSON:\n\n%s\n\nExpected:\n\n%s" % (dumpsOneLevel(dataResultJson), dumpsOneLevel(test["json"])))
 
+        # serializers compiled for the resolved types (--jit), flattened programs of operations
+        # (--program), and basket-at-a-time reading (--bulk, which falls back to entry-at-a-time
+        # for trees it can't read) must give the same records as walking the types
+
+        for option in ["--jit", "--program", "--bulk"]:
+            command = ["build/root2avro", "--mode=json", option, rootFile, "t"]
+            try:
+                dataResultJson = map(json.loads, root2avroOutput(command).splitlines())
+            except ValueError as err:
+                raise RuntimeError("root2avro %s produced bad JSON: %s" % (option, err))
+
+            if not same(dataResultJson, test["json"], 1e-5):
+                raise RuntimeError("root2avro %s produced the wrong JSON:\n\n%s\n\nExpected:\n\n%s" % (option, dumpsOneLevel(dataResultJson), dumpsOneLevel(test["json"])))
+
+            command = ["build/root2avro", "--mode=avro", option, rootFile, "t"]
+            try:
+                dataResultJson = readAvroContainer(root2avroOutput(command))
+            except ValueError as err:
+                raise RuntimeError("root2avro %s produced bad Avro: %s" % (option, err))
+
+            if not same(dataResultJson, test["json"], 1e-5):
+                raise RuntimeError("root2avro %s produced the wrong Avro:\n\n%s\n\nExpected:\n\n%s" % (option, dumpsOneLevel(dataResultJson), dumpsOneLevel(test["json"])))
+
+        # the same records in Avro (through avro-c, and through the block writer with compression threads),
+        # also encoded by worker threads (--encode-threads)
+
+        for options in [], ["--codec=deflate", "--codec-threads=2"], ["--encode-threads=2"], ["--encode-threads=2", "--codec=deflate", "--codec-threads=2"]:
+            command = ["build/root2avro", "--mode=avro"] + options + [rootFile, "t"]
+            try:
+                dataResultJson = readAvroContainer(root2avroOutput(command))
+            except ValueError as err:
+                raise RuntimeError("root2avro %s produced bad Avro: %s" % (" ".join(options), err))
+
+            if not same(dataResultJson, test["json"], 1e-5):
+                raise RuntimeError("root2avro %s produced the wrong Avro:\n\n%s\n\nExpected:\n\n%s" % (" ".join(options), dumpsOneLevel(dataResultJson), dumpsOneLevel(test["json"])))
+
+        command = ["build/root2avro", "--mode=avro-stream", rootFile, "t"]
+        try:
+            entries, dataResultJson = readAvroStream(root2avroOutput(command), schemaResultJson)
+        except ValueError as err:
+            raise RuntimeError("root2avro produced bad Avro: %s" % err)
+
+        if entries != range(len(test["json"]))  or  not same(dataResultJson, test["json"], 1e-5):
+            raise RuntimeError("root2avro produced the wrong Avro:\n\n%s\n\nExpected:\n\n%s" % (dumpsOneLevel(dataResultJson), dumpsOneLevel(test["json"])))
+
+        # in worker processes (--jobs), stitched together: the same records as in one process
+
+        outputs = []
+        for jobs in 1, 3:
+            command = ["build/root2avro", "--mode=avro", "--jobs=%d" % jobs, rootFile, rootFile, rootFile, "t"]
+            try:
+                outputs.append(readAvroContainer(root2avroOutput(command)))
+            except ValueError as err:
+                raise RuntimeError("root2avro produced bad Avro: %s" % err)
+
+        if not same(outputs[0], outputs[1], 0)  or  not same(outputs[1], test["json"] * 3, 1e-5):
+            raise RuntimeError("root2avro --jobs=3 produced the wrong Avro:\n\n%s\n\nExpected:\n\n%s" % (dumpsOneLevel(outputs[1]), dumpsOneLevel(outputs[0])))
+
+        command = ["build/root2avro", "--mode=json", "--jobs=3", rootFile, rootFile, rootFile, "t"]
+        dataResultJson = map(json.loads, root2avroOutput(command).splitlines())
+        if not same(dataResultJson, test["json"] * 3, 1e-5):
+            raise RuntimeError("root2avro --jobs=3 produced the wrong JSON:\n\n%s\n\nExpected:\n\n%s" % (dumpsOneLevel(dataResultJson), dumpsOneLevel(test["json"] * 3)))
+
     except Exception as err:
         print TerminalColor.BOLD + TerminalColor.FAIL + "FAILURE" + TerminalColor.ENDC
         print >> sys.stderr
@@ -0,0 +1,254 @@
+// Copyright 2016 Jim Pivarski
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//     http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifdef ARROW
+
+#include "arrowWriter.h"
+
+ArrowWriter::ArrowWriter(TreeWalker *treeWalker, int fd, bool fileFormat, int64_t batchRows) :
+  treeWalker(treeWalker),
+  layout(treeWalker),
+  batchRows(batchRows),
+  snapshot(64*1024)
+{
+  std::set<LayoutNode*> visiting;
+  std::vector<std::shared_ptr<arrow::Field> > fields;
+  for (size_t i = 0;  i < layout.root->members.size();  i++) {
+    std::shared_ptr<arrow::DataType> type = arrowType(layout.root->members[i], visiting);
+    if (type == nullptr) return;
+    fields.push_back(arrow::field(layout.root->memberNames[i], type));
+
+    std::unique_ptr<arrow::ArrayBuilder> builder;
+    check(arrow::MakeBuilder(arrow::default_memory_pool(), type, &builder));
+    columns.push_back(std::move(builder));
+  }
+  schema = arrow::schema(fields);
+  if (!valid) return;
+
+  auto openedSink = arrow::io::FileOutputStream::Open(fd);
+  if (!openedSink.ok()) {
+    check(openedSink.status());
+    return;
+  }
+  sink = *openedSink;
+
+  auto openedWriter = fileFormat ? arrow::ipc::MakeFileWriter(sink, schema) : arrow::ipc::MakeStreamWriter(sink, schema);
+  if (!openedWriter.ok()) {
+    check(openedWriter.status());
+    return;
+  }
+  writer = *openedWriter;
+}
+
+void ArrowWriter::check(const arrow::Status &status) {
+  if (!status.ok()  &&  valid) {
+    valid = false;
+    errorMessage = status.ToString();
+  }
+}
+
+std::shared_ptr<arrow::DataType> ArrowWriter::arrowType(LayoutNode *node, std::set<LayoutNode*> &visiting) {
+  switch (node->instruction) {
+    case SchemaBool:    return arrow::boolean();
+    case SchemaChar:    return arrow::int8();
+    case SchemaUChar:   return arrow::uint8();
+    case SchemaShort:   return arrow::int16();
+    case SchemaUShort:  return arrow::uint16();
+    case SchemaInt:     return arrow::int32();
+    case SchemaUInt:    return arrow::uint32();
+    case SchemaLong:    return arrow::int64();
+    case SchemaULong:   return arrow::uint64();
+    case SchemaFloat:   return arrow::float32();
+    case SchemaDouble:  return arrow::float64();
+    case SchemaString:  return arrow::utf8();
+
+    case SchemaClassName: {
+      if (visiting.find(node) != visiting.end()) {
+        valid = false;
+        errorMessage = std::string("Recursive class ") + node->name + std::string(" cannot be represented as an Arrow type.");
+        return nullptr;
+      }
+      visiting.insert(node);
+      std::vector<std::shared_ptr<arrow::Field> > fields;
+      for (size_t i = 0;  i < node->members.size();  i++) {
+        std::shared_ptr<arrow::DataType> type = arrowType(node->members[i], visiting);
+        if (type == nullptr) return nullptr;
+        fields.push_back(arrow::field(node->memberNames[i], type));
+      }
+      visiting.erase(node);
+      return arrow::struct_(fields);
+    }
+
+    case SchemaPointer:                                  // Arrow types are all nullable
+      return arrowType(node->item, visiting);
+
+    case SchemaSequence: {
+      std::shared_ptr<arrow::DataType> type = arrowType(node->item, visiting);
+      if (type == nullptr) return nullptr;
+      return arrow::list(type);
+    }
+
+    default:
+      valid = false;
+      errorMessage = std::string("Unexpected schema instruction in Arrow conversion.");
+      return nullptr;
+  }
+}
+
+const char *ArrowWriter::append(const char *ptr, LayoutNode *node, arrow::ArrayBuilder *builder) {
+  switch (node->instruction) {
+    case SchemaBool:    check(static_cast<arrow::BooleanBuilder*>(builder)->Append(readSnapshot<char>(ptr) != 0));    break;
+    case SchemaChar:    check(static_cast<arrow::Int8Builder*>(builder)->Append(readSnapshot<int8_t>(ptr)));          break;
+    case SchemaUChar:   check(static_cast<arrow::UInt8Builder*>(builder)->Append(readSnapshot<uint8_t>(ptr)));        break;
+    case SchemaShort:   check(static_cast<arrow::Int16Builder*>(builder)->Append(readSnapshot<int16_t>(ptr)));        break;
+    case SchemaUShort:  check(static_cast<arrow::UInt16Builder*>(builder)->Append(readSnapshot<uint16_t>(ptr)));      break;
+    case SchemaInt:     check(static_cast<arrow::Int32Builder*>(builder)->Append(readSnapshot<int32_t>(ptr)));        break;
+    case SchemaUInt:    check(static_cast<arrow::UInt32Builder*>(builder)->Append(readSnapshot<uint32_t>(ptr)));      break;
+    case SchemaLong:    check(static_cast<arrow::Int64Builder*>(builder)->Append(readSnapshot<int64_t>(ptr)));        break;
+    case SchemaULong:   check(static_cast<arrow::UInt64Builder*>(builder)->Append(readSnapshot<uint64_t>(ptr)));      break;
+    case SchemaFloat:   check(static_cast<arrow::FloatBuilder*>(builder)->Append(readSnapshot<float>(ptr)));          break;
+    case SchemaDouble:  check(static_cast<arrow::DoubleBuilder*>(builder)->Append(readSnapshot<double>(ptr)));        break;
+
+    case SchemaString: {
+      int length = readSnapshot<int>(ptr);
+      check(static_cast<arrow::StringBuilder*>(builder)->Append(ptr, length));
+      ptr += length;
+      break;
+    }
+
+    case SchemaClassName: {
+      arrow::StructBuilder *structBuilder = static_cast<arrow::StructBuilder*>(builder);
+      check(structBuilder->Append());
+      for (size_t i = 0;  i < node->members.size();  i++)
+        ptr = append(ptr, node->members[i], structBuilder->field_builder(i));
+      break;
+    }
+
+    case SchemaPointer:
+      if (readSnapshot<char>(ptr) == 0)
+        check(builder->AppendNull());
+      else
+        ptr = append(ptr, node->item, builder);
+      break;
+
+    case SchemaSequence: {
+      arrow::ListBuilder *listBuilder = static_cast<arrow::ListBuilder*>(builder);
+      int numItems = readSnapshot<int>(ptr);
+      check(listBuilder->Append());
+      ptr = appendRun(ptr, node->item, listBuilder->value_builder(), numItems);
+      break;
+    }
+
+    default:
+      break;
+  }
+  return ptr;
+}
+
+template <typename BUILDER, typename T>
+inline const char *appendValues(const char *ptr, arrow::ArrayBuilder *builder, int numItems, arrow::Status &status) {
+  // the snapshot holds the items contiguously (copied from the TTreeReaderArray or std::vector)
+  status = static_cast<BUILDER*>(builder)->AppendValues(reinterpret_cast<const T*>(ptr), numItems);
+  return ptr + numItems * sizeof(T);
+}
+
+const char *ArrowWriter::appendRun(const char *ptr, LayoutNode *node, arrow::ArrayBuilder *builder, int numItems) {
+  arrow::Status status;
+  switch (node->instruction) {
+    case SchemaBool:    ptr = appendValues<arrow::BooleanBuilder, uint8_t>(ptr, builder, numItems, status);   break;
+    case SchemaChar:    ptr = appendValues<arrow::Int8Builder, int8_t>(ptr, builder, numItems, status);       break;
+    case SchemaUChar:   ptr = appendValues<arrow::UInt8Builder, uint8_t>(ptr, builder, numItems, status);     break;
+    case SchemaShort:   ptr = appendValues<arrow::Int16Builder, int16_t>(ptr, builder, numItems, status);     break;
+    case SchemaUShort:  ptr = appendValues<arrow::UInt16Builder, uint16_t>(ptr, builder, numItems, status);   break;
+    case SchemaInt:     ptr = appendValues<arrow::Int32Builder, int32_t>(ptr, builder, numItems, status);     break;
+    case SchemaUInt:    ptr = appendValues<arrow::UInt32Builder, uint32_t>(ptr, builder, numItems, status);   break;
+    case SchemaLong:    ptr = appendValues<arrow::Int64Builder, int64_t>(ptr, builder, numItems, status);     break;
+    case SchemaULong:   ptr = appendValues<arrow::UInt64Builder, uint64_t>(ptr, builder, numItems, status);   break;
+    case SchemaFloat:   ptr = appendValues<arrow::FloatBuilder, float>(ptr, builder, numItems, status);       break;
+    case SchemaDouble:  ptr = appendValues<arrow::DoubleBuilder, double>(ptr, builder, numItems, status);     break;
+
+    default:
+      for (int i = 0;  i < numItems;  i++)
+        ptr = append(ptr, node, builder);
+      break;
+  }
+  check(status);
+  return ptr;
+}
+
+bool ArrowWriter::write(int64_t firstEntry, int64_t lastEntry) {
+  int64_t entry = firstEntry;
+  while (valid  &&  entry < lastEntry) {
+    if (treeWalker->cut != nullptr) {
+      treeWalker->setEntryInCurrentTree(entry);
+      if (!treeWalker->passesCut()) {
+        entry++;
+        continue;
+      }
+    }
+
+    snapshot[0] = StatusWriting;
+    try {
+      treeWalker->copyToBuffer(entry, 1, snapshot.data(), snapshot.size());
+    }
+    catch (std::exception &err) {
+      valid = false;
+      errorMessage = err.what();
+      break;
+    }
+    if (snapshot[0] == StatusTooSmall) {
+      snapshot.resize(2 * snapshot.size());              // and try the same entry again
+      continue;
+    }
+
+    const char *ptr = snapshot.data() + sizeof(char);    // status byte
+    for (size_t i = 0;  i < columns.size();  i++)
+      ptr = append(ptr, layout.root->members[i], columns[i].get());
+    numRows++;
+    entry++;
+
+    if (numRows >= batchRows)
+      writeBatch();
+  }
+  return valid;
+}
+
+bool ArrowWriter::writeBatch() {
+  if (numRows == 0  ||  !valid) return valid;
+
+  std::vector<std::shared_ptr<arrow::Array> > arrays;
+  for (auto column = columns.begin();  column != columns.end();  ++column) {
+    std::shared_ptr<arrow::Array> array;
+    check((*column)->Finish(&array));
+    arrays.push_back(array);
+  }
+  if (!valid) return false;
+
+  std::shared_ptr<arrow::RecordBatch> batch = arrow::RecordBatch::Make(schema, numRows, arrays);
+  check(writer->WriteRecordBatch(*batch));
+  numRows = 0;
+  return valid;
+}
+
+bool ArrowWriter::close() {
+  if (closed) return valid;
+  closed = true;
+  if (writer == nullptr) return valid;
+  writeBatch();
+  check(writer->Close());
+  check(sink->Close());
+  return valid;
+}
+
+#endif // ARROW
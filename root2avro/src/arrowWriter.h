@@ -0,0 +1,75 @@
+// Copyright 2016 Jim Pivarski
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//     http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef ARROW_WRITER_H
+#define ARROW_WRITER_H
+
+#ifdef ARROW
+
+// C includes
+#include <stdint.h>
+
+// C++ includes
+#include <memory>
+#include <set>
+#include <string>
+#include <vector>
+
+// Arrow includes
+#include <arrow/api.h>
+#include <arrow/io/file.h>
+#include <arrow/ipc/writer.h>
+
+#include "datawalker.h"
+#include "pipeline.h"
+
+// Arrow IPC output (--mode=arrow for the stream format, --mode=arrow-file for the file
+// format). Entries are snapshotted with TreeWalker::copyToBuffer, as in the encode
+// pipeline, and appended to one Arrow builder per top-level field: classes become struct
+// columns, sequences become list columns (primitive items are appended as whole
+// contiguous runs), and pointers become nulls. Every batchRows entries, the builders are
+// finished into a record batch and written.
+
+class ArrowWriter {
+public:
+  bool valid = true;
+  std::string errorMessage = "";
+
+  ArrowWriter(TreeWalker *treeWalker, int fd, bool fileFormat, int64_t batchRows);
+  bool write(int64_t firstEntry, int64_t lastEntry);   // entry numbers in the current tree
+  bool close();
+
+private:
+  TreeWalker *treeWalker;
+  SnapshotLayout layout;
+  int64_t batchRows;
+  int64_t numRows = 0;
+  bool closed = false;
+  std::vector<char> snapshot;
+
+  std::shared_ptr<arrow::Schema> schema;
+  std::vector<std::unique_ptr<arrow::ArrayBuilder> > columns;
+  std::shared_ptr<arrow::io::FileOutputStream> sink;
+  std::shared_ptr<arrow::ipc::RecordBatchWriter> writer;
+
+  void check(const arrow::Status &status);
+  std::shared_ptr<arrow::DataType> arrowType(LayoutNode *node, std::set<LayoutNode*> &visiting);
+  const char *append(const char *ptr, LayoutNode *node, arrow::ArrayBuilder *builder);
+  const char *appendRun(const char *ptr, LayoutNode *node, arrow::ArrayBuilder *builder, int numItems);
+  bool writeBatch();
+};
+
+#endif // ARROW
+
+#endif // ARROW_WRITER_H
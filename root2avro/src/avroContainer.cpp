@@ -0,0 +1,720 @@
+// Copyright 2016 Jim Pivarski
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//     http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <errno.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#ifdef DEFLATE_CODEC
+#include <zlib.h>
+#endif
+#ifdef SNAPPY_CODEC
+#include <snappy-c.h>
+#include <zlib.h>
+#endif
+#ifdef LZMA_CODEC
+#include <lzma.h>
+#endif
+#ifdef ZSTD_CODEC
+#include <zdict.h>
+#include <zstd.h>
+#endif
+#ifdef LZ4_CODEC
+#include <lz4.h>
+#include <lz4hc.h>
+#endif
+
+#include "avroContainer.h"
+#include "avroIndex.h"
+
+bool readAvroLong(FILE *in, int64_t &value) {
+  // zig-zag varint, as in the Avro specification
+  uint64_t encoded = 0;
+  int shift = 0;
+  int byte;
+  do {
+    byte = fgetc(in);
+    if (byte == EOF  ||  shift > 63)
+      return false;
+    encoded |= ((uint64_t)(byte & 0x7f)) << shift;
+    shift += 7;
+  } while (byte & 0x80);
+  value = (int64_t)(encoded >> 1) ^ -(int64_t)(encoded & 1);
+  return true;
+}
+
+void writeAvroLong(FILE *out, int64_t value) {
+  uint64_t encoded = ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+  while (encoded & ~((uint64_t)0x7f)) {
+    fputc((int)((encoded & 0x7f) | 0x80), out);
+    encoded >>= 7;
+  }
+  fputc((int)encoded, out);
+}
+
+static void appendAvroLong(std::string &out, int64_t value) {
+  uint64_t encoded = ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+  while (encoded & ~((uint64_t)0x7f)) {
+    out.push_back((char)((encoded & 0x7f) | 0x80));
+    encoded >>= 7;
+  }
+  out.push_back((char)encoded);
+}
+
+///////////////////////////////////////////////////////////////////// AvroContainerReader
+
+AvroContainerReader::AvroContainerReader(FILE *in) : in(in) {
+  int first = fgetc(in);
+  if (first == EOF) {
+    // a process that had nothing to convert may not have written a header at all
+    empty = true;
+    valid = true;
+    return;
+  }
+  ungetc(first, in);
+
+  header.resize(4);
+  if (fread(&header[0], 1, 4, in) != 4  ||  header != std::string("Obj\x01", 4)) {
+    errorMessage = std::string("Not an Avro object container file.");
+    return;
+  }
+
+  // metadata map (blocks of key-value pairs, terminated by a zero-length block)
+  int64_t numItems;
+  do {
+    if (!readHeaderLong(numItems)) return;
+    if (numItems < 0) {
+      int64_t blockSize;
+      if (!readHeaderLong(blockSize)) return;
+      numItems = -numItems;
+    }
+    for (int64_t i = 0;  i < 2*numItems;  i++) {
+      int64_t size;
+      if (!readHeaderLong(size)  ||  !readHeaderBytes(size)) return;
+    }
+  } while (numItems != 0);
+
+  if (fread(sync, 1, AVRO_SYNC_SIZE, in) != AVRO_SYNC_SIZE) {
+    errorMessage = std::string("Truncated Avro header.");
+    return;
+  }
+
+  valid = true;
+}
+
+bool AvroContainerReader::readHeaderLong(int64_t &value) {
+  if (!readAvroLong(in, value)) {
+    errorMessage = std::string("Truncated Avro header.");
+    return false;
+  }
+  uint64_t encoded = ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+  do {
+    header.push_back((char)((encoded & 0x7f) | (encoded > 0x7f ? 0x80 : 0x00)));
+    encoded >>= 7;
+  } while (encoded != 0);
+  return true;
+}
+
+bool AvroContainerReader::readHeaderBytes(int64_t size) {
+  // a corrupt length must not be allocated before the bytes are found to be missing
+  char buffer[4096];
+  while (size > 0) {
+    size_t chunk = size < (int64_t)sizeof(buffer) ? (size_t)size : sizeof(buffer);
+    if (fread(buffer, 1, chunk, in) != chunk)
+      break;
+    header.append(buffer, chunk);
+    size -= chunk;
+  }
+  if (size != 0) {
+    errorMessage = std::string("Truncated Avro header.");
+    return false;
+  }
+  return true;
+}
+
+bool AvroContainerReader::nextBlock(int64_t &numObjects, std::string &data) {
+  if (!valid  ||  empty)
+    return false;
+
+  int first = fgetc(in);
+  if (first == EOF)
+    return false;
+  ungetc(first, in);
+
+  int64_t size;
+  char blockSync[AVRO_SYNC_SIZE];
+  if (!readAvroLong(in, numObjects)  ||  !readAvroLong(in, size)  ||  size < 0) {
+    errorMessage = std::string("Truncated Avro block.");
+    valid = false;
+    return false;
+  }
+
+  data.resize(size);
+  if ((size > 0  &&  fread(&data[0], 1, size, in) != (size_t)size)  ||
+      fread(blockSync, 1, AVRO_SYNC_SIZE, in) != AVRO_SYNC_SIZE) {
+    errorMessage = std::string("Truncated Avro block.");
+    valid = false;
+    return false;
+  }
+
+  if (memcmp(blockSync, sync, AVRO_SYNC_SIZE) != 0) {
+    errorMessage = std::string("Avro block does not end with the file's sync marker.");
+    valid = false;
+    return false;
+  }
+
+  return true;
+}
+
+///////////////////////////////////////////////////////////////////// concatenation
+
+bool concatenateAvro(std::vector<FILE*> &inputs, FILE *out, std::string &errorMessage) {
+  // all inputs must have been written with the same schema and codec; the header and sync
+  // marker of the first non-empty input are used for the whole output
+  bool headerWritten = false;
+  char sync[AVRO_SYNC_SIZE];
+  int64_t numObjects;
+  std::string data;
+
+  for (auto input = inputs.begin();  input != inputs.end();  ++input) {
+    AvroContainerReader reader(*input);
+    if (!reader.valid) {
+      errorMessage = reader.errorMessage;
+      return false;
+    }
+    if (reader.empty)
+      continue;
+
+    if (!headerWritten) {
+      memcpy(sync, reader.sync, AVRO_SYNC_SIZE);
+      fwrite(reader.header.data(), 1, reader.header.size(), out);
+      fwrite(sync, 1, AVRO_SYNC_SIZE, out);
+      headerWritten = true;
+    }
+
+    while (reader.nextBlock(numObjects, data)) {
+      writeAvroLong(out, numObjects);
+      writeAvroLong(out, data.size());
+      fwrite(data.data(), 1, data.size(), out);
+      fwrite(sync, 1, AVRO_SYNC_SIZE, out);
+    }
+    if (!reader.valid) {
+      errorMessage = reader.errorMessage;
+      return false;
+    }
+  }
+
+  return true;
+}
+
+///////////////////////////////////////////////////////////////////// codecs
+
+#ifdef ZSTD_CODEC
+// one compression context per thread (compressor thread or the main thread), reused for
+// every block because creating one allocates the match-finder tables
+class ZstdContext {
+public:
+  ZSTD_CCtx *context;
+  ZstdContext() : context(ZSTD_createCCtx()) { }
+  ~ZstdContext() { ZSTD_freeCCtx(context); }
+};
+#endif
+
+bool compressAvroBlock(const std::string &codec, const char *data, size_t size, std::vector<char> &out, const AvroCodecOptions &options) {
+  if (codec == std::string("null")) {
+    out.assign(data, data + size);
+    return true;
+  }
+
+#ifdef DEFLATE_CODEC
+  else if (codec == std::string("deflate")) {
+    // raw deflate (no zlib header), as in the Avro specification
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+    if (deflateInit2(&stream, options.level == 0 ? Z_DEFAULT_COMPRESSION : options.level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+      return false;
+    out.resize(deflateBound(&stream, size));
+    stream.next_in = (Bytef*)data;
+    stream.avail_in = size;
+    stream.next_out = (Bytef*)out.data();
+    stream.avail_out = out.size();
+    int status = deflate(&stream, Z_FINISH);
+    out.resize(stream.total_out);
+    deflateEnd(&stream);
+    return status == Z_STREAM_END;
+  }
+#endif
+
+#ifdef SNAPPY_CODEC
+  else if (codec == std::string("snappy")) {
+    // snappy-compressed data followed by the big-endian CRC32 of the uncompressed data
+    size_t length = snappy_max_compressed_length(size);
+    out.resize(length + 4);
+    if (snappy_compress(data, size, out.data(), &length) != SNAPPY_OK)
+      return false;
+    uint32_t crc = crc32(0L, (const Bytef*)data, size);
+    out[length] = (char)(crc >> 24);
+    out[length + 1] = (char)(crc >> 16);
+    out[length + 2] = (char)(crc >> 8);
+    out[length + 3] = (char)crc;
+    out.resize(length + 4);
+    return true;
+  }
+#endif
+
+#ifdef LZMA_CODEC
+  else if (codec == std::string("lzma")) {
+    // raw LZMA2 with the default preset (like avro-c) unless a level is given
+    lzma_options_lzma lzmaOptions;
+    lzma_lzma_preset(&lzmaOptions, options.level == 0 ? LZMA_PRESET_DEFAULT : options.level);
+    lzma_filter filters[2];
+    filters[0].id = LZMA_FILTER_LZMA2;
+    filters[0].options = &lzmaOptions;
+    filters[1].id = LZMA_VLI_UNKNOWN;
+    filters[1].options = nullptr;
+    size_t position = 0;
+    out.resize(lzma_stream_buffer_bound(size));
+    if (lzma_raw_buffer_encode(filters, nullptr, (const uint8_t*)data, size, (uint8_t*)out.data(), &position, out.size()) != LZMA_OK)
+      return false;
+    out.resize(position);
+    return true;
+  }
+#endif
+
+#ifdef ZSTD_CODEC
+  else if (codec == std::string("zstandard")) {
+    // one zstd frame per block, as in the Avro specification
+    static thread_local ZstdContext zstd;
+    ZSTD_CCtx_reset(zstd.context, ZSTD_reset_session_and_parameters);
+    ZSTD_CCtx_setParameter(zstd.context, ZSTD_c_compressionLevel, options.level == 0 ? ZSTD_CLEVEL_DEFAULT : options.level);
+    if (options.longDistance) {
+      // a window as large as the block, so that matches can reach back to its start
+      int windowLog = AVRO_ZSTD_WINDOW_LOG_MIN;
+      while (windowLog < AVRO_ZSTD_WINDOW_LOG_MAX  &&  ((size_t)1 << windowLog) < size)
+        windowLog++;
+      ZSTD_CCtx_setParameter(zstd.context, ZSTD_c_windowLog, windowLog);
+      ZSTD_CCtx_setParameter(zstd.context, ZSTD_c_enableLongDistanceMatching, 1);
+    }
+    if (options.dictionary != nullptr)
+      ZSTD_CCtx_refCDict(zstd.context, (const ZSTD_CDict*)options.dictionary);
+    out.resize(ZSTD_compressBound(size));
+    size_t length = ZSTD_compress2(zstd.context, out.data(), out.size(), data, size);
+    if (ZSTD_isError(length))
+      return false;
+    out.resize(length);
+    return true;
+  }
+#endif
+
+#ifdef LZ4_CODEC
+  else if (codec == std::string("lz4")) {
+    // uncompressed size (4 bytes, little-endian) and an LZ4 block, as in fastavro; a level
+    // selects LZ4HC
+    out.resize(4 + LZ4_compressBound(size));
+    out[0] = (char)size;
+    out[1] = (char)(size >> 8);
+    out[2] = (char)(size >> 16);
+    out[3] = (char)(size >> 24);
+    int length;
+    if (options.level == 0)
+      length = LZ4_compress_default(data, out.data() + 4, size, out.size() - 4);
+    else
+      length = LZ4_compress_HC(data, out.data() + 4, size, out.size() - 4, options.level);
+    if (length <= 0  &&  size > 0)
+      return false;
+    out.resize(4 + length);
+    return true;
+  }
+#endif
+
+  return false;
+}
+
+///////////////////////////////////////////////////////////////////// AvroBlockWriter
+
+static int64_t avroLongSize(int64_t value) {
+  uint64_t encoded = ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+  int64_t size = 1;
+  while (encoded & ~((uint64_t)0x7f)) {
+    encoded >>= 7;
+    size++;
+  }
+  return size;
+}
+
+static uint64_t fnv1a(const std::string &data, uint64_t hash) {
+  for (size_t i = 0;  i < data.size();  i++) {
+    hash ^= (unsigned char)data[i];
+    hash *= 1099511628211ULL;
+  }
+  return hash;
+}
+
+AvroBlockWriter::AvroBlockWriter(FILE *out, std::string schema, std::string codec, size_t blockSize, int codecThreads, AvroCodecOptions options) :
+  out(out),
+  codec(codec),
+  options(options),
+  blockSize(blockSize),
+  block(nullptr),
+  maxInFlight(2 * codecThreads + 1),
+  toCompress(2 * codecThreads),
+  compressed(2 * codecThreads),
+  recycled(4 * codecThreads)
+{
+  std::vector<char> test;
+  if (!compressAvroBlock(codec, "", 0, test, options)) {
+    errorMessage = std::string("Unrecognized or unavailable codec: ") + codec;
+    return;
+  }
+
+  // deterministic sync marker: two FNV-1a hashes of the schema and codec
+  uint64_t hash1 = fnv1a(schema + codec, 14695981039346656037ULL);
+  uint64_t hash2 = fnv1a(codec + schema, hash1 ^ 0x5bd1e9955bd1e995ULL);
+  for (int i = 0;  i < 8;  i++) {
+    sync[i] = (char)(hash1 >> (8*i));
+    sync[8 + i] = (char)(hash2 >> (8*i));
+  }
+
+  // the dictionary's ID is chosen now, so that the header can name it before it is trained
+  bool withDictionary = codec == std::string("zstandard")  &&  !options.dictionaryFile.empty();
+  if (withDictionary)
+    this->options.dictionaryID = AVRO_DICTIONARY_MIN_ID + (uint32_t)(hash1 % (0x80000000ULL - AVRO_DICTIONARY_MIN_ID));
+
+  header.append("Obj\x01", 4);
+  appendAvroLong(header, withDictionary ? 3 : 2);
+  appendAvroLong(header, 11);
+  header.append("avro.schema");
+  appendAvroLong(header, schema.size());
+  header.append(schema);
+  appendAvroLong(header, 10);
+  header.append("avro.codec");
+  appendAvroLong(header, codec.size());
+  header.append(codec);
+  if (withDictionary) {
+    std::string dictionaryID = std::to_string(this->options.dictionaryID);
+    appendAvroLong(header, 25);
+    header.append("root2avro.zstd.dictionary");
+    appendAvroLong(header, dictionaryID.size());
+    header.append(dictionaryID);
+  }
+  appendAvroLong(header, 0);
+  header.append(sync, AVRO_SYNC_SIZE);
+  if (out != nullptr) {              // otherwise, rollFiles writes it at the start of each file (or continueFile doesn't)
+    fwrite(header.data(), 1, header.size(), out);
+    outOffset = header.size();
+  }
+
+  for (int i = 0;  i < codecThreads;  i++)
+    workers.push_back(std::thread(&AvroBlockWriter::compressLoop, this));
+
+  block = newBlock();
+  valid = true;
+}
+
+AvroBlockWriter::~AvroBlockWriter() {
+  close();
+  delete block;
+}
+
+AvroBlock *AvroBlockWriter::newBlock() {
+  AvroBlock *out;
+  if (!recycled.tryPop(out))
+    out = new AvroBlock;
+  out->numRecords = 0;
+  out->raw.clear();
+  out->recordSizes.clear();
+  return out;
+}
+
+bool AvroBlockWriter::rollFiles(std::string directory, int64_t maxBytes, int64_t maxEntries) {
+  if (mkdir(directory.c_str(), 0777) != 0  &&  errno != EEXIST) {
+    errorMessage = std::string("Could not create output directory ") + directory + std::string(": ") + strerror(errno);
+    valid = false;
+    return false;
+  }
+  this->directory = directory;
+  this->maxBytes = maxBytes;
+  this->maxEntries = maxEntries;
+  return true;
+}
+
+void AvroBlockWriter::continueFile(FILE *out) {
+  this->out = out;
+}
+
+bool AvroBlockWriter::append(const char *record, size_t size, int64_t entry) {
+  if (block->numRecords > 0  &&  block->raw.size + size > blockSize)
+    submit();
+  if (block->numRecords == 0)
+    block->firstEntry = entry;
+  block->lastEntry = entry;
+  block->raw.reserve(size);
+  memcpy(block->raw.buffer + block->raw.size, record, size);
+  block->raw.size += size;
+  block->numRecords++;
+  if (waitingForDictionary())
+    block->recordSizes.push_back(size);
+
+  // end the block early where the current file reaches maxEntries (if it's already full, this
+  // block will start the next one)
+  if (maxEntries > 0  &&  block->numRecords >= (fileRecords < maxEntries ? maxEntries - fileRecords : maxEntries))
+    submit();
+
+  // with codec threads, a failure is seen a few blocks after the block that failed
+  return !failed;
+}
+
+bool AvroBlockWriter::waitingForDictionary() {
+  return codec == std::string("zstandard")  &&  !options.dictionaryFile.empty()  &&  !dictionaryTrained;
+}
+
+void AvroBlockWriter::trainDictionary() {
+#ifdef ZSTD_CODEC
+  // the samples are the records of the held-back blocks
+  std::string samples;
+  std::vector<size_t> sampleSizes;
+  for (auto held = untrained.begin();  held != untrained.end();  ++held) {
+    samples.append((*held)->raw.buffer, (*held)->raw.size);
+    sampleSizes.insert(sampleSizes.end(), (*held)->recordSizes.begin(), (*held)->recordSizes.end());
+  }
+
+  std::vector<char> dictionary(AVRO_DICTIONARY_SIZE);
+  size_t size = ZDICT_trainFromBuffer(dictionary.data(), dictionary.size(), samples.data(), sampleSizes.data(), sampleSizes.size());
+  if (ZDICT_isError(size))
+    fprintf(stderr, "Could not train a zstandard dictionary (%s); compressing without one.\n", ZDICT_getErrorName(size));
+  else {
+    // replace the ID that training picked (after the 4-byte magic number) with the one in the header
+    for (int i = 0;  i < 4  &&  size >= 8;  i++)
+      dictionary[4 + i] = (char)(options.dictionaryID >> (8*i));
+    FILE *file = fopen(options.dictionaryFile.c_str(), "wb");
+    if (file == nullptr  ||  fwrite(dictionary.data(), 1, size, file) != size  ||  fclose(file) != 0) {
+      errorMessage = std::string("Could not write the zstandard dictionary to ") + options.dictionaryFile;
+      failed = true;
+    }
+    else
+      options.dictionary = ZSTD_createCDict(dictionary.data(), size, options.level == 0 ? ZSTD_CLEVEL_DEFAULT : options.level);
+  }
+#endif
+
+  dictionaryTrained = true;
+  for (auto held = untrained.begin();  held != untrained.end();  ++held)
+    submitBlock(*held);
+  untrained.clear();
+}
+
+void AvroBlockWriter::submit() {
+  // blocks are submitted in this order, even the ones held back for the dictionary
+  block->sequence = numSubmitted + untrained.size();
+  block->startsFile = false;
+  if (!directory.empty())
+    placeBlock();
+
+  if (waitingForDictionary()) {
+    untrained.push_back(block);
+    block = newBlock();
+    if (untrained.size() >= AVRO_DICTIONARY_BLOCKS)
+      trainDictionary();
+    return;
+  }
+  submitBlock(block);
+  block = newBlock();
+}
+
+void AvroBlockWriter::placeBlock() {
+  // Decide whether this block goes into the current file or starts a new one. Compressed sizes
+  // are only known once blocks come back from the workers, so to make the same decision for any
+  // number of threads, the current file's last AVRO_ROLL_LAG_BLOCKS blocks (and this one) are
+  // counted by their uncompressed size; the ones before them are waited for, if need be.
+  bool full = false;
+  if (!fileRawSizes.empty()) {
+    if (maxEntries > 0  &&  fileRecords + block->numRecords > maxEntries)
+      full = true;
+    else if (maxBytes > 0) {
+      while (fileKnown + AVRO_ROLL_LAG_BLOCKS < fileRawSizes.size()) {
+        uint64_t sequence = fileFirstBlock + fileKnown;
+        while (numEmitted <= sequence)
+          collect(true);
+        fileKnownBytes += emittedSizes[sequence];
+        emittedSizes.erase(sequence);
+        fileRawBytes -= fileRawSizes[fileKnown];
+        fileKnown++;
+      }
+      int64_t rawOverhead = AVRO_SYNC_SIZE + 2 * 10;   // varints are at most 10 bytes
+      int64_t estimate = header.size() + fileKnownBytes + fileRawBytes + (fileRawSizes.size() - fileKnown + 1) * rawOverhead + block->raw.size;
+      full = estimate > maxBytes;
+    }
+  }
+
+  if (fileRawSizes.empty()  ||  full) {
+    block->startsFile = true;
+    fileFirstBlock = block->sequence;
+    fileRecords = 0;
+    fileRawSizes.clear();
+    fileKnown = 0;
+    fileKnownBytes = 0;
+    fileRawBytes = 0;
+    emittedSizes.erase(emittedSizes.begin(), emittedSizes.lower_bound(fileFirstBlock));
+  }
+  fileRecords += block->numRecords;
+  fileRawSizes.push_back(block->raw.size);
+  fileRawBytes += block->raw.size;
+}
+
+void AvroBlockWriter::submitBlock(AvroBlock *block) {
+  numSubmitted++;
+  if (workers.empty()) {
+    block->ok = compressAvroBlock(codec, block->raw.buffer, block->raw.size, block->compressed, options);
+    emit(block);
+    numEmitted++;
+  }
+  else {
+    toCompress.push(block);
+    collect(false);
+    while (numSubmitted - numEmitted >= maxInFlight)
+      collect(true);
+  }
+}
+
+void AvroBlockWriter::collect(bool wait) {
+  // move finished blocks into the reordering map and emit as many as are next in line
+  AvroBlock *finished;
+  int spins = 0;
+  bool progress = false;
+  while (!progress) {
+    while (compressed.tryPop(finished))
+      done[finished->sequence] = finished;
+    for (auto iter = done.find(numEmitted);  iter != done.end();  iter = done.find(numEmitted)) {
+      emit(iter->second);
+      done.erase(iter);
+      numEmitted++;
+      progress = true;
+    }
+    if (!wait) break;
+    if (!progress) boundedQueueWait(spins);
+  }
+}
+
+void AvroBlockWriter::emit(AvroBlock *block) {
+  if (!block->ok) {
+    if (!failed)
+      errorMessage = std::string("Could not compress Avro block with codec ") + codec;
+    failed = true;
+  }
+  else if (!failed  &&  block->startsFile  &&  (!finishFile()  ||  !openFile(block->firstEntry)))
+    failed = true;
+  else if (!failed) {
+    int64_t size = avroLongSize(block->numRecords) + avroLongSize(block->compressed.size()) + block->compressed.size() + AVRO_SYNC_SIZE;
+    if (!directory.empty()) {
+      if (block->sequence >= fileFirstBlock)
+        emittedSizes[block->sequence] = size;
+      outLastEntry = block->lastEntry;
+    }
+    // the index and the container stay in step: a block the index doesn't have isn't written
+    if (index != nullptr  &&  !index->add(sync, outOffset, block->firstEntry, block->lastEntry, block->numRecords)) {
+      errorMessage = index->errorMessage;
+      failed = true;
+    }
+    else {
+      outOffset += size;
+      writeAvroLong(out, block->numRecords);
+      writeAvroLong(out, block->compressed.size());
+      fwrite(block->compressed.data(), 1, block->compressed.size(), out);
+      fwrite(sync, 1, AVRO_SYNC_SIZE, out);
+      if (ferror(out)) {
+        errorMessage = std::string("Could not write Avro block: ") + strerror(errno);
+        failed = true;
+      }
+      else if (checkpoint != nullptr  &&  !checkpoint->blockWritten(out, block->lastEntry + 1)) {
+        errorMessage = checkpoint->errorMessage;
+        failed = true;
+      }
+    }
+  }
+  if (!recycled.tryPush(block))
+    delete block;
+}
+
+bool AvroBlockWriter::openFile(int64_t firstEntry) {
+  char name[64];
+  snprintf(name, sizeof(name), "/.part-%012lld.avro.tmp", (long long)firstEntry);
+  outName = directory + name;
+  out = fopen(outName.c_str(), "wb");
+  if (out == nullptr) {
+    errorMessage = std::string("Could not open ") + outName + std::string(": ") + strerror(errno);
+    return false;
+  }
+  fwrite(header.data(), 1, header.size(), out);
+  outOffset = header.size();
+  outFirstEntry = firstEntry;
+  return true;
+}
+
+bool AvroBlockWriter::finishFile() {
+  if (out == nullptr)
+    return true;
+  char name[64];
+  snprintf(name, sizeof(name), "/part-%012lld-%012lld.avro", (long long)outFirstEntry, (long long)outLastEntry + 1);
+  std::string finalName = directory + name;
+  bool success = fclose(out) == 0;
+  out = nullptr;
+  if (!success  ||  rename(outName.c_str(), finalName.c_str()) != 0) {
+    errorMessage = std::string("Could not finish ") + finalName + std::string(": ") + strerror(errno);
+    return false;
+  }
+  return true;
+}
+
+void AvroBlockWriter::compressLoop() {
+  while (true) {
+    AvroBlock *block = toCompress.pop();
+    if (block == nullptr) return;
+    block->ok = compressAvroBlock(codec, block->raw.buffer, block->raw.size, block->compressed, options);
+    compressed.push(block);
+  }
+}
+
+bool AvroBlockWriter::flush() {
+  if (!valid) return false;
+  if (block->numRecords > 0)
+    submit();
+  if (!untrained.empty())
+    trainDictionary();               // fewer blocks than AVRO_DICTIONARY_BLOCKS in all
+  while (numEmitted < numSubmitted)
+    collect(true);
+  if (out != nullptr  &&  fflush(out) != 0  &&  !failed) {
+    errorMessage = std::string("Could not write Avro block: ") + strerror(errno);
+    failed = true;
+  }
+  return !failed;
+}
+
+bool AvroBlockWriter::close() {
+  if (!valid  ||  closed) return valid  &&  !failed;
+  flush();
+  if (!directory.empty()  &&  !failed  &&  !finishFile())
+    failed = true;
+  for (size_t i = 0;  i < workers.size();  i++)
+    toCompress.push(nullptr);
+  for (auto worker = workers.begin();  worker != workers.end();  ++worker)
+    worker->join();
+  AvroBlock *block;
+  while (recycled.tryPop(block))
+    delete block;
+#ifdef ZSTD_CODEC
+  ZSTD_freeCDict((ZSTD_CDict*)options.dictionary);
+  options.dictionary = nullptr;
+#endif
+  closed = true;
+  return !failed;
+}
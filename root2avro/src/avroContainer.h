@@ -0,0 +1,182 @@
+// Copyright 2016 Jim Pivarski
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//     http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef AVRO_CONTAINER_H
+#define AVRO_CONTAINER_H
+
+// C includes
+#include <stdint.h>
+#include <stdio.h>
+
+// C++ includes
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "avroEncoder.h"
+#include "boundedQueue.h"
+#include "checkpoint.h"
+
+class AvroIndexWriter;
+
+// Avro object container files are a header (magic, metadata map, 16-byte sync marker)
+// followed by blocks (number of objects, size in bytes, data, sync marker). Blocks can
+// be moved from one container to another without decoding them, as long as both have
+// the same schema and codec and the sync marker is rewritten.
+
+#define AVRO_SYNC_SIZE 16
+
+#define AVRO_DICTIONARY_BLOCKS 8         // blocks of records to train a zstandard dictionary on
+#define AVRO_DICTIONARY_SIZE 112640      // zstd's default dictionary size
+#define AVRO_DICTIONARY_MIN_ID 32768     // zstd reserves dictionary IDs below this
+#define AVRO_ZSTD_WINDOW_LOG_MIN 10      // long-distance matching: window sizes from 1 KB
+#define AVRO_ZSTD_WINDOW_LOG_MAX 27      // up to 128 MB, the largest that zstd decoders accept by default
+
+#define AVRO_ROLL_LAG_BLOCKS 16          // rolling files: blocks counted by uncompressed size (see placeBlock)
+
+bool readAvroLong(FILE *in, int64_t &value);
+void writeAvroLong(FILE *out, int64_t value);
+
+class AvroContainerReader {
+public:
+  FILE *in;
+  bool valid = false;
+  bool empty = false;
+  std::string errorMessage = "";
+  std::string header;             // everything before the sync marker: magic and metadata
+  char sync[AVRO_SYNC_SIZE];
+
+  AvroContainerReader(FILE *in);
+  bool nextBlock(int64_t &numObjects, std::string &data);
+
+private:
+  bool readHeaderLong(int64_t &value);
+  bool readHeaderBytes(int64_t size);
+};
+
+bool concatenateAvro(std::vector<FILE*> &inputs, FILE *out, std::string &errorMessage);
+
+// Writes an Avro object container file without avro-c: records (already Avro-encoded) are
+// collected into blocks of at most blockSize bytes and compressed by codecThreads workers
+// (or in the calling thread if codecThreads is 0). Blocks are emitted in order and the
+// sync marker is a hash of the schema and codec, so the output does not depend on the
+// number of threads.
+// 
+// With rollFiles, it writes a directory of containers instead of one stream: a new file is
+// started, on a block boundary, before a block would put more than maxEntries records or
+// maxBytes bytes into the current one. Each file is written as .part-FIRST.avro.tmp and renamed
+// to part-FIRST-END.avro when it is complete, where [FIRST, END) are the entry numbers passed
+// to append (zero-padded, so that the names sort in entry order).
+// 
+// With a checkpoint, each written block is reported to it (see checkpoint.h), and continueFile
+// appends blocks to the output of a checkpointed run, which already has the header. With an
+// index, the offset and entry range of each written block are added to it (see avroIndex.h).
+
+// Codec settings beyond the name (--codec-level, --codec-long, --codec-dictionary). The
+// "zstandard" codec is the one in the Avro specification; "lz4" is not in the specification
+// but is read by fastavro (the uncompressed size as 4 little-endian bytes, then an LZ4 block).
+// Zstandard's long-distance matching only looks within a block, so it needs a large blockSize
+// to find anything. With a dictionary, the header has a "root2avro.zstd.dictionary" entry: the
+// dictionary's ID in decimal, which is also in the frame header of each block compressed with it.
+
+class AvroCodecOptions {
+public:
+  int level = 0;                     // 0 is the codec's default
+  bool longDistance = false;         // zstandard: long-distance matching (standard frames)
+  std::string dictionaryFile;        // zstandard: train a dictionary on the first blocks, save it here
+  void *dictionary = nullptr;        // the trained ZSTD_CDict, once there is one
+  uint32_t dictionaryID = 0;         // its ID, chosen before training and named in the header
+};
+
+bool compressAvroBlock(const std::string &codec, const char *data, size_t size, std::vector<char> &out, const AvroCodecOptions &options = AvroCodecOptions());
+
+class AvroBlock {
+public:
+  uint64_t sequence;
+  int64_t numRecords;
+  AvroEncoder raw;
+  std::vector<size_t> recordSizes;   // only while a dictionary is waiting to be trained
+  std::vector<char> compressed;
+  bool ok;
+  int64_t firstEntry;
+  int64_t lastEntry;
+  bool startsFile;                   // rolling files: close the current file before this block
+};
+
+class AvroBlockWriter {
+public:
+  bool valid = false;
+  std::string errorMessage = "";
+  char sync[AVRO_SYNC_SIZE];
+  Checkpoint *checkpoint = nullptr;
+  AvroIndexWriter *index = nullptr;
+
+  AvroBlockWriter(FILE *out, std::string schema, std::string codec, size_t blockSize, int codecThreads, AvroCodecOptions options = AvroCodecOptions());
+  ~AvroBlockWriter();
+  bool rollFiles(std::string directory, int64_t maxBytes, int64_t maxEntries);
+  void continueFile(FILE *out);
+  bool append(const char *record, size_t size, int64_t entry = -1);   // false once anything has failed
+  bool flush();
+  bool close();
+
+private:
+  FILE *out;
+  std::string header;                // magic, metadata, and sync marker
+  std::string codec;
+  AvroCodecOptions options;
+  size_t blockSize;
+  std::vector<AvroBlock*> untrained; // the first blocks, held back until the dictionary is trained
+  bool dictionaryTrained = false;    // (or training failed, and the blocks go without one)
+  AvroBlock *block;
+  uint64_t numSubmitted = 0;
+  uint64_t numEmitted = 0;
+  uint64_t maxInFlight;
+  bool failed = false;
+  bool closed = false;
+  std::map<uint64_t, AvroBlock*> done;
+  BoundedQueue<AvroBlock*> toCompress;
+  BoundedQueue<AvroBlock*> compressed;
+  BoundedQueue<AvroBlock*> recycled;
+  std::vector<std::thread> workers;
+
+  std::string directory;             // rolling files, if not empty
+  int64_t maxBytes = 0;
+  int64_t maxEntries = 0;
+  uint64_t fileFirstBlock = 0;       // placement: sequence number of the current file's first block,
+  int64_t fileRecords = 0;           //   the number of records placed in it,
+  std::vector<int64_t> fileRawSizes; //   the uncompressed sizes of its blocks,
+  size_t fileKnown = 0;              //   how many of them are counted by their emitted size,
+  int64_t fileKnownBytes = 0;        //   and the total of each kind
+  int64_t fileRawBytes = 0;
+  std::map<uint64_t, int64_t> emittedSizes;
+  int64_t outOffset = 0;             // emission: bytes written to the open file,
+  std::string outName;               //   its temporary name, and its entry range
+  int64_t outFirstEntry = 0;
+  int64_t outLastEntry = 0;
+
+  AvroBlock *newBlock();
+  bool waitingForDictionary();
+  void trainDictionary();
+  void submit();
+  void placeBlock();
+  void submitBlock(AvroBlock *block);
+  void collect(bool wait);
+  void emit(AvroBlock *block);
+  bool openFile(int64_t firstEntry);
+  bool finishFile();
+  void compressLoop();
+};
+
+#endif // AVRO_CONTAINER_H
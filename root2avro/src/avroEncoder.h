@@ -0,0 +1,102 @@
+// Copyright 2016 Jim Pivarski
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//     http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef AVRO_ENCODER_H
+#define AVRO_ENCODER_H
+
+// C includes
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Avro binary encoding into a growable byte buffer, without avro-c's generic values.
+// See https://avro.apache.org/docs/1.8.1/spec.html#binary_encoding
+
+class AvroEncoder {
+public:
+  char *buffer;
+  size_t size;
+  size_t capacity;
+
+  AvroEncoder(size_t capacity = 4096) : buffer((char*)malloc(capacity)), size(0), capacity(capacity) { }
+  ~AvroEncoder() { free(buffer); }
+
+  void clear() { size = 0; }
+
+  void reserve(size_t extra) {
+    if (size + extra > capacity) {
+      while (size + extra > capacity)
+        capacity *= 2;
+      buffer = (char*)realloc(buffer, capacity);
+    }
+  }
+
+  void writeBoolean(bool value) {
+    reserve(1);
+    buffer[size++] = value ? 1 : 0;
+  }
+
+  void writeInt(int32_t value) {
+    writeLong(value);
+  }
+
+  void writeLong(int64_t value) {
+    reserve(10);
+    putLong(value);
+  }
+
+  void putLong(int64_t value) {        // like writeLong, but the caller has reserved 10 bytes
+    uint64_t encoded = ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);   // zig-zag
+    while (encoded & ~((uint64_t)0x7f)) {
+      buffer[size++] = (char)((encoded & 0x7f) | 0x80);
+      encoded >>= 7;
+    }
+    buffer[size++] = (char)encoded;
+  }
+
+  void writeFloat(float value) {       // little-endian, like the machines we run on
+    reserve(sizeof(float));
+    memcpy(buffer + size, &value, sizeof(float));
+    size += sizeof(float);
+  }
+
+  void writeDouble(double value) {
+    reserve(sizeof(double));
+    memcpy(buffer + size, &value, sizeof(double));
+    size += sizeof(double);
+  }
+
+  void writeFixed(const void *data, size_t length) {     // raw bytes, no length
+    reserve(length);
+    memcpy(buffer + size, data, length);
+    size += length;
+  }
+
+  void writeString(const char *string, size_t length) {
+    writeLong(length);
+    reserve(length);
+    memcpy(buffer + size, string, length);
+    size += length;
+  }
+
+  void writeString(const char *string) {
+    writeString(string, strlen(string));
+  }
+
+private:
+  AvroEncoder(const AvroEncoder&);
+  AvroEncoder &operator=(const AvroEncoder&);
+};
+
+#endif // AVRO_ENCODER_H
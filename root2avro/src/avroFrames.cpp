@@ -0,0 +1,327 @@
+// Copyright 2016 Jim Pivarski
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//     http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// C includes
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// C++ includes
+#include <utility>
+#include <vector>
+
+#include "avroFrames.h"
+
+///////////////////////////////////////////////////////////////////// Parsing Canonical Form
+
+// just enough JSON to rewrite a schema
+class SchemaJSON {
+public:
+  enum Kind {Null, Bool, Number, String, Array, Object};
+  Kind kind = Null;
+  std::string text;                  // string contents (unescaped), or the number or literal
+  std::vector<SchemaJSON> items;
+  std::vector<std::pair<std::string, SchemaJSON> > members;
+
+  const SchemaJSON *get(const char *key) const {
+    for (auto member = members.begin();  member != members.end();  ++member)
+      if (member->first == key)
+        return &member->second;
+    return nullptr;
+  }
+};
+
+static void skipSpace(const std::string &in, size_t &pos) {
+  while (pos < in.size()  &&  (in[pos] == ' '  ||  in[pos] == '\t'  ||  in[pos] == '\n'  ||  in[pos] == '\r'))
+    pos++;
+}
+
+static void appendUTF8(std::string &out, uint32_t code) {
+  if (code < 0x80)
+    out.push_back((char)code);
+  else if (code < 0x800) {
+    out.push_back((char)(0xc0 | (code >> 6)));
+    out.push_back((char)(0x80 | (code & 0x3f)));
+  }
+  else if (code < 0x10000) {
+    out.push_back((char)(0xe0 | (code >> 12)));
+    out.push_back((char)(0x80 | ((code >> 6) & 0x3f)));
+    out.push_back((char)(0x80 | (code & 0x3f)));
+  }
+  else {
+    out.push_back((char)(0xf0 | (code >> 18)));
+    out.push_back((char)(0x80 | ((code >> 12) & 0x3f)));
+    out.push_back((char)(0x80 | ((code >> 6) & 0x3f)));
+    out.push_back((char)(0x80 | (code & 0x3f)));
+  }
+}
+
+static bool parseString(const std::string &in, size_t &pos, std::string &out) {
+  if (pos >= in.size()  ||  in[pos] != '"') return false;
+  pos++;
+  while (pos < in.size()  &&  in[pos] != '"') {
+    if (in[pos] != '\\') {
+      out.push_back(in[pos++]);
+      continue;
+    }
+    if (++pos >= in.size()) return false;
+    char escape = in[pos++];
+    switch (escape) {
+      case 'b': out.push_back('\b'); break;
+      case 'f': out.push_back('\f'); break;
+      case 'n': out.push_back('\n'); break;
+      case 'r': out.push_back('\r'); break;
+      case 't': out.push_back('\t'); break;
+      case 'u': {
+        if (pos + 4 > in.size()) return false;
+        uint32_t code = strtoul(in.substr(pos, 4).c_str(), nullptr, 16);
+        pos += 4;
+        if (code >= 0xd800  &&  code < 0xdc00  &&  pos + 6 <= in.size()  &&  in[pos] == '\\'  &&  in[pos + 1] == 'u') {
+          uint32_t low = strtoul(in.substr(pos + 2, 4).c_str(), nullptr, 16);
+          code = 0x10000 + ((code - 0xd800) << 10) + (low - 0xdc00);
+          pos += 6;
+        }
+        appendUTF8(out, code);
+        break;
+      }
+      default: out.push_back(escape);       // quote, backslash, slash
+    }
+  }
+  if (pos >= in.size()) return false;
+  pos++;
+  return true;
+}
+
+static bool parseJSON(const std::string &in, size_t &pos, SchemaJSON &out) {
+  skipSpace(in, pos);
+  if (pos >= in.size()) return false;
+
+  if (in[pos] == '"') {
+    out.kind = SchemaJSON::String;
+    return parseString(in, pos, out.text);
+  }
+
+  if (in[pos] == '[') {
+    out.kind = SchemaJSON::Array;
+    pos++;
+    skipSpace(in, pos);
+    if (pos < in.size()  &&  in[pos] == ']') { pos++; return true; }
+    while (true) {
+      out.items.push_back(SchemaJSON());
+      if (!parseJSON(in, pos, out.items.back())) return false;
+      skipSpace(in, pos);
+      if (pos < in.size()  &&  in[pos] == ',') { pos++; continue; }
+      if (pos < in.size()  &&  in[pos] == ']') { pos++; return true; }
+      return false;
+    }
+  }
+
+  if (in[pos] == '{') {
+    out.kind = SchemaJSON::Object;
+    pos++;
+    skipSpace(in, pos);
+    if (pos < in.size()  &&  in[pos] == '}') { pos++; return true; }
+    while (true) {
+      std::string key;
+      skipSpace(in, pos);
+      if (!parseString(in, pos, key)) return false;
+      skipSpace(in, pos);
+      if (pos >= in.size()  ||  in[pos] != ':') return false;
+      pos++;
+      out.members.push_back(std::make_pair(key, SchemaJSON()));
+      if (!parseJSON(in, pos, out.members.back().second)) return false;
+      skipSpace(in, pos);
+      if (pos < in.size()  &&  in[pos] == ',') { pos++; continue; }
+      if (pos < in.size()  &&  in[pos] == '}') { pos++; return true; }
+      return false;
+    }
+  }
+
+  // numbers and literals
+  size_t end = pos;
+  while (end < in.size()  &&  strchr(",]} \t\n\r", in[end]) == nullptr)
+    end++;
+  if (end == pos) return false;
+  out.text = in.substr(pos, end - pos);
+  out.kind = out.text == "null" ? SchemaJSON::Null : (out.text == "true"  ||  out.text == "false") ? SchemaJSON::Bool : SchemaJSON::Number;
+  pos = end;
+  return true;
+}
+
+static std::string quoted(const std::string &text) {
+  std::string out = "\"";
+  for (size_t i = 0;  i < text.size();  i++) {
+    unsigned char c = text[i];
+    if (c == '"'  ||  c == '\\') {
+      out.push_back('\\');
+      out.push_back(c);
+    }
+    else if (c < 0x20) {
+      char escape[8];
+      snprintf(escape, sizeof(escape), "\\u%04x", c);
+      out += escape;
+    }
+    else
+      out.push_back(c);
+  }
+  return out + "\"";
+}
+
+static bool isPrimitive(const std::string &name) {
+  return name == "null"  ||  name == "boolean"  ||  name == "int"  ||  name == "long"  ||  name == "float"  ||  name == "double"  ||  name == "bytes"  ||  name == "string";
+}
+
+static std::string fullName(const std::string &name, const std::string &enclosing) {
+  return name.find('.') != std::string::npos  ||  enclosing.empty() ? name : enclosing + "." + name;
+}
+
+// the specification's transformations: PRIMITIVES, FULLNAMES, STRIP, ORDER, STRINGS, INTEGERS, and WHITESPACE
+static std::string canonical(const SchemaJSON &schema, const std::string &enclosing) {
+  if (schema.kind == SchemaJSON::String)
+    return quoted(isPrimitive(schema.text) ? schema.text : fullName(schema.text, enclosing));
+
+  if (schema.kind == SchemaJSON::Array) {
+    std::string out = "[";
+    for (size_t i = 0;  i < schema.items.size();  i++)
+      out += (i == 0 ? "" : ",") + canonical(schema.items[i], enclosing);
+    return out + "]";
+  }
+
+  const SchemaJSON *type = schema.get("type");
+  if (schema.kind != SchemaJSON::Object  ||  type == nullptr)
+    return schema.text;
+  if (type->kind != SchemaJSON::String)
+    return canonical(*type, enclosing);
+
+  if (type->text == "record"  ||  type->text == "error"  ||  type->text == "enum"  ||  type->text == "fixed") {
+    const SchemaJSON *name = schema.get("name");
+    const SchemaJSON *space = schema.get("namespace");
+    std::string full = name == nullptr ? "" : name->text;
+    if (full.find('.') == std::string::npos)
+      full = fullName(full, space != nullptr ? space->text : enclosing);
+    std::string inner = full.find('.') == std::string::npos ? "" : full.substr(0, full.rfind('.'));
+
+    std::string out = "{\"name\":" + quoted(full) + ",\"type\":" + quoted(type->text);
+    const SchemaJSON *fields = schema.get("fields");
+    const SchemaJSON *symbols = schema.get("symbols");
+    const SchemaJSON *size = schema.get("size");
+    if (fields != nullptr) {
+      out += ",\"fields\":[";
+      for (size_t i = 0;  i < fields->items.size();  i++) {
+        const SchemaJSON *fieldName = fields->items[i].get("name");
+        const SchemaJSON *fieldType = fields->items[i].get("type");
+        out += std::string(i == 0 ? "" : ",") + "{\"name\":" + quoted(fieldName == nullptr ? "" : fieldName->text) + ",\"type\":" + (fieldType == nullptr ? "null" : canonical(*fieldType, inner)) + "}";
+      }
+      out += "]";
+    }
+    if (symbols != nullptr) {
+      out += ",\"symbols\":[";
+      for (size_t i = 0;  i < symbols->items.size();  i++)
+        out += (i == 0 ? "" : ",") + quoted(symbols->items[i].text);
+      out += "]";
+    }
+    if (size != nullptr)
+      out += ",\"size\":" + std::to_string(strtoll(size->text.c_str(), nullptr, 10));
+    return out + "}";
+  }
+
+  const SchemaJSON *items = schema.get("items");
+  if (type->text == "array"  &&  items != nullptr)
+    return "{\"type\":\"array\",\"items\":" + canonical(*items, enclosing) + "}";
+  const SchemaJSON *values = schema.get("values");
+  if (type->text == "map"  &&  values != nullptr)
+    return "{\"type\":\"map\",\"values\":" + canonical(*values, enclosing) + "}";
+
+  return canonical(*type, enclosing);     // {"type": "int"} and the like
+}
+
+std::string avroCanonicalForm(const std::string &schema) {
+  SchemaJSON parsed;
+  size_t pos = 0;
+  if (!parseJSON(schema, pos, parsed))
+    return schema;
+  return canonical(parsed, "");
+}
+
+///////////////////////////////////////////////////////////////////// fingerprints and frames
+
+uint64_t avroFingerprint(const std::string &schema) {
+  // the 64-bit Rabin fingerprint from the Avro specification ("Schema Fingerprints"), of the
+  // schema's Parsing Canonical Form, so that it matches other implementations and registries
+  static uint64_t table[256];
+  static bool filled = false;
+  const uint64_t empty = 0xc15d213aa4d7a795ULL;
+  if (!filled) {
+    for (int i = 0;  i < 256;  i++) {
+      uint64_t fp = i;
+      for (int j = 0;  j < 8;  j++)
+        fp = (fp >> 1) ^ (empty & -(fp & 1));
+      table[i] = fp;
+    }
+    filled = true;
+  }
+
+  std::string canonicalForm = avroCanonicalForm(schema);
+  uint64_t fp = empty;
+  for (size_t i = 0;  i < canonicalForm.size();  i++)
+    fp = (fp >> 8) ^ table[(fp ^ (uint8_t)canonicalForm[i]) & 0xff];
+  return fp;
+}
+
+AvroFrameWriter::AvroFrameWriter(FILE *out, int64_t maxRecords, int64_t maxMillis, uint64_t fingerprint) :
+  frame(1024 * 1024), out(out), maxRecords(maxRecords), maxMillis(maxMillis), fingerprint(fingerprint) {
+  frame.size = AVRO_FRAME_HEADER_SIZE;
+}
+
+AvroEncoder &AvroFrameWriter::record(int64_t entry) {
+  // the caller encodes the record into the frame after this
+  if (numRecords == 0) {
+    baseEntry = entry;
+    if (maxMillis > 0)
+      started = std::chrono::steady_clock::now();
+  }
+  frame.writeLong(entry - baseEntry);
+  return frame;
+}
+
+bool AvroFrameWriter::commit() {
+  numRecords++;
+  if ((int64_t)numRecords >= maxRecords)
+    return flush();
+  if (maxMillis > 0  &&  std::chrono::steady_clock::now() - started >= std::chrono::milliseconds(maxMillis))
+    return flush();
+  return true;
+}
+
+bool AvroFrameWriter::flush() {
+  if (numRecords == 0)
+    return true;
+
+  // little-endian, like the machines we run on (see AvroEncoder)
+  uint64_t payloadSize = frame.size - AVRO_FRAME_HEADER_SIZE;
+  memcpy(frame.buffer, AVRO_FRAME_MAGIC, 4);
+  memcpy(frame.buffer + 4, &numRecords, sizeof(uint32_t));
+  memcpy(frame.buffer + 8, &baseEntry, sizeof(int64_t));
+  memcpy(frame.buffer + 16, &fingerprint, sizeof(uint64_t));
+  memcpy(frame.buffer + 24, &payloadSize, sizeof(uint64_t));
+
+  bool ok = fwrite(frame.buffer, 1, frame.size, out) == frame.size  &&  fflush(out) == 0;
+  if (!ok)
+    errorMessage = std::string("Could not write an Avro frame: ") + strerror(errno);
+
+  frame.size = AVRO_FRAME_HEADER_SIZE;
+  numRecords = 0;
+  return ok;
+}
@@ -0,0 +1,67 @@
+// Copyright 2016 Jim Pivarski
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//     http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef AVRO_FRAMES_H
+#define AVRO_FRAMES_H
+
+// C includes
+#include <stdint.h>
+#include <stdio.h>
+
+// C++ includes
+#include <chrono>
+#include <string>
+
+#include "avroEncoder.h"
+
+// --mode=avro-frames: schemaless Avro records, like --mode=avro-stream, but collected into
+// frames that a consumer can read with two reads (header, then payload). A frame is
+//
+//     4 bytes   "R2AF"
+//     uint32    number of records
+//     int64     base entry number (of the first record)
+//     uint64    schema fingerprint (CRC-64-AVRO of its Parsing Canonical Form), or 0 if not requested
+//     uint64    payload size in bytes
+//     payload   for each record: its entry number minus the base (Avro long), then the record
+//
+// with the numbers in the header little-endian. A frame is written when it has maxRecords
+// records or (if maxMillis is not 0) its first record is maxMillis old, and at the end.
+
+#define AVRO_FRAME_MAGIC "R2AF"
+#define AVRO_FRAME_HEADER_SIZE 32
+
+std::string avroCanonicalForm(const std::string &schema);
+uint64_t avroFingerprint(const std::string &schema);       // of the canonical form
+
+class AvroFrameWriter {
+public:
+  AvroEncoder frame;                 // header (filled in when written) and payload
+  std::string errorMessage = "";
+
+  AvroFrameWriter(FILE *out, int64_t maxRecords, int64_t maxMillis, uint64_t fingerprint);
+  AvroEncoder &record(int64_t entry);
+  bool commit();
+  bool flush();
+
+private:
+  FILE *out;
+  int64_t maxRecords;
+  int64_t maxMillis;
+  uint64_t fingerprint;
+  int64_t baseEntry = 0;
+  uint32_t numRecords = 0;
+  std::chrono::steady_clock::time_point started;
+};
+
+#endif // AVRO_FRAMES_H
@@ -0,0 +1,161 @@
+// Copyright 2016 Jim Pivarski
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//     http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+// C includes
+#include <errno.h>
+#include <string.h>
+
+// C++ includes
+#include <algorithm>
+
+#include "avroIndex.h"
+
+///////////////////////////////////////////////////////////////////// AvroIndexWriter
+
+AvroIndexWriter::AvroIndexWriter(std::string path) : path(path) {
+  out = fopen(path.c_str(), "wb");
+  if (out == nullptr) {
+    errorMessage = std::string("Could not open index ") + path + std::string(": ") + strerror(errno);
+    return;
+  }
+  valid = true;
+}
+
+void AvroIndexWriter::fileStarted(int64_t fileIndex, int64_t firstEntry) {
+  std::lock_guard<std::mutex> lock(mutex);
+  fileStarts.push_back(std::make_pair(fileIndex, firstEntry));
+}
+
+bool AvroIndexWriter::add(const char *sync, int64_t offset, int64_t firstEntry, int64_t lastEntry, int64_t numRecords) {
+  if (!headerWritten) {
+    fwrite(AVRO_INDEX_MAGIC, 1, 8, out);
+    fwrite(sync, 1, AVRO_SYNC_SIZE, out);
+    headerWritten = true;
+  }
+
+  // the last input file started at or before the block's first entry (with --encode-threads,
+  // later ones may have started)
+  int64_t fileIndex = 0;
+  int64_t fileFirstEntry = 0;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    for (auto start = fileStarts.begin();  start != fileStarts.end()  &&  start->second <= firstEntry;  ++start) {
+      fileIndex = start->first;
+      fileFirstEntry = start->second;
+    }
+  }
+
+  // little-endian, like the machines we run on (see AvroEncoder)
+  char record[AVRO_INDEX_RECORD_SIZE];
+  int64_t treeEntry = firstEntry - fileFirstEntry;
+  uint32_t records = (uint32_t)numRecords;
+  uint32_t file = (uint32_t)fileIndex;
+  memcpy(record, &offset, sizeof(int64_t));
+  memcpy(record + 8, &firstEntry, sizeof(int64_t));
+  memcpy(record + 16, &lastEntry, sizeof(int64_t));
+  memcpy(record + 24, &treeEntry, sizeof(int64_t));
+  memcpy(record + 32, &records, sizeof(uint32_t));
+  memcpy(record + 36, &file, sizeof(uint32_t));
+
+  if (fwrite(record, 1, AVRO_INDEX_RECORD_SIZE, out) != AVRO_INDEX_RECORD_SIZE) {
+    errorMessage = std::string("Could not write index ") + path + std::string(": ") + strerror(errno);
+    return false;
+  }
+  return true;
+}
+
+bool AvroIndexWriter::close() {
+  if (out == nullptr)
+    return valid;
+  bool success = fclose(out) == 0;
+  out = nullptr;
+  if (!success) {
+    errorMessage = std::string("Could not write index ") + path + std::string(": ") + strerror(errno);
+    valid = false;
+  }
+  return valid;
+}
+
+///////////////////////////////////////////////////////////////////// AvroIndex
+
+AvroIndex::AvroIndex(std::string path) {
+  memset(sync, 0, AVRO_SYNC_SIZE);
+  FILE *in = fopen(path.c_str(), "rb");
+  if (in == nullptr) {
+    errorMessage = std::string("Could not open index ") + path + std::string(": ") + strerror(errno);
+    return;
+  }
+
+  char header[AVRO_INDEX_HEADER_SIZE];
+  size_t headerSize = fread(header, 1, AVRO_INDEX_HEADER_SIZE, in);
+  if (headerSize == 0) {
+    // no blocks were written
+    fclose(in);
+    valid = true;
+    return;
+  }
+  if (headerSize != AVRO_INDEX_HEADER_SIZE  ||  memcmp(header, AVRO_INDEX_MAGIC, 8) != 0) {
+    errorMessage = std::string("Not a root2avro index: ") + path;
+    fclose(in);
+    return;
+  }
+  memcpy(sync, header + 8, AVRO_SYNC_SIZE);
+
+  char record[AVRO_INDEX_RECORD_SIZE];
+  size_t size;
+  while ((size = fread(record, 1, AVRO_INDEX_RECORD_SIZE, in)) == AVRO_INDEX_RECORD_SIZE) {
+    AvroIndexEntry block;
+    memcpy(&block.offset, record, sizeof(int64_t));
+    memcpy(&block.firstEntry, record + 8, sizeof(int64_t));
+    memcpy(&block.lastEntry, record + 16, sizeof(int64_t));
+    memcpy(&block.treeEntry, record + 24, sizeof(int64_t));
+    memcpy(&block.numRecords, record + 32, sizeof(uint32_t));
+    memcpy(&block.fileIndex, record + 36, sizeof(uint32_t));
+    blocks.push_back(block);
+  }
+  fclose(in);
+
+  if (size != 0) {
+    errorMessage = std::string("Truncated root2avro index: ") + path;
+    return;
+  }
+  valid = true;
+}
+
+int64_t AvroIndex::find(int64_t entry) const {
+  // blocks are in entry order: the last one starting at or before entry
+  auto after = std::upper_bound(blocks.begin(), blocks.end(), entry, [](int64_t entry, const AvroIndexEntry &block) { return entry < block.firstEntry; });
+  if (after == blocks.begin())
+    return -1;
+  --after;
+  if (entry > after->lastEntry)
+    return -1;
+  return after - blocks.begin();
+}
+
+void AvroIndex::range(int64_t firstEntry, int64_t endEntry, size_t &begin, size_t &end) const {
+  auto first = std::lower_bound(blocks.begin(), blocks.end(), firstEntry, [](const AvroIndexEntry &block, int64_t entry) { return block.lastEntry < entry; });
+  auto last = std::lower_bound(first, blocks.end(), endEntry, [](const AvroIndexEntry &block, int64_t entry) { return block.firstEntry < entry; });
+  begin = first - blocks.begin();
+  end = last - blocks.begin();
+}
+
+bool readIndexedBlock(AvroContainerReader &reader, const AvroIndexEntry &block, int64_t &numObjects, std::string &data) {
+  if (fseeko(reader.in, block.offset, SEEK_SET) != 0) {
+    reader.errorMessage = std::string("Could not seek to Avro block: ") + strerror(errno);
+    return false;
+  }
+  return reader.nextBlock(numObjects, data);
+}
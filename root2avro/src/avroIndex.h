@@ -0,0 +1,96 @@
+// Copyright 2016 Jim Pivarski
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//     http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef AVRO_INDEX_H
+#define AVRO_INDEX_H
+
+// C includes
+#include <stdint.h>
+#include <stdio.h>
+
+// C++ includes
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "avroContainer.h"
+
+// --index=FILE: a sidecar for random access into the Avro output, so that entry N can be found
+// without scanning the file from the start. It is
+// 
+//     8 bytes   "R2AINDX1"
+//     16 bytes  the Avro file's sync marker (to check that they belong together)
+// 
+// followed by one 40-byte record per Avro block, in file order:
+// 
+//     int64     byte offset of the block in the Avro file
+//     int64     global entry number of its first record
+//     int64     global entry number of its last record
+//     int64     entry number of its first record in its input file's TTree
+//     uint32    number of records
+//     uint32    index of that input file on the command line
+// 
+// with the numbers little-endian. Without --cut, entry N is record N - first of its block; with
+// --cut, the entries between first and last that didn't pass are not in the block.
+
+#define AVRO_INDEX_MAGIC "R2AINDX1"
+#define AVRO_INDEX_HEADER_SIZE 24
+#define AVRO_INDEX_RECORD_SIZE 40
+
+class AvroIndexEntry {
+public:
+  int64_t offset;
+  int64_t firstEntry;
+  int64_t lastEntry;
+  int64_t treeEntry;
+  uint32_t numRecords;
+  uint32_t fileIndex;
+};
+
+class AvroIndexWriter {
+public:
+  bool valid = false;
+  std::string errorMessage = "";
+
+  AvroIndexWriter(std::string path);
+  void fileStarted(int64_t fileIndex, int64_t firstEntry);
+  bool add(const char *sync, int64_t offset, int64_t firstEntry, int64_t lastEntry, int64_t numRecords);
+  bool close();
+
+private:
+  std::string path;
+  FILE *out;
+  bool headerWritten = false;
+  std::mutex mutex;                  // fileStarted (ROOT thread) and add (writer thread)
+  std::vector<std::pair<int64_t, int64_t> > fileStarts;
+};
+
+class AvroIndex {
+public:
+  bool valid = false;
+  std::string errorMessage = "";
+  char sync[AVRO_SYNC_SIZE];
+  std::vector<AvroIndexEntry> blocks;
+
+  AvroIndex(std::string path);
+  int64_t find(int64_t entry) const;                                // block containing entry, or -1
+  void range(int64_t firstEntry, int64_t endEntry, size_t &begin, size_t &end) const;   // blocks overlapping [firstEntry, endEntry)
+};
+
+// seek to an indexed block of an open container and read it (as AvroContainerReader::nextBlock)
+bool readIndexedBlock(AvroContainerReader &reader, const AvroIndexEntry &block, int64_t &numObjects, std::string &data);
+
+#endif // AVRO_INDEX_H
@@ -0,0 +1,124 @@
+// Copyright 2016 Jim Pivarski
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//     http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef BOUNDED_QUEUE_H
+#define BOUNDED_QUEUE_H
+
+// C includes
+#include <stdint.h>
+#include <time.h>
+
+// C++ includes
+#include <atomic>
+#include <memory>
+#include <thread>
+
+///////////////////////////////////////////////////////////////////// BoundedQueue
+
+// Dmitry Vyukov's bounded multi-producer, multi-consumer queue: one compare-and-swap per
+// push or pop, no locks. Blocking push/pop poll with a short sleep when full/empty.
+
+inline void boundedQueueWait(int &spins) {
+  if (spins < 64) {
+    spins++;
+    std::this_thread::yield();
+  }
+  else {
+    timespec req, rem;
+    req.tv_sec = 0;
+    req.tv_nsec = 50000;
+    nanosleep(&req, &rem);
+  }
+}
+
+template <typename T>
+class BoundedQueue {
+public:
+  BoundedQueue(size_t minimumCapacity) {
+    size_t capacity = 2;
+    while (capacity < minimumCapacity) capacity *= 2;
+    mask = capacity - 1;
+    cells = std::unique_ptr<Cell[]>(new Cell[capacity]);
+    for (size_t i = 0;  i < capacity;  i++)
+      cells[i].sequence.store(i, std::memory_order_relaxed);
+    enqueuePosition.store(0, std::memory_order_relaxed);
+    dequeuePosition.store(0, std::memory_order_relaxed);
+  }
+
+  bool tryPush(T data) {
+    Cell *cell;
+    size_t position = enqueuePosition.load(std::memory_order_relaxed);
+    while (true) {
+      cell = &cells[position & mask];
+      size_t sequence = cell->sequence.load(std::memory_order_acquire);
+      intptr_t difference = (intptr_t)sequence - (intptr_t)position;
+      if (difference == 0) {
+        if (enqueuePosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+          break;
+      }
+      else if (difference < 0)
+        return false;
+      else
+        position = enqueuePosition.load(std::memory_order_relaxed);
+    }
+    cell->data = data;
+    cell->sequence.store(position + 1, std::memory_order_release);
+    return true;
+  }
+
+  bool tryPop(T &data) {
+    Cell *cell;
+    size_t position = dequeuePosition.load(std::memory_order_relaxed);
+    while (true) {
+      cell = &cells[position & mask];
+      size_t sequence = cell->sequence.load(std::memory_order_acquire);
+      intptr_t difference = (intptr_t)sequence - (intptr_t)(position + 1);
+      if (difference == 0) {
+        if (dequeuePosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+          break;
+      }
+      else if (difference < 0)
+        return false;
+      else
+        position = dequeuePosition.load(std::memory_order_relaxed);
+    }
+    data = cell->data;
+    cell->sequence.store(position + mask + 1, std::memory_order_release);
+    return true;
+  }
+
+  void push(T data) {
+    int spins = 0;
+    while (!tryPush(data)) boundedQueueWait(spins);
+  }
+
+  T pop() {
+    T data;
+    int spins = 0;
+    while (!tryPop(data)) boundedQueueWait(spins);
+    return data;
+  }
+
+private:
+  struct Cell {
+    std::atomic<size_t> sequence;
+    T data;
+  };
+  std::unique_ptr<Cell[]> cells;
+  size_t mask;
+  alignas(64) std::atomic<size_t> enqueuePosition;
+  alignas(64) std::atomic<size_t> dequeuePosition;
+};
+
+#endif // BOUNDED_QUEUE_H
@@ -0,0 +1,152 @@
+// Copyright 2016 Jim Pivarski
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//     http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// C includes
+#include <string.h>
+
+// C++ includes
+#include <algorithm>
+#include <stdexcept>
+
+#include "bulkReader.h"
+
+// ROOT includes
+#if ROOT_VERSION_CODE >= ROOT_VERSION(6,14,0)
+#include <ROOT/TBulkBranchRead.hxx>
+#endif
+
+///////////////////////////////////////////////////////////////////// eligibility
+
+bool bulkReadable(TreeWalker *treeWalker, std::string &errorMessage) {
+#if ROOT_VERSION_CODE < ROOT_VERSION(6,14,0)
+  errorMessage = "Bulk reading needs ROOT 6.14 or later.";
+  return false;
+#else
+  if (treeWalker->cut != nullptr) {
+    errorMessage = "Bulk reading can't be combined with --cut.";
+    return false;
+  }
+  TTree *ttree = treeWalker->reader->GetTree();
+  for (auto iter = treeWalker->fields.begin();  iter != treeWalker->fields.end();  ++iter) {
+    LeafWalker *leaf = dynamic_cast<LeafWalker*>(*iter);
+    if (leaf == nullptr  ||  leaf->dimensions != 0  ||  dynamic_cast<CStringWalker*>(leaf->walker) != nullptr) {
+      errorMessage = std::string("Bulk reading needs every field to be a single number, but ") + (*iter)->fieldName + std::string(" is not.");
+      return false;
+    }
+    TLeaf *tleaf = ttree->GetLeaf(leaf->fieldName.c_str());
+    if (tleaf == nullptr  ||  tleaf->GetBranch()->GetListOfLeaves()->GetEntries() != 1) {
+      errorMessage = std::string("Bulk reading needs every leaf to have its own branch, but ") + leaf->fieldName + std::string(" does not.");
+      return false;
+    }
+  }
+  return true;
+#endif
+}
+
+///////////////////////////////////////////////////////////////////// byte order
+
+// the loops have no calls or branches in them, so the compiler turns them into byte shuffles
+// over whole vector registers
+template <typename T, T (*SWAP)(T)>
+inline void swapRun(char *data, int64_t count) {
+  for (int64_t i = 0;  i < count;  i++) {
+    T value;
+    memcpy(&value, data + i * sizeof(T), sizeof(T));
+    value = SWAP(value);
+    memcpy(data + i * sizeof(T), &value, sizeof(T));
+  }
+}
+
+inline uint16_t swap16(uint16_t x) { return __builtin_bswap16(x); }
+inline uint32_t swap32(uint32_t x) { return __builtin_bswap32(x); }
+inline uint64_t swap64(uint64_t x) { return __builtin_bswap64(x); }
+
+void swapBytes(char *data, int64_t count, size_t itemSize) {
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+  switch (itemSize) {
+    case 2:  swapRun<uint16_t, swap16>(data, count);  break;
+    case 4:  swapRun<uint32_t, swap32>(data, count);  break;
+    case 8:  swapRun<uint64_t, swap64>(data, count);  break;
+    default: break;                  // one byte: nothing to swap
+  }
+#endif
+}
+
+///////////////////////////////////////////////////////////////////// BulkColumn
+
+BulkColumn::BulkColumn(LeafWalker *leaf) :
+  leaf(leaf),
+  buffer(new TBufferFile(TBufferFile::kWrite, 32 * 1024)),
+  itemSize(leaf->walker->sizeOf()) { }
+
+BulkColumn::~BulkColumn() {
+  delete buffer;
+}
+
+void BulkColumn::load(int64_t entry) {
+#if ROOT_VERSION_CODE >= ROOT_VERSION(6,14,0)
+  // the bulk read returns a whole basket: start at the first entry of the one containing entry
+  Long64_t *basketEntry = branch->GetBasketEntry();
+  int numBaskets = branch->GetWriteBasket() + 1;
+  int basket = std::upper_bound(basketEntry, basketEntry + numBaskets, entry) - basketEntry - 1;
+  if (basket < 0)
+    basket = 0;
+
+  first = basketEntry[basket];
+  count = branch->GetBulkRead().GetEntriesSerialized(first, *buffer);
+  if (count <= 0  ||  entry >= first + count)
+    throw std::runtime_error(std::string("Bulk read of branch ") + branch->GetName() + std::string(" failed at entry ") + std::to_string(entry));
+
+  data = buffer->GetCurrent();
+  swapBytes(data, count, itemSize);
+#endif
+}
+
+///////////////////////////////////////////////////////////////////// BulkReader
+
+BulkReader::BulkReader(TreeWalker *treeWalker) {
+  for (auto iter = treeWalker->fields.begin();  iter != treeWalker->fields.end();  ++iter)
+    columns.push_back(new BulkColumn((LeafWalker*)(*iter)));
+  reset(treeWalker->reader->GetTree());
+}
+
+BulkReader::~BulkReader() {
+  for (auto column = columns.begin();  column != columns.end();  ++column)
+    delete *column;
+}
+
+void BulkReader::reset(TTree *ttree) {
+  for (auto column = columns.begin();  column != columns.end();  ++column) {
+    (*column)->branch = ttree->GetLeaf((*column)->leaf->fieldName.c_str())->GetBranch();
+    (*column)->first = 0;
+    (*column)->count = 0;
+  }
+  entry = -1;
+  numEntries = ttree->GetEntries();
+}
+
+bool BulkReader::setEntry(int64_t entry) {
+  this->entry = entry;
+  if (entry < 0  ||  entry >= numEntries)
+    return false;
+  for (auto column = columns.begin();  column != columns.end();  ++column)
+    if (entry < (*column)->first  ||  entry >= (*column)->first + (*column)->count)
+      (*column)->load(entry);
+  return true;
+}
+
+void *BulkReader::address(size_t index) {
+  BulkColumn *column = columns[index];
+  return column->data + (entry - column->first) * column->itemSize;
+}
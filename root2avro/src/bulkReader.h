@@ -0,0 +1,71 @@
+// Copyright 2016 Jim Pivarski
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//     http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef BULK_READER_H
+#define BULK_READER_H
+
+// C includes
+#include <stdint.h>
+
+// C++ includes
+#include <string>
+#include <vector>
+
+// ROOT includes
+#include <RVersion.h>
+#include <TBranch.h>
+#include <TBufferFile.h>
+#include <TTree.h>
+
+#include "datawalker.h"
+
+// Reads a flat tree (every field a scalar number leaf, alone in its branch) a basket at a
+// time with ROOT's bulk I/O (6.14 and later), instead of one entry at a time through
+// TTreeReader. Each basket is swapped from big-endian to native order in one pass, and the
+// TreeWalker hands the walkers (or the compiled serializers) addresses into it, so that the
+// encoders are unchanged. Anything else (arrays, objects, --cut, --define) is read through
+// TTreeReader as before.
+
+class BulkColumn {
+public:
+  LeafWalker *leaf;
+  TBranch *branch = nullptr;
+  TBufferFile *buffer;
+  size_t itemSize;
+  int64_t first = 0;                 // entries [first, first + count) are in the buffer, in native order
+  int64_t count = 0;
+  char *data = nullptr;
+
+  BulkColumn(LeafWalker *leaf);
+  ~BulkColumn();
+  void load(int64_t entry);
+};
+
+class BulkReader {
+public:
+  std::vector<BulkColumn*> columns;  // indexed like the TreeWalker's fields
+  int64_t entry = -1;
+  int64_t numEntries = 0;
+
+  BulkReader(TreeWalker *treeWalker);
+  ~BulkReader();
+  void reset(TTree *ttree);
+  bool setEntry(int64_t entry);
+  void *address(size_t index);
+};
+
+bool bulkReadable(TreeWalker *treeWalker, std::string &errorMessage);
+void swapBytes(char *data, int64_t count, size_t itemSize);
+
+#endif // BULK_READER_H
@@ -0,0 +1,162 @@
+// Copyright 2016 Jim Pivarski
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//     http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+// C includes
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "checkpoint.h"
+
+uint64_t hashArguments(int argc, char **argv) {
+  // FNV-1a of the arguments, each with its terminating zero
+  uint64_t hash = 14695981039346656037ULL;
+  for (int i = 1;  i < argc;  i++)
+    for (const char *c = argv[i];  ;  c++) {
+      hash ^= (unsigned char)*c;
+      hash *= 1099511628211ULL;
+      if (*c == 0) break;
+    }
+  return hash;
+}
+
+Checkpoint::Checkpoint(std::string path, uint64_t arguments) : path(path), arguments(arguments) { }
+
+bool Checkpoint::resume(FILE *out) {
+  struct stat status;
+  if (fstat(fileno(out), &status) != 0  ||  !S_ISREG(status.st_mode)) {
+    errorMessage = std::string("--checkpoint needs the output redirected (with >>) to a regular file.");
+    return false;
+  }
+
+  FILE *file = fopen(path.c_str(), "r");
+  if (file == nullptr) {
+    if (errno != ENOENT) {
+      errorMessage = std::string("Could not read checkpoint ") + path + std::string(": ") + strerror(errno);
+      return false;
+    }
+    if (status.st_size != 0) {
+      errorMessage = std::string("The output is not empty, but there is no checkpoint ") + path + std::string(" to continue from.");
+      return false;
+    }
+    return true;                     // first run
+  }
+
+  char key[64];
+  long long value;
+  int found = 0;
+  uint64_t checkpointArguments = 0;
+  while (fscanf(file, "%63s %lld", key, &value) == 2) {
+    std::string name(key);
+    if (name == std::string("arguments"))           { checkpointArguments = (uint64_t)value;  found |= 1; }
+    else if (name == std::string("nextEntry"))      { nextEntry = value;                      found |= 2; }
+    else if (name == std::string("fileIndex"))      { fileIndex = value;                      found |= 4; }
+    else if (name == std::string("fileFirstEntry")) { fileFirstEntry = value;                 found |= 8; }
+    else if (name == std::string("outputSize"))     { outputSize = value;                     found |= 16; }
+  }
+  fclose(file);
+
+  if (found != 31) {
+    errorMessage = std::string("Checkpoint ") + path + std::string(" is incomplete.");
+    return false;
+  }
+  if (checkpointArguments != arguments) {
+    errorMessage = std::string("Checkpoint ") + path + std::string(" is for a different command line; remove it to start over.");
+    return false;
+  }
+  if (status.st_size < outputSize) {
+    errorMessage = std::string("The output is shorter than checkpoint ") + path + std::string(" says; was it truncated (redirect with >>)?");
+    return false;
+  }
+
+  // drop whatever was written after the last checkpointed block
+  if (ftruncate(fileno(out), outputSize) != 0  ||  fseeko(out, outputSize, SEEK_SET) != 0) {
+    errorMessage = std::string("Could not truncate the output: ") + strerror(errno);
+    return false;
+  }
+  resumed = true;
+  return true;
+}
+
+void Checkpoint::fileStarted(int64_t fileIndex, int64_t firstEntry) {
+  std::lock_guard<std::mutex> lock(mutex);
+  fileStarts.push_back(std::make_pair(fileIndex, firstEntry));
+}
+
+bool Checkpoint::blockWritten(FILE *out, int64_t nextEntry) {
+  std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+  if (saved  &&  now - lastSaved < std::chrono::milliseconds(CHECKPOINT_INTERVAL_MS))
+    return true;
+
+  // the checkpoint must not get ahead of the data on disk
+  struct stat status;
+  if (fflush(out) != 0  ||  fsync(fileno(out)) != 0  ||  fstat(fileno(out), &status) != 0) {
+    errorMessage = std::string("Could not sync the output for a checkpoint: ") + strerror(errno);
+    return false;
+  }
+
+  // the last file started at or before nextEntry (with --encode-threads, later ones may have started)
+  int64_t index = 0;
+  int64_t firstEntry = 0;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    for (auto start = fileStarts.begin();  start != fileStarts.end()  &&  start->second <= nextEntry;  ++start) {
+      index = start->first;
+      firstEntry = start->second;
+    }
+  }
+
+  saved = true;
+  lastSaved = now;
+  return save(nextEntry, index, firstEntry, status.st_size);
+}
+
+bool Checkpoint::save(int64_t nextEntry, int64_t fileIndex, int64_t fileFirstEntry, int64_t outputSize) {
+  // write a new file and rename it over the old one, so that a crash leaves one or the other
+  std::string temporary = path + std::string(".tmp");
+  FILE *file = fopen(temporary.c_str(), "w");
+  if (file == nullptr) {
+    errorMessage = std::string("Could not write checkpoint ") + temporary + std::string(": ") + strerror(errno);
+    return false;
+  }
+  fprintf(file, "arguments %lld\nnextEntry %lld\nfileIndex %lld\nfileFirstEntry %lld\noutputSize %lld\n",
+          (long long)arguments, (long long)nextEntry, (long long)fileIndex, (long long)fileFirstEntry, (long long)outputSize);
+  bool success = fflush(file) == 0  &&  fsync(fileno(file)) == 0;
+  success = fclose(file) == 0  &&  success;
+  if (!success  ||  rename(temporary.c_str(), path.c_str()) != 0) {
+    errorMessage = std::string("Could not write checkpoint ") + path + std::string(": ") + strerror(errno);
+    return false;
+  }
+
+  // and the rename itself has to reach the disk
+  size_t slash = path.rfind('/');
+  std::string directory = slash == std::string::npos ? std::string(".") : (slash == 0 ? std::string("/") : path.substr(0, slash));
+  int fd = open(directory.c_str(), O_RDONLY);
+  if (fd >= 0) {
+    fsync(fd);
+    close(fd);
+  }
+  return true;
+}
+
+bool Checkpoint::finish() {
+  if (unlink(path.c_str()) != 0  &&  errno != ENOENT) {
+    errorMessage = std::string("Could not remove checkpoint ") + path + std::string(": ") + strerror(errno);
+    return false;
+  }
+  return true;
+}
@@ -0,0 +1,75 @@
+// Copyright 2016 Jim Pivarski
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//     http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+// C includes
+#include <stdint.h>
+#include <stdio.h>
+
+// C++ includes
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+// --checkpoint=FILE lets a long conversion that dies part of the way through be run again with
+// the same arguments and continue where it stopped. After an Avro block is written (at most once
+// per CHECKPOINT_INTERVAL_MS), the output is synced to disk and FILE is replaced (atomically)
+// with the entry number after that block's last record, the input file that entry is in, and
+// the size of the output. A restart truncates the output to that size (the last good block) and
+// converts from that entry on, opening no input files before it. FILE is small "key value"
+// text, removed when the conversion finishes.
+// 
+// The output has to be a regular file, redirected with >> so that the shell doesn't truncate
+// it on restart (without a checkpoint, it must be empty).
+
+#ifndef CHECKPOINT_INTERVAL_MS
+#define CHECKPOINT_INTERVAL_MS 1000           // (tests set it to 0: a checkpoint for every block)
+#endif
+
+class Checkpoint {
+public:
+  std::string path;
+  uint64_t arguments;                // hash of the command line that the checkpoint is for
+  std::string errorMessage = "";
+
+  // where to continue, if a checkpoint was found by resume
+  bool resumed = false;
+  int64_t nextEntry = 0;
+  int64_t fileIndex = 0;
+  int64_t fileFirstEntry = 0;        // global entry number of that file's first entry
+  int64_t outputSize = 0;
+
+  Checkpoint(std::string path, uint64_t arguments);
+  bool resume(FILE *out);
+  void fileStarted(int64_t fileIndex, int64_t firstEntry);
+  bool blockWritten(FILE *out, int64_t nextEntry);
+  bool finish();
+
+private:
+  std::mutex mutex;                  // fileStarted (ROOT thread) and blockWritten (writer thread)
+  std::vector<std::pair<int64_t, int64_t> > fileStarts;
+  bool saved = false;
+  std::chrono::steady_clock::time_point lastSaved;
+
+  bool save(int64_t nextEntry, int64_t fileIndex, int64_t fileFirstEntry, int64_t outputSize);
+};
+
+uint64_t hashArguments(int argc, char **argv);
+
+#endif // CHECKPOINT_H
@@ -13,34 +13,23 @@
 // limitations under the License.
 
 #include "datawalker.h"
+#include "primitiveRuns.h"
+#include "walkerProgram.h"
+#include "bulkReader.h"
 
 ///////////////////////////////////////////////////////////////////// FieldWalker
 
 FieldWalker::FieldWalker(std::string fieldName, std::string typeName) :
   fieldName(fieldName), typeName(typeName) { }
 
-void FieldWalker::printEscapedString(const char *string, std::ostream &stream) {
-  for (const char *c = string;  *c != 0;  c++)
-    switch (*c) {
-      case '"': stream << "\\\""; break;
-      case '\\': stream << "\\\\"; break;
-      case '\b': stream << "\\b"; break;
-      case '\f': stream << "\\f"; break;
-      case '\n': stream << "\\n"; break;
-      case '\r': stream << "\\r"; break;
-      case '\t': stream << "\\t"; break;
-      default:
-        if ('\x00' <= *c  &&  *c <= '\x1f')
-          stream << "\\u" << std::hex << std::setw(4) << std::setfill('0') << (int)*c << std::dec;
-        else
-          stream << *c;
-    }
+void FieldWalker::printEscapedString(const char *string, JSONWriter &stream) {
+  stream.printEscapedString(string);
 }
 
 std::string FieldWalker::escapedString(const char *string) {
-  std::ostringstream stream;
+  JSONWriter stream(0);
   printEscapedString(string, stream);
-  return stream.str();
+  return stream.buffer;
 }
 
 TDictionary *FieldWalker::tdictionary() {
@@ -66,6 +55,53 @@ std::string PrimitiveWalker::avroSchema(int indent, std::set<std::string> &memo)
   return std::string("\"") + avroTypeName() + std::string("\"");
 }
 
+void *PrimitiveWalker::copyRunToBuffer(void *ptr, void *limit, const void *items, int numItems) {
+  for (int i = 0;  i < numItems;  i++)
+    ptr = copyToBuffer(ptr, limit, (void*)((size_t)items + i * sizeOf()));
+  return ptr;
+}
+
+void *PrimitiveWalker::copyRunToBuffer(void *ptr, void *limit, TTreeReaderArrayBase *readerArrayBase, int i, int numItems) {
+  const void *items = contiguous(readerArrayBase, i, numItems);
+  if (items != nullptr)
+    return copyRunToBuffer(ptr, limit, items, numItems);
+  for (int j = i;  j < i + numItems;  j++)
+    ptr = copyToBuffer(ptr, limit, readerArrayBase, j);
+  return ptr;
+}
+
+#ifdef AVRO
+bool PrimitiveWalker::writeAvroRun(const void *items, int numItems, AvroEncoder &encoder) {
+  for (int i = 0;  i < numItems;  i++)
+    if (!writeAvro((void*)((size_t)items + i * sizeOf()), encoder))
+      return false;
+  return true;
+}
+
+bool PrimitiveWalker::writeAvroRun(TTreeReaderArrayBase *readerArrayBase, int i, int numItems, AvroEncoder &encoder) {
+  const void *items = contiguous(readerArrayBase, i, numItems);
+  if (items != nullptr)
+    return writeAvroRun(items, numItems, encoder);
+  for (int j = i;  j < i + numItems;  j++)
+    if (!writeAvro(readerArrayBase, j, encoder))
+      return false;
+  return true;
+}
+#endif
+
+const void *PrimitiveWalker::contiguous(TTreeReaderArrayBase *readerArrayBase, int i, int numItems) {
+  // a leaf's TTreeReaderArray is one buffer: if the first and last items are the right distance
+  // apart, the run can be taken straight from it (CStringWalker, with sizeOf() == 0, never is)
+  if (numItems <= 0  ||  sizeOf() == 0)
+    return nullptr;
+  const void *first = unpack(readerArrayBase, i);
+  const void *last = unpack(readerArrayBase, i + numItems - 1);
+  if ((size_t)last - (size_t)first == (numItems - 1) * sizeOf())
+    return first;
+  else
+    return nullptr;
+}
+
 //// BoolWalker
 
 BoolWalker::BoolWalker(std::string fieldName) : PrimitiveWalker(fieldName, "bool") { }
@@ -80,11 +116,11 @@ void BoolWalker::buildSchema(SchemaBuilder schemaBuilder, std::set<std::string>
   schemaBuilder(SchemaBool, nullptr);
 }
 
-void BoolWalker::printJSON(void *address, std::ostream &stream) {
+void BoolWalker::printJSON(void *address, JSONWriter &stream) {
   if (*((bool*)address)) stream << "true"; else stream << "false";
 }
 
-void BoolWalker::printJSON(TTreeReaderArrayBase *readerArrayBase, int i, std::ostream &stream) {
+void BoolWalker::printJSON(TTreeReaderArrayBase *readerArrayBase, int i, JSONWriter &stream) {
   if (((TTreeReaderArray<bool>*)readerArrayBase)->At(i)) stream << "true"; else stream << "false";
 }
 
@@ -104,6 +140,22 @@ bool BoolWalker::printAvro(TTreeReaderArrayBase *readerArrayBase, int i, avro_va
     avro_value_set_boolean(avrovalue, false);
   return true;
 }
+
+bool BoolWalker::writeAvro(void *address, AvroEncoder &encoder) {
+  if (*((bool*)address))
+    encoder.writeBoolean(true);
+  else
+    encoder.writeBoolean(false);
+  return true;
+}
+
+bool BoolWalker::writeAvro(TTreeReaderArrayBase *readerArrayBase, int i, AvroEncoder &encoder) {
+  if (((TTreeReaderArray<bool>*)readerArrayBase)->At(i))
+    encoder.writeBoolean(true);
+  else
+    encoder.writeBoolean(false);
+  return true;
+}
 #endif
 
 const void *BoolWalker::unpack(const void *address) {
@@ -142,6 +194,17 @@ TTreeReaderArrayBase *BoolWalker::readerArray(TTreeReader *reader) {
   return new TTreeReaderArray<bool>(*reader, fieldName.c_str());
 }
 
+void *BoolWalker::copyRunToBuffer(void *ptr, void *limit, const void *items, int numItems) {
+  return ::copyRunToBuffer<bool>(ptr, limit, items, numItems);
+}
+
+#ifdef AVRO
+bool BoolWalker::writeAvroRun(const void *items, int numItems, AvroEncoder &encoder) {
+  ::writeAvroRun<bool>(encoder, items, numItems);
+  return true;
+}
+#endif
+
 //// CharWalker
 
 CharWalker::CharWalker(std::string fieldName) : PrimitiveWalker(fieldName, "char") { }
@@ -156,11 +219,11 @@ void CharWalker::buildSchema(SchemaBuilder schemaBuilder, std::set<std::string>
   schemaBuilder(SchemaChar, nullptr);
 }
 
-void CharWalker::printJSON(void *address, std::ostream &stream) {
+void CharWalker::printJSON(void *address, JSONWriter &stream) {
   stream << ((int)(*((char*)address)));
 }
 
-void CharWalker::printJSON(TTreeReaderArrayBase *readerArrayBase, int i, std::ostream &stream) {
+void CharWalker::printJSON(TTreeReaderArrayBase *readerArrayBase, int i, JSONWriter &stream) {
   stream << ((int)((TTreeReaderArray<char>*)readerArrayBase)->At(i));
 }
 
@@ -174,6 +237,16 @@ bool CharWalker::printAvro(TTreeReaderArrayBase *readerArrayBase, int i, avro_va
   avro_value_set_int(avrovalue, ((TTreeReaderArray<char>*)readerArrayBase)->At(i));
   return true;
 }
+
+bool CharWalker::writeAvro(void *address, AvroEncoder &encoder) {
+  encoder.writeInt(*((char*)address));
+  return true;
+}
+
+bool CharWalker::writeAvro(TTreeReaderArrayBase *readerArrayBase, int i, AvroEncoder &encoder) {
+  encoder.writeInt(((TTreeReaderArray<char>*)readerArrayBase)->At(i));
+  return true;
+}
 #endif
 
 const void *CharWalker::unpack(const void *address) {
@@ -206,6 +279,17 @@ TTreeReaderArrayBase *CharWalker::readerArray(TTreeReader *reader) {
   return new TTreeReaderArray<char>(*reader, fieldName.c_str());
 }
 
+void *CharWalker::copyRunToBuffer(void *ptr, void *limit, const void *items, int numItems) {
+  return ::copyRunToBuffer<char>(ptr, limit, items, numItems);
+}
+
+#ifdef AVRO
+bool CharWalker::writeAvroRun(const void *items, int numItems, AvroEncoder &encoder) {
+  ::writeAvroRun<char>(encoder, items, numItems);
+  return true;
+}
+#endif
+
 //// UCharWalker
 
 UCharWalker::UCharWalker(std::string fieldName) : PrimitiveWalker(fieldName, "unsigned char") { }
@@ -220,11 +304,11 @@ void UCharWalker::buildSchema(SchemaBuilder schemaBuilder, std::set<std::string>
   schemaBuilder(SchemaUChar, nullptr);
 }
 
-void UCharWalker::printJSON(void *address, std::ostream &stream) {
+void UCharWalker::printJSON(void *address, JSONWriter &stream) {
   stream << ((int)(*((unsigned char*)address)));
 }
 
-void UCharWalker::printJSON(TTreeReaderArrayBase *readerArrayBase, int i, std::ostream &stream) {
+void UCharWalker::printJSON(TTreeReaderArrayBase *readerArrayBase, int i, JSONWriter &stream) {
   stream << ((int)((TTreeReaderArray<unsigned char>*)readerArrayBase)->At(i));
 }
 
@@ -238,6 +322,16 @@ bool UCharWalker::printAvro(TTreeReaderArrayBase *readerArrayBase, int i, avro_v
   avro_value_set_int(avrovalue, ((TTreeReaderArray<unsigned char>*)readerArrayBase)->At(i));
   return true;
 }
+
+bool UCharWalker::writeAvro(void *address, AvroEncoder &encoder) {
+  encoder.writeInt(*((unsigned char*)address));
+  return true;
+}
+
+bool UCharWalker::writeAvro(TTreeReaderArrayBase *readerArrayBase, int i, AvroEncoder &encoder) {
+  encoder.writeInt(((TTreeReaderArray<unsigned char>*)readerArrayBase)->At(i));
+  return true;
+}
 #endif
 
 const void *UCharWalker::unpack(const void *address) {
@@ -270,6 +364,17 @@ TTreeReaderArrayBase *UCharWalker::readerArray(TTreeReader *reader) {
   return new TTreeReaderArray<unsigned char>(*reader, fieldName.c_str());
 }
 
+void *UCharWalker::copyRunToBuffer(void *ptr, void *limit, const void *items, int numItems) {
+  return ::copyRunToBuffer<unsigned char>(ptr, limit, items, numItems);
+}
+
+#ifdef AVRO
+bool UCharWalker::writeAvroRun(const void *items, int numItems, AvroEncoder &encoder) {
+  ::writeAvroRun<unsigned char>(encoder, items, numItems);
+  return true;
+}
+#endif
+
 //// ShortWalker
 
 ShortWalker::ShortWalker(std::string fieldName) : PrimitiveWalker(fieldName, "short") { }
@@ -284,11 +389,11 @@ void ShortWalker::buildSchema(SchemaBuilder schemaBuilder, std::set<std::string>
   schemaBuilder(SchemaShort, nullptr);
 }
 
-void ShortWalker::printJSON(void *address, std::ostream &stream) {
+void ShortWalker::printJSON(void *address, JSONWriter &stream) {
   stream << *((short*)address);
 }
 
-void ShortWalker::printJSON(TTreeReaderArrayBase *readerArrayBase, int i, std::ostream &stream) {
+void ShortWalker::printJSON(TTreeReaderArrayBase *readerArrayBase, int i, JSONWriter &stream) {
   stream << ((TTreeReaderArray<short>*)readerArrayBase)->At(i);
 }
 
@@ -302,6 +407,16 @@ bool ShortWalker::printAvro(TTreeReaderArrayBase *readerArrayBase, int i, avro_v
   avro_value_set_int(avrovalue, ((TTreeReaderArray<short>*)readerArrayBase)->At(i));
   return true;
 }
+
+bool ShortWalker::writeAvro(void *address, AvroEncoder &encoder) {
+  encoder.writeInt(*((short*)address));
+  return true;
+}
+
+bool ShortWalker::writeAvro(TTreeReaderArrayBase *readerArrayBase, int i, AvroEncoder &encoder) {
+  encoder.writeInt(((TTreeReaderArray<short>*)readerArrayBase)->At(i));
+  return true;
+}
 #endif
 
 const void *ShortWalker::unpack(const void *address) {
@@ -334,6 +449,17 @@ TTreeReaderArrayBase *ShortWalker::readerArray(TTreeReader *reader) {
   return new TTreeReaderArray<short>(*reader, fieldName.c_str());
 }
 
+void *ShortWalker::copyRunToBuffer(void *ptr, void *limit, const void *items, int numItems) {
+  return ::copyRunToBuffer<short>(ptr, limit, items, numItems);
+}
+
+#ifdef AVRO
+bool ShortWalker::writeAvroRun(const void *items, int numItems, AvroEncoder &encoder) {
+  ::writeAvroRun<short>(encoder, items, numItems);
+  return true;
+}
+#endif
+
 //// UShortWalker
 
 UShortWalker::UShortWalker(std::string fieldName) : PrimitiveWalker(fieldName, "unsigned short") { }
@@ -348,11 +474,11 @@ void UShortWalker::buildSchema(SchemaBuilder schemaBuilder, std::set<std::string
   schemaBuilder(SchemaUShort, nullptr);
 }
 
-void UShortWalker::printJSON(void *address, std::ostream &stream) {
+void UShortWalker::printJSON(void *address, JSONWriter &stream) {
   stream << *((unsigned short*)address);
 }
 
-void UShortWalker::printJSON(TTreeReaderArrayBase *readerArrayBase, int i, std::ostream &stream) {
+void UShortWalker::printJSON(TTreeReaderArrayBase *readerArrayBase, int i, JSONWriter &stream) {
   stream << ((TTreeReaderArray<unsigned short>*)readerArrayBase)->At(i);
 }
 
@@ -366,6 +492,16 @@ bool UShortWalker::printAvro(TTreeReaderArrayBase *readerArrayBase, int i, avro_
   avro_value_set_int(avrovalue, ((TTreeReaderArray<unsigned short>*)readerArrayBase)->At(i));
   return true;
 }
+
+bool UShortWalker::writeAvro(void *address, AvroEncoder &encoder) {
+  encoder.writeInt(*((unsigned short*)address));
+  return true;
+}
+
+bool UShortWalker::writeAvro(TTreeReaderArrayBase *readerArrayBase, int i, AvroEncoder &encoder) {
+  encoder.writeInt(((TTreeReaderArray<unsigned short>*)readerArrayBase)->At(i));
+  return true;
+}
 #endif
 
 const void *UShortWalker::unpack(const void *address) {
@@ -398,6 +534,17 @@ TTreeReaderArrayBase *UShortWalker::readerArray(TTreeReader *reader) {
   return new TTreeReaderArray<unsigned short>(*reader, fieldName.c_str());
 }
 
+void *UShortWalker::copyRunToBuffer(void *ptr, void *limit, const void *items, int numItems) {
+  return ::copyRunToBuffer<unsigned short>(ptr, limit, items, numItems);
+}
+
+#ifdef AVRO
+bool UShortWalker::writeAvroRun(const void *items, int numItems, AvroEncoder &encoder) {
+  ::writeAvroRun<unsigned short>(encoder, items, numItems);
+  return true;
+}
+#endif
+
 //// IntWalker
 
 IntWalker::IntWalker(std::string fieldName) : PrimitiveWalker(fieldName, "int") { }
@@ -412,11 +559,11 @@ void IntWalker::buildSchema(SchemaBuilder schemaBuilder, std::set<std::string> &
   schemaBuilder(SchemaInt, nullptr);
 }
 
-void IntWalker::printJSON(void *address, std::ostream &stream) {
+void IntWalker::printJSON(void *address, JSONWriter &stream) {
   stream << *((int*)address);
 }
 
-void IntWalker::printJSON(TTreeReaderArrayBase *readerArrayBase, int i, std::ostream &stream) {
+void IntWalker::printJSON(TTreeReaderArrayBase *readerArrayBase, int i, JSONWriter &stream) {
   stream << ((TTreeReaderArray<int>*)readerArrayBase)->At(i);
 }
 
@@ -430,6 +577,16 @@ bool IntWalker::printAvro(TTreeReaderArrayBase *readerArrayBase, int i, avro_val
   avro_value_set_int(avrovalue, ((TTreeReaderArray<int>*)readerArrayBase)->At(i));
   return true;
 }
+
+bool IntWalker::writeAvro(void *address, AvroEncoder &encoder) {
+  encoder.writeInt(*((int*)address));
+  return true;
+}
+
+bool IntWalker::writeAvro(TTreeReaderArrayBase *readerArrayBase, int i, AvroEncoder &encoder) {
+  encoder.writeInt(((TTreeReaderArray<int>*)readerArrayBase)->At(i));
+  return true;
+}
 #endif
 
 const void *IntWalker::unpack(const void *address) {
@@ -462,6 +619,17 @@ TTreeReaderArrayBase *IntWalker::readerArray(TTreeReader *reader) {
   return new TTreeReaderArray<int>(*reader, fieldName.c_str());
 }
 
+void *IntWalker::copyRunToBuffer(void *ptr, void *limit, const void *items, int numItems) {
+  return ::copyRunToBuffer<int>(ptr, limit, items, numItems);
+}
+
+#ifdef AVRO
+bool IntWalker::writeAvroRun(const void *items, int numItems, AvroEncoder &encoder) {
+  ::writeAvroRun<int>(encoder, items, numItems);
+  return true;
+}
+#endif
+
 int IntWalker::value(TTreeReaderValueBase *readerValue) {
   return *((int*)readerValue->GetAddress());
 }
@@ -480,11 +648,11 @@ void UIntWalker::buildSchema(SchemaBuilder schemaBuilder, std::set<std::string>
   schemaBuilder(SchemaUInt, nullptr);
 }
 
-void UIntWalker::printJSON(void *address, std::ostream &stream) {
+void UIntWalker::printJSON(void *address, JSONWriter &stream) {
   stream << *((unsigned int*)address);
 }
 
-void UIntWalker::printJSON(TTreeReaderArrayBase *readerArrayBase, int i, std::ostream &stream) {
+void UIntWalker::printJSON(TTreeReaderArrayBase *readerArrayBase, int i, JSONWriter &stream) {
   stream << ((TTreeReaderArray<unsigned int>*)readerArrayBase)->At(i);
 }
 
@@ -498,6 +666,16 @@ bool UIntWalker::printAvro(TTreeReaderArrayBase *readerArrayBase, int i, avro_va
   avro_value_set_long(avrovalue, ((TTreeReaderArray<unsigned int>*)readerArrayBase)->At(i));
   return true;
 }
+
+bool UIntWalker::writeAvro(void *address, AvroEncoder &encoder) {
+  encoder.writeLong(*((unsigned int*)address));
+  return true;
+}
+
+bool UIntWalker::writeAvro(TTreeReaderArrayBase *readerArrayBase, int i, AvroEncoder &encoder) {
+  encoder.writeLong(((TTreeReaderArray<unsigned int>*)readerArrayBase)->At(i));
+  return true;
+}
 #endif
 
 const void *UIntWalker::unpack(const void *address) {
@@ -511,6 +689,7 @@ const void *UIntWalker::unpack(TTreeReaderArrayBase *readerArrayBase, int i) {
 void *UIntWalker::copyToBuffer(void *ptr, void *limit, void *address) {
   if (ptr == nullptr  ||  (size_t)limit - (size_t)ptr < sizeOf())
     return nullptr;
+  *((unsigned int*)ptr) = *((unsigned int*)address);
   return (void*)((size_t)ptr + sizeOf());
 }
 
@@ -529,6 +708,17 @@ TTreeReaderArrayBase *UIntWalker::readerArray(TTreeReader *reader) {
   return new TTreeReaderArray<unsigned int>(*reader, fieldName.c_str());
 }
 
+void *UIntWalker::copyRunToBuffer(void *ptr, void *limit, const void *items, int numItems) {
+  return ::copyRunToBuffer<unsigned int>(ptr, limit, items, numItems);
+}
+
+#ifdef AVRO
+bool UIntWalker::writeAvroRun(const void *items, int numItems, AvroEncoder &encoder) {
+  ::writeAvroRun<unsigned int>(encoder, items, numItems);
+  return true;
+}
+#endif
+
 //// LongWalker
 
 LongWalker::LongWalker(std::string fieldName) : PrimitiveWalker(fieldName, "Long64_t") { }
@@ -543,11 +733,11 @@ void LongWalker::buildSchema(SchemaBuilder schemaBuilder, std::set<std::string>
   schemaBuilder(SchemaLong, nullptr);
 }
 
-void LongWalker::printJSON(void *address, std::ostream &stream) {
+void LongWalker::printJSON(void *address, JSONWriter &stream) {
   stream << *((Long64_t*)address);
 }
 
-void LongWalker::printJSON(TTreeReaderArrayBase *readerArrayBase, int i, std::ostream &stream) {
+void LongWalker::printJSON(TTreeReaderArrayBase *readerArrayBase, int i, JSONWriter &stream) {
   stream << ((TTreeReaderArray<Long64_t>*)readerArrayBase)->At(i);
 }
 
@@ -561,6 +751,16 @@ bool LongWalker::printAvro(TTreeReaderArrayBase *readerArrayBase, int i, avro_va
   avro_value_set_long(avrovalue, ((TTreeReaderArray<Long64_t>*)readerArrayBase)->At(i));
   return true;
 }
+
+bool LongWalker::writeAvro(void *address, AvroEncoder &encoder) {
+  encoder.writeLong(*((Long64_t*)address));
+  return true;
+}
+
+bool LongWalker::writeAvro(TTreeReaderArrayBase *readerArrayBase, int i, AvroEncoder &encoder) {
+  encoder.writeLong(((TTreeReaderArray<Long64_t>*)readerArrayBase)->At(i));
+  return true;
+}
 #endif
 
 const void *LongWalker::unpack(const void *address) {
@@ -593,6 +793,17 @@ TTreeReaderArrayBase *LongWalker::readerArray(TTreeReader *reader) {
   return new TTreeReaderArray<Long64_t>(*reader, fieldName.c_str());
 }
 
+void *LongWalker::copyRunToBuffer(void *ptr, void *limit, const void *items, int numItems) {
+  return ::copyRunToBuffer<Long64_t>(ptr, limit, items, numItems);
+}
+
+#ifdef AVRO
+bool LongWalker::writeAvroRun(const void *items, int numItems, AvroEncoder &encoder) {
+  ::writeAvroRun<Long64_t>(encoder, items, numItems);
+  return true;
+}
+#endif
+
 //// ULongWalker
 
 ULongWalker::ULongWalker(std::string fieldName) : PrimitiveWalker(fieldName, "ULong64_t") { }
@@ -607,11 +818,11 @@ void ULongWalker::buildSchema(SchemaBuilder schemaBuilder, std::set<std::string>
   schemaBuilder(SchemaULong, nullptr);
 }
 
-void ULongWalker::printJSON(void *address, std::ostream &stream) {
+void ULongWalker::printJSON(void *address, JSONWriter &stream) {
   stream << *((ULong64_t*)address);
 }
 
-void ULongWalker::printJSON(TTreeReaderArrayBase *readerArrayBase, int i, std::ostream &stream) {
+void ULongWalker::printJSON(TTreeReaderArrayBase *readerArrayBase, int i, JSONWriter &stream) {
   stream << ((TTreeReaderArray<unsigned long>*)readerArrayBase)->At(i);
 }
 
@@ -625,6 +836,16 @@ bool ULongWalker::printAvro(TTreeReaderArrayBase *readerArrayBase, int i, avro_v
   avro_value_set_double(avrovalue, ((TTreeReaderArray<ULong64_t>*)readerArrayBase)->At(i));
   return true;
 }
+
+bool ULongWalker::writeAvro(void *address, AvroEncoder &encoder) {
+  encoder.writeDouble(*((ULong64_t*)address));
+  return true;
+}
+
+bool ULongWalker::writeAvro(TTreeReaderArrayBase *readerArrayBase, int i, AvroEncoder &encoder) {
+  encoder.writeDouble(((TTreeReaderArray<ULong64_t>*)readerArrayBase)->At(i));
+  return true;
+}
 #endif
 
 const void *ULongWalker::unpack(const void *address) {
@@ -657,6 +878,17 @@ TTreeReaderArrayBase *ULongWalker::readerArray(TTreeReader *reader) {
   return new TTreeReaderArray<ULong64_t>(*reader, fieldName.c_str());
 }
 
+void *ULongWalker::copyRunToBuffer(void *ptr, void *limit, const void *items, int numItems) {
+  return ::copyRunToBuffer<ULong64_t>(ptr, limit, items, numItems);
+}
+
+#ifdef AVRO
+bool ULongWalker::writeAvroRun(const void *items, int numItems, AvroEncoder &encoder) {
+  ::writeAvroRun<ULong64_t>(encoder, items, numItems);
+  return true;
+}
+#endif
+
 //// FloatWalker
 
 FloatWalker::FloatWalker(std::string fieldName) : PrimitiveWalker(fieldName, "float") { }
@@ -671,11 +903,11 @@ void FloatWalker::buildSchema(SchemaBuilder schemaBuilder, std::set<std::string>
   schemaBuilder(SchemaFloat, nullptr);
 }
 
-void FloatWalker::printJSON(void *address, std::ostream &stream) {
+void FloatWalker::printJSON(void *address, JSONWriter &stream) {
   stream << *((float*)address);
 }
 
-void FloatWalker::printJSON(TTreeReaderArrayBase *readerArrayBase, int i, std::ostream &stream) {
+void FloatWalker::printJSON(TTreeReaderArrayBase *readerArrayBase, int i, JSONWriter &stream) {
   stream << ((TTreeReaderArray<float>*)readerArrayBase)->At(i);
 }
 
@@ -689,6 +921,16 @@ bool FloatWalker::printAvro(TTreeReaderArrayBase *readerArrayBase, int i, avro_v
   avro_value_set_float(avrovalue, ((TTreeReaderArray<float>*)readerArrayBase)->At(i));
   return true;
 }
+
+bool FloatWalker::writeAvro(void *address, AvroEncoder &encoder) {
+  encoder.writeFloat(*((float*)address));
+  return true;
+}
+
+bool FloatWalker::writeAvro(TTreeReaderArrayBase *readerArrayBase, int i, AvroEncoder &encoder) {
+  encoder.writeFloat(((TTreeReaderArray<float>*)readerArrayBase)->At(i));
+  return true;
+}
 #endif
 
 const void *FloatWalker::unpack(const void *address) {
@@ -721,6 +963,17 @@ TTreeReaderArrayBase *FloatWalker::readerArray(TTreeReader *reader) {
   return new TTreeReaderArray<float>(*reader, fieldName.c_str());
 }
 
+void *FloatWalker::copyRunToBuffer(void *ptr, void *limit, const void *items, int numItems) {
+  return ::copyRunToBuffer<float>(ptr, limit, items, numItems);
+}
+
+#ifdef AVRO
+bool FloatWalker::writeAvroRun(const void *items, int numItems, AvroEncoder &encoder) {
+  ::writeAvroRun<float>(encoder, items, numItems);
+  return true;
+}
+#endif
+
 //// DoubleWalker
 
 DoubleWalker::DoubleWalker(std::string fieldName) : PrimitiveWalker(fieldName, "double") { }
@@ -735,11 +988,11 @@ void DoubleWalker::buildSchema(SchemaBuilder schemaBuilder, std::set<std::string
   schemaBuilder(SchemaDouble, nullptr);
 }
 
-void DoubleWalker::printJSON(void *address, std::ostream &stream) {
+void DoubleWalker::printJSON(void *address, JSONWriter &stream) {
   stream << *((double*)address);
 } 
 
-void DoubleWalker::printJSON(TTreeReaderArrayBase *readerArrayBase, int i, std::ostream &stream) {
+void DoubleWalker::printJSON(TTreeReaderArrayBase *readerArrayBase, int i, JSONWriter &stream) {
   stream << ((TTreeReaderArray<double>*)readerArrayBase)->At(i);
 }
 
@@ -753,6 +1006,16 @@ bool DoubleWalker::printAvro(TTreeReaderArrayBase *readerArrayBase, int i, avro_
   avro_value_set_double(avrovalue, ((TTreeReaderArray<double>*)readerArrayBase)->At(i));
   return true;
 }
+
+bool DoubleWalker::writeAvro(void *address, AvroEncoder &encoder) {
+  encoder.writeDouble(*((double*)address));
+  return true;
+}
+
+bool DoubleWalker::writeAvro(TTreeReaderArrayBase *readerArrayBase, int i, AvroEncoder &encoder) {
+  encoder.writeDouble(((TTreeReaderArray<double>*)readerArrayBase)->At(i));
+  return true;
+}
 #endif
 
 const void *DoubleWalker::unpack(const void *address) {
@@ -785,6 +1048,17 @@ TTreeReaderArrayBase *DoubleWalker::readerArray(TTreeReader *reader) {
   return new TTreeReaderArray<double>(*reader, fieldName.c_str());
 }
 
+void *DoubleWalker::copyRunToBuffer(void *ptr, void *limit, const void *items, int numItems) {
+  return ::copyRunToBuffer<double>(ptr, limit, items, numItems);
+}
+
+#ifdef AVRO
+bool DoubleWalker::writeAvroRun(const void *items, int numItems, AvroEncoder &encoder) {
+  ::writeAvroRun<double>(encoder, items, numItems);
+  return true;
+}
+#endif
+
 ///////////////////////////////////////////////////////////////////// AnyStringWalkers
 
 AnyStringWalker::AnyStringWalker(std::string fieldName, std::string typeName) :
@@ -815,13 +1089,13 @@ void CStringWalker::buildSchema(SchemaBuilder schemaBuilder, std::set<std::strin
   schemaBuilder(SchemaString, nullptr);
 }
 
-void CStringWalker::printJSON(void *address, std::ostream &stream) {
+void CStringWalker::printJSON(void *address, JSONWriter &stream) {
   stream << "\"";
   printEscapedString((char*)address, stream);
   stream << "\"";
 }
 
-void CStringWalker::printJSON(TTreeReaderArrayBase *readerArrayBase, int i, std::ostream &stream) {
+void CStringWalker::printJSON(TTreeReaderArrayBase *readerArrayBase, int i, JSONWriter &stream) {
   stream << "\"";
   printEscapedString(((TTreeReaderArray<char*>*)readerArrayBase)->At(i), stream);
   stream << "\"";
@@ -837,6 +1111,16 @@ bool CStringWalker::printAvro(TTreeReaderArrayBase *readerArrayBase, int i, avro
   avro_value_set_string(avrovalue, ((TTreeReaderArray<char*>*)readerArrayBase)->At(i));
   return true;
 }
+
+bool CStringWalker::writeAvro(void *address, AvroEncoder &encoder) {
+  encoder.writeString((char*)address);
+  return true;
+}
+
+bool CStringWalker::writeAvro(TTreeReaderArrayBase *readerArrayBase, int i, AvroEncoder &encoder) {
+  encoder.writeString(((TTreeReaderArray<char*>*)readerArrayBase)->At(i));
+  return true;
+}
 #endif
 
 const void *CStringWalker::unpack(const void *address) {
@@ -889,13 +1173,13 @@ void StdStringWalker::buildSchema(SchemaBuilder schemaBuilder, std::set<std::str
   schemaBuilder(SchemaString, nullptr);
 }
 
-void StdStringWalker::printJSON(void *address, std::ostream &stream) {
+void StdStringWalker::printJSON(void *address, JSONWriter &stream) {
   stream << "\"";
   printEscapedString(((std::string*)address)->c_str(), stream);
   stream << "\"";
 }
 
-void StdStringWalker::printJSON(TTreeReaderArrayBase *readerArrayBase, int i, std::ostream &stream) {
+void StdStringWalker::printJSON(TTreeReaderArrayBase *readerArrayBase, int i, JSONWriter &stream) {
   stream << "\"";
   printEscapedString(((TTreeReaderArray<std::string>*)readerArrayBase)->At(i).c_str(), stream);
   stream << "\"";
@@ -911,6 +1195,16 @@ bool StdStringWalker::printAvro(TTreeReaderArrayBase *readerArrayBase, int i, av
   avro_value_set_string(avrovalue, ((TTreeReaderArray<std::string>*)readerArrayBase)->At(i).c_str());
   return true;
 }
+
+bool StdStringWalker::writeAvro(void *address, AvroEncoder &encoder) {
+  encoder.writeString(((std::string*)address)->c_str());
+  return true;
+}
+
+bool StdStringWalker::writeAvro(TTreeReaderArrayBase *readerArrayBase, int i, AvroEncoder &encoder) {
+  encoder.writeString(((TTreeReaderArray<std::string>*)readerArrayBase)->At(i).c_str());
+  return true;
+}
 #endif
 
 const void *StdStringWalker::unpack(const void *address) {
@@ -964,13 +1258,13 @@ void TStringWalker::buildSchema(SchemaBuilder schemaBuilder, std::set<std::strin
   schemaBuilder(SchemaString, nullptr);
 }
 
-void TStringWalker::printJSON(void *address, std::ostream &stream) {
+void TStringWalker::printJSON(void *address, JSONWriter &stream) {
   stream << "\"";
   printEscapedString(((TString*)address)->Data(), stream);
   stream << "\"";
 }
 
-void TStringWalker::printJSON(TTreeReaderArrayBase *readerArrayBase, int i, std::ostream &stream) {
+void TStringWalker::printJSON(TTreeReaderArrayBase *readerArrayBase, int i, JSONWriter &stream) {
   stream << "\"";
   printEscapedString(((TTreeReaderArray<TString>*)readerArrayBase)->At(i).Data(), stream);
   stream << "\"";
@@ -986,6 +1280,16 @@ bool TStringWalker::printAvro(TTreeReaderArrayBase *readerArrayBase, int i, avro
   avro_value_set_string(avrovalue, ((TTreeReaderArray<TString>*)readerArrayBase)->At(i).Data());
   return true;
 }
+
+bool TStringWalker::writeAvro(void *address, AvroEncoder &encoder) {
+  encoder.writeString(((TString*)address)->Data());
+  return true;
+}
+
+bool TStringWalker::writeAvro(TTreeReaderArrayBase *readerArrayBase, int i, AvroEncoder &encoder) {
+  encoder.writeString(((TTreeReaderArray<TString>*)readerArrayBase)->At(i).Data());
+  return true;
+}
 #endif
 
 const void *TStringWalker::unpack(const void *address) {
@@ -1158,7 +1462,7 @@ void MemberWalker::buildSchema(SchemaBuilder schemaBuilder, std::set<std::string
   walker->buildSchema(schemaBuilder, memo);
 }
 
-void MemberWalker::printJSON(void *address, std::ostream &stream) {
+void MemberWalker::printJSON(void *address, JSONWriter &stream) {
   stream << "\"" << fieldName << "\": ";
   walker->printJSON((void*)((size_t)address + offset), stream);
 }
@@ -1167,6 +1471,10 @@ void MemberWalker::printJSON(void *address, std::ostream &stream) {
 bool MemberWalker::printAvro(void *address, avro_value_t *avrovalue) {
   return walker->printAvro((void*)((size_t)address + offset), avrovalue);
 }
+
+bool MemberWalker::writeAvro(void *address, AvroEncoder &encoder) {
+  return walker->writeAvro((void*)((size_t)address + offset), encoder);
+}
 #endif
 
 const void *MemberWalker::unpack(const void *address) {
@@ -1345,7 +1653,7 @@ void ClassWalker::buildSchema(SchemaBuilder schemaBuilder, std::set<std::string>
   }
 }
 
-void ClassWalker::printJSON(void *address, std::ostream &stream) {
+void ClassWalker::printJSON(void *address, JSONWriter &stream) {
   stream << "{";
   bool first = true;
   for (auto iter = members.begin();  iter != members.end();  ++iter) {
@@ -1367,6 +1675,13 @@ bool ClassWalker::printAvro(void *address, avro_value_t *avrovalue) {
   }
   return true;
 }
+
+bool ClassWalker::writeAvro(void *address, AvroEncoder &encoder) {
+  for (auto iter = members.begin();  iter != members.end();  ++iter)
+    if (!(*iter)->writeAvro(address, encoder))
+      return false;
+  return true;
+}
 #endif
 
 const void *ClassWalker::unpack(const void *address) {
@@ -1419,19 +1734,21 @@ std::string PointerWalker::avroTypeName() { return "union"; }
 
 std::string PointerWalker::avroSchema(int indent, std::set<std::string> &memo) {
   FieldWalker *subWalker = walker;
-  for (PointerWalker *pointerWalker = dynamic_cast<PointerWalker*>(subWalker);  pointerWalker != nullptr;  subWalker = pointerWalker->walker);
+  for (PointerWalker *pointerWalker = dynamic_cast<PointerWalker*>(subWalker);  pointerWalker != nullptr;  pointerWalker = dynamic_cast<PointerWalker*>(subWalker))
+    subWalker = pointerWalker->walker;
   return std::string("[\"null\", ") + subWalker->avroSchema(indent, memo) + std::string("]");
 }
 
 void PointerWalker::buildSchema(SchemaBuilder schemaBuilder, std::set<std::string> &memo) {
   FieldWalker *subWalker = walker;
-  for (PointerWalker *pointerWalker = dynamic_cast<PointerWalker*>(subWalker);  pointerWalker != nullptr;  subWalker = pointerWalker->walker);
+  for (PointerWalker *pointerWalker = dynamic_cast<PointerWalker*>(subWalker);  pointerWalker != nullptr;  pointerWalker = dynamic_cast<PointerWalker*>(subWalker))
+    subWalker = pointerWalker->walker;
 
   schemaBuilder(SchemaPointer, &dataProvider);
   subWalker->buildSchema(schemaBuilder, memo);
 }
 
-void PointerWalker::printJSON(void *address, std::ostream &stream) {
+void PointerWalker::printJSON(void *address, JSONWriter &stream) {
   void *dereferenced = *((void**)address);
   if (dereferenced == nullptr)
     stream << "null";
@@ -1460,6 +1777,19 @@ bool PointerWalker::printAvro(void *address, avro_value_t *avrovalue) {
 
   return true;
 }
+
+bool PointerWalker::writeAvro(void *address, AvroEncoder &encoder) {
+  void *dereferenced = *((void**)address);
+
+  if (dereferenced == nullptr) {
+    encoder.writeLong(0);                                    // union branch 0: null
+    return true;
+  }
+  else {
+    encoder.writeLong(1);
+    return walker->writeAvro(dereferenced, encoder);
+  }
+}
 #endif
 
 const void *PointerWalker::unpack(const void *address) {
@@ -1517,7 +1847,7 @@ void TRefWalker::buildSchema(SchemaBuilder schemaBuilder, std::set<std::string>
   std::cerr << std::endl << "TREF" << std::endl;
 }
 
-void TRefWalker::printJSON(void *address, std::ostream &stream) {
+void TRefWalker::printJSON(void *address, JSONWriter &stream) {
   std::cerr << std::endl << "TREF" << std::endl;
 }
 
@@ -1525,6 +1855,10 @@ void TRefWalker::printJSON(void *address, std::ostream &stream) {
 bool TRefWalker::printAvro(void *address, avro_value_t *avrovalue) {
   std::cerr << std::endl << "TREF" << std::endl; return false;
 }
+
+bool TRefWalker::writeAvro(void *address, AvroEncoder &encoder) {
+  std::cerr << std::endl << "TREF" << std::endl; return false;
+}
 #endif
 
 const void *TRefWalker::unpack(const void *address) {
@@ -1555,6 +1889,7 @@ const void *StdVectorWalkerDataProvider::getData(const void *address, int index)
 StdVectorWalker::StdVectorWalker(std::string fieldName, std::string typeName, FieldWalker *walker) :
   FieldWalker(fieldName, typeName),
   walker(walker),
+  primitive(dynamic_cast<PrimitiveWalker*>(walker)),
   dataProvider(this),
   typeId_(TClass::GetClass(typeName.c_str())->GetTypeInfo()) { }
 
@@ -1591,7 +1926,7 @@ void StdVectorWalker::buildSchema(SchemaBuilder schemaBuilder, std::set<std::str
   walker->buildSchema(schemaBuilder, memo);
 }
 
-void StdVectorWalker::printJSON(void *address, std::ostream &stream) {
+void StdVectorWalker::printJSON(void *address, JSONWriter &stream) {
   stream << "[";
   std::vector<char> *generic = (std::vector<char>*)address;
   int numItems = generic->size() / walker->sizeOf();
@@ -1620,6 +1955,27 @@ bool StdVectorWalker::printAvro(void *address, avro_value_t *avrovalue) {
   }
   return true;
 }
+
+bool StdVectorWalker::writeAvro(void *address, AvroEncoder &encoder) {
+  std::vector<char> *generic = (std::vector<char>*)address;
+  size_t itemSize = walker->sizeOf();
+  int numItems = generic->size() / itemSize;
+  void *ptr = generic->data();
+  if (numItems > 0)
+    encoder.writeLong(numItems);                             // one Avro block with all items
+  if (primitive != nullptr) {
+    if (!primitive->writeAvroRun(ptr, numItems, encoder))
+      return false;
+  }
+  else
+    for (int i = 0;  i < numItems;  i++) {
+      if (!walker->writeAvro(ptr, encoder))
+        return false;
+      ptr = (void*)((size_t)ptr + itemSize);
+    }
+  encoder.writeLong(0);
+  return true;
+}
 #endif
 
 const void *StdVectorWalker::unpack(const void *address) {
@@ -1634,7 +1990,9 @@ void *StdVectorWalker::copyToBuffer(void *ptr, void *limit, void *address) {
   *((int*)ptr) = numItems;
   ptr = (void*)((size_t)ptr + sizeof(int));
   void *p = generic->data();
-  for (int i = 0;  i < numItems;  i++) {                     // see above
+  if (primitive != nullptr)                                  // see above
+    return primitive->copyRunToBuffer(ptr, limit, p, numItems);
+  for (int i = 0;  i < numItems;  i++) {
     ptr = walker->copyToBuffer(ptr, limit, p);
     p = (void*)((size_t)p + walker->sizeOf());
   }
@@ -1688,7 +2046,7 @@ void StdVectorBoolWalker::buildSchema(SchemaBuilder schemaBuilder, std::set<std:
   walker->buildSchema(schemaBuilder, memo);
 }
 
-void StdVectorBoolWalker::printJSON(void *address, std::ostream &stream) {
+void StdVectorBoolWalker::printJSON(void *address, JSONWriter &stream) {
   stream << "[";
   std::vector<bool> *vectorBool = (std::vector<bool>*)address;
 
@@ -1716,6 +2074,17 @@ bool StdVectorBoolWalker::printAvro(void *address, avro_value_t *avrovalue) {
   }
   return true;
 }
+
+bool StdVectorBoolWalker::writeAvro(void *address, AvroEncoder &encoder) {
+  std::vector<bool> *vectorBool = (std::vector<bool>*)address;
+  int numItems = vectorBool->size();
+  if (numItems > 0)
+    encoder.writeLong(numItems);
+  for (int i = 0;  i < numItems;  i++)
+    encoder.writeBoolean(vectorBool->at(i));
+  encoder.writeLong(0);
+  return true;
+}
 #endif
 
 const void *StdVectorBoolWalker::unpack(const void *address) {
@@ -1752,7 +2121,7 @@ const void *ArrayWalkerDataProvider::getData(const void *address, int index) {
 }
 
 ArrayWalker::ArrayWalker(std::string fieldName, FieldWalker *walker, int numItems) :
-  FieldWalker(fieldName, "[]"), walker(walker), numItems(numItems), dataProvider(this) { }
+  FieldWalker(fieldName, "[]"), walker(walker), primitive(dynamic_cast<PrimitiveWalker*>(walker)), numItems(numItems), dataProvider(this) { }
 
 size_t ArrayWalker::sizeOf() { return 0; }
 
@@ -1779,7 +2148,7 @@ void ArrayWalker::buildSchema(SchemaBuilder schemaBuilder, std::set<std::string>
   walker->buildSchema(schemaBuilder, memo);
 }
 
-void ArrayWalker::printJSON(void *address, std::ostream &stream) {
+void ArrayWalker::printJSON(void *address, JSONWriter &stream) {
   stream << "[";
   void *ptr = address;
   bool first = true;
@@ -1804,6 +2173,25 @@ bool ArrayWalker::printAvro(void *address, avro_value_t *avrovalue) {
   }
   return true;
 }
+
+bool ArrayWalker::writeAvro(void *address, AvroEncoder &encoder) {
+  size_t itemSize = walker->sizeOf();
+  void *ptr = address;
+  if (numItems > 0)
+    encoder.writeLong(numItems);
+  if (primitive != nullptr) {
+    if (!primitive->writeAvroRun(ptr, numItems, encoder))
+      return false;
+  }
+  else
+    for (int i = 0;  i < numItems;  i++) {
+      if (!walker->writeAvro(ptr, encoder))
+        return false;
+      ptr = (void*)((size_t)ptr + itemSize);
+    }
+  encoder.writeLong(0);
+  return true;
+}
 #endif
 
 const void *ArrayWalker::unpack(const void *address) {
@@ -1816,6 +2204,8 @@ void *ArrayWalker::copyToBuffer(void *ptr, void *limit, void *address) {
   *((int*)ptr) = numItems;
   ptr = (void*)((size_t)ptr + sizeof(int));
   void *p = address;
+  if (primitive != nullptr)
+    return primitive->copyRunToBuffer(ptr, limit, p, numItems);
   for (int i = 0;  i < numItems;  i++) {
     ptr = walker->copyToBuffer(ptr, limit, p);
     p = (void*)((size_t)p + walker->sizeOf());
@@ -1883,7 +2273,7 @@ void TObjArrayWalker::buildSchema(SchemaBuilder schemaBuilder, std::set<std::str
   walker->buildSchema(schemaBuilder, memo);
 }
 
-void TObjArrayWalker::printJSON(void *address, std::ostream &stream) {
+void TObjArrayWalker::printJSON(void *address, JSONWriter &stream) {
   if (!resolved()) resolve(address);
   if (!resolved()) throw std::invalid_argument(std::string("could not resolve TObjArray (is the first one empty?)"));
   TObjArray *array = (TObjArray*)address;
@@ -1920,6 +2310,25 @@ bool TObjArrayWalker::printAvro(void *address, avro_value_t *avrovalue) {
 
   return true;
 }
+
+bool TObjArrayWalker::writeAvro(void *address, AvroEncoder &encoder) {
+  if (!resolved()) resolve(address);
+  if (!resolved()) throw std::invalid_argument(std::string("could not resolve TObjArray (is the first one empty?)"));
+  TObjArray *array = (TObjArray*)address;
+  if (!array->AssertClass(classToAssert))
+    throw std::invalid_argument(std::string("TObjArray elements must all have the same class for Avro conversion"));
+
+  int numItems = array->GetEntries();                        // non-empty slots, as TIter visits them
+  if (numItems > 0)
+    encoder.writeLong(numItems);
+  TIter nextItem = array;
+  for (void *item = (void*)nextItem();  item != nullptr;  item = (void*)nextItem())
+    if (!walker->writeAvro(item, encoder))
+      return false;
+  encoder.writeLong(0);
+
+  return true;
+}
 #endif
 
 const void *TObjArrayWalker::unpack(const void *address) {
@@ -1976,7 +2385,7 @@ void TRefArrayWalker::buildSchema(SchemaBuilder schemaBuilder, std::set<std::str
   std::cerr << std::endl << "TREFARRAY" << std::endl;
 }
 
-void TRefArrayWalker::printJSON(void *address, std::ostream &stream) {
+void TRefArrayWalker::printJSON(void *address, JSONWriter &stream) {
   std::cerr << std::endl << "TREFARRAY" << std::endl;
 }
 
@@ -1984,6 +2393,10 @@ void TRefArrayWalker::printJSON(void *address, std::ostream &stream) {
 bool TRefArrayWalker::printAvro(void *address, avro_value_t *avrovalue) {
   std::cerr << std::endl << "TREFARRAY" << std::endl; return false;
 }
+
+bool TRefArrayWalker::writeAvro(void *address, AvroEncoder &encoder) {
+  std::cerr << std::endl << "TREFARRAY" << std::endl; return false;
+}
 #endif
 
 const void *TRefArrayWalker::unpack(const void *address) {
@@ -2050,7 +2463,7 @@ void TClonesArrayWalker::buildSchema(SchemaBuilder schemaBuilder, std::set<std::
   walker->buildSchema(schemaBuilder, memo);
 }
 
-void TClonesArrayWalker::printJSON(void *address, std::ostream &stream) {
+void TClonesArrayWalker::printJSON(void *address, JSONWriter &stream) {
   if (!resolved()) resolve(address);
   if (!resolved()) throw std::invalid_argument(std::string("could not resolve TClonesArray"));
   stream << "[";
@@ -2077,6 +2490,20 @@ bool TClonesArrayWalker::printAvro(void *address, avro_value_t *avrovalue) {
   }
   return true;
 }
+
+bool TClonesArrayWalker::writeAvro(void *address, AvroEncoder &encoder) {
+  if (!resolved()) resolve(address);
+  if (!resolved()) throw std::invalid_argument(std::string("could not resolve TClonesArray"));
+  int numItems = ((TClonesArray*)address)->GetEntries();
+  if (numItems > 0)
+    encoder.writeLong(numItems);
+  TIter nextItem = (TClonesArray*)address;
+  for (void *item = (void*)nextItem();  item != nullptr;  item = (void*)nextItem())
+    if (!walker->writeAvro(item, encoder))
+      return false;
+  encoder.writeLong(0);
+  return true;
+}
 #endif
 
 const void *TClonesArrayWalker::unpack(const void *address) {
@@ -2284,7 +2711,7 @@ void LeafWalker::buildSchema(SchemaBuilder schemaBuilder, std::set<std::string>
   walker->buildSchema(schemaBuilder, memo);
 }
 
-int LeafWalker::printJSONDeep(int readerIndex, int readerSize, LeafDimension *dim, std::ostream &stream) {
+int LeafWalker::printJSONDeep(int readerIndex, int readerSize, LeafDimension *dim, JSONWriter &stream) {
   int dimSize = dim->size();
 
   stream << "[";
@@ -2303,7 +2730,7 @@ int LeafWalker::printJSONDeep(int readerIndex, int readerSize, LeafDimension *di
   return readerIndex;
 }
 
-void LeafWalker::printJSON(void *address, std::ostream &stream) {
+void LeafWalker::printJSON(void *address, JSONWriter &stream) {
   stream << "\"" << fieldName << "\": ";
   if (address != nullptr)
     walker->printJSON(address, stream);
@@ -2346,6 +2773,46 @@ bool LeafWalker::printAvro(void *address, avro_value_t *avrovalue) {
       return true;
   }
 }
+
+int LeafWalker::writeAvroDeep(int readerIndex, int readerSize, LeafDimension *dim, AvroEncoder &encoder) {
+  int dimSize = dim->size();
+
+  // Avro needs the number of items up front: as many as printAvroDeep would append, given
+  // that each item of this dimension consumes up to innerSize values from the reader
+  int innerSize = dim->next() == nullptr ? 1 : dim->next()->flatSize();
+  int remaining = readerSize - readerIndex;
+  int numItems;
+  if (remaining <= 0)
+    numItems = 0;
+  else if (innerSize <= 0)
+    numItems = dimSize;
+  else
+    numItems = std::min(dimSize, (remaining + innerSize - 1) / innerSize);
+
+  if (numItems > 0)
+    encoder.writeLong(numItems);
+  if (dim->next() == nullptr) {
+    if (!walker->writeAvroRun(readerArray, readerIndex, numItems, encoder))
+      return -1;
+    readerIndex += numItems;
+  }
+  else
+    for (int dimIndex = 0;  dimIndex < numItems;  dimIndex++) {
+      readerIndex = writeAvroDeep(readerIndex, readerSize, dim->next(), encoder);
+      if (readerIndex == -1)
+        return -1;
+    }
+  encoder.writeLong(0);
+
+  return readerIndex;
+}
+
+bool LeafWalker::writeAvro(void *address, AvroEncoder &encoder) {
+  if (address != nullptr)
+    return walker->writeAvro(address, encoder);
+  else
+    return writeAvroDeep(0, dims->flatSize(), dims, encoder) != -1;
+}
 #endif
 
 const void *LeafWalker::unpack(const void *address) {
@@ -2362,14 +2829,14 @@ int LeafWalker::copyToBufferDeep(void **ptr, void *limit, int readerIndex, int r
     *ptr = (void*)((size_t)(*ptr) + sizeof(int));
   }
 
-  for (int dimIndex = 0;  dimIndex < dimSize  &&  readerIndex < readerSize;  dimIndex++) {
-    if (dim->next() == nullptr) {
-      *ptr = walker->copyToBuffer(*ptr, limit, readerArray, readerIndex);
-      readerIndex += 1;
-    }
-    else
-      readerIndex = copyToBufferDeep(ptr, limit, readerIndex, readerSize, dim->next());
+  if (dim->next() == nullptr) {
+    int numItems = std::max(0, std::min(dimSize, readerSize - readerIndex));
+    *ptr = walker->copyRunToBuffer(*ptr, limit, readerArray, readerIndex, numItems);
+    readerIndex += numItems;
   }
+  else
+    for (int dimIndex = 0;  dimIndex < dimSize  &&  readerIndex < readerSize;  dimIndex++)
+      readerIndex = copyToBufferDeep(ptr, limit, readerIndex, readerSize, dim->next());
 
   return readerIndex;
 }
@@ -2377,8 +2844,10 @@ int LeafWalker::copyToBufferDeep(void **ptr, void *limit, int readerIndex, int r
 void *LeafWalker::copyToBuffer(void *ptr, void *limit, void *address) {
   if (address != nullptr)
     return walker->copyToBuffer(ptr, limit, address);
-  else
+  else {
     copyToBufferDeep(&ptr, limit, 0, dims->flatSize(), dims);
+    return ptr;
+  }
 }
 
 void LeafWalker::reset(TTreeReader *reader) {
@@ -2433,7 +2902,7 @@ void ReaderValueWalker::buildSchema(SchemaBuilder schemaBuilder, std::set<std::s
   walker->buildSchema(schemaBuilder, memo);
 }
 
-void ReaderValueWalker::printJSON(void *address, std::ostream &stream) {
+void ReaderValueWalker::printJSON(void *address, JSONWriter &stream) {
   stream << "\"" << fieldName << "\": ";
   walker->printJSON(address, stream);
 }
@@ -2442,6 +2911,10 @@ void ReaderValueWalker::printJSON(void *address, std::ostream &stream) {
 bool ReaderValueWalker::printAvro(void *address, avro_value_t *avrovalue) {
   return walker->printAvro(address, avrovalue);
 }
+
+bool ReaderValueWalker::writeAvro(void *address, AvroEncoder &encoder) {
+  return walker->writeAvro(address, encoder);
+}
 #endif
 
 const void *ReaderValueWalker::unpack(const void *address) {
@@ -2490,7 +2963,7 @@ void RawTBranchWalker::buildSchema(SchemaBuilder schemaBuilder, std::set<std::st
   walker->buildSchema(schemaBuilder, memo);
 }
 
-void RawTBranchWalker::printJSON(void *address, std::ostream &stream) {
+void RawTBranchWalker::printJSON(void *address, JSONWriter &stream) {
   stream << "\"" << fieldName << "\": ";
   walker->printJSON(address, stream);
 }
@@ -2499,6 +2972,10 @@ void RawTBranchWalker::printJSON(void *address, std::ostream &stream) {
 bool RawTBranchWalker::printAvro(void *address, avro_value_t *avrovalue) {
   return walker->printAvro(address, avrovalue);
 }
+
+bool RawTBranchWalker::writeAvro(void *address, AvroEncoder &encoder) {
+  return walker->writeAvro(address, encoder);
+}
 #endif
 
 const void *RawTBranchWalker::unpack(const void *address) {
@@ -2557,10 +3034,36 @@ void *RawTBranchTStringWalker::getAddress() {
   return data;
 }
 
+///////////////////////////////////////////////////////////////////// FormulaWalker
+
+FormulaWalker::FormulaWalker(std::string fieldName, std::string expression, TTreeReader *reader) :
+  RawTBranchWalker(fieldName, "double", new DoubleWalker(fieldName)),
+  expression(expression),
+  formula(new TTreeFormula(fieldName.c_str(), expression.c_str(), reader->GetTree())),
+  data(0.0) { }
+
+std::string FormulaWalker::repr(int indent, std::set<std::string> &memo) {
+  return std::string("\"") + fieldName + std::string("\": {\"extractor\": \"TTreeFormula\", \"expression\": \"") + escapedString(expression.c_str()) + std::string("\", \"type\": \"double\"}");
+}
+
+void FormulaWalker::reset(TTreeReader *reader) {
+  delete formula;
+  formula = new TTreeFormula(fieldName.c_str(), expression.c_str(), reader->GetTree());
+}
+
+void *FormulaWalker::getAddress() {
+  // the formula reads its own branches at the tree's current entry (set by the TTreeReader)
+  if (formula->GetNdata() > 0)
+    data = formula->EvalInstance(0);
+  else
+    data = 0.0;
+  return &data;
+}
+
 ///////////////////////////////////////////////////////////////////// TreeWalker
 
-TreeWalker::TreeWalker(std::string fileLocation, std::string treeLocation, std::string schemaName, std::string avroNamespace) :
-  fileLocation(fileLocation), treeLocation(treeLocation), schemaName(schemaName), avroNamespace(avroNamespace)
+TreeWalker::TreeWalker(std::string fileLocation, std::string treeLocation, std::string schemaName, std::string avroNamespace, std::vector<std::string> branches, std::vector<std::string> excludeBranches) :
+  fileLocation(fileLocation), treeLocation(treeLocation), schemaName(schemaName), avroNamespace(avroNamespace), branches(branches), excludeBranches(excludeBranches)
 {
   valid = tryToOpenFile();
   if (!valid) return;
@@ -2571,11 +3074,20 @@ TreeWalker::TreeWalker(std::string fileLocation, std::string treeLocation, std::
   for (TBranch *tbranch = (TBranch*)nextBranch();  tbranch != nullptr;  tbranch = (TBranch*)nextBranch()) {
     std::string branchName = tbranch->GetName();
     std::string className = std::string(tbranch->GetClassName());
+    if (!selected(branchName))
+      continue;
+    cachedBranches.push_back(branchName);
 
     if (className.empty()) {
       TIter nextLeaf = tbranch->GetListOfLeaves();
-      for (TLeaf *tleaf = (TLeaf*)nextLeaf();  tleaf != nullptr;  tleaf = (TLeaf*)nextLeaf())
+      for (TLeaf *tleaf = (TLeaf*)nextLeaf();  tleaf != nullptr;  tleaf = (TLeaf*)nextLeaf()) {
         fields.push_back(new LeafWalker(tleaf, ttree, reader));
+
+        // a variable-length leaf needs its counter's branch, even if that branch is not selected
+        TLeaf *counter = tleaf->GetLeafCount();
+        if (counter != nullptr)
+          addReadBranch(counter->GetBranch()->GetName());
+      }
     }
     else if (className == std::string("string"))
       fields.push_back(new RawTBranchStdStringWalker(branchName, reader));
@@ -2584,9 +3096,51 @@ TreeWalker::TreeWalker(std::string fileLocation, std::string treeLocation, std::
     else
       fields.push_back(new ReaderValueWalker(branchName, tbranch, reader, avroNamespace, defs));
   }
+
+  selectBranches();
+  configureCache();
 }
 
-bool TreeWalker::tryToOpenFile() {
+bool TreeWalker::selected(std::string branchName) {
+  bool out = branches.empty();
+  for (auto pattern = branches.begin();  !out  &&  pattern != branches.end();  ++pattern)
+    if (fnmatch(pattern->c_str(), branchName.c_str(), 0) == 0)
+      out = true;
+  for (auto pattern = excludeBranches.begin();  out  &&  pattern != excludeBranches.end();  ++pattern)
+    if (fnmatch(pattern->c_str(), branchName.c_str(), 0) == 0)
+      out = false;
+  return out;
+}
+
+void TreeWalker::addReadBranch(std::string branchName) {
+  if (std::find(cachedBranches.begin(), cachedBranches.end(), branchName) == cachedBranches.end())
+    cachedBranches.push_back(branchName);
+}
+
+void TreeWalker::addFormulaBranches(TTreeFormula *formula) {
+  for (int i = 0;  i < formula->GetNcodes();  i++) {
+    TLeaf *tleaf = formula->GetLeaf(i);
+    if (tleaf == nullptr) continue;
+    addReadBranch(tleaf->GetBranch()->GetMother()->GetName());
+    if (tleaf->GetLeafCount() != nullptr)
+      addReadBranch(tleaf->GetLeafCount()->GetBranch()->GetMother()->GetName());
+  }
+}
+
+void TreeWalker::selectBranches() {
+  // disable every branch that is not read, so that its baskets are never fetched or decompressed
+  if (branches.empty()  &&  excludeBranches.empty()) return;
+  TTree *ttree = reader->GetTree();
+  if (ttree == nullptr) return;
+
+  ttree->SetBranchStatus("*", false);
+  for (auto name = cachedBranches.begin();  name != cachedBranches.end();  ++name) {
+    ttree->SetBranchStatus(name->c_str(), true);
+    ttree->SetBranchStatus((*name + std::string(".*")).c_str(), true);
+  }
+}
+
+bool openTree(std::string fileLocation, std::string treeLocation, TFile *&file, TTreeReader *&reader, std::string &errorMessage) {
   file = TFile::Open(fileLocation.c_str());
   if (file == nullptr  ||  !file->IsOpen()) {
     errorMessage = std::string("File not found: ") + fileLocation;
@@ -2607,20 +3161,173 @@ bool TreeWalker::tryToOpenFile() {
   return true;
 }
 
+void warmFirstBaskets(TBranch *tbranch) {
+  if (tbranch->GetEntries() > 0)
+    tbranch->GetBasket(0);
+  TIter nextBranch = tbranch->GetListOfBranches();
+  for (TBranch *subbranch = (TBranch*)nextBranch();  subbranch != nullptr;  subbranch = (TBranch*)nextBranch())
+    warmFirstBaskets(subbranch);
+}
+
+OpenedFile *openFileAhead(std::string fileLocation, std::string treeLocation, std::vector<std::string> warmBranches) {
+  OpenedFile *out = new OpenedFile;
+  out->fileLocation = fileLocation;
+  out->valid = openTree(fileLocation, treeLocation, out->file, out->reader, out->errorMessage);
+
+  // read and decompress the first basket of each branch that will be walked
+  if (out->valid) {
+    TTree *ttree = out->reader->GetTree();
+    for (auto name = warmBranches.begin();  name != warmBranches.end();  ++name) {
+      TBranch *tbranch = ttree->GetBranch(name->c_str());
+      if (tbranch != nullptr)
+        warmFirstBaskets(tbranch);
+    }
+  }
+  return out;
+}
+
+bool TreeWalker::tryToOpenFile() {
+  return openTree(fileLocation, treeLocation, file, reader, errorMessage);
+}
+
+// ROOT I/O from more than one thread needs ROOT::EnableThreadSafety() to have been called first
+void TreeWalker::openAhead(std::string fileLocation) {
+  filesAhead.push_back(std::make_pair(fileLocation, std::async(std::launch::async, openFileAhead, fileLocation, treeLocation, cachedBranches)));
+}
+
+void TreeWalker::closeAhead() {
+  // wait for files still being opened in the background, so that none outlive this TreeWalker
+  for (auto ahead = filesAhead.begin();  ahead != filesAhead.end();  ++ahead) {
+    OpenedFile *opened = ahead->second.get();
+    delete opened->reader;
+    if (opened->file != nullptr) {
+      opened->file->Close();
+      delete opened->file;
+    }
+    delete opened;
+  }
+  filesAhead.clear();
+}
+
+TreeWalker::~TreeWalker() {
+  closeAhead();
+}
+
 void TreeWalker::reset(std::string fileLocation) {
   file->Close();
   delete file;
   delete this->reader;
 
   this->fileLocation = fileLocation;
-  valid = tryToOpenFile();
+
+  auto ahead = filesAhead.begin();
+  while (ahead != filesAhead.end()  &&  ahead->first != fileLocation)
+    ++ahead;
+
+  if (ahead != filesAhead.end()) {
+    // already opened in the background: just swap it in
+    OpenedFile *opened = ahead->second.get();
+    filesAhead.erase(ahead);
+    file = opened->file;
+    reader = opened->reader;
+    errorMessage = opened->errorMessage;
+    valid = opened->valid;
+    delete opened;
+  }
+  else
+    valid = tryToOpenFile();
   if (!valid) return;
 
+  selectBranches();
   for (auto iter = fields.begin();  iter != fields.end();  ++iter)
     (*iter)->reset(reader);
+
+  if (!cutExpression.empty()) {
+    delete cut;
+    cut = new TTreeFormula("cut", cutExpression.c_str(), reader->GetTree());
+  }
+
+  configureCache();
+
+  if (bulk != nullptr)
+    bulk->reset(reader->GetTree());
+
+  pendingEntry = -1;                 // entry numbers are per file
+}
+
+bool TreeWalker::addDefine(std::string name, std::string expression) {
+  FormulaWalker *walker = new FormulaWalker(name, expression, reader);
+  if (walker->formula->GetNdim() == 0) {
+    errorMessage = std::string("Could not compile --define expression for ") + name + std::string(": ") + expression;
+    delete walker;
+    return false;
+  }
+  fields.push_back(walker);
+  addFormulaBranches(walker->formula);
+  selectBranches();
+  configureCache();
+  return true;
+}
+
+bool TreeWalker::setCut(std::string expression) {
+  cutExpression = expression;
+  cut = new TTreeFormula("cut", expression.c_str(), reader->GetTree());
+  if (cut->GetNdim() == 0) {
+    errorMessage = std::string("Could not compile --cut expression: ") + expression;
+    return false;
+  }
+  addFormulaBranches(cut);
+  selectBranches();
+  configureCache();
+  return true;
+}
+
+bool TreeWalker::passesCut() {
+  // an entry passes if any instance of the (possibly array-valued) expression is nonzero
+  if (cut == nullptr) return true;
+  int numInstances = cut->GetNdata();
+  for (int i = 0;  i < numInstances;  i++)
+    if (cut->EvalInstance(i) != 0.0)
+      return true;
+  return false;
+}
+
+void TreeWalker::setCache(int64_t cacheSize, int cacheLearnEntries, bool prefetch) {
+  this->cacheSize = cacheSize;
+  this->cacheLearnEntries = cacheLearnEntries;
+  this->prefetch = prefetch;
+  if (valid)
+    configureCache();
+}
+
+void TreeWalker::configureCache() {
+  // A TTreeCache belongs to one TFile, so each new file gets a new one, but with the
+  // branch list already known it can skip the learning phase and fill from the first read.
+  TTree *ttree = reader->GetTree();
+  if (ttree == nullptr) return;
+
+  if (cacheSize == 0) {
+    ttree->SetCacheSize(0);
+    return;
+  }
+  ttree->SetCacheSize(cacheSize);
+
+  for (auto name = cachedBranches.begin();  name != cachedBranches.end();  ++name)
+    ttree->AddBranchToCache(name->c_str(), true);
+
+  if (cacheLearnEntries > 0)
+    ttree->SetCacheLearnEntries(cacheLearnEntries);
+  else
+    ttree->StopCacheLearningPhase();
+
+  TTreeCache *cache = ttree->GetReadCache(file);
+  if (cache != nullptr)
+    cache->SetEnablePrefetching(prefetch);
 }
 
 bool TreeWalker::next() {
+  if (bulk != nullptr)
+    return bulk->setEntry(bulk->entry + 1);
   return reader->Next();
 }
 
@@ -2629,7 +3336,23 @@ long TreeWalker::numEntriesInCurrentTree() {
 }
 
 void TreeWalker::setEntryInCurrentTree(long entry) {
-  reader->SetEntry(entry);
+  if (bulk != nullptr)
+    bulk->setEntry(entry);
+  else
+    reader->SetEntry(entry);
+}
+
+bool TreeWalker::enableBulk() {
+  if (!bulkReadable(this, errorMessage))
+    return false;
+  bulk = new BulkReader(this);
+  return true;
+}
+
+void *TreeWalker::fieldAddress(size_t index) {
+  if (bulk != nullptr)
+    return bulk->address(index);
+  return fields[index]->getAddress();
 }
 
 bool TreeWalker::resolved() {
@@ -2657,14 +3380,29 @@ std::string TreeWalker::repr() {
   return out;
 }
 
+void TreeWalker::printFieldJSON(size_t index, JSONWriter &stream) {
+  if (index < jitJSON.size()  &&  jitJSON[index] != nullptr)
+    jitJSON[index](fieldAddress(index), stream);
+  else if (index < programs.size()  &&  programs[index] != nullptr)
+    programs[index]->printJSON(fieldAddress(index), stream);
+  else
+    fields[index]->printJSON(fieldAddress(index), stream);
+}
+
 void TreeWalker::printJSON() {
-  std::cout << "{";
-  bool first = true;
-  for (auto iter = fields.begin();  iter != fields.end();  ++iter) {
-    if (first) first = false; else std::cout << ", ";
-    (*iter)->printJSON((*iter)->getAddress(), std::cout);
+  json << "{";
+  for (size_t i = 0;  i < fields.size();  i++) {
+    if (i > 0) json << ", ";
+    printFieldJSON(i, json);
   }
-  std::cout << "}" << std::endl;
+  json << "}\n";
+  if (json.size() >= 1048576)        // write out in big blocks, not one entry at a time
+    json.flush(stdout);
+}
+
+void TreeWalker::flushJSON() {
+  json.flush(stdout);
+  fflush(stdout);
 }
 
 void TreeWalker::buildSchema(SchemaBuilder schemaBuilder) {
@@ -2687,15 +3425,14 @@ void TreeWalker::buildSchema(SchemaBuilder schemaBuilder) {
 }
 
 std::string TreeWalker::stringJSON() {
-  std::ostringstream stream;
+  JSONWriter stream(0);
   stream << "{";
-  bool first = true;
-  for (auto iter = fields.begin();  iter != fields.end();  ++iter) {
-    if (first) first = false; else stream << ", ";
-    (*iter)->printJSON((*iter)->getAddress(), stream);
+  for (size_t i = 0;  i < fields.size();  i++) {
+    if (i > 0) stream << ", ";
+    printFieldJSON(i, stream);
   }
-  stream << "}" << std::endl;
-  return stream.str();
+  stream << "}\n";
+  return stream.buffer;
 }
 
 #ifdef AVRO
@@ -2723,8 +3460,8 @@ std::string TreeWalker::avroSchema() {
   return out;
 }
 
-bool TreeWalker::printAvroHeaderOnce(std::string &codec, int blockSize, bool stream) {
-  if (!avroHeaderPrinted) {
+bool TreeWalker::prepareAvro() {
+  if (!avroPrepared) {
     std::string schemastr = avroSchema();
 
     avro_schema_error_t schemaError;
@@ -2750,6 +3487,16 @@ bool TreeWalker::printAvroHeaderOnce(std::string &codec, int blockSize, bool str
         return false;
       }
 
+    avroPrepared = true;
+  }
+  return true;
+}
+
+bool TreeWalker::printAvroHeaderOnce(std::string &codec, int blockSize, bool stream) {
+  if (!avroHeaderPrinted) {
+    if (!prepareAvro())
+      return false;
+
     if (stream) {
       avro_schema_error_t schemaError;
       if (avro_schema_from_json("{\"type\":\"long\"}", 15, &entrySchema, &schemaError) != 0) {
@@ -2783,19 +3530,44 @@ bool TreeWalker::printAvroHeaderOnce(std::string &codec, int blockSize, bool str
   return true;
 }
 
-bool TreeWalker::printAvro(bool stream, uint64_t currentEntry) {
-  for (auto iter = fields.begin();  iter != fields.end();  ++iter)
-    if (!(*iter)->printAvro((*iter)->getAddress(), &(*iter)->avroValue)) {
+bool TreeWalker::fillAvro() {
+  for (size_t i = 0;  i < fields.size();  i++)
+    if (!fields[i]->printAvro(fieldAddress(i), &fields[i]->avroValue)) {
       std::cerr << avro_strerror() << std::endl;
       return false;
     }
-  if (stream) {
-    avro_value_set_long(&avroEntryValue, currentEntry);
-    avro_value_write(avro_writer_file(stdout), &avroEntryValue);
-    avro_value_write(avro_writer_file(stdout), &avroValue);
-  }
+  return true;
+}
+
+bool TreeWalker::writeFieldAvro(size_t index, AvroEncoder &encoder) {
+  if (index < jitAvro.size()  &&  jitAvro[index] != nullptr)
+    return jitAvro[index](fieldAddress(index), &encoder);
+  else if (index < programs.size()  &&  programs[index] != nullptr)
+    return programs[index]->writeAvro(fieldAddress(index), encoder);
   else
-    avro_file_writer_append_value(avroWriter, &avroValue);
+    return fields[index]->writeAvro(fieldAddress(index), encoder);
+}
+
+bool TreeWalker::writeAvro(AvroEncoder &encoder) {
+  for (size_t i = 0;  i < fields.size();  i++)
+    if (!writeFieldAvro(i, encoder))
+      return false;
+  return true;
+}
+
+bool TreeWalker::printAvro(bool stream, uint64_t currentEntry) {
+  // encoded directly from the walkers; fillAvro() builds the equivalent avro-c value
+  avroEncoder.clear();
+  if (stream)
+    avroEncoder.writeLong(currentEntry);
+  if (!writeAvro(avroEncoder))
+    return false;
+  if (stream)
+    fwrite(avroEncoder.buffer, 1, avroEncoder.size, stdout);
+  else if (avro_file_writer_append_encoded(avroWriter, avroEncoder.buffer, avroEncoder.size) != 0) {
+    std::cerr << avro_strerror() << std::endl;
+    return false;
+  }
   return true;
 }
 
@@ -2810,8 +3582,60 @@ int TreeWalker::getDataSize(const void *address) {
 }
 
 const void *TreeWalker::getData(const void *address, int index) {
-  ExtractableWalker *field = fields[index];
-  return field->unpack(field->getAddress());
+  return fields[index]->unpack(fieldAddress(index));
+}
+
+void *TreeWalker::copyFieldToBuffer(size_t index, void *ptr, void *limit) {
+  if (index < jitBuffer.size()  &&  jitBuffer[index] != nullptr)
+    return jitBuffer[index](ptr, limit, fieldAddress(index));
+  else if (index < programs.size()  &&  programs[index] != nullptr)
+    return programs[index]->copyToBuffer(ptr, limit, fieldAddress(index));
+  else
+    return fields[index]->copyToBuffer(ptr, limit, fieldAddress(index));
+}
+
+void *TreeWalker::copyEntryToBuffer(int64_t entry, void *ptr, void *limit) {
+  if (entry == pendingEntry) {
+    // serialized by the call that found it didn't fit; it's still good
+    if (ptr == nullptr  ||  (size_t)limit - (size_t)ptr < pendingSize)
+      return nullptr;
+    memcpy(ptr, pending, pendingSize);
+    pendingEntry = -1;
+    return (void*)((size_t)ptr + pendingSize);
+  }
+
+  setEntryInCurrentTree(entry);
+  for (size_t j = 0;  j < fields.size();  j++)
+    ptr = copyFieldToBuffer(j, ptr, limit);
+  return ptr;
+}
+
+void TreeWalker::holdPending(int64_t entry, size_t room) {
+  // the entry is still the current one: serialize it once more, into a buffer of our own
+  // that grows until it fits, so that its exact size is known and its bytes can be reused
+  if (entry != pendingEntry) {
+    size_t capacity = std::max(pendingCapacity, std::max(2 * room, (size_t)1024));
+    while (true) {
+      if (pendingCapacity < capacity) {
+        ::operator delete(pending);
+        pending = ::operator new(capacity);
+        pendingCapacity = capacity;
+      }
+      void *ptr = pending;
+      void *limit = (void*)((size_t)pending + pendingCapacity);
+      for (size_t j = 0;  j < fields.size();  j++)
+        ptr = copyFieldToBuffer(j, ptr, limit);
+      if (ptr != nullptr) {
+        pendingSize = (size_t)ptr - (size_t)pending;
+        break;
+      }
+      capacity = 2 * pendingCapacity;
+    }
+    pendingEntry = entry;
+  }
+
+  // its status byte, its data, and the byte kept at the end of every buffer
+  sizeNeeded = sizeof(char) + pendingSize + sizeof(char);
 }
 
 size_t TreeWalker::copyToBuffer(int64_t entry, int microBatchSize, void *buffer, size_t size) {
@@ -2827,50 +3651,63 @@ size_t TreeWalker::copyToBuffer(int64_t entry, int microBatchSize, void *buffer,
     nanosleep(&req, &rem);  // nanosleep (even with 0 ns) keeps the poll from taking 100% CPU
   }
 
+  // Entries are committed one at a time: if one doesn't fit, the ones before it are left
+  // as they are (StatusReading), it is marked StatusTooSmall, and sizeNeeded says how big a
+  // buffer the next call (starting with that entry) needs. The last byte is never used for
+  // data so that there is always room for that marker.
   void *ptr = buffer;
-  void *limit = (void*)((size_t)buffer + size);
- 
+  void *limit = (void*)((size_t)buffer + size - sizeof(char));
+  entriesCopied = 0;
+  sizeNeeded = 0;
+
   void *beginningOfRecord = ptr;
   for (int i = 0;  i < microBatchSize;  i++) {
     beginningOfRecord = ptr;
-    ptr = (void*)((size_t)ptr + sizeof(char));
-
-    reader->SetEntry(entry + i);
+    if ((size_t)ptr < (size_t)limit)
+      ptr = (void*)((size_t)ptr + sizeof(char));
+    else
+      ptr = nullptr;                 // only the status byte fits
 
-    for (auto iter = fields.begin();  iter != fields.end();  ++iter)
-      ptr = (*iter)->copyToBuffer(ptr, limit, (*iter)->getAddress());
+    ptr = copyEntryToBuffer(entry + i, ptr, limit);
 
     if (ptr == nullptr) {
+      holdPending(entry + i, size);
       *((char*)beginningOfRecord) = StatusTooSmall;
-      return 0;
+      return i == 0 ? 0 : (size_t)beginningOfRecord - (size_t)buffer - sizeof(char);
     }
-    else
+    else {
       *((char*)beginningOfRecord) = StatusReading;
+      entriesCopied++;
+    }
   }
 
   return (size_t)ptr - (size_t)buffer - sizeof(char);
 }
 
-void TreeWalker::dumpRaw(int64_t entry) {
+const void *TreeWalker::rawEntry(int64_t entry, size_t &size) {
   if (rawBuffer == nullptr)
     rawBuffer = ::operator new(rawBufferSize);
 
   ((char*)(rawBuffer))[0] = StatusWriting;
+  size = copyToBuffer(entry, 1, rawBuffer, rawBufferSize);
 
-  size_t size = 0;
-
-  while (((char*)(rawBuffer))[0] != StatusReading) {
+  if (((char*)(rawBuffer))[0] == StatusTooSmall) {
+    // grow once, to at least the exact size; the entry's bytes are copied, not walked again
+    ::operator delete(rawBuffer);
+    rawBufferSize = std::max(2 * rawBufferSize, sizeNeeded);
+    rawBuffer = ::operator new(rawBufferSize);
+    ((char*)(rawBuffer))[0] = StatusWriting;
     size = copyToBuffer(entry, 1, rawBuffer, rawBufferSize);
-    if (((char*)(rawBuffer))[0] == StatusTooSmall) {
-      ::operator delete(rawBuffer);
-      rawBufferSize *= 2;
-      rawBuffer = ::operator new(rawBufferSize);
-      ((char*)(rawBuffer))[0] = StatusWriting;
-    }
   }
 
+  return (void*)((size_t)rawBuffer + sizeof(char));
+}
+
+void TreeWalker::dumpRaw(int64_t entry) {
+  size_t size;
+  const void *data = rawEntry(entry, size);
   fwrite(&entry, sizeof(entry), 1, stdout);
-  fwrite((void*)((size_t)rawBuffer + sizeof(char)), 1, size, stdout);
+  fwrite(data, 1, size, stdout);
 }
 
 void resetSignals() {
@@ -16,9 +16,13 @@
 #define DATAWALKER_H
 
 // C includes
+#include <fnmatch.h>
 #include <time.h>
 
 // C++ includes
+#include <algorithm>
+#include <deque>
+#include <future>
 #include <iomanip>
 #include <iostream>
 #include <map>
@@ -28,9 +32,12 @@
 #include <typeinfo>
 #include <vector>
 
+#include "jsonWriter.h"
+
 // Avro includes
 #ifdef AVRO
 #include <avro.h>
+#include "avroEncoder.h"
 #endif
 
 // ROOT includes
@@ -53,11 +60,14 @@
 #include <TLeafS.h>
 #include <TList.h>
 #include <TObjArray.h>
+#include <TROOT.h>
 #include <TRefArray.h>
 #include <TRef.h>
 #include <TString.h>
 #include <TSystem.h>
+#include <TTreeCache.h>
 #include <TTree.h>
+#include <TTreeFormula.h>
 #include <TTreeReaderArray.h>
 #include <TTreeReader.h>
 #include <TTreeReaderValue.h>
@@ -116,7 +126,7 @@ public:
   std::string fieldName;
   std::string typeName;
   FieldWalker(std::string fieldName, std::string typeName);
-  void printEscapedString(const char *string, std::ostream &stream);
+  void printEscapedString(const char *string, JSONWriter &stream);
   std::string escapedString(const char *string);
   virtual size_t sizeOf() = 0;
   virtual const std::type_info *typeId() = 0;
@@ -128,9 +138,10 @@ public:
   virtual std::string avroTypeName() = 0;
   virtual std::string avroSchema(int indent, std::set<std::string> &memo) = 0;
   virtual void buildSchema(SchemaBuilder schemaBuilder, std::set<std::string> &memo) = 0;
-  virtual void printJSON(void *address, std::ostream &stream) = 0;
+  virtual void printJSON(void *address, JSONWriter &stream) = 0;
 #ifdef AVRO
   virtual bool printAvro(void *address, avro_value_t *avrovalue) = 0;
+  virtual bool writeAvro(void *address, AvroEncoder &encoder) = 0;
 #endif
   virtual const void *unpack(const void *address) = 0;
   virtual void *copyToBuffer(void *ptr, void *limit, void *address) = 0;
@@ -147,11 +158,13 @@ public:
   std::string repr(int indent, std::set<std::string> &memo);
   std::string avroSchema(int indent, std::set<std::string> &memo);
   virtual void buildSchema(SchemaBuilder schemaBuilder, std::set<std::string> &memo) = 0;
-  virtual void printJSON(void *address, std::ostream &stream) = 0;
-  virtual void printJSON(TTreeReaderArrayBase *readerArrayBase, int i, std::ostream &stream) = 0;
+  virtual void printJSON(void *address, JSONWriter &stream) = 0;
+  virtual void printJSON(TTreeReaderArrayBase *readerArrayBase, int i, JSONWriter &stream) = 0;
 #ifdef AVRO
   virtual bool printAvro(void *address, avro_value_t *avrovalue) = 0;
+  virtual bool writeAvro(void *address, AvroEncoder &encoder) = 0;
   virtual bool printAvro(TTreeReaderArrayBase *readerArrayBase, int i, avro_value_t *avrovalue) = 0;
+  virtual bool writeAvro(TTreeReaderArrayBase *readerArrayBase, int i, AvroEncoder &encoder) = 0;
 #endif
   virtual const void *unpack(const void *address) = 0;
   virtual const void *unpack(TTreeReaderArrayBase *readerArrayBase, int i) = 0;
@@ -159,6 +172,16 @@ public:
   virtual void *copyToBuffer(void *ptr, void *limit, TTreeReaderArrayBase *readerArrayBase, int i) = 0;
   virtual TTreeReaderValueBase *readerValue(TTreeReader *reader) = 0;
   virtual TTreeReaderArrayBase *readerArray(TTreeReader *reader) = 0;
+
+  // numItems values, sizeOf() apart: the numbers override these with the bulk kernels in
+  // primitiveRuns.h; the TTreeReaderArray versions use them if the items are contiguous
+  virtual void *copyRunToBuffer(void *ptr, void *limit, const void *items, int numItems);
+  void *copyRunToBuffer(void *ptr, void *limit, TTreeReaderArrayBase *readerArrayBase, int i, int numItems);
+#ifdef AVRO
+  virtual bool writeAvroRun(const void *items, int numItems, AvroEncoder &encoder);
+  bool writeAvroRun(TTreeReaderArrayBase *readerArrayBase, int i, int numItems, AvroEncoder &encoder);
+#endif
+  const void *contiguous(TTreeReaderArrayBase *readerArrayBase, int i, int numItems);
 };
 
 class BoolWalker : public PrimitiveWalker {
@@ -168,11 +191,13 @@ public:
   const std::type_info *typeId();
   std::string avroTypeName();
   void buildSchema(SchemaBuilder schemaBuilder, std::set<std::string> &memo);
-  void printJSON(void *address, std::ostream &stream);
-  void printJSON(TTreeReaderArrayBase *readerArrayBase, int i, std::ostream &stream);
+  void printJSON(void *address, JSONWriter &stream);
+  void printJSON(TTreeReaderArrayBase *readerArrayBase, int i, JSONWriter &stream);
 #ifdef AVRO
   bool printAvro(void *address, avro_value_t *avrovalue);
+  bool writeAvro(void *address, AvroEncoder &encoder);
   bool printAvro(TTreeReaderArrayBase *readerArrayBase, int i, avro_value_t *avrovalue);
+  bool writeAvro(TTreeReaderArrayBase *readerArrayBase, int i, AvroEncoder &encoder);
 #endif
   const void *unpack(const void *address);
   const void *unpack(TTreeReaderArrayBase *readerArrayBase, int i);
@@ -180,6 +205,10 @@ public:
   void *copyToBuffer(void *ptr, void *limit, TTreeReaderArrayBase *readerArrayBase, int i);
   TTreeReaderValueBase *readerValue(TTreeReader *reader);
   TTreeReaderArrayBase *readerArray(TTreeReader *reader);
+  void *copyRunToBuffer(void *ptr, void *limit, const void *items, int numItems);
+#ifdef AVRO
+  bool writeAvroRun(const void *items, int numItems, AvroEncoder &encoder);
+#endif
 };
 
 class CharWalker : public PrimitiveWalker {
@@ -189,11 +218,13 @@ public:
   const std::type_info *typeId();
   std::string avroTypeName();
   void buildSchema(SchemaBuilder schemaBuilder, std::set<std::string> &memo);
-  void printJSON(void *address, std::ostream &stream);
-  void printJSON(TTreeReaderArrayBase *readerArrayBase, int i, std::ostream &stream);
+  void printJSON(void *address, JSONWriter &stream);
+  void printJSON(TTreeReaderArrayBase *readerArrayBase, int i, JSONWriter &stream);
 #ifdef AVRO
   bool printAvro(void *address, avro_value_t *avrovalue);
+  bool writeAvro(void *address, AvroEncoder &encoder);
   bool printAvro(TTreeReaderArrayBase *readerArrayBase, int i, avro_value_t *avrovalue);
+  bool writeAvro(TTreeReaderArrayBase *readerArrayBase, int i, AvroEncoder &encoder);
 #endif
   const void *unpack(const void *address);
   const void *unpack(TTreeReaderArrayBase *readerArrayBase, int i);
@@ -201,6 +232,10 @@ public:
   void *copyToBuffer(void *ptr, void *limit, TTreeReaderArrayBase *readerArrayBase, int i);
   TTreeReaderValueBase *readerValue(TTreeReader *reader);
   TTreeReaderArrayBase *readerArray(TTreeReader *reader);
+  void *copyRunToBuffer(void *ptr, void *limit, const void *items, int numItems);
+#ifdef AVRO
+  bool writeAvroRun(const void *items, int numItems, AvroEncoder &encoder);
+#endif
 };
 
 class UCharWalker : public PrimitiveWalker {
@@ -210,11 +245,13 @@ public:
   const std::type_info *typeId();
   std::string avroTypeName();
   void buildSchema(SchemaBuilder schemaBuilder, std::set<std::string> &memo);
-  void printJSON(void *address, std::ostream &stream);
-  void printJSON(TTreeReaderArrayBase *readerArrayBase, int i, std::ostream &stream);
+  void printJSON(void *address, JSONWriter &stream);
+  void printJSON(TTreeReaderArrayBase *readerArrayBase, int i, JSONWriter &stream);
 #ifdef AVRO
   bool printAvro(void *address, avro_value_t *avrovalue);
+  bool writeAvro(void *address, AvroEncoder &encoder);
   bool printAvro(TTreeReaderArrayBase *readerArrayBase, int i, avro_value_t *avrovalue);
+  bool writeAvro(TTreeReaderArrayBase *readerArrayBase, int i, AvroEncoder &encoder);
 #endif
   const void *unpack(const void *address);
   const void *unpack(TTreeReaderArrayBase *readerArrayBase, int i);
@@ -222,6 +259,10 @@ public:
   void *copyToBuffer(void *ptr, void *limit, TTreeReaderArrayBase *readerArrayBase, int i);
   TTreeReaderValueBase *readerValue(TTreeReader *reader);
   TTreeReaderArrayBase *readerArray(TTreeReader *reader);
+  void *copyRunToBuffer(void *ptr, void *limit, const void *items, int numItems);
+#ifdef AVRO
+  bool writeAvroRun(const void *items, int numItems, AvroEncoder &encoder);
+#endif
 };
 
 class ShortWalker : public PrimitiveWalker {
@@ -231,11 +272,13 @@ public:
   const std::type_info *typeId();
   std::string avroTypeName();
   void buildSchema(SchemaBuilder schemaBuilder, std::set<std::string> &memo);
-  void printJSON(void *address, std::ostream &stream);
-  void printJSON(TTreeReaderArrayBase *readerArrayBase, int i, std::ostream &stream);
+  void printJSON(void *address, JSONWriter &stream);
+  void printJSON(TTreeReaderArrayBase *readerArrayBase, int i, JSONWriter &stream);
 #ifdef AVRO
   bool printAvro(void *address, avro_value_t *avrovalue);
+  bool writeAvro(void *address, AvroEncoder &encoder);
   bool printAvro(TTreeReaderArrayBase *readerArrayBase, int i, avro_value_t *avrovalue);
+  bool writeAvro(TTreeReaderArrayBase *readerArrayBase, int i, AvroEncoder &encoder);
 #endif
   const void *unpack(const void *address);
   const void *unpack(TTreeReaderArrayBase *readerArrayBase, int i);
@@ -243,6 +286,10 @@ public:
   void *copyToBuffer(void *ptr, void *limit, TTreeReaderArrayBase *readerArrayBase, int i);
   TTreeReaderValueBase *readerValue(TTreeReader *reader);
   TTreeReaderArrayBase *readerArray(TTreeReader *reader);
+  void *copyRunToBuffer(void *ptr, void *limit, const void *items, int numItems);
+#ifdef AVRO
+  bool writeAvroRun(const void *items, int numItems, AvroEncoder &encoder);
+#endif
 };
 
 class UShortWalker : public PrimitiveWalker {
@@ -252,11 +299,13 @@ public:
   const std::type_info *typeId();
   std::string avroTypeName();
   void buildSchema(SchemaBuilder schemaBuilder, std::set<std::string> &memo);
-  void printJSON(void *address, std::ostream &stream);
-  void printJSON(TTreeReaderArrayBase *readerArrayBase, int i, std::ostream &stream);
+  void printJSON(void *address, JSONWriter &stream);
+  void printJSON(TTreeReaderArrayBase *readerArrayBase, int i, JSONWriter &stream);
 #ifdef AVRO
   bool printAvro(void *address, avro_value_t *avrovalue);
+  bool writeAvro(void *address, AvroEncoder &encoder);
   bool printAvro(TTreeReaderArrayBase *readerArrayBase, int i, avro_value_t *avrovalue);
+  bool writeAvro(TTreeReaderArrayBase *readerArrayBase, int i, AvroEncoder &encoder);
 #endif
   const void *unpack(const void *address);
   const void *unpack(TTreeReaderArrayBase *readerArrayBase, int i);
@@ -264,6 +313,10 @@ public:
   void *copyToBuffer(void *ptr, void *limit, TTreeReaderArrayBase *readerArrayBase, int i);
   TTreeReaderValueBase *readerValue(TTreeReader *reader);
   TTreeReaderArrayBase *readerArray(TTreeReader *reader);
+  void *copyRunToBuffer(void *ptr, void *limit, const void *items, int numItems);
+#ifdef AVRO
+  bool writeAvroRun(const void *items, int numItems, AvroEncoder &encoder);
+#endif
 };
 
 class IntWalker : public PrimitiveWalker {
@@ -273,11 +326,13 @@ public:
   const std::type_info *typeId();
   std::string avroTypeName();
   void buildSchema(SchemaBuilder schemaBuilder, std::set<std::string> &memo);
-  void printJSON(void *address, std::ostream &stream);
-  void printJSON(TTreeReaderArrayBase *readerArrayBase, int i, std::ostream &stream);
+  void printJSON(void *address, JSONWriter &stream);
+  void printJSON(TTreeReaderArrayBase *readerArrayBase, int i, JSONWriter &stream);
 #ifdef AVRO
   bool printAvro(void *address, avro_value_t *avrovalue);
+  bool writeAvro(void *address, AvroEncoder &encoder);
   bool printAvro(TTreeReaderArrayBase *readerArrayBase, int i, avro_value_t *avrovalue);
+  bool writeAvro(TTreeReaderArrayBase *readerArrayBase, int i, AvroEncoder &encoder);
 #endif
   const void *unpack(const void *address);
   const void *unpack(TTreeReaderArrayBase *readerArrayBase, int i);
@@ -285,6 +340,10 @@ public:
   void *copyToBuffer(void *ptr, void *limit, TTreeReaderArrayBase *readerArrayBase, int i);
   TTreeReaderValueBase *readerValue(TTreeReader *reader);
   TTreeReaderArrayBase *readerArray(TTreeReader *reader);
+  void *copyRunToBuffer(void *ptr, void *limit, const void *items, int numItems);
+#ifdef AVRO
+  bool writeAvroRun(const void *items, int numItems, AvroEncoder &encoder);
+#endif
   int value(TTreeReaderValueBase *readerValue);
 };
 
@@ -295,11 +354,13 @@ public:
   const std::type_info *typeId();
   std::string avroTypeName();
   void buildSchema(SchemaBuilder schemaBuilder, std::set<std::string> &memo);
-  void printJSON(void *address, std::ostream &stream);
-  void printJSON(TTreeReaderArrayBase *readerArrayBase, int i, std::ostream &stream);
+  void printJSON(void *address, JSONWriter &stream);
+  void printJSON(TTreeReaderArrayBase *readerArrayBase, int i, JSONWriter &stream);
 #ifdef AVRO
   bool printAvro(void *address, avro_value_t *avrovalue);
+  bool writeAvro(void *address, AvroEncoder &encoder);
   bool printAvro(TTreeReaderArrayBase *readerArrayBase, int i, avro_value_t *avrovalue);
+  bool writeAvro(TTreeReaderArrayBase *readerArrayBase, int i, AvroEncoder &encoder);
 #endif
   const void *unpack(const void *address);
   const void *unpack(TTreeReaderArrayBase *readerArrayBase, int i);
@@ -307,6 +368,10 @@ public:
   void *copyToBuffer(void *ptr, void *limit, TTreeReaderArrayBase *readerArrayBase, int i);
   TTreeReaderValueBase *readerValue(TTreeReader *reader);
   TTreeReaderArrayBase *readerArray(TTreeReader *reader);
+  void *copyRunToBuffer(void *ptr, void *limit, const void *items, int numItems);
+#ifdef AVRO
+  bool writeAvroRun(const void *items, int numItems, AvroEncoder &encoder);
+#endif
 };
 
 class LongWalker : public PrimitiveWalker {
@@ -316,11 +381,13 @@ public:
   const std::type_info *typeId();
   std::string avroTypeName();
   void buildSchema(SchemaBuilder schemaBuilder, std::set<std::string> &memo);
-  void printJSON(void *address, std::ostream &stream);
-  void printJSON(TTreeReaderArrayBase *readerArrayBase, int i, std::ostream &stream);
+  void printJSON(void *address, JSONWriter &stream);
+  void printJSON(TTreeReaderArrayBase *readerArrayBase, int i, JSONWriter &stream);
 #ifdef AVRO
   bool printAvro(void *address, avro_value_t *avrovalue);
+  bool writeAvro(void *address, AvroEncoder &encoder);
   bool printAvro(TTreeReaderArrayBase *readerArrayBase, int i, avro_value_t *avrovalue);
+  bool writeAvro(TTreeReaderArrayBase *readerArrayBase, int i, AvroEncoder &encoder);
 #endif
   const void *unpack(const void *address);
   const void *unpack(TTreeReaderArrayBase *readerArrayBase, int i);
@@ -328,6 +395,10 @@ public:
   void *copyToBuffer(void *ptr, void *limit, TTreeReaderArrayBase *readerArrayBase, int i);
   TTreeReaderValueBase *readerValue(TTreeReader *reader);
   TTreeReaderArrayBase *readerArray(TTreeReader *reader);
+  void *copyRunToBuffer(void *ptr, void *limit, const void *items, int numItems);
+#ifdef AVRO
+  bool writeAvroRun(const void *items, int numItems, AvroEncoder &encoder);
+#endif
 };
 
 class ULongWalker : public PrimitiveWalker {
@@ -337,11 +408,13 @@ public:
   const std::type_info *typeId();
   std::string avroTypeName();
   void buildSchema(SchemaBuilder schemaBuilder, std::set<std::string> &memo);
-  void printJSON(void *address, std::ostream &stream);
-  void printJSON(TTreeReaderArrayBase *readerArrayBase, int i, std::ostream &stream);
+  void printJSON(void *address, JSONWriter &stream);
+  void printJSON(TTreeReaderArrayBase *readerArrayBase, int i, JSONWriter &stream);
 #ifdef AVRO
   bool printAvro(void *address, avro_value_t *avrovalue);
+  bool writeAvro(void *address, AvroEncoder &encoder);
   bool printAvro(TTreeReaderArrayBase *readerArrayBase, int i, avro_value_t *avrovalue);
+  bool writeAvro(TTreeReaderArrayBase *readerArrayBase, int i, AvroEncoder &encoder);
 #endif
   const void *unpack(const void *address);
   const void *unpack(TTreeReaderArrayBase *readerArrayBase, int i);
@@ -349,6 +422,10 @@ public:
   void *copyToBuffer(void *ptr, void *limit, TTreeReaderArrayBase *readerArrayBase, int i);
   TTreeReaderValueBase *readerValue(TTreeReader *reader);
   TTreeReaderArrayBase *readerArray(TTreeReader *reader);
+  void *copyRunToBuffer(void *ptr, void *limit, const void *items, int numItems);
+#ifdef AVRO
+  bool writeAvroRun(const void *items, int numItems, AvroEncoder &encoder);
+#endif
 };
 
 class FloatWalker : public PrimitiveWalker {
@@ -358,11 +435,13 @@ public:
   const std::type_info *typeId();
   std::string avroTypeName();
   void buildSchema(SchemaBuilder schemaBuilder, std::set<std::string> &memo);
-  void printJSON(void *address, std::ostream &stream);
-  void printJSON(TTreeReaderArrayBase *readerArrayBase, int i, std::ostream &stream);
+  void printJSON(void *address, JSONWriter &stream);
+  void printJSON(TTreeReaderArrayBase *readerArrayBase, int i, JSONWriter &stream);
 #ifdef AVRO
   bool printAvro(void *address, avro_value_t *avrovalue);
+  bool writeAvro(void *address, AvroEncoder &encoder);
   bool printAvro(TTreeReaderArrayBase *readerArrayBase, int i, avro_value_t *avrovalue);
+  bool writeAvro(TTreeReaderArrayBase *readerArrayBase, int i, AvroEncoder &encoder);
 #endif
   const void *unpack(const void *address);
   const void *unpack(TTreeReaderArrayBase *readerArrayBase, int i);
@@ -370,6 +449,10 @@ public:
   void *copyToBuffer(void *ptr, void *limit, TTreeReaderArrayBase *readerArrayBase, int i);
   TTreeReaderValueBase *readerValue(TTreeReader *reader);
   TTreeReaderArrayBase *readerArray(TTreeReader *reader);
+  void *copyRunToBuffer(void *ptr, void *limit, const void *items, int numItems);
+#ifdef AVRO
+  bool writeAvroRun(const void *items, int numItems, AvroEncoder &encoder);
+#endif
 };
 
 class DoubleWalker : public PrimitiveWalker {
@@ -379,11 +462,13 @@ public:
   const std::type_info *typeId();
   std::string avroTypeName();
   void buildSchema(SchemaBuilder schemaBuilder, std::set<std::string> &memo);
-  void printJSON(void *address, std::ostream &stream);
-  void printJSON(TTreeReaderArrayBase *readerArrayBase, int i, std::ostream &stream);
+  void printJSON(void *address, JSONWriter &stream);
+  void printJSON(TTreeReaderArrayBase *readerArrayBase, int i, JSONWriter &stream);
 #ifdef AVRO
   bool printAvro(void *address, avro_value_t *avrovalue);
+  bool writeAvro(void *address, AvroEncoder &encoder);
   bool printAvro(TTreeReaderArrayBase *readerArrayBase, int i, avro_value_t *avrovalue);
+  bool writeAvro(TTreeReaderArrayBase *readerArrayBase, int i, AvroEncoder &encoder);
 #endif
   const void *unpack(const void *address);
   const void *unpack(TTreeReaderArrayBase *readerArrayBase, int i);
@@ -391,6 +476,10 @@ public:
   void *copyToBuffer(void *ptr, void *limit, TTreeReaderArrayBase *readerArrayBase, int i);
   TTreeReaderValueBase *readerValue(TTreeReader *reader);
   TTreeReaderArrayBase *readerArray(TTreeReader *reader);
+  void *copyRunToBuffer(void *ptr, void *limit, const void *items, int numItems);
+#ifdef AVRO
+  bool writeAvroRun(const void *items, int numItems, AvroEncoder &encoder);
+#endif
 };
 
 ///////////////////////////////////////////////////////////////////// AnyStringWalkers
@@ -413,11 +502,13 @@ public:
   size_t sizeOf();
   const std::type_info *typeId();
   void buildSchema(SchemaBuilder schemaBuilder, std::set<std::string> &memo);
-  void printJSON(void *address, std::ostream &stream);
-  void printJSON(TTreeReaderArrayBase *readerArrayBase, int i, std::ostream &stream);
+  void printJSON(void *address, JSONWriter &stream);
+  void printJSON(TTreeReaderArrayBase *readerArrayBase, int i, JSONWriter &stream);
 #ifdef AVRO
   bool printAvro(void *address, avro_value_t *avrovalue);
+  bool writeAvro(void *address, AvroEncoder &encoder);
   bool printAvro(TTreeReaderArrayBase *readerArrayBase, int i, avro_value_t *avrovalue);
+  bool writeAvro(TTreeReaderArrayBase *readerArrayBase, int i, AvroEncoder &encoder);
 #endif
   const void *unpack(const void *address);
   const void *unpack(TTreeReaderArrayBase *readerArrayBase, int i);
@@ -433,11 +524,13 @@ public:
   size_t sizeOf();
   const std::type_info *typeId();
   void buildSchema(SchemaBuilder schemaBuilder, std::set<std::string> &memo);
-  void printJSON(void *address, std::ostream &stream);
-  void printJSON(TTreeReaderArrayBase *readerArrayBase, int i, std::ostream &stream);
+  void printJSON(void *address, JSONWriter &stream);
+  void printJSON(TTreeReaderArrayBase *readerArrayBase, int i, JSONWriter &stream);
 #ifdef AVRO
   bool printAvro(void *address, avro_value_t *avrovalue);
+  bool writeAvro(void *address, AvroEncoder &encoder);
   bool printAvro(TTreeReaderArrayBase *readerArrayBase, int i, avro_value_t *avrovalue);
+  bool writeAvro(TTreeReaderArrayBase *readerArrayBase, int i, AvroEncoder &encoder);
 #endif
   const void *unpack(const void *address);
   const void *unpack(TTreeReaderArrayBase *readerArrayBase, int i);
@@ -453,11 +546,13 @@ public:
   size_t sizeOf();
   const std::type_info *typeId();
   void buildSchema(SchemaBuilder schemaBuilder, std::set<std::string> &memo);
-  void printJSON(void *address, std::ostream &stream);
-  void printJSON(TTreeReaderArrayBase *readerArrayBase, int i, std::ostream &stream);
+  void printJSON(void *address, JSONWriter &stream);
+  void printJSON(TTreeReaderArrayBase *readerArrayBase, int i, JSONWriter &stream);
 #ifdef AVRO
   bool printAvro(void *address, avro_value_t *avrovalue);
+  bool writeAvro(void *address, AvroEncoder &encoder);
   bool printAvro(TTreeReaderArrayBase *readerArrayBase, int i, avro_value_t *avrovalue);
+  bool writeAvro(TTreeReaderArrayBase *readerArrayBase, int i, AvroEncoder &encoder);
 #endif
   const void *unpack(const void *address);
   const void *unpack(TTreeReaderArrayBase *readerArrayBase, int i);
@@ -488,9 +583,10 @@ public:
   std::string avroTypeName();
   std::string avroSchema(int indent, std::set<std::string> &memo);
   void buildSchema(SchemaBuilder schemaBuilder, std::set<std::string> &memo);
-  void printJSON(void *address, std::ostream &stream);
+  void printJSON(void *address, JSONWriter &stream);
 #ifdef AVRO
   bool printAvro(void *address, avro_value_t *avrovalue);
+  bool writeAvro(void *address, AvroEncoder &encoder);
 #endif
   const void *unpack(const void *address);
   void *copyToBuffer(void *ptr, void *limit, void *address);
@@ -537,9 +633,10 @@ public:
   std::string reference(std::set<std::string> &memo);
   std::string avroSchema(int indent, std::set<std::string> &memo);
   void buildSchema(SchemaBuilder schemaBuilder, std::set<std::string> &memo);
-  void printJSON(void *address, std::ostream &stream);
+  void printJSON(void *address, JSONWriter &stream);
 #ifdef AVRO
   bool printAvro(void *address, avro_value_t *avrovalue);
+  bool writeAvro(void *address, AvroEncoder &encoder);
 #endif
   const void *unpack(const void *address);
   void *copyToBuffer(void *ptr, void *limit, void *address);
@@ -573,9 +670,10 @@ public:
   std::string avroTypeName();
   std::string avroSchema(int indent, std::set<std::string> &memo);
   void buildSchema(SchemaBuilder schemaBuilder, std::set<std::string> &memo);
-  void printJSON(void *address, std::ostream &stream);
+  void printJSON(void *address, JSONWriter &stream);
 #ifdef AVRO
   bool printAvro(void *address, avro_value_t *avrovalue);
+  bool writeAvro(void *address, AvroEncoder &encoder);
 #endif
   const void *unpack(const void *address);
   void *copyToBuffer(void *ptr, void *limit, void *address);
@@ -597,9 +695,10 @@ public:
   std::string avroTypeName();
   std::string avroSchema(int indent, std::set<std::string> &memo);
   void buildSchema(SchemaBuilder schemaBuilder, std::set<std::string> &memo);
-  void printJSON(void *address, std::ostream &stream);
+  void printJSON(void *address, JSONWriter &stream);
 #ifdef AVRO
   bool printAvro(void *address, avro_value_t *avrovalue);
+  bool writeAvro(void *address, AvroEncoder &encoder);
 #endif
   const void *unpack(const void *address);
   void *copyToBuffer(void *ptr, void *limit, void *address);
@@ -622,6 +721,7 @@ private:
   const std::type_info *typeId_;
 public:
   FieldWalker *walker;
+  PrimitiveWalker *primitive;        // walker, if its items can be handled as runs
   StdVectorWalkerDataProvider dataProvider;
 
   StdVectorWalker(std::string fieldName, std::string typeName, FieldWalker *walker);
@@ -634,9 +734,10 @@ public:
   std::string avroTypeName();
   std::string avroSchema(int indent, std::set<std::string> &memo);
   void buildSchema(SchemaBuilder schemaBuilder, std::set<std::string> &memo);
-  void printJSON(void *address, std::ostream &stream);
+  void printJSON(void *address, JSONWriter &stream);
 #ifdef AVRO
   bool printAvro(void *address, avro_value_t *avrovalue);
+  bool writeAvro(void *address, AvroEncoder &encoder);
 #endif
   const void *unpack(const void *address);
   void *copyToBuffer(void *ptr, void *limit, void *address);
@@ -672,9 +773,10 @@ public:
   std::string avroTypeName();
   std::string avroSchema(int indent, std::set<std::string> &memo);
   void buildSchema(SchemaBuilder schemaBuilder, std::set<std::string> &memo);
-  void printJSON(void *address, std::ostream &stream);
+  void printJSON(void *address, JSONWriter &stream);
 #ifdef AVRO
   bool printAvro(void *address, avro_value_t *avrovalue);
+  bool writeAvro(void *address, AvroEncoder &encoder);
 #endif
   const void *unpack(const void *address);
   void *copyToBuffer(void *ptr, void *limit, void *address);
@@ -696,6 +798,7 @@ public:
 class ArrayWalker : public FieldWalker {
 public:
   FieldWalker *walker;
+  PrimitiveWalker *primitive;        // walker, if its items can be handled as runs
   int numItems;
   ArrayWalkerDataProvider dataProvider;
 
@@ -709,9 +812,10 @@ public:
   std::string avroTypeName();
   std::string avroSchema(int indent, std::set<std::string> &memo);
   void buildSchema(SchemaBuilder schemaBuilder, std::set<std::string> &memo);
-  void printJSON(void *address, std::ostream &stream);
+  void printJSON(void *address, JSONWriter &stream);
 #ifdef AVRO
   bool printAvro(void *address, avro_value_t *avrovalue);
+  bool writeAvro(void *address, AvroEncoder &encoder);
 #endif
   const void *unpack(const void *address);
   void *copyToBuffer(void *ptr, void *limit, void *address);
@@ -748,9 +852,10 @@ public:
   std::string avroTypeName();
   std::string avroSchema(int indent, std::set<std::string> &memo);
   void buildSchema(SchemaBuilder schemaBuilder, std::set<std::string> &memo);
-  void printJSON(void *address, std::ostream &stream);
+  void printJSON(void *address, JSONWriter &stream);
 #ifdef AVRO
   bool printAvro(void *address, avro_value_t *avrovalue);
+  bool writeAvro(void *address, AvroEncoder &encoder);
 #endif
   const void *unpack(const void *address);
   void *copyToBuffer(void *ptr, void *limit, void *address);
@@ -774,9 +879,10 @@ public:
   std::string avroTypeName();
   std::string avroSchema(int indent, std::set<std::string> &memo);
   void buildSchema(SchemaBuilder schemaBuilder, std::set<std::string> &memo);
-  void printJSON(void *address, std::ostream &stream);
+  void printJSON(void *address, JSONWriter &stream);
 #ifdef AVRO
   bool printAvro(void *address, avro_value_t *avrovalue);
+  bool writeAvro(void *address, AvroEncoder &encoder);
 #endif
   const void *unpack(const void *address);
   void *copyToBuffer(void *ptr, void *limit, void *address);
@@ -812,9 +918,10 @@ public:
   std::string avroTypeName();
   std::string avroSchema(int indent, std::set<std::string> &memo);
   void buildSchema(SchemaBuilder schemaBuilder, std::set<std::string> &memo);
-  void printJSON(void *address, std::ostream &stream);
+  void printJSON(void *address, JSONWriter &stream);
 #ifdef AVRO
   bool printAvro(void *address, avro_value_t *avrovalue);
+  bool writeAvro(void *address, AvroEncoder &encoder);
 #endif
   const void *unpack(const void *address);
   void *copyToBuffer(void *ptr, void *limit, void *address);
@@ -878,11 +985,13 @@ public:
   std::string avroTypeName();
   std::string avroSchema(int indent, std::set<std::string> &memo);
   void buildSchema(SchemaBuilder schemaBuilder, std::set<std::string> &memo);
-  int printJSONDeep(int readerIndex, int readerSize, LeafDimension *dim, std::ostream &stream);
-  void printJSON(void *address, std::ostream &stream);
+  int printJSONDeep(int readerIndex, int readerSize, LeafDimension *dim, JSONWriter &stream);
+  void printJSON(void *address, JSONWriter &stream);
 #ifdef AVRO
   int printAvroDeep(int readerIndex, int readerSize, LeafDimension *dim, avro_value_t *avrovalue);
+  int writeAvroDeep(int readerIndex, int readerSize, LeafDimension *dim, AvroEncoder &encoder);
   bool printAvro(void *address, avro_value_t *avrovalue);
+  bool writeAvro(void *address, AvroEncoder &encoder);
 #endif
   const void *unpack(const void *address);
   int copyToBufferDeep(void **ptr, void *limit, int readerIndex, int readerSize, LeafDimension *dim);
@@ -914,9 +1023,10 @@ public:
   std::string avroTypeName();
   std::string avroSchema(int indent, std::set<std::string> &memo);
   void buildSchema(SchemaBuilder schemaBuilder, std::set<std::string> &memo);
-  void printJSON(void *address, std::ostream &stream);
+  void printJSON(void *address, JSONWriter &stream);
 #ifdef AVRO
   bool printAvro(void *address, avro_value_t *avrovalue);
+  bool writeAvro(void *address, AvroEncoder &encoder);
 #endif
   const void *unpack(const void *address);
   void *copyToBuffer(void *ptr, void *limit, void *address);
@@ -940,9 +1050,10 @@ public:
   std::string avroTypeName();
   std::string avroSchema(int indent, std::set<std::string> &memo);
   void buildSchema(SchemaBuilder schemaBuilder, std::set<std::string> &memo);
-  void printJSON(void *address, std::ostream &stream);
+  void printJSON(void *address, JSONWriter &stream);
 #ifdef AVRO
   bool printAvro(void *address, avro_value_t *avrovalue);
+  bool writeAvro(void *address, AvroEncoder &encoder);
 #endif
   const void *unpack(const void *address);
   void *copyToBuffer(void *ptr, void *limit, void *address);
@@ -972,8 +1083,44 @@ public:
   void *getAddress();
 };
 
+///////////////////////////////////////////////////////////////////// FormulaWalker
+
+// A computed column (--define): a TTreeFormula evaluated for each entry, presented as a double.
+class FormulaWalker : public RawTBranchWalker {
+public:
+  std::string expression;
+  TTreeFormula *formula;
+  double data;
+
+  FormulaWalker(std::string fieldName, std::string expression, TTreeReader *reader);
+  std::string repr(int indent, std::set<std::string> &memo);
+  void reset(TTreeReader *reader);
+  void *getAddress();
+};
+
 ///////////////////////////////////////////////////////////////////// TreeWalker
 
+// A file opened (possibly in a background thread) and ready to be handed to a TreeWalker.
+class OpenedFile {
+public:
+  std::string fileLocation;
+  bool valid = false;
+  std::string errorMessage = "";
+  TFile *file = nullptr;
+  TTreeReader *reader = nullptr;
+};
+
+// serializers for one top-level field, compiled from the resolved walkers (walkerToCode.h)
+typedef void (*JSONSerializer)(void *address, JSONWriter &stream);
+typedef bool (*AvroSerializer)(void *address, void *encoder);     // encoder is an AvroEncoder*
+typedef void *(*BufferSerializer)(void *ptr, void *limit, void *address);
+
+class WalkerProgram;
+class BulkReader;
+
+bool openTree(std::string fileLocation, std::string treeLocation, TFile *&file, TTreeReader *&reader, std::string &errorMessage);
+OpenedFile *openFileAhead(std::string fileLocation, std::string treeLocation, std::vector<std::string> warmBranches);
+
 class TreeWalker : public DataProvider {
 public:
   std::string fileLocation;
@@ -989,10 +1136,54 @@ public:
   void *rawBuffer = nullptr;
   size_t rawBufferSize = 1024;
 
+  // after copyToBuffer: how many entries it committed and, if one didn't fit, how big a
+  // buffer the next call (starting with that entry) needs; that entry is kept, serialized,
+  // in pending so that the next call copies it rather than reading it again
+  int entriesCopied = 0;
+  size_t sizeNeeded = 0;
+  int64_t pendingEntry = -1;
+  void *pending = nullptr;
+  size_t pendingSize = 0;
+  size_t pendingCapacity = 0;
+
   std::map<const std::string, ClassWalker*> defs;
   std::vector<ExtractableWalker*> fields;
 
+  // glob patterns selecting top-level branches (all if branches is empty); the rest are disabled
+  std::vector<std::string> branches;
+  std::vector<std::string> excludeBranches;
+
+  // entry selection (--cut), evaluated before any field is read
+  std::string cutExpression;
+  TTreeFormula *cut = nullptr;
+
+  // TTreeCache for the branches that are read; cacheSize -1 is ROOT's default (based
+  // on the tree's auto-flush) and 0 disables the cache; cacheLearnEntries 0 skips learning
+  std::vector<std::string> cachedBranches;
+  int64_t cacheSize = -1;
+  int cacheLearnEntries = 0;
+  bool prefetch = false;
+
+  // files being opened in background threads, in the order they were requested
+  std::deque<std::pair<std::string, std::future<OpenedFile*>>> filesAhead;
+
+  // compiled serializers (--jit), indexed like fields; a missing or nullptr entry means
+  // that field is serialized by its walker
+  std::vector<JSONSerializer> jitJSON;
+  std::vector<AvroSerializer> jitAvro;
+  std::vector<BufferSerializer> jitBuffer;
+
+  // fields flattened into programs of operations (--program, walkerProgram.h), indexed like
+  // fields; used where there is no compiled serializer
+  std::vector<WalkerProgram*> programs;
+
+  // basket-at-a-time reading of flat trees (--bulk, bulkReader.h); nullptr means TTreeReader
+  BulkReader *bulk = nullptr;
+
+  JSONWriter json;                   // printJSON's output, until flushJSON or a full block
+
 #ifdef AVRO
+  bool avroPrepared = false;
   bool avroHeaderPrinted = false;
   avro_schema_t entrySchema;
   avro_schema_t schema;
@@ -1001,31 +1192,56 @@ public:
   avro_value_iface_t *avroInterface;
   avro_value_t avroEntryValue;
   avro_value_t avroValue;
+  AvroEncoder avroEncoder;
 #endif
 
-  TreeWalker(std::string fileLocation, std::string treeLocation, std::string schemaName, std::string avroNamespace);
+  TreeWalker(std::string fileLocation, std::string treeLocation, std::string schemaName, std::string avroNamespace, std::vector<std::string> branches = std::vector<std::string>(), std::vector<std::string> excludeBranches = std::vector<std::string>());
+  ~TreeWalker();
+  bool selected(std::string branchName);
+  void addReadBranch(std::string branchName);
+  void addFormulaBranches(TTreeFormula *formula);
+  void selectBranches();
+  bool addDefine(std::string name, std::string expression);
+  bool setCut(std::string expression);
+  bool passesCut();
   bool tryToOpenFile();
   void reset(std::string fileLocation);
+  void openAhead(std::string fileLocation);
+  void closeAhead();
+  void setCache(int64_t cacheSize, int cacheLearnEntries, bool prefetch);
+  void configureCache();
 
   bool next();
   long numEntriesInCurrentTree();
   void setEntryInCurrentTree(long entry);
+  bool enableBulk();
+  void *fieldAddress(size_t index);
 
   bool resolved();
   void resolve();
   std::string repr();
+  void printFieldJSON(size_t index, JSONWriter &stream);
   void printJSON();
+  void flushJSON();
   void buildSchema(SchemaBuilder schemaBuilder);
   std::string stringJSON();
 #ifdef AVRO
   std::string avroSchema();
+  bool prepareAvro();
+  bool fillAvro();
   bool printAvroHeaderOnce(std::string &codec, int blockSize, bool stream);
   bool printAvro(bool stream, uint64_t currentEntry);
+  bool writeFieldAvro(size_t index, AvroEncoder &encoder);
+  bool writeAvro(AvroEncoder &encoder);
   void closeAvro();
 #endif
   int getDataSize(const void *address);
   const void *getData(const void *address, int index);
+  void *copyFieldToBuffer(size_t index, void *ptr, void *limit);
+  void *copyEntryToBuffer(int64_t entry, void *ptr, void *limit);
+  void holdPending(int64_t entry, size_t room);
   size_t copyToBuffer(int64_t entry, int microBatchSize, void *buffer, size_t size);
+  const void *rawEntry(int64_t entry, size_t &size);
   void dumpRaw(int64_t entry);
 };
 
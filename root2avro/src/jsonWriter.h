@@ -0,0 +1,122 @@
+// Copyright 2016 Jim Pivarski
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//     http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef JSON_WRITER_H
+#define JSON_WRITER_H
+
+// C includes
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// C++ includes
+#if __cplusplus >= 201703L
+#include <charconv>
+#endif
+#include <string>
+
+// JSON text into a growable byte buffer, written out in large blocks, instead of
+// formatting through std::ostream. Integers use std::to_chars, floats and doubles the
+// shortest representation that reads back as the same value (std::to_chars, which is Ryu
+// in libstdc++), and strings are copied in runs between the characters that need escaping.
+// The operators are the ones printJSON uses, so the walkers read as they did with a stream.
+
+class JSONWriter {
+public:
+  std::string buffer;                // the only member: the generated code (walkerToCode.h) relies on it
+
+  JSONWriter(size_t capacity = 65536) { buffer.reserve(capacity); }
+
+  void clear() { buffer.clear(); }
+  size_t size() { return buffer.size(); }
+
+  JSONWriter &write(const char *data, size_t length) { buffer.append(data, length); return *this; }
+
+  JSONWriter &operator<<(const char *string) { buffer.append(string); return *this; }
+  JSONWriter &operator<<(const std::string &string) { buffer.append(string); return *this; }
+  JSONWriter &operator<<(char c) { buffer.push_back(c); return *this; }
+
+  JSONWriter &operator<<(short value) { return integer(value); }
+  JSONWriter &operator<<(unsigned short value) { return integer(value); }
+  JSONWriter &operator<<(int value) { return integer(value); }
+  JSONWriter &operator<<(unsigned int value) { return integer(value); }
+  JSONWriter &operator<<(long value) { return integer(value); }
+  JSONWriter &operator<<(unsigned long value) { return integer(value); }
+  JSONWriter &operator<<(long long value) { return integer(value); }
+  JSONWriter &operator<<(unsigned long long value) { return integer(value); }
+  JSONWriter &operator<<(float value) { return floating<float, 6, 9>(value); }
+  JSONWriter &operator<<(double value) { return floating<double, 15, 17>(value); }
+
+  void printEscapedString(const char *string) {
+    static const char hex[] = "0123456789abcdef";
+    const char *run = string;
+    for (const char *c = string;  *c != 0;  c++) {
+      if (*c != '"'  &&  *c != '\\'  &&  !('\x00' <= *c  &&  *c <= '\x1f'))
+        continue;
+      buffer.append(run, c - run);
+      run = c + 1;
+      switch (*c) {
+        case '"': buffer.append("\\\""); break;
+        case '\\': buffer.append("\\\\"); break;
+        case '\b': buffer.append("\\b"); break;
+        case '\f': buffer.append("\\f"); break;
+        case '\n': buffer.append("\\n"); break;
+        case '\r': buffer.append("\\r"); break;
+        case '\t': buffer.append("\\t"); break;
+        default:
+          char escape[6] = {'\\', 'u', '0', '0', hex[(*c >> 4) & 0xf], hex[*c & 0xf]};
+          buffer.append(escape, 6);
+      }
+    }
+    buffer.append(run);
+  }
+
+  bool flush(FILE *file) {           // false if the file can't take it
+    bool ok = buffer.empty()  ||  fwrite(buffer.data(), 1, buffer.size(), file) == buffer.size();
+    buffer.clear();
+    return ok;
+  }
+
+private:
+  template <typename T> JSONWriter &integer(T value) {
+#if __cplusplus >= 201703L
+    char digits[24];
+    buffer.append(digits, std::to_chars(digits, digits + sizeof(digits), value).ptr - digits);
+#else
+    buffer.append(std::to_string(value));
+#endif
+    return *this;
+  }
+
+  // MINDIGITS always reads back the same decimal, MAXDIGITS always the same value
+  template <typename T, int MINDIGITS, int MAXDIGITS> JSONWriter &floating(T value) {
+    char digits[32];
+#if defined(__cpp_lib_to_chars)
+    buffer.append(digits, std::to_chars(digits, digits + sizeof(digits), value).ptr - digits);
+#else
+    // without floating-point std::to_chars: the fewest %g digits that read back the same, starting
+    // at MINDIGITS (%g drops trailing zeros, so numbers with fewer digits come out short anyway)
+    int length = 0;
+    for (int precision = MINDIGITS;  precision <= MAXDIGITS;  precision++) {
+      length = snprintf(digits, sizeof(digits), "%.*g", precision, (double)value);
+      if ((T)strtod(digits, nullptr) == value)
+        break;
+    }
+    buffer.append(digits, length);
+#endif
+    return *this;
+  }
+};
+
+#endif // JSON_WRITER_H
@@ -0,0 +1,213 @@
+// Copyright 2016 Jim Pivarski
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//     http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+// C includes
+#include <errno.h>
+#include <ftw.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// C++ includes
+#include <set>
+
+#include "TROOT.h"
+#include "TSystem.h"
+
+#include "datawalker.h"
+#include "libraryCache.h"
+
+///////////////////////////////////////////////////////////////////// keys
+
+static uint64_t fnv1a(const std::string &data, uint64_t hash) {
+  for (size_t i = 0;  i < data.size();  i++) {
+    hash ^= (unsigned char)data[i];
+    hash *= 1099511628211ULL;
+  }
+  return hash;
+}
+
+static bool readFile(std::string path, std::string &contents) {
+  FILE *in = fopen(path.c_str(), "rb");
+  if (in == nullptr)
+    return false;
+  char buffer[65536];
+  size_t size;
+  while ((size = fread(buffer, 1, sizeof(buffer), in)) > 0)
+    contents.append(buffer, size);
+  fclose(in);
+  return true;
+}
+
+static std::string directoryOf(std::string path) {
+  size_t slash = path.rfind('/');
+  return slash == std::string::npos ? std::string(".") : path.substr(0, slash);
+}
+
+static std::string baseName(std::string path) {
+  size_t slash = path.rfind('/');
+  return slash == std::string::npos ? path : path.substr(slash + 1);
+}
+
+// adds the file and everything it includes with quotes (that can be found) to the description;
+// system headers are covered by the ROOT version and include path
+static void describeSource(std::string path, const std::vector<std::string> &includes, std::set<std::string> &seen, std::string &description) {
+  std::string contents;
+  if (!seen.insert(path).second  ||  !readFile(path, contents))
+    return;
+  description += std::string("\nfile ") + baseName(path) + std::string(" ") + std::to_string(contents.size()) + std::string("\n") + contents;
+
+  std::string here = directoryOf(path);
+  size_t position = 0;
+  while (position < contents.size()) {
+    size_t newline = contents.find('\n', position);
+    if (newline == std::string::npos) newline = contents.size();
+    std::string line = contents.substr(position, newline - position);
+    position = newline + 1;
+
+    size_t i = line.find_first_not_of(" \t");
+    if (i == std::string::npos  ||  line[i] != '#') continue;
+    i = line.find_first_not_of(" \t", i + 1);
+    if (i == std::string::npos  ||  line.compare(i, 7, "include") != 0) continue;
+    i = line.find_first_not_of(" \t", i + 7);
+    if (i == std::string::npos  ||  line[i] != '"') continue;
+    size_t close = line.find('"', i + 1);
+    if (close == std::string::npos) continue;
+    std::string header = line.substr(i + 1, close - i - 1);
+
+    std::vector<std::string> candidates;
+    candidates.push_back(header[0] == '/' ? header : here + std::string("/") + header);
+    for (auto include = includes.begin();  include != includes.end();  ++include)
+      candidates.push_back(*include + std::string("/") + header);
+    for (auto candidate = candidates.begin();  candidate != candidates.end();  ++candidate)
+      if (access(candidate->c_str(), R_OK) == 0) {
+        describeSource(*candidate, includes, seen, description);
+        break;
+      }
+  }
+}
+
+bool isLibrarySource(std::string lib) {
+  std::string extensions[] = {".cxx", ".cpp", ".cc", ".C"};
+  for (auto extension = std::begin(extensions);  extension != std::end(extensions);  ++extension)
+    if (lib.size() > extension->size()  &&  lib.compare(lib.size() - extension->size(), extension->size(), *extension) == 0)
+      return true;
+  return false;
+}
+
+std::string libraryCacheKey(std::string source, const std::vector<std::string> &includes) {
+  std::string description = std::string("root ") + gROOT->GetVersion() + std::string("\nincludePath ") + gSystem->GetIncludePath();
+  for (auto include = includes.begin();  include != includes.end();  ++include)
+    description += std::string("\ninclude ") + *include;
+  std::set<std::string> seen;
+  describeSource(source, includes, seen, description);
+
+  // two FNV-1a hashes (as for the walker cache), as 32 hex digits
+  uint64_t hash1 = fnv1a(description, 14695981039346656037ULL);
+  uint64_t hash2 = fnv1a(description, hash1 ^ 0x5bd1e9955bd1e995ULL);
+  char key[33];
+  snprintf(key, sizeof(key), "%016llx%016llx", (unsigned long long)hash1, (unsigned long long)hash2);
+  return std::string(key);
+}
+
+std::string libraryCacheDescription(std::string lib, const std::vector<std::string> &includes) {
+  if (isLibrarySource(lib))
+    return lib + std::string(" ") + libraryCacheKey(lib, includes);
+  struct stat status;
+  if (stat(lib.c_str(), &status) != 0)
+    return lib;
+  return lib + std::string(" ") + std::to_string(status.st_size) + std::string(" ") + std::to_string(status.st_mtime);
+}
+
+///////////////////////////////////////////////////////////////////// building
+
+static int removeEntry(const char *path, const struct stat *status, int flag, struct FTW *ftw) {
+  remove(path);
+  return 0;
+}
+
+static void removeDirectory(std::string path) {
+  nftw(path.c_str(), removeEntry, 16, FTW_DEPTH | FTW_PHYS);
+}
+
+// SOURCE.cxx -> SOURCE_cxx.so, as ACLiC names it
+static std::string libraryName(std::string source) {
+  std::string name = baseName(source);
+  size_t dot = name.rfind('.');
+  return name.substr(0, dot) + std::string("_") + name.substr(dot + 1) + std::string(".so");
+}
+
+std::string cachedLibrary(std::string directory, std::string source, const std::vector<std::string> &includes, std::string &errorMessage) {
+  if (access(source.c_str(), R_OK) != 0) {
+    errorMessage = std::string("Could not read library source ") + source + std::string(": ") + strerror(errno);
+    return std::string("");
+  }
+
+  std::string libs = directory + std::string("/libs");
+  std::string key = libraryCacheKey(source, includes);
+  std::string cached = libs + std::string("/") + key;
+  std::string library = cached + std::string("/") + libraryName(source);
+
+  // built by an earlier run (or a concurrent one that finished first)
+  if (access(library.c_str(), R_OK) == 0)
+    return library;
+
+  if ((mkdir(directory.c_str(), 0777) != 0  &&  errno != EEXIST)  ||  (mkdir(libs.c_str(), 0777) != 0  &&  errno != EEXIST)) {
+    errorMessage = std::string("Could not create cache directory ") + libs + std::string(": ") + strerror(errno);
+    return std::string("");
+  }
+
+  std::string temporary = cached + std::string(".") + std::to_string(getpid()) + std::string(".tmp");
+  removeDirectory(temporary);        // left by an earlier process with the same pid
+  if (mkdir(temporary.c_str(), 0777) != 0) {
+    errorMessage = std::string("Could not create build directory ") + temporary + std::string(": ") + strerror(errno);
+    return std::string("");
+  }
+
+  // compile only ("c"): the library is loaded from its final place, where its dictionary is found
+  if (gSystem->CompileMacro(source.c_str(), "fOc", (temporary + std::string("/") + libraryName(source)).c_str(), temporary.c_str()) != 1) {
+    errorMessage = std::string("Could not compile ") + source + std::string(" with ACLiC.");
+    removeDirectory(temporary);
+    return std::string("");
+  }
+
+  if (rename(temporary.c_str(), cached.c_str()) != 0) {
+    int renameErrno = errno;
+    removeDirectory(temporary);
+    if (access(library.c_str(), R_OK) != 0) {
+      errorMessage = std::string("Could not move compiled library to ") + cached + std::string(": ") + strerror(renameErrno);
+      return std::string("");
+    }
+  }
+  return library;
+}
+
+bool loadCachedLibrary(std::string directory, std::string lib, const std::vector<std::string> &includes, std::string &errorMessage) {
+  if (!isLibrarySource(lib)) {
+    loadLibrary(lib.c_str());
+    return true;
+  }
+
+  std::string library = cachedLibrary(directory, lib, includes, errorMessage);
+  if (library.empty())
+    return false;
+
+  if (gSystem->Load(library.c_str()) < 0) {
+    errorMessage = std::string("Could not load compiled library ") + library + std::string(" (built from ") + lib + std::string(").");
+    return false;
+  }
+  return true;
+}
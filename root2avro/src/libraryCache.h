@@ -0,0 +1,47 @@
+// Copyright 2016 Jim Pivarski
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//     http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef LIBRARY_CACHE_H
+#define LIBRARY_CACHE_H
+
+#include <string>
+#include <vector>
+
+// Compiled C++ sources for --libs (with --cache-dir): rather than having Cling process
+// SOURCE.cxx at every start, ACLiC compiles it once into DIRECTORY/libs/KEY/SOURCE_cxx.so, with
+// its dictionary (SOURCE_cxx_ACLiC_dict_rdict.pcm) beside it, and later runs only load that. KEY
+// hashes the ROOT version, the include path, and the contents of the source and of the headers
+// it includes with quotes (found beside the including file or in the include directories), so
+// editing either one builds a new library.
+// 
+// Each process builds in its own DIRECTORY/libs/KEY.PID.tmp and renames the whole directory to
+// KEY; if another process got there first, the rename fails and the other library is used.
+
+bool isLibrarySource(std::string lib);
+
+std::string libraryCacheKey(std::string source, const std::vector<std::string> &includes);
+
+// what a lib contributes to other cache keys (see walkerCache.h): the libraryCacheKey of a C++
+// source, or the size and modification time of a compiled library
+std::string libraryCacheDescription(std::string lib, const std::vector<std::string> &includes);
+
+// path of the shared library built from source (building it if it isn't in the cache yet), or
+// empty and errorMessage
+std::string cachedLibrary(std::string directory, std::string source, const std::vector<std::string> &includes, std::string &errorMessage);
+
+// loadLibrary through the cache for C++ sources; compiled libraries are loaded as they are
+bool loadCachedLibrary(std::string directory, std::string lib, const std::vector<std::string> &includes, std::string &errorMessage);
+
+#endif // LIBRARY_CACHE_H
@@ -0,0 +1,277 @@
+// Copyright 2016 Jim Pivarski
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//     http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "pipeline.h"
+
+///////////////////////////////////////////////////////////////////// SnapshotLayout
+
+// SchemaBuilder is a plain function pointer (for JNA), so instructions are collected through a static
+static std::vector<std::pair<SchemaInstruction, std::string> > *collectedInstructions = nullptr;
+
+static void collectInstruction(SchemaInstruction instruction, const void *data) {
+  if (instruction == SchemaClassName  ||  instruction == SchemaClassReference  ||  instruction == SchemaClassFieldName)
+    collectedInstructions->push_back(std::make_pair(instruction, std::string((const char*)data)));
+  else
+    collectedInstructions->push_back(std::make_pair(instruction, std::string()));
+}
+
+SnapshotLayout::SnapshotLayout(TreeWalker *treeWalker) {
+  collectedInstructions = &instructions;
+  treeWalker->buildSchema(collectInstruction);
+  collectedInstructions = nullptr;
+
+  size_t index = 0;
+  root = parse(index);
+}
+
+LayoutNode *SnapshotLayout::parse(size_t &index) {
+  SchemaInstruction instruction = instructions[index].first;
+  std::string name = instructions[index].second;
+  index++;
+
+  switch (instruction) {
+    case SchemaClassName: {
+      LayoutNode *node = new LayoutNode(instruction);
+      node->name = name;
+      classes[name] = node;                              // before members, for recursive types
+      index++;                                           // SchemaClassPointer
+      while (instructions[index].first != SchemaClassEnd) {
+        node->memberNames.push_back(instructions[index].second);
+        index += 2;                                      // SchemaClassFieldName, SchemaClassFieldDoc
+        node->members.push_back(parse(index));
+      }
+      index++;                                           // SchemaClassEnd
+      return node;
+    }
+
+    case SchemaClassReference:
+      return classes.at(name);
+
+    case SchemaPointer:
+    case SchemaSequence: {
+      LayoutNode *node = new LayoutNode(instruction);
+      node->item = parse(index);
+      return node;
+    }
+
+    default:
+      return new LayoutNode(instruction);
+  }
+}
+
+const char *SnapshotLayout::encodeAvro(const char *ptr, LayoutNode *node, AvroEncoder &encoder) {
+  switch (node->instruction) {
+    case SchemaBool:    encoder.writeBoolean(readSnapshot<char>(ptr) != 0);           break;
+    case SchemaChar:    encoder.writeInt(readSnapshot<signed char>(ptr));             break;
+    case SchemaUChar:   encoder.writeInt(readSnapshot<unsigned char>(ptr));           break;
+    case SchemaShort:   encoder.writeInt(readSnapshot<int16_t>(ptr));                 break;
+    case SchemaUShort:  encoder.writeInt(readSnapshot<uint16_t>(ptr));                break;
+    case SchemaInt:     encoder.writeInt(readSnapshot<int32_t>(ptr));                 break;
+    case SchemaUInt:    encoder.writeLong(readSnapshot<uint32_t>(ptr));               break;
+    case SchemaLong:    encoder.writeLong(readSnapshot<int64_t>(ptr));                break;
+    case SchemaULong:   encoder.writeDouble((double)readSnapshot<uint64_t>(ptr));     break;
+    case SchemaFloat:   encoder.writeFloat(readSnapshot<float>(ptr));                 break;
+    case SchemaDouble:  encoder.writeDouble(readSnapshot<double>(ptr));               break;
+
+    case SchemaString: {
+      int length = readSnapshot<int>(ptr);
+      encoder.writeString(ptr, length);
+      ptr += length;
+      break;
+    }
+
+    case SchemaClassName:
+      for (auto member = node->members.begin();  member != node->members.end();  ++member)
+        ptr = encodeAvro(ptr, *member, encoder);
+      break;
+
+    case SchemaPointer:                                  // union ["null", item]
+      if (readSnapshot<char>(ptr) == 0)
+        encoder.writeLong(0);
+      else {
+        encoder.writeLong(1);
+        ptr = encodeAvro(ptr, node->item, encoder);
+      }
+      break;
+
+    case SchemaSequence: {
+      int numItems = readSnapshot<int>(ptr);
+      if (numItems > 0) {
+        encoder.writeLong(numItems);
+        for (int i = 0;  i < numItems;  i++)
+          ptr = encodeAvro(ptr, node->item, encoder);
+      }
+      encoder.writeLong(0);
+      break;
+    }
+
+    default:
+      break;
+  }
+  return ptr;
+}
+
+///////////////////////////////////////////////////////////////////// AvroPipeline
+
+#ifdef AVRO
+AvroPipeline::AvroPipeline(TreeWalker *treeWalker, avro_file_writer_t avroWriter, int numEncoders, size_t batchSize, AvroBlockWriter *blockWriter) :
+  treeWalker(treeWalker),
+  avroWriter(avroWriter),
+  blockWriter(blockWriter),
+  layout(treeWalker),
+  batchSize(batchSize),
+  snapshotQueue(2 * numEncoders),
+  encodedQueue(2 * numEncoders),
+  recycledQueue(8 * numEncoders),
+  maxInFlight(4 * numEncoders)
+{
+  numWritten.store(0);
+  writeFailed.store(false);
+  for (int i = 0;  i < numEncoders;  i++)
+    encoders.push_back(std::thread(&AvroPipeline::encodeLoop, this));
+  writer = std::thread(&AvroPipeline::writeLoop, this);
+}
+
+bool AvroPipeline::convert(int64_t firstEntry, int64_t lastEntry, int64_t entryOffset) {
+  int64_t entry = firstEntry;
+  while (entry < lastEntry  &&  !failed) {
+    PipelineBatch *batch;
+    if (!recycledQueue.tryPop(batch)) {
+      batch = new PipelineBatch;
+      batch->snapshots.resize(batchSize + 1024);
+    }
+    batch->sequence = numSubmitted;
+    batch->snapshotsSize = 0;
+    batch->numRecords = 0;
+    batch->entries.clear();
+
+    // snapshot entries until the batch is about one Avro block
+    while (entry < lastEntry  &&  batch->snapshotsSize < batchSize) {
+      if (treeWalker->cut != nullptr) {
+        treeWalker->setEntryInCurrentTree(entry);
+        if (!treeWalker->passesCut()) {
+          entry++;
+          continue;
+        }
+      }
+
+      char *record = &batch->snapshots[batch->snapshotsSize];
+      *record = StatusWriting;
+      size_t size;
+      try {
+        size = treeWalker->copyToBuffer(entry, 1, record, batch->snapshots.size() - batch->snapshotsSize);
+      }
+      catch (std::exception &err) {
+        std::cerr << err.what() << std::endl;
+        failed = true;
+        break;
+      }
+
+      if (*record == StatusTooSmall)
+        batch->snapshots.resize(2 * batch->snapshots.size());   // and try the same entry again
+      else {
+        batch->snapshotsSize += sizeof(char) + size;
+        batch->numRecords++;
+        batch->entries.push_back(entryOffset + entry);
+        entry++;
+      }
+    }
+
+    // bound the number of batches between this thread and the writer (reordering could hold many)
+    int spins = 0;
+    while (numSubmitted - numWritten.load(std::memory_order_acquire) >= maxInFlight)
+      boundedQueueWait(spins);
+
+    numSubmitted++;
+    snapshotQueue.push(batch);
+
+    if (writeFailed.load(std::memory_order_relaxed))
+      failed = true;
+  }
+  return !failed;
+}
+
+void AvroPipeline::encodeLoop() {
+  while (true) {
+    PipelineBatch *batch = snapshotQueue.pop();
+    if (batch == nullptr) return;
+
+    batch->encoded.clear();
+    batch->offsets.clear();
+    const char *ptr = batch->snapshots.data();
+    for (int i = 0;  i < batch->numRecords;  i++) {
+      ptr += sizeof(char);                               // status byte
+      batch->offsets.push_back(batch->encoded.size);
+      ptr = layout.encodeAvro(ptr, layout.root, batch->encoded);
+    }
+    batch->offsets.push_back(batch->encoded.size);
+
+    encodedQueue.push(batch);
+  }
+}
+
+void AvroPipeline::writeLoop() {
+  std::map<uint64_t, PipelineBatch*> pending;
+  uint64_t next = 0;
+
+  while (true) {
+    PipelineBatch *batch = encodedQueue.pop();
+    if (batch == nullptr) return;
+    pending[batch->sequence] = batch;
+
+    for (auto iter = pending.find(next);  iter != pending.end();  iter = pending.find(next)) {
+      batch = iter->second;
+      pending.erase(iter);
+
+      // after a failure, batches are still taken (so that the other threads can finish) but not written
+      if (blockWriter != nullptr) {
+        for (int i = 0;  i < batch->numRecords  &&  !writeFailed.load(std::memory_order_relaxed);  i++)
+          if (!blockWriter->append(batch->encoded.buffer + batch->offsets[i], batch->offsets[i + 1] - batch->offsets[i], batch->entries[i]))
+            writeFailed.store(true);    // blockWriter->close() reports the error
+      }
+      else {
+        for (int i = 0;  i < batch->numRecords  &&  !writeFailed.load(std::memory_order_relaxed);  i++)
+          if (avro_file_writer_append_encoded(avroWriter, batch->encoded.buffer + batch->offsets[i], batch->offsets[i + 1] - batch->offsets[i]) != 0) {
+            std::cerr << avro_strerror() << std::endl;
+            writeFailed.store(true);
+          }
+      }
+
+      if (!recycledQueue.tryPush(batch))
+        delete batch;
+      next++;
+      numWritten.store(next, std::memory_order_release);
+    }
+  }
+}
+
+bool AvroPipeline::finish() {
+  if (!finished) {
+    for (size_t i = 0;  i < encoders.size();  i++)
+      snapshotQueue.push(nullptr);
+    for (auto encoder = encoders.begin();  encoder != encoders.end();  ++encoder)
+      encoder->join();
+
+    encodedQueue.push(nullptr);
+    writer.join();
+
+    PipelineBatch *batch;
+    while (recycledQueue.tryPop(batch))
+      delete batch;
+
+    finished = true;
+  }
+  return !failed  &&  !writeFailed.load();
+}
+#endif // AVRO
@@ -0,0 +1,116 @@
+// Copyright 2016 Jim Pivarski
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//     http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+// C includes
+#include <stdint.h>
+#include <string.h>
+
+// C++ includes
+#include <atomic>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "avroContainer.h"
+#include "avroEncoder.h"
+#include "boundedQueue.h"
+#include "datawalker.h"
+
+// Three-stage conversion: the ROOT thread snapshots entries with TreeWalker::copyToBuffer,
+// encoder threads turn snapshots into Avro binary (no ROOT calls), and a writer thread
+// appends them to the Avro file in entry order (compressing blocks as it goes).
+
+///////////////////////////////////////////////////////////////////// SnapshotLayout
+
+// The copyToBuffer byte layout, as described by TreeWalker::buildSchema.
+
+class LayoutNode {
+public:
+  SchemaInstruction instruction;    // a primitive, SchemaClassName, SchemaPointer, or SchemaSequence
+  std::string name;                 // class name, if SchemaClassName
+  std::vector<LayoutNode*> members;
+  std::vector<std::string> memberNames;
+  LayoutNode *item;
+  LayoutNode(SchemaInstruction instruction) : instruction(instruction), item(nullptr) { }
+};
+
+template <typename T>
+inline T readSnapshot(const char *&ptr) {
+  T out;
+  memcpy(&out, ptr, sizeof(T));     // snapshots are packed, not aligned
+  ptr += sizeof(T);
+  return out;
+}
+
+class SnapshotLayout {
+public:
+  LayoutNode *root;
+  SnapshotLayout(TreeWalker *treeWalker);
+  const char *encodeAvro(const char *ptr, LayoutNode *node, AvroEncoder &encoder);
+
+private:
+  std::vector<std::pair<SchemaInstruction, std::string> > instructions;
+  std::map<std::string, LayoutNode*> classes;
+  LayoutNode *parse(size_t &index);
+};
+
+///////////////////////////////////////////////////////////////////// AvroPipeline
+
+#ifdef AVRO
+class PipelineBatch {
+public:
+  uint64_t sequence;
+  std::vector<char> snapshots;      // copyToBuffer records: status byte followed by field data
+  size_t snapshotsSize;
+  int numRecords;
+  std::vector<int64_t> entries;     // entry number of each record (in all files, for rolling output)
+  AvroEncoder encoded;
+  std::vector<size_t> offsets;      // start of each record in encoded, plus the end
+};
+
+class AvroPipeline {
+public:
+  TreeWalker *treeWalker;
+  avro_file_writer_t avroWriter;
+  AvroBlockWriter *blockWriter;      // if not nullptr, used instead of avroWriter
+  SnapshotLayout layout;
+  size_t batchSize;
+  bool failed = false;
+
+  AvroPipeline(TreeWalker *treeWalker, avro_file_writer_t avroWriter, int numEncoders, size_t batchSize, AvroBlockWriter *blockWriter = nullptr);
+  bool convert(int64_t firstEntry, int64_t lastEntry, int64_t entryOffset = 0);   // entry numbers in the current tree, and the first one's in all files
+  bool finish();
+
+private:
+  BoundedQueue<PipelineBatch*> snapshotQueue;
+  BoundedQueue<PipelineBatch*> encodedQueue;
+  BoundedQueue<PipelineBatch*> recycledQueue;
+  std::vector<std::thread> encoders;
+  std::thread writer;
+  uint64_t maxInFlight;
+  uint64_t numSubmitted = 0;
+  std::atomic<uint64_t> numWritten;
+  std::atomic<bool> writeFailed;
+  bool finished = false;
+
+  void encodeLoop();
+  void writeLoop();
+};
+#endif // AVRO
+
+#endif // PIPELINE_H
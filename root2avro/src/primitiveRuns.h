@@ -0,0 +1,119 @@
+// Copyright 2016 Jim Pivarski
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//     http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef PRIMITIVE_RUNS_H
+#define PRIMITIVE_RUNS_H
+
+// C includes
+#include <stdint.h>
+#include <string.h>
+
+// ROOT includes
+#include "RtypesCore.h"
+
+#ifdef AVRO
+#include "avroEncoder.h"
+#include "varintRuns.h"
+#endif
+
+// Bulk kernels for contiguous runs of numbers (the data of a std::vector<T>, a fixed-size
+// array, or a leaf's TTreeReaderArray): the space is checked once per run rather than once
+// per item, and the loops have no calls in them, so that the compiler can vectorize them.
+// The output is the same as the items' copyToBuffer and writeAvro, one after another.
+
+// copyToBuffer layout: the in-memory values, with bools normalized to 0 or 1
+template <typename T>
+inline void *copyRunToBuffer(void *ptr, void *limit, const void *items, int numItems) {
+  size_t size = numItems * sizeof(T);
+  if (ptr == nullptr  ||  (size_t)limit - (size_t)ptr < size)
+    return nullptr;
+  memcpy(ptr, items, size);
+  return (void*)((size_t)ptr + size);
+}
+
+template <>
+inline void *copyRunToBuffer<bool>(void *ptr, void *limit, const void *items, int numItems) {
+  if (ptr == nullptr  ||  (size_t)limit - (size_t)ptr < (size_t)numItems)
+    return nullptr;
+  const uint8_t *in = (const uint8_t*)items;
+  uint8_t *out = (uint8_t*)ptr;
+  for (int i = 0;  i < numItems;  i++)
+    out[i] = (in[i] != 0);
+  return (void*)((size_t)ptr + numItems);
+}
+
+#ifdef AVRO
+// Avro: integers are zig-zag varints, reserved for the worst case up front
+template <typename T>
+inline void writeAvroRun(AvroEncoder &encoder, const void *items, int numItems) {
+  const T *in = (const T*)items;
+  encoder.reserve(10 * (size_t)numItems);
+  for (int i = 0;  i < numItems;  i++)
+    encoder.putLong(in[i]);
+}
+
+// shorts, ints, and longs (the leaf arrays and std::vectors that dominate) use the
+// vectorized encoder in varintRuns.h
+template <>
+inline void writeAvroRun<short>(AvroEncoder &encoder, const void *items, int numItems) {
+  encoder.reserve(10 * (size_t)numItems);
+  encoder.size += encodeVarints((const int16_t*)items, numItems, encoder.buffer + encoder.size);
+}
+
+template <>
+inline void writeAvroRun<int>(AvroEncoder &encoder, const void *items, int numItems) {
+  encoder.reserve(10 * (size_t)numItems);
+  encoder.size += encodeVarints((const int32_t*)items, numItems, encoder.buffer + encoder.size);
+}
+
+template <>
+inline void writeAvroRun<Long64_t>(AvroEncoder &encoder, const void *items, int numItems) {
+  encoder.reserve(10 * (size_t)numItems);
+  encoder.size += encodeVarints((const int64_t*)items, numItems, encoder.buffer + encoder.size);
+}
+
+template <>
+inline void writeAvroRun<bool>(AvroEncoder &encoder, const void *items, int numItems) {
+  const uint8_t *in = (const uint8_t*)items;
+  encoder.reserve(numItems);
+  uint8_t *out = (uint8_t*)(encoder.buffer + encoder.size);
+  for (int i = 0;  i < numItems;  i++)
+    out[i] = (in[i] != 0);
+  encoder.size += numItems;
+}
+
+// Avro's floating point is the in-memory (little-endian) format
+template <>
+inline void writeAvroRun<float>(AvroEncoder &encoder, const void *items, int numItems) {
+  encoder.writeFixed(items, numItems * sizeof(float));
+}
+
+template <>
+inline void writeAvroRun<double>(AvroEncoder &encoder, const void *items, int numItems) {
+  encoder.writeFixed(items, numItems * sizeof(double));
+}
+
+template <>
+inline void writeAvroRun<ULong64_t>(AvroEncoder &encoder, const void *items, int numItems) {
+  const ULong64_t *in = (const ULong64_t*)items;      // see ULongWalker::writeAvro
+  encoder.reserve(numItems * sizeof(double));
+  for (int i = 0;  i < numItems;  i++) {
+    double value = in[i];
+    memcpy(encoder.buffer + encoder.size, &value, sizeof(double));
+    encoder.size += sizeof(double);
+  }
+}
+#endif // AVRO
+
+#endif // PRIMITIVE_RUNS_H
@@ -12,26 +12,53 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include <errno.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
 #include <iostream>
 #include <sstream>
 #include <string>
 #include <vector>
 
+#include "arrowWriter.h"
+#include "avroContainer.h"
+#include "avroFrames.h"
+#include "avroIndex.h"
+#include "checkpoint.h"
 #include "datawalker.h"
+#include "libraryCache.h"
+#include "pipeline.h"
+#include "shardPlanner.h"
+#include "shmRing.h"
 #include "streamerToCode.h"
+#include "walkerToCode.h"
+#include "walkerProgram.h"
+#include "walkerCache.h"
 
 #define NA ((uint64_t)(-1))
 
 using namespace ROOT::Internal;
 // using namespace ROOT;
 
-// global variables for this tiny, single-threaded program (parallelism comes from multiple processes)
+// global variables for this tiny, single-threaded program (parallelism comes from multiple processes, see --jobs)
 std::vector<std::string> fileLocations;
 std::string              treeLocation;
 uint64_t                 start = NA;
 uint64_t                 end = NA;
 std::vector<std::string> libs;
 std::vector<std::string> includes;
+std::vector<std::string> branches;
+std::vector<std::string> excludeBranches;
+std::string              cut = "";
+std::vector<std::pair<std::string, std::string> > defines;
 bool                     inferTypes = false;
 std::string              mode = "avro";
 std::string              codec = "null";
@@ -39,6 +66,29 @@ int                      blockKB = 64;
 std::string              schemaName = "";
 std::string              ns = "";
 bool                     debug = false;
+int                      jobs = 1;
+int                      shards = 1;
+int                      encodeThreads = 0;
+int                      codecThreads = 0;
+AvroCodecOptions         codecOptions;
+int64_t                  cacheMB = -1;
+int                      cacheLearnEntries = 0;
+bool                     prefetch = false;
+int                      openAhead = 0;
+bool                     jit = false;
+bool                     program = false;
+bool                     bulk = false;
+std::string              transport = "pipe";
+int64_t                  frameEntries = 1024;
+int64_t                  frameMillis = 0;
+bool                     fingerprint = false;
+int64_t                  arrowBatch = 65536;
+std::string              outputDir = "";
+int64_t                  maxBytes = 0;
+int64_t                  maxEntries = 0;
+std::string              checkpointFile = "";
+std::string              indexFile = "";
+std::string              cacheDir = "";
 
 void help(bool banner) {
   if (banner)
@@ -61,16 +111,85 @@ void help(bool banner) {
             << "  --mode=MODE               What to write to standard output:" << std::endl
             << "                                * \"avro\" (Avro file, default)" << std::endl
             << "                                * \"avro-stream\" (schemaless Avro fragments with entry numbers)" << std::endl
+            << "                                * \"avro-frames\" (schemaless Avro records in length-prefixed frames, see" << std::endl
+            << "                                  --frame-entries)" << std::endl
             << "                                * \"dump\" (raw dump of data that can be interpreted by ScaROOT-Reader)" << std::endl
             << "                                * \"json\" (one JSON object per line, schemaless)" << std::endl
             << "                                * \"schema\" (just the Avro schema as a JSON document)" << std::endl
+            << "                                * \"arrow\" (Arrow IPC stream of record batches)" << std::endl
+            << "                                * \"arrow-file\" (Arrow IPC file of record batches)" << std::endl
             << "                                * \"repr\" (custom JSON schema representing the ROOT source)" << std::endl
             << "                                * \"c++\" (C++ code that would be generated from streamers with --inferTypes)" << std::endl
+            << "                                * \"plan\" (JSON list of entry ranges for --shards, aligned to TTree clusters and" << std::endl
+            << "                                  balanced by compressed bytes)" << std::endl
             << "  --codec=CODEC             Codec for compressing the Avro output; may be \"null\" (uncompressed, default)," << std::endl
-            << "                            \"deflate\", \"snappy\", \"lzma\", depending on libraries installed on your system." << std::endl
+            << "                            \"deflate\", \"snappy\", \"lzma\", \"zstandard\" (or \"zstd\"), \"lz4\" (not in the Avro" << std::endl
+            << "                            specification, but read by fastavro), depending on libraries installed on your system." << std::endl
+            << "  --codec-level=N           Compression level for deflate, lzma, zstandard, or lz4 (LZ4HC); default is the" << std::endl
+            << "                            codec's own default." << std::endl
+            << "  --codec-long              Use zstandard's long-distance matching with a window as large as the block (up to" << std::endl
+            << "                            128 MB, still readable by any zstd decoder); matches are only found within a" << std::endl
+            << "                            block, so this needs a large --block (e.g. --block=65536) to help." << std::endl
+            << "  --codec-dictionary=FILE   Train a zstandard dictionary on the first blocks, save it to FILE, and compress" << std::endl
+            << "                            with it; readers then need FILE (e.g. zstd -D FILE), so the output is no longer" << std::endl
+            << "                            standard Avro (the header's root2avro.zstd.dictionary entry is the dictionary's ID)." << std::endl
             << "  --block=SIZE              Avro block size in KB (default is 64); if too small, no output will be produced." << std::endl
+            << "  --output-dir=DIR          Write Avro to a directory of files named part-FIRST-END.avro (for entries FIRST" << std::endl
+            << "                            up to END, zero-padded), rather than to standard output (\"avro\" mode only)." << std::endl
+            << "  --max-bytes=N             With --output-dir, start a new file (on a block boundary) before the current one" << std::endl
+            << "                            would be more than about N bytes (default is 0: no limit)." << std::endl
+            << "  --max-entries=N           With --output-dir, put at most N entries in each file (default is 0: no limit)." << std::endl
+            << "  --checkpoint=FILE         Record progress in FILE as Avro blocks are written (\"avro\" mode, one job); if the" << std::endl
+            << "                            conversion stops, running it again with the same arguments truncates the output" << std::endl
+            << "                            to the last recorded block and continues from there. Redirect the output with >>" << std::endl
+            << "                            so that the shell doesn't truncate it; FILE is removed when the conversion ends." << std::endl
+            << "  --index=FILE              Also write an index of the Avro blocks (byte offset, entry range, input file and" << std::endl
+            << "                            TTree entry) to FILE, for seeking to any entry (see src/avroIndex.h); \"avro\" mode" << std::endl
+            << "                            to standard output, one job, without --checkpoint." << std::endl
+            << "  --cache-dir=DIR           Keep what startup learns about a file's classes and TTree (dynamic types of" << std::endl
+            << "                            TObjArrays and TClonesArrays, schema, repr, --inferTypes code) in DIR, keyed by" << std::endl
+            << "                            its streamer checksums and branches, so that later runs on files like it skip it;" << std::endl
+            << "                            also C++ sources in --libs, compiled once into shared libraries in DIR." << std::endl
+            << "  --arrow-batch=N           Number of entries per Arrow record batch (default is 65536)." << std::endl
+            << "  --frame-entries=N         Maximum number of records per frame with --mode=avro-frames (default is 1024)." << std::endl
+            << "  --frame-ms=T              Also write a frame when its first record is T milliseconds old (default is 0:" << std::endl
+            << "                            only by number of records)." << std::endl
+            << "  --fingerprint             Put the schema's CRC-64-AVRO fingerprint in each frame (default is off; the field is 0)." << std::endl
+            << "  --branches=GLOB1,GLOB2    Convert only the top-level branches matching these shell-style patterns; all" << std::endl
+            << "                            other branches are disabled and never read (default is all branches)." << std::endl
+            << "  --exclude-branches=GLOBS  Do not convert (or read) top-level branches matching these patterns." << std::endl
+            << "  --cut=EXPRESSION          Convert only entries for which this TTreeFormula expression is nonzero (for any" << std::endl
+            << "                            instance, if it is array-valued); only the branches it uses are read for rejected" << std::endl
+            << "                            entries. --start and --end still count all entries." << std::endl
+            << "  --define=NAME:EXPRESSION  Add a field NAME (double) computed with a TTreeFormula expression; may be repeated." << std::endl
             << "  --name=NAME               Name for schema (taken from TTree name if not provided)." << std::endl
             << "  --ns=NAMESPACE            Namespace for schema (blank if not provided)." << std::endl
+            << "  --jobs=N                  Number of worker processes (default is 1); the entry range is split among them" << std::endl
+            << "                            and their output is stitched together in entry order (\"avro\" and \"json\" modes;" << std::endl
+            << "                            with --output-dir, each job writes its own files)." << std::endl
+            << "  --shards=N                Number of entry ranges to plan with --mode=plan (default is 1)." << std::endl
+            << "  --encode-threads=N        Encode Avro in N threads while ROOT is read in another and output is written in" << std::endl
+            << "                            a third (\"avro\" mode only); default is 0 (read, encode, and write in one thread)." << std::endl
+            << "  --codec-threads=N         Compress Avro blocks in N threads (\"avro\" mode only); output is identical for any" << std::endl
+            << "                            N >= 1. Default is 0 (let the Avro library compress blocks as it writes them)." << std::endl
+            << "  --cache-size=SIZE         TTreeCache size in MB for the branches being converted; 0 disables the cache" << std::endl
+            << "                            (default is ROOT's choice, based on the TTree's auto-flush size)." << std::endl
+            << "  --cache-learn-entries=N   Let the TTreeCache learn which branches to read for N entries before filling;" << std::endl
+            << "                            default is 0 (cache exactly the converted branches from the first entry)." << std::endl
+            << "  --prefetch                Prefetch the next TTreeCache block asynchronously while the current one is used." << std::endl
+            << "  --open-ahead=N            Open (and read the first baskets of) up to N upcoming files in background threads" << std::endl
+            << "                            while the current one is converted; default is 0 (open each file when needed)." << std::endl
+            << "  --jit                     Generate and compile (with Cling) serialization code for the resolved types," << std::endl
+            << "                            rather than walking the type structure for each entry; fields that can't be" << std::endl
+            << "                            compiled (e.g. TObjArray, multidimensional leaves) are walked as usual." << std::endl
+            << "  --program                 Flatten the resolved types into a list of operations run by one loop, rather" << std::endl
+            << "                            than walking the type structure for each entry (no compilation at startup," << std::endl
+            << "                            unlike --jit, which takes precedence for the fields it compiles)." << std::endl
+            << "  --bulk                    Read a basket at a time with ROOT's bulk I/O (6.14 and later), rather than one" << std::endl
+            << "                            entry at a time; only for trees of single-number leaves, without --cut or" << std::endl
+            << "                            --define (others are read entry by entry, with a warning)." << std::endl
+            << "  --transport=TRANSPORT     Where --mode=dump writes: \"pipe\" (standard output, default) or \"shm:NAME\" (a" << std::endl
+            << "                            shared-memory ring named NAME, read by a consumer with shmRing.h)." << std::endl
             << "  -d, -debug, --debug       If supplied, only show the generated C++ code and exit; do not run it." << std::endl
             << "  -h, -help, --help         Print this message and exit." << std::endl;
 }
@@ -84,137 +203,161 @@ std::vector<std::string> splitByComma(std::string in) {
   return out;
 }
 
-int main(int argc, char **argv) {
-  for (int i = 1;  i < argc;  i++) {
-    if (std::string(argv[i]) == std::string("-h")  ||
-        std::string(argv[i]) == std::string("-help")  ||
-        std::string(argv[i]) == std::string("--help")) {
-      help(true);
-      return 0;
-    }
-  }
-
-  std::string startPrefix("--start=");
-  std::string endPrefix("--end=");
-  std::string libsPrefix("--libs=");
-  std::string includesPrefix("--includes=");
-  std::string inferTypesPrefix("--inferTypes");
-  std::string modePrefix("--mode=");
-  std::string codecPrefix("--codec=");
-  std::string blockPrefix("--block=");
-  std::string namePrefix("--name=");
-  std::string nsPrefix("--ns=");
-  std::string badPrefix("-");
+std::string fileURL(std::string fileLocation) {
+  if (fileLocation.find(std::string("://")) == std::string::npos)
+    return std::string("file://") + fileLocation;
+  else
+    return fileLocation;
+}
 
-  for (int i = 1;  i < argc;  i++) {
-    std::string arg(argv[i]);
+// progress of this conversion, for a restart to continue from (--checkpoint)
+Checkpoint *checkpoint = nullptr;
 
-    if (arg.substr(0, startPrefix.size()) == startPrefix) {
-      std::string value = arg.substr(startPrefix.size(), arg.size());
-      start = strtoul(value.c_str(), nullptr, 10);
-    }
+// startup results for files with the same classes and TTree structure (--cache-dir)
+WalkerCacheEntry walkerCacheEntry;
+std::string walkerCacheEntryKey = "";
 
-    else if (arg.substr(0, endPrefix.size()) == endPrefix) {
-      std::string value = arg.substr(endPrefix.size(), arg.size());
-      end = strtoul(value.c_str(), nullptr, 10);
-    }
+// everything besides the file itself that changes the walkers, schema, or generated code
+std::string walkerCacheOptions() {
+  std::ostringstream out;
+  out << "root2avro " << VERSION << "\ntree " << treeLocation << "\nname " << schemaName << "\nns " << ns << "\ninferTypes " << inferTypes << "\ncut " << cut;
+  for (auto branch = branches.begin();  branch != branches.end();  ++branch)
+    out << "\nbranch " << *branch;
+  for (auto branch = excludeBranches.begin();  branch != excludeBranches.end();  ++branch)
+    out << "\nexclude " << *branch;
+  for (auto define = defines.begin();  define != defines.end();  ++define)
+    out << "\ndefine " << define->first << ":" << define->second;
+  for (auto include = includes.begin();  include != includes.end();  ++include)
+    out << "\ninclude " << *include;
+  for (auto lib = libs.begin();  lib != libs.end();  ++lib)
+    out << "\nlib " << libraryCacheDescription(*lib, includes);
+  return out.str();
+}
 
-    else if (arg.substr(0, libsPrefix.size()) == libsPrefix) {
-      libs = splitByComma(arg.substr(libsPrefix.size(), arg.size()));
-    }
+// loads the entry for this key (once); an entry that can't be read is a miss
+void loadWalkerCacheEntry(std::string key) {
+  if (key != walkerCacheEntryKey) {
+    walkerCacheEntry = WalkerCacheEntry();
+    walkerCacheEntry.load(cacheDir, key);
+    walkerCacheEntryKey = key;
+  }
+}
 
-    else if (arg.substr(0, includesPrefix.size()) == includesPrefix) {
-      includes = splitByComma(arg.substr(includesPrefix.size(), arg.size()));
-    }
+// the cache only saves work, so failing to write it is not an error
+void saveWalkerCacheEntry() {
+  std::string errorMessage;
+  if (!walkerCacheEntry.save(cacheDir, walkerCacheEntryKey, errorMessage))
+    std::cerr << errorMessage << " Continuing without --cache-dir." << std::endl;
+}
 
-    else if (arg.substr(0, inferTypesPrefix.size()) == inferTypesPrefix) {
-      inferTypes = true;
-    }
+#ifdef AVRO
+// Avro container output, either through avro-c's file writer or (with --codec-threads, or
+// codecs and settings that avro-c doesn't have, or --output-dir, --checkpoint, or --index) an
+// AvroBlockWriter
+AvroBlockWriter *blockWriter = nullptr;
+AvroIndexWriter *indexWriter = nullptr;
 
-    else if (arg.substr(0, modePrefix.size()) == modePrefix) {
-      mode = arg.substr(modePrefix.size(), arg.size());
-    }
+bool avroCCodec() {
+  return (codec == std::string("null")  ||  codec == std::string("deflate")  ||  codec == std::string("snappy")  ||  codec == std::string("lzma"))  &&
+         codecOptions.level == 0;
+}
 
-    else if (arg.substr(0, codecPrefix.size()) == codecPrefix)
-      codec = arg.substr(codecPrefix.size(), arg.size());
+bool startAvro(TreeWalker *treeWalker) {
+  if (codecThreads == 0  &&  avroCCodec()  &&  outputDir.empty()  &&  checkpoint == nullptr  &&  indexWriter == nullptr)
+    return treeWalker->printAvroHeaderOnce(codec, blockKB * 1024, false);
 
-    else if (arg.substr(0, blockPrefix.size()) == blockPrefix) {
-      std::string value = arg.substr(blockPrefix.size(), arg.size());
-      blockKB = atoi(value.c_str());
-    }
-
-    else if (arg.substr(0, namePrefix.size()) == namePrefix) {
-      schemaName = arg.substr(namePrefix.size(), arg.size());
+  if (blockWriter == nullptr) {
+    if (!treeWalker->prepareAvro()) return false;
+    bool resumed = checkpoint != nullptr  &&  checkpoint->resumed;
+    blockWriter = new AvroBlockWriter(outputDir.empty()  &&  !resumed ? stdout : nullptr, treeWalker->avroSchema(), codec, blockKB * 1024, codecThreads, codecOptions);
+    if (blockWriter->valid  &&  !outputDir.empty())
+      blockWriter->rollFiles(outputDir, maxBytes, maxEntries);
+    if (resumed)
+      blockWriter->continueFile(stdout);
+    else if (checkpoint != nullptr  &&  blockWriter->valid) {
+      // a checkpoint for the header alone, so that a restart never finds output without one
+      if (!checkpoint->blockWritten(stdout, start == NA ? 0 : start)) {
+        std::cerr << checkpoint->errorMessage << std::endl;
+        return false;
+      }
     }
-
-    else if (arg.substr(0, nsPrefix.size()) == nsPrefix) {
-      ns = arg.substr(nsPrefix.size(), arg.size());
+    blockWriter->checkpoint = checkpoint;
+    blockWriter->index = indexWriter;
+    if (!blockWriter->valid) {
+      std::cerr << blockWriter->errorMessage << std::endl;
+      return false;
     }
+  }
+  return true;
+}
 
-    else if (arg == std::string("-d")  ||  arg == std::string("-debug")  ||  arg == std::string("--debug"))
-      debug = true;
-
-    else if (arg.substr(0, badPrefix.size()) == badPrefix) {
-      std::cerr << "Recognized switches are: --start, --end, --mode, --codec, --libs, --includes, --inferTypes, --name, --ns, --debug, --help." << std::endl;
-      return -1;
-    }
+bool writeAvro(TreeWalker *treeWalker, uint64_t currentEntry) {
+  if (blockWriter == nullptr)
+    return treeWalker->printAvro(false, currentEntry);
 
-    else
-      fileLocations.push_back(arg);
-  }
+  treeWalker->avroEncoder.clear();
+  if (!treeWalker->writeAvro(treeWalker->avroEncoder)) return false;
+  return blockWriter->append(treeWalker->avroEncoder.buffer, treeWalker->avroEncoder.size, currentEntry);
+}
 
-  if (fileLocations.size() < 2) {
-    std::cerr << "At least two (non-switch) arguments are required." << std::endl;
-    return -1;
+bool finishAvro(TreeWalker *treeWalker) {
+  treeWalker->closeAvro();
+  if (blockWriter != nullptr  &&  !blockWriter->close()) {
+    std::cerr << blockWriter->errorMessage << std::endl;
+    return false;
   }
-  treeLocation = fileLocations.back();
-  fileLocations.pop_back();
-
-  if (start != NA  &&  end != NA  &&  start > end) {
-    std::cerr << "Start must be less than or equal to end (if provided)." << std::endl;
-    return -1;
+  if (indexWriter != nullptr  &&  !indexWriter->close()) {
+    std::cerr << indexWriter->errorMessage << std::endl;
+    return false;
   }
+  return true;
+}
+#endif
 
-  // ROOT initialization
-  resetSignals();
-
-  for (auto include = includes.begin();  include != includes.end();  ++include)
-    addInclude(include->c_str());
-
-  for (auto lib = libs.begin();  lib != libs.end();  ++lib)
-    loadLibrary(lib->c_str());
-
-  // C++ code generation from inferTypes
-  if (inferTypes  ||  mode == std::string("c++")) {
-    std::string url = fileLocations[0];
-    if (url.find(std::string("://")) == std::string::npos)
-      url = std::string("file://") + url;
-
-    std::vector<std::string> classNames;
-    std::string errorMessage;
-    std::string code = generateCodeFromStreamers(url, treeLocation, classNames, errorMessage);
+// --mode=dump output, to standard output or (with --transport=shm:NAME) a shared-memory ring
+ShmRing *dumpRing = nullptr;
 
-    if (code.empty()) {
-      std::cerr << errorMessage << std::endl;
-      return -1;
-    }
+bool dumpEntry(TreeWalker *treeWalker, int64_t entry) {
+  if (dumpRing == nullptr) {
+    treeWalker->dumpRaw(entry);
+    return true;
+  }
+  size_t size;
+  const void *data = treeWalker->rawEntry(entry, size);
+  if (shmRingWrite(dumpRing, &entry, sizeof(entry))  &&  shmRingWrite(dumpRing, data, size))
+    return true;
+  std::cerr << "The consumer closed the shared-memory ring." << std::endl;
+  return false;
+}
 
-    if (mode == std::string("c++")) {
-      std::cout << code << std::endl;
-      return 0;
-    }
-    else
-      declareClasses(code, classNames);
+void dumpEnd() {
+  int64_t endMarker = -1;
+  if (dumpRing == nullptr) {
+    fwrite(&endMarker, sizeof(endMarker), 1, stdout);
+    return;
   }
+  shmRingWrite(dumpRing, &endMarker, sizeof(endMarker));
+  shmRingClose(dumpRing);
+  dumpRing = nullptr;
+}
 
-  TreeWalker *treeWalker = nullptr;
+// convert [start, end) of all the files in this process, with the TreeWalker it sets up
+int convertFiles(TreeWalker *&treeWalker) {
+#ifdef AVRO
+  AvroPipeline *pipeline = nullptr;
+  AvroFrameWriter *frameWriter = nullptr;
+#endif
+#ifdef ARROW
+  ArrowWriter *arrowWriter = nullptr;
+#endif
 
-  // main loop
-  uint64_t currentEntry = 0;
-  for (int fileIndex = 0;  fileIndex < fileLocations.size();  fileIndex++) {
-    std::string url = fileLocations[fileIndex];
-    if (url.find(std::string("://")) == std::string::npos)
-      url = std::string("file://") + url;
+  // main loop (from the checkpointed file, if continuing a conversion)
+  bool resumed = checkpoint != nullptr  &&  checkpoint->resumed;
+  uint64_t currentEntry = resumed ? checkpoint->fileFirstEntry : 0;
+  int firstFile = resumed ? checkpoint->fileIndex : 0;
+  int nextToOpen = firstFile + 1;
+  for (int fileIndex = firstFile;  fileIndex < fileLocations.size();  fileIndex++) {
+    std::string url = fileURL(fileLocations[fileIndex]);
 
     // set up or update the TreeWalker
     if (treeWalker != nullptr) {
@@ -222,18 +365,57 @@ int main(int argc, char **argv) {
       if (treeWalker->valid) treeWalker->next();
     }
     else {
-      treeWalker = new TreeWalker(url, treeLocation, schemaName, ns);
+      treeWalker = new TreeWalker(url, treeLocation, schemaName, ns, branches, excludeBranches);
+      treeWalker->setCache(cacheMB > 0 ? cacheMB * 1024 * 1024 : cacheMB, cacheLearnEntries, prefetch);
+      for (auto define = defines.begin();  treeWalker->valid  &&  define != defines.end();  ++define)
+        treeWalker->valid = treeWalker->addDefine(define->first, define->second);
+      if (treeWalker->valid  &&  !cut.empty())
+        treeWalker->valid = treeWalker->setCut(cut);
+
+      // dynamic types from a file like this one, rather than reading entries until they're known
+      bool cached = false;
+      if (treeWalker->valid  &&  !cacheDir.empty()) {
+        loadWalkerCacheEntry(walkerCacheKey(treeWalker->file, treeWalker->reader->GetTree(), walkerCacheOptions()));
+        cached = !walkerCacheEntry.repr.empty()  &&  applyResolutions(treeWalker, walkerCacheEntry.resolutions);
+      }
+
       while (treeWalker->valid  &&  !treeWalker->resolved()  &&  treeWalker->next())
         treeWalker->resolve();
       if (!treeWalker->resolved()) {
         std::cerr << "Could not resolve dynamic types (e.g. TClonesArray); is the first file empty?" << std::endl;
         return -1;
       }
+
+      if (treeWalker->valid  &&  !cacheDir.empty()  &&  !cached) {
+        recordResolutions(treeWalker, walkerCacheEntry.resolutions);
+#ifdef AVRO
+        walkerCacheEntry.schema = treeWalker->avroSchema();
+#endif
+        walkerCacheEntry.repr = treeWalker->repr();
+        saveWalkerCacheEntry();
+      }
+      if (bulk  &&  !treeWalker->enableBulk())
+        std::cerr << treeWalker->errorMessage << " Reading entry by entry instead." << std::endl;
+      if (program)
+        compilePrograms(treeWalker);
+      std::string jitError;
+      if (jit  &&  !compileSerializers(treeWalker, jitError))
+        std::cerr << jitError << " Walking the types instead." << std::endl;
     }
     if (!treeWalker->valid) {
       std::cerr << treeWalker->errorMessage << std::endl;
       return -1;
     }
+    if (checkpoint != nullptr)
+      checkpoint->fileStarted(fileIndex, currentEntry);
+#ifdef AVRO
+    if (indexWriter != nullptr)
+      indexWriter->fileStarted(fileIndex, currentEntry);
+#endif
+
+    // start opening the next few files while this one is being converted
+    while (nextToOpen < fileLocations.size()  &&  nextToOpen <= fileIndex + openAhead)
+      treeWalker->openAhead(fileURL(fileLocations[nextToOpen++]));
 
     // skip this file if the first requested entry comes after it
     if (start != NA  &&  start >= currentEntry + treeWalker->numEntriesInCurrentTree()) {
@@ -251,15 +433,42 @@ int main(int argc, char **argv) {
       treeWalker->setEntryInCurrentTree(0);
 
       do {
-        if (end != NA  &&  currentEntry >= end)
+        if (end != NA  &&  currentEntry >= end) {
+          treeWalker->flushJSON();
           return 0;
+        }
 
-        treeWalker->printJSON();
+        if (treeWalker->passesCut())
+          treeWalker->printJSON();
         currentEntry += 1;
       } while (treeWalker->next());
     }
 
 #ifdef AVRO
+    // print out Avro bytes (with an "Obj" header), reading, encoding, and writing in separate threads
+    else if (mode == std::string("avro")  &&  encodeThreads > 0) {
+      int64_t numEntries = treeWalker->numEntriesInCurrentTree();
+      int64_t firstEntry = (start != NA  &&  start > currentEntry) ? start - currentEntry : 0;
+      int64_t lastEntry = (end != NA  &&  end < currentEntry + numEntries) ? end - currentEntry : numEntries;
+
+      if (!startAvro(treeWalker)) return -1;
+      if (pipeline == nullptr)
+        pipeline = new AvroPipeline(treeWalker, treeWalker->avroWriter, encodeThreads, blockKB * 1024, blockWriter);
+
+      if (!pipeline->convert(firstEntry, lastEntry, currentEntry)) {
+        pipeline->finish();
+        finishAvro(treeWalker);
+        return -1;
+      }
+
+      currentEntry += numEntries;
+      if (end != NA  &&  currentEntry >= end) {
+        bool success = pipeline->finish();
+        success = finishAvro(treeWalker)  &&  success;
+        return success ? 0 : -1;
+      }
+    }
+
     // print out Avro bytes (with an "Obj" header)
     else if (mode == std::string("avro")) {
       if (start != NA  &&  start > currentEntry) {
@@ -269,15 +478,13 @@ int main(int argc, char **argv) {
       else
       treeWalker->setEntryInCurrentTree(0);
 
-      if (!treeWalker->printAvroHeaderOnce(codec, blockKB * 1024, false)) return -1;
+      if (!startAvro(treeWalker)) return -1;
       do {
-        if (end != NA  &&  currentEntry >= end) {
-          treeWalker->closeAvro();
-          return 0;
-        }
+        if (end != NA  &&  currentEntry >= end)
+          return finishAvro(treeWalker) ? 0 : -1;
 
-        if (!treeWalker->printAvro(false, currentEntry)) {
-          treeWalker->closeAvro();
+        if (treeWalker->passesCut()  &&  !writeAvro(treeWalker, currentEntry)) {
+          finishAvro(treeWalker);
           return -1;
         }
 
@@ -301,7 +508,7 @@ int main(int argc, char **argv) {
           return 0;
         }
 
-        if (!treeWalker->printAvro(true, currentEntry)) {
+        if (treeWalker->passesCut()  &&  !treeWalker->printAvro(true, currentEntry)) {
           treeWalker->closeAvro();
           return -1;
         }
@@ -310,6 +517,37 @@ int main(int argc, char **argv) {
       } while (treeWalker->next());
     }
 
+    // Avro records in frames, many per write (see avroFrames.h)
+    else if (mode == std::string("avro-frames")) {
+      if (start != NA  &&  start > currentEntry) {
+        treeWalker->setEntryInCurrentTree(start - currentEntry);
+        currentEntry = start;
+      }
+      else
+      treeWalker->setEntryInCurrentTree(0);
+
+      if (frameWriter == nullptr)
+        frameWriter = new AvroFrameWriter(stdout, frameEntries, frameMillis, fingerprint ? avroFingerprint(treeWalker->avroSchema()) : 0);
+      do {
+        if (end != NA  &&  currentEntry >= end)
+          break;
+
+        if (treeWalker->passesCut()) {
+          if (!treeWalker->writeAvro(frameWriter->record(currentEntry)))
+            return -1;
+          if (!frameWriter->commit()) {
+            std::cerr << frameWriter->errorMessage << std::endl;
+            return -1;
+          }
+        }
+
+        currentEntry += 1;
+      } while (treeWalker->next());
+
+      if (end != NA  &&  currentEntry >= end)
+        break;
+    }
+
     // print the schema and exit
     else if (mode == std::string("schema")) {
       std::cout << treeWalker->avroSchema() << std::endl;
@@ -317,6 +555,29 @@ int main(int argc, char **argv) {
     }
 #endif // AVRO
 
+#ifdef ARROW
+    // print out Arrow record batches, as an IPC stream or file
+    else if (mode == std::string("arrow")  ||  mode == std::string("arrow-file")) {
+      int64_t numEntries = treeWalker->numEntriesInCurrentTree();
+      int64_t firstEntry = (start != NA  &&  start > currentEntry) ? start - currentEntry : 0;
+      int64_t lastEntry = (end != NA  &&  end < currentEntry + numEntries) ? end - currentEntry : numEntries;
+
+      if (arrowWriter == nullptr) {
+        fflush(stdout);
+        arrowWriter = new ArrowWriter(treeWalker, fileno(stdout), mode == std::string("arrow-file"), arrowBatch);
+      }
+
+      if (!arrowWriter->write(firstEntry, lastEntry)) {
+        std::cerr << arrowWriter->errorMessage << std::endl;
+        return -1;
+      }
+
+      currentEntry += numEntries;
+      if (end != NA  &&  currentEntry >= end)
+        break;
+    }
+#endif // ARROW
+
     // dump data for ScaROOT-Reader
     else if (mode == std::string("dump")) {
       if (start != NA  &&  start > currentEntry) {
@@ -328,12 +589,12 @@ int main(int argc, char **argv) {
 
       do {
         if (end != NA  &&  currentEntry >= end) {
-          int64_t endMarker = -1;
-          fwrite(&endMarker, sizeof(endMarker), 1, stdout);
+          dumpEnd();
           return 0;
         }
 
-        treeWalker->dumpRaw(currentEntry);
+        if (treeWalker->passesCut()  &&  !dumpEntry(treeWalker, currentEntry))
+          return -1;
 
         currentEntry += 1;
       } while (treeWalker->next());
@@ -351,13 +612,584 @@ int main(int argc, char **argv) {
     }
   }
 
-  if (mode == std::string("dump")) {
-    int64_t endMarker = -1;
-    fwrite(&endMarker, sizeof(endMarker), 1, stdout);
+  if (mode == std::string("json")  &&  treeWalker != nullptr)
+    treeWalker->flushJSON();
+
+  if (mode == std::string("dump"))
+    dumpEnd();
+
+#ifdef ARROW
+  if (arrowWriter != nullptr  &&  !arrowWriter->close()) {
+    std::cerr << arrowWriter->errorMessage << std::endl;
+    return -1;
   }
+#endif
 
 #ifdef AVRO
-  treeWalker->closeAvro();
+  if (frameWriter != nullptr  &&  !frameWriter->flush()) {
+    std::cerr << frameWriter->errorMessage << std::endl;
+    return -1;
+  }
+  if (pipeline != nullptr  &&  !pipeline->finish()) {
+    finishAvro(treeWalker);
+    return -1;
+  }
+  if (!finishAvro(treeWalker))
+    return -1;
 #endif
   return 0;
 }
+
+int convert() {
+  TreeWalker *treeWalker = nullptr;
+  int result = convertFiles(treeWalker);
+
+  // the records before an error are still written, as they were before printJSON was buffered
+  if (result != 0  &&  mode == std::string("json")  &&  treeWalker != nullptr)
+    treeWalker->flushJSON();
+
+  // however it stopped, no file opened ahead is still being read when the process exits
+  if (treeWalker != nullptr)
+    treeWalker->closeAhead();
+  return result;
+}
+
+// unnamed temporary file for one job's output, removed as soon as it is closed
+FILE *anonymousTempFile() {
+  const char *tmpdir = getenv("TMPDIR");
+  std::string path = std::string(tmpdir != nullptr  &&  tmpdir[0] != 0 ? tmpdir : "/tmp") + std::string("/root2avro-XXXXXX");
+  int fd = mkstemp(&path[0]);
+  if (fd < 0)
+    return nullptr;
+  unlink(path.c_str());
+  return fdopen(fd, "w+");
+}
+
+// when a later job can't be started: the ones already running would keep writing to files
+// that nobody reads after this process exits
+void stopJobs(std::vector<pid_t> &pids, std::vector<FILE*> &outputs) {
+  for (auto pid = pids.begin();  pid != pids.end();  ++pid)
+    kill(*pid, SIGTERM);
+  for (auto pid = pids.begin();  pid != pids.end();  ++pid) {
+    int status;
+    waitpid(*pid, &status, 0);
+  }
+  for (auto output = outputs.begin();  output != outputs.end();  ++output)
+    if (*output != nullptr)
+      fclose(*output);
+}
+
+// split [start, end) into contiguous ranges, convert each in a forked process, and stitch the outputs in order
+int convertInJobs() {
+  if (mode != std::string("avro")  &&  mode != std::string("json")) {
+    std::cerr << "--jobs is only supported with --mode=avro and --mode=json." << std::endl;
+    return -1;
+  }
+
+  // ranges are aligned to cluster boundaries so that no two jobs decompress the same baskets
+  std::vector<std::string> urls;
+  for (auto fileLocation = fileLocations.begin();  fileLocation != fileLocations.end();  ++fileLocation)
+    urls.push_back(fileURL(*fileLocation));
+
+  std::vector<ClusterInfo> clusters;
+  std::string errorMessage;
+  if (!readClusters(urls, treeLocation, clusters, errorMessage)) {
+    std::cerr << errorMessage << std::endl;
+    return -1;
+  }
+
+  std::vector<ShardInfo> plan = planShards(clusters, jobs, start == NA ? -1 : (int64_t)start, end == NA ? -1 : (int64_t)end);
+  uint64_t numJobs = plan.size();
+  if (numJobs == 0) {
+    // nothing in range; still produce a (possibly empty) output in one process
+    ShardInfo nothing;
+    nothing.globalStart = nothing.globalEnd = (start == NA ? 0 : start);
+    plan.push_back(nothing);
+    numJobs = 1;
+  }
+
+  std::vector<FILE*> outputs;
+  std::vector<pid_t> pids;
+  std::vector<uint64_t> jobStarts;
+
+  fflush(stdout);
+  fflush(stderr);
+
+  for (uint64_t i = 0;  i < numJobs;  i++) {
+    uint64_t jobStart = plan[i].globalStart;
+    uint64_t jobEnd = plan[i].globalEnd;
+
+    // with --output-dir, each job writes its own files; otherwise, its output is stitched together below
+    FILE *output = outputDir.empty() ? anonymousTempFile() : nullptr;
+    if (outputDir.empty()  &&  output == nullptr) {
+      std::cerr << "Could not create a temporary file for job " << i << "." << std::endl;
+      stopJobs(pids, outputs);
+      return -1;
+    }
+
+    pid_t pid = fork();
+    if (pid < 0) {
+      std::cerr << "Could not fork job " << i << "." << std::endl;
+      if (output != nullptr)
+        fclose(output);
+      stopJobs(pids, outputs);
+      return -1;
+    }
+
+    if (pid == 0) {
+      // child: same options, but its own entry range and its standard output goes to the temporary file
+      if (output != nullptr  &&  dup2(fileno(output), STDOUT_FILENO) < 0)
+        _exit(1);
+      start = jobStart;
+      end = jobEnd;
+      int status = convert();
+      fflush(stdout);
+      _exit(status == 0 ? 0 : 1);
+    }
+
+    outputs.push_back(output);
+    pids.push_back(pid);
+    jobStarts.push_back(jobStart);
+  }
+
+  bool success = true;
+  for (uint64_t i = 0;  i < numJobs;  i++) {
+    int status;
+    if (waitpid(pids[i], &status, 0) < 0  ||  !WIFEXITED(status)  ||  WEXITSTATUS(status) != 0) {
+      std::cerr << "Job " << i << " (starting at entry " << jobStarts[i] << ") failed." << std::endl;
+      success = false;
+    }
+  }
+
+  if (success  &&  outputDir.empty()) {
+    for (auto output = outputs.begin();  output != outputs.end();  ++output)
+      rewind(*output);
+
+    if (mode == std::string("json")) {
+      char buffer[65536];
+      for (auto output = outputs.begin();  output != outputs.end();  ++output) {
+        size_t size;
+        while ((size = fread(buffer, 1, sizeof(buffer), *output)) > 0)
+          fwrite(buffer, 1, size, stdout);
+      }
+    }
+    else {
+      if (!concatenateAvro(outputs, stdout, errorMessage)) {
+        std::cerr << errorMessage << std::endl;
+        success = false;
+      }
+    }
+    fflush(stdout);
+  }
+
+  for (auto output = outputs.begin();  output != outputs.end();  ++output)
+    if (*output != nullptr)
+      fclose(*output);
+
+  return success ? 0 : -1;
+}
+
+int main(int argc, char **argv) {
+  for (int i = 1;  i < argc;  i++) {
+    if (std::string(argv[i]) == std::string("-h")  ||
+        std::string(argv[i]) == std::string("-help")  ||
+        std::string(argv[i]) == std::string("--help")) {
+      help(true);
+      return 0;
+    }
+  }
+
+  std::string startPrefix("--start=");
+  std::string endPrefix("--end=");
+  std::string libsPrefix("--libs=");
+  std::string includesPrefix("--includes=");
+  std::string branchesPrefix("--branches=");
+  std::string excludeBranchesPrefix("--exclude-branches=");
+  std::string cutPrefix("--cut=");
+  std::string definePrefix("--define=");
+  std::string inferTypesPrefix("--inferTypes");
+  std::string modePrefix("--mode=");
+  std::string codecPrefix("--codec=");
+  std::string blockPrefix("--block=");
+  std::string namePrefix("--name=");
+  std::string nsPrefix("--ns=");
+  std::string jobsPrefix("--jobs=");
+  std::string shardsPrefix("--shards=");
+  std::string encodeThreadsPrefix("--encode-threads=");
+  std::string codecThreadsPrefix("--codec-threads=");
+  std::string codecLevelPrefix("--codec-level=");
+  std::string codecDictionaryPrefix("--codec-dictionary=");
+  std::string cacheSizePrefix("--cache-size=");
+  std::string cacheLearnEntriesPrefix("--cache-learn-entries=");
+  std::string openAheadPrefix("--open-ahead=");
+  std::string arrowBatchPrefix("--arrow-batch=");
+  std::string transportPrefix("--transport=");
+  std::string frameEntriesPrefix("--frame-entries=");
+  std::string frameMsPrefix("--frame-ms=");
+  std::string outputDirPrefix("--output-dir=");
+  std::string maxBytesPrefix("--max-bytes=");
+  std::string maxEntriesPrefix("--max-entries=");
+  std::string checkpointPrefix("--checkpoint=");
+  std::string indexPrefix("--index=");
+  std::string cacheDirPrefix("--cache-dir=");
+  std::string badPrefix("-");
+
+  for (int i = 1;  i < argc;  i++) {
+    std::string arg(argv[i]);
+
+    if (arg.substr(0, startPrefix.size()) == startPrefix) {
+      std::string value = arg.substr(startPrefix.size(), arg.size());
+      start = strtoul(value.c_str(), nullptr, 10);
+    }
+
+    else if (arg.substr(0, endPrefix.size()) == endPrefix) {
+      std::string value = arg.substr(endPrefix.size(), arg.size());
+      end = strtoul(value.c_str(), nullptr, 10);
+    }
+
+    else if (arg.substr(0, libsPrefix.size()) == libsPrefix) {
+      libs = splitByComma(arg.substr(libsPrefix.size(), arg.size()));
+    }
+
+    else if (arg.substr(0, includesPrefix.size()) == includesPrefix) {
+      includes = splitByComma(arg.substr(includesPrefix.size(), arg.size()));
+    }
+
+    else if (arg.substr(0, branchesPrefix.size()) == branchesPrefix) {
+      branches = splitByComma(arg.substr(branchesPrefix.size(), arg.size()));
+    }
+
+    else if (arg.substr(0, excludeBranchesPrefix.size()) == excludeBranchesPrefix) {
+      excludeBranches = splitByComma(arg.substr(excludeBranchesPrefix.size(), arg.size()));
+    }
+
+    else if (arg.substr(0, cutPrefix.size()) == cutPrefix) {
+      cut = arg.substr(cutPrefix.size(), arg.size());
+    }
+
+    else if (arg.substr(0, definePrefix.size()) == definePrefix) {
+      std::string value = arg.substr(definePrefix.size(), arg.size());
+      size_t colon = value.find(':');
+      if (colon == std::string::npos  ||  colon == 0) {
+        std::cerr << "--define must have the form NAME:EXPRESSION." << std::endl;
+        return -1;
+      }
+      defines.push_back(std::make_pair(value.substr(0, colon), value.substr(colon + 1)));
+    }
+
+    else if (arg.substr(0, inferTypesPrefix.size()) == inferTypesPrefix) {
+      inferTypes = true;
+    }
+
+    else if (arg.substr(0, modePrefix.size()) == modePrefix) {
+      mode = arg.substr(modePrefix.size(), arg.size());
+    }
+
+    else if (arg.substr(0, codecPrefix.size()) == codecPrefix) {
+      codec = arg.substr(codecPrefix.size(), arg.size());
+      if (codec == std::string("zstd"))
+        codec = std::string("zstandard");      // the name in the Avro specification
+    }
+
+    else if (arg.substr(0, codecLevelPrefix.size()) == codecLevelPrefix) {
+      std::string value = arg.substr(codecLevelPrefix.size(), arg.size());
+      codecOptions.level = atoi(value.c_str());
+    }
+
+    else if (arg == std::string("--codec-long"))
+      codecOptions.longDistance = true;
+
+    else if (arg.substr(0, codecDictionaryPrefix.size()) == codecDictionaryPrefix)
+      codecOptions.dictionaryFile = arg.substr(codecDictionaryPrefix.size(), arg.size());
+
+    else if (arg.substr(0, blockPrefix.size()) == blockPrefix) {
+      std::string value = arg.substr(blockPrefix.size(), arg.size());
+      blockKB = atoi(value.c_str());
+    }
+
+    else if (arg.substr(0, namePrefix.size()) == namePrefix) {
+      schemaName = arg.substr(namePrefix.size(), arg.size());
+    }
+
+    else if (arg.substr(0, nsPrefix.size()) == nsPrefix) {
+      ns = arg.substr(nsPrefix.size(), arg.size());
+    }
+
+    else if (arg.substr(0, jobsPrefix.size()) == jobsPrefix) {
+      std::string value = arg.substr(jobsPrefix.size(), arg.size());
+      jobs = atoi(value.c_str());
+    }
+
+    else if (arg.substr(0, shardsPrefix.size()) == shardsPrefix) {
+      std::string value = arg.substr(shardsPrefix.size(), arg.size());
+      shards = atoi(value.c_str());
+    }
+
+    else if (arg.substr(0, encodeThreadsPrefix.size()) == encodeThreadsPrefix) {
+      std::string value = arg.substr(encodeThreadsPrefix.size(), arg.size());
+      encodeThreads = atoi(value.c_str());
+    }
+
+    else if (arg.substr(0, codecThreadsPrefix.size()) == codecThreadsPrefix) {
+      std::string value = arg.substr(codecThreadsPrefix.size(), arg.size());
+      codecThreads = atoi(value.c_str());
+    }
+
+    else if (arg.substr(0, cacheSizePrefix.size()) == cacheSizePrefix) {
+      std::string value = arg.substr(cacheSizePrefix.size(), arg.size());
+      cacheMB = atol(value.c_str());
+    }
+
+    else if (arg.substr(0, cacheLearnEntriesPrefix.size()) == cacheLearnEntriesPrefix) {
+      std::string value = arg.substr(cacheLearnEntriesPrefix.size(), arg.size());
+      cacheLearnEntries = atoi(value.c_str());
+    }
+
+    else if (arg == std::string("--prefetch"))
+      prefetch = true;
+
+    else if (arg == std::string("--jit"))
+      jit = true;
+    else if (arg == std::string("--program"))
+      program = true;
+    else if (arg == std::string("--bulk"))
+      bulk = true;
+
+    else if (arg.substr(0, openAheadPrefix.size()) == openAheadPrefix) {
+      std::string value = arg.substr(openAheadPrefix.size(), arg.size());
+      openAhead = atoi(value.c_str());
+    }
+
+    else if (arg.substr(0, arrowBatchPrefix.size()) == arrowBatchPrefix) {
+      std::string value = arg.substr(arrowBatchPrefix.size(), arg.size());
+      arrowBatch = atol(value.c_str());
+    }
+
+    else if (arg.substr(0, transportPrefix.size()) == transportPrefix)
+      transport = arg.substr(transportPrefix.size(), arg.size());
+
+    else if (arg.substr(0, frameEntriesPrefix.size()) == frameEntriesPrefix) {
+      std::string value = arg.substr(frameEntriesPrefix.size(), arg.size());
+      frameEntries = atol(value.c_str());
+    }
+
+    else if (arg.substr(0, frameMsPrefix.size()) == frameMsPrefix) {
+      std::string value = arg.substr(frameMsPrefix.size(), arg.size());
+      frameMillis = atol(value.c_str());
+    }
+
+    else if (arg == std::string("--fingerprint"))
+      fingerprint = true;
+
+    else if (arg.substr(0, outputDirPrefix.size()) == outputDirPrefix)
+      outputDir = arg.substr(outputDirPrefix.size(), arg.size());
+
+    else if (arg.substr(0, maxBytesPrefix.size()) == maxBytesPrefix) {
+      std::string value = arg.substr(maxBytesPrefix.size(), arg.size());
+      maxBytes = atol(value.c_str());
+    }
+
+    else if (arg.substr(0, maxEntriesPrefix.size()) == maxEntriesPrefix) {
+      std::string value = arg.substr(maxEntriesPrefix.size(), arg.size());
+      maxEntries = atol(value.c_str());
+    }
+
+    else if (arg.substr(0, checkpointPrefix.size()) == checkpointPrefix)
+      checkpointFile = arg.substr(checkpointPrefix.size(), arg.size());
+
+    else if (arg.substr(0, indexPrefix.size()) == indexPrefix)
+      indexFile = arg.substr(indexPrefix.size(), arg.size());
+
+    else if (arg.substr(0, cacheDirPrefix.size()) == cacheDirPrefix)
+      cacheDir = arg.substr(cacheDirPrefix.size(), arg.size());
+
+    else if (arg == std::string("-d")  ||  arg == std::string("-debug")  ||  arg == std::string("--debug"))
+      debug = true;
+
+    else if (arg.substr(0, badPrefix.size()) == badPrefix) {
+      std::cerr << "Recognized switches are: --start, --end, --mode, --codec, --codec-level, --codec-long, --codec-dictionary, --output-dir, --max-bytes, --max-entries, --checkpoint, --index, --cache-dir, --arrow-batch, --frame-entries, --frame-ms, --fingerprint, --libs, --includes, --branches, --exclude-branches, --cut, --define, --inferTypes, --name, --ns, --jobs, --shards, --encode-threads, --codec-threads, --cache-size, --cache-learn-entries, --prefetch, --open-ahead, --jit, --program, --bulk, --transport, --debug, --help." << std::endl;
+      return -1;
+    }
+
+    else
+      fileLocations.push_back(arg);
+  }
+
+  if (fileLocations.size() < 2) {
+    std::cerr << "At least two (non-switch) arguments are required." << std::endl;
+    return -1;
+  }
+  treeLocation = fileLocations.back();
+  fileLocations.pop_back();
+
+  if (jobs < 1  ||  shards < 1  ||  encodeThreads < 0  ||  codecThreads < 0  ||  openAhead < 0  ||  arrowBatch < 1  ||  frameEntries < 1  ||  frameMillis < 0) {
+    std::cerr << "Number of jobs, shards, and entries per Arrow batch or frame must be at least 1; numbers of threads, files opened ahead, and frame milliseconds must not be negative." << std::endl;
+    return -1;
+  }
+
+  if (frameEntries > UINT32_MAX) {
+    std::cerr << "Entries per frame must be at most " << UINT32_MAX << " (the frame header counts them in 32 bits)." << std::endl;
+    return -1;
+  }
+
+  if ((codecOptions.longDistance  ||  !codecOptions.dictionaryFile.empty())  &&  codec != std::string("zstandard")) {
+    std::cerr << "--codec-long and --codec-dictionary are only for --codec=zstandard." << std::endl;
+    return -1;
+  }
+
+  if (!codecOptions.dictionaryFile.empty()  &&  jobs > 1) {
+    std::cerr << "--codec-dictionary can't be used with --jobs (each job would train its own dictionary)." << std::endl;
+    return -1;
+  }
+
+  if (outputDir.empty() ? (maxBytes != 0  ||  maxEntries != 0) : (mode != std::string("avro")  ||  maxBytes < 0  ||  maxEntries < 0)) {
+    std::cerr << "--output-dir is only supported with --mode=avro, and --max-bytes and --max-entries (not negative) need --output-dir." << std::endl;
+    return -1;
+  }
+
+  if (start != NA  &&  end != NA  &&  start > end) {
+    std::cerr << "Start must be less than or equal to end (if provided)." << std::endl;
+    return -1;
+  }
+
+  // ROOT initialization
+  resetSignals();
+
+  // cluster-aligned sharding plan (only needs TTree metadata, not the classes in it)
+  if (mode == std::string("plan")) {
+    std::vector<std::string> urls;
+    for (auto fileLocation = fileLocations.begin();  fileLocation != fileLocations.end();  ++fileLocation)
+      urls.push_back(fileURL(*fileLocation));
+
+    std::vector<ClusterInfo> clusters;
+    std::string errorMessage;
+    if (!readClusters(urls, treeLocation, clusters, errorMessage)) {
+      std::cerr << errorMessage << std::endl;
+      return -1;
+    }
+
+    std::vector<ShardInfo> plan = planShards(clusters, shards, start == NA ? -1 : (int64_t)start, end == NA ? -1 : (int64_t)end);
+    std::cout << planJSON(plan, urls, treeLocation) << std::endl;
+    return 0;
+  }
+
+  // a file with the same classes and TTree structure has been seen before: no need to load or infer classes
+  if (!cacheDir.empty()  &&  (inferTypes  ||  mode == std::string("c++")  ||  mode == std::string("schema")  ||  mode == std::string("repr"))) {
+    std::string key;
+    std::string errorMessage;
+    if (!walkerCacheKey(fileURL(fileLocations[0]), treeLocation, walkerCacheOptions(), key, errorMessage)) {
+      std::cerr << errorMessage << std::endl;
+      return -1;
+    }
+    loadWalkerCacheEntry(key);
+
+    if (mode == std::string("schema")  &&  !walkerCacheEntry.schema.empty()) {
+      std::cout << walkerCacheEntry.schema << std::endl;
+      return 0;
+    }
+    if (mode == std::string("repr")  &&  !walkerCacheEntry.repr.empty()) {
+      std::cout << walkerCacheEntry.repr << std::endl;
+      return 0;
+    }
+  }
+
+  // ROOT I/O from more than one thread (files opened ahead) needs its global locks turned on first
+  if (openAhead > 0)
+    ROOT::EnableThreadSafety();
+
+  for (auto include = includes.begin();  include != includes.end();  ++include)
+    addInclude(include->c_str());
+
+  for (auto lib = libs.begin();  lib != libs.end();  ++lib) {
+    std::string errorMessage;
+    if (cacheDir.empty())
+      loadLibrary(lib->c_str());
+    else if (!loadCachedLibrary(cacheDir, *lib, includes, errorMessage)) {
+      std::cerr << errorMessage << std::endl;
+      return -1;
+    }
+  }
+
+  // C++ code generation from inferTypes
+  if (inferTypes  ||  mode == std::string("c++")) {
+    std::string url = fileURL(fileLocations[0]);
+
+    std::vector<std::string> classNames = walkerCacheEntry.classNames;
+    std::string errorMessage;
+    std::string code = walkerCacheEntry.code;
+    if (code.empty()) {
+      code = generateCodeFromStreamers(url, treeLocation, classNames, errorMessage);
+
+      if (code.empty()) {
+        std::cerr << errorMessage << std::endl;
+        return -1;
+      }
+
+      if (!cacheDir.empty()) {
+        walkerCacheEntry.code = code;
+        walkerCacheEntry.classNames = classNames;
+        saveWalkerCacheEntry();
+      }
+    }
+
+    if (mode == std::string("c++")) {
+      std::cout << code << std::endl;
+      return 0;
+    }
+    else
+      declareClasses(code, classNames);
+  }
+
+  if (transport != std::string("pipe")) {
+    if (transport.substr(0, 4) != std::string("shm:")  ||  transport.size() == 4  ||  mode != std::string("dump")  ||  jobs > 1) {
+      std::cerr << "--transport must be \"pipe\" or \"shm:NAME\", and shm is only supported with --mode=dump (one job)." << std::endl;
+      return -1;
+    }
+    dumpRing = shmRingCreate(transport.substr(4).c_str(), SHM_RING_DEFAULT_CAPACITY);
+    if (dumpRing == nullptr) {
+      std::cerr << "Could not create shared-memory ring " << transport.substr(4) << ": " << strerror(errno) << std::endl;
+      return -1;
+    }
+  }
+
+  if (!checkpointFile.empty()) {
+    if (mode != std::string("avro")  ||  jobs > 1  ||  !outputDir.empty()  ||  !codecOptions.dictionaryFile.empty()) {
+      std::cerr << "--checkpoint is only supported with --mode=avro to standard output, in one job, and without --codec-dictionary." << std::endl;
+      return -1;
+    }
+    checkpoint = new Checkpoint(checkpointFile, hashArguments(argc, argv));
+    if (!checkpoint->resume(stdout)) {
+      std::cerr << checkpoint->errorMessage << std::endl;
+      return -1;
+    }
+    if (checkpoint->resumed)
+      start = checkpoint->nextEntry;
+  }
+
+#ifdef AVRO
+  if (!indexFile.empty()) {
+    // block offsets are only known to the process writing the whole file, from its beginning
+    if (mode != std::string("avro")  ||  jobs > 1  ||  !outputDir.empty()  ||  !checkpointFile.empty()) {
+      std::cerr << "--index is only supported with --mode=avro to standard output, in one job, and without --checkpoint." << std::endl;
+      return -1;
+    }
+    indexWriter = new AvroIndexWriter(indexFile);
+    if (!indexWriter->valid) {
+      std::cerr << indexWriter->errorMessage << std::endl;
+      return -1;
+    }
+  }
+#endif
+
+  if (jobs > 1)
+    return convertInJobs();
+
+  int result = convert();
+  if (result == 0  &&  checkpoint != nullptr  &&  !checkpoint->finish()) {
+    std::cerr << checkpoint->errorMessage << std::endl;
+    result = -1;
+  }
+  if (dumpRing != nullptr)
+    shmRingClose(dumpRing);          // stopped early: the consumer sees the end instead of waiting
+  return result;
+}
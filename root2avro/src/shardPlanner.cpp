@@ -0,0 +1,188 @@
+// Copyright 2016 Jim Pivarski
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//     http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <algorithm>
+#include <sstream>
+
+#include "jsonWriter.h"
+#include "shardPlanner.h"
+
+ClusterInfo::ClusterInfo(int fileIndex, int64_t start, int64_t end, int64_t globalStart) :
+  fileIndex(fileIndex), start(start), end(end), globalStart(globalStart), compressedBytes(0.0) { }
+
+bool readClusters(std::vector<std::string> &fileLocations, std::string treeLocation, std::vector<ClusterInfo> &clusters, std::string &errorMessage) {
+  int64_t globalStart = 0;
+
+  for (int fileIndex = 0;  fileIndex < fileLocations.size();  fileIndex++) {
+    std::string fileLocation = fileLocations[fileIndex];
+
+    TFile *file = TFile::Open(fileLocation.c_str());
+    if (file == nullptr  ||  !file->IsOpen()) {
+      errorMessage = std::string("File not found: ") + fileLocation;
+      delete file;
+      return false;
+    }
+
+    if (file->IsZombie()) {
+      errorMessage = std::string("Not a ROOT file: ") + fileLocation;
+      file->Close();
+      delete file;
+      return false;
+    }
+
+    TTree *ttree = nullptr;
+    file->GetObject(treeLocation.c_str(), ttree);
+    if (ttree == nullptr) {
+      errorMessage = std::string("Not a TTree: ") + treeLocation + std::string(" in file: ") + fileLocation;
+      file->Close();
+      delete file;
+      return false;
+    }
+
+    int64_t numEntries = ttree->GetEntries();
+    size_t first = clusters.size();
+
+    TTree::TClusterIterator clusterIterator = ttree->GetClusterIterator(0);
+    for (int64_t start = clusterIterator();  start < numEntries;  start = clusterIterator()) {
+      int64_t end = std::min((int64_t)clusterIterator.GetNextEntry(), numEntries);
+      clusters.push_back(ClusterInfo(fileIndex, start, end, globalStart + start));
+    }
+
+    TIter nextBranch = ttree->GetListOfBranches();
+    for (TBranch *tbranch = (TBranch*)nextBranch();  tbranch != nullptr;  tbranch = (TBranch*)nextBranch())
+      addBasketBytes(tbranch, clusters, first, clusters.size());
+
+    globalStart += numEntries;
+    file->Close();
+    delete file;
+  }
+
+  return true;
+}
+
+void addBasketBytes(TBranch *tbranch, std::vector<ClusterInfo> &clusters, size_t first, size_t last) {
+  // baskets still in memory when the file was written (write basket) are stored with the TTree
+  // and cost nothing extra to read, so only the flushed baskets are counted; the write basket's
+  // basketEntry is where it starts, so basketEntry[i + 1] ends every flushed one
+  int numBaskets = tbranch->GetWriteBasket();
+  Long64_t *basketEntry = tbranch->GetBasketEntry();
+  Int_t *basketBytes = tbranch->GetBasketBytes();
+
+  for (int i = 0;  i < numBaskets;  i++) {
+    int64_t start = basketEntry[i];
+    int64_t end = basketEntry[i + 1];
+    if (end <= start) continue;
+
+    // first cluster that ends after this basket starts
+    size_t lo = first;
+    size_t hi = last;
+    while (lo < hi) {
+      size_t mid = (lo + hi) / 2;
+      if (clusters[mid].end <= start) lo = mid + 1; else hi = mid;
+    }
+
+    for (size_t j = lo;  j < last  &&  clusters[j].start < end;  j++) {
+      int64_t overlap = std::min(end, clusters[j].end) - std::max(start, clusters[j].start);
+      if (overlap > 0)
+        clusters[j].compressedBytes += (double)basketBytes[i] * overlap / (end - start);
+    }
+  }
+
+  TIter nextBranch = tbranch->GetListOfBranches();
+  for (TBranch *subbranch = (TBranch*)nextBranch();  subbranch != nullptr;  subbranch = (TBranch*)nextBranch())
+    addBasketBytes(subbranch, clusters, first, last);
+}
+
+std::vector<ShardInfo> planShards(std::vector<ClusterInfo> &clusters, int numShards, int64_t start, int64_t end) {
+  // restrict to [start, end) in global entry numbers (negative means unbounded); edge clusters are clipped
+  std::vector<ClusterInfo> selected;
+  for (auto cluster = clusters.begin();  cluster != clusters.end();  ++cluster) {
+    int64_t globalEnd = cluster->globalStart + (cluster->end - cluster->start);
+    int64_t clipStart = (start >= 0) ? std::max(start, cluster->globalStart) : cluster->globalStart;
+    int64_t clipEnd = (end >= 0) ? std::min(end, globalEnd) : globalEnd;
+    if (clipStart >= clipEnd) continue;
+
+    ClusterInfo clipped = *cluster;
+    clipped.start += clipStart - cluster->globalStart;
+    clipped.end -= globalEnd - clipEnd;
+    clipped.globalStart = clipStart;
+    clipped.compressedBytes = cluster->compressedBytes * (clipEnd - clipStart) / (globalEnd - cluster->globalStart);
+    selected.push_back(clipped);
+  }
+
+  double total = 0.0;
+  for (auto cluster = selected.begin();  cluster != selected.end();  ++cluster)
+    total += cluster->compressedBytes;
+
+  if (numShards < 1) numShards = 1;
+  if (numShards > selected.size()) numShards = selected.size();
+
+  // contiguous partition: cut at the cluster edge nearest to each multiple of total/numShards,
+  // leaving at least one cluster for every remaining shard
+  std::vector<ShardInfo> shards;
+  double cumulative = 0.0;
+  size_t i = 0;
+  for (int shard = 0;  shard < numShards;  shard++) {
+    ShardInfo shardInfo;
+    shardInfo.compressedBytes = 0.0;
+    double target = total * (shard + 1) / numShards;
+
+    do {
+      ClusterInfo &cluster = selected[i];
+      if (!shardInfo.pieces.empty()  &&  shardInfo.pieces.back().fileIndex == cluster.fileIndex  &&  shardInfo.pieces.back().end == cluster.start) {
+        shardInfo.pieces.back().end = cluster.end;
+        shardInfo.pieces.back().compressedBytes += cluster.compressedBytes;
+      }
+      else
+        shardInfo.pieces.push_back(cluster);
+      shardInfo.compressedBytes += cluster.compressedBytes;
+      cumulative += cluster.compressedBytes;
+      i++;
+    } while (i < selected.size()  &&
+             selected.size() - i > numShards - shard - 1  &&
+             (shard == numShards - 1  ||  cumulative + selected[i].compressedBytes / 2.0 <= target));
+
+    shardInfo.globalStart = shardInfo.pieces.front().globalStart;
+    shardInfo.globalEnd = shardInfo.pieces.back().globalStart + (shardInfo.pieces.back().end - shardInfo.pieces.back().start);
+    shards.push_back(shardInfo);
+  }
+
+  return shards;
+}
+
+static std::string quoted(const std::string &string) {
+  JSONWriter out(string.size() + 2);
+  out << '"';
+  out.printEscapedString(string.c_str());
+  out << '"';
+  return out.buffer;
+}
+
+std::string planJSON(std::vector<ShardInfo> &shards, std::vector<std::string> &fileLocations, std::string treeLocation) {
+  std::ostringstream out;
+  out << "{\"tree\": " << quoted(treeLocation) << ", \"shards\": [";
+  bool first = true;
+  for (auto shard = shards.begin();  shard != shards.end();  ++shard) {
+    if (first) first = false; else out << ",";
+    out << "\n  {\"start\": " << shard->globalStart << ", \"end\": " << shard->globalEnd << ", \"compressedBytes\": " << (int64_t)shard->compressedBytes << ", \"files\": [";
+    bool firstPiece = true;
+    for (auto piece = shard->pieces.begin();  piece != shard->pieces.end();  ++piece) {
+      if (firstPiece) firstPiece = false; else out << ", ";
+      out << "{\"file\": " << quoted(fileLocations[piece->fileIndex]) << ", \"start\": " << piece->start << ", \"end\": " << piece->end << "}";
+    }
+    out << "]}";
+  }
+  out << "\n]}";
+  return out.str();
+}
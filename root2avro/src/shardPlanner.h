@@ -0,0 +1,58 @@
+// Copyright 2016 Jim Pivarski
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//     http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef SHARD_PLANNER_H
+#define SHARD_PLANNER_H
+
+// C includes
+#include <stdint.h>
+
+// C++ includes
+#include <string>
+#include <vector>
+
+// ROOT includes
+#include <TBranch.h>
+#include <TFile.h>
+#include <TObjArray.h>
+#include <TTree.h>
+
+// A cluster is the smallest range of entries that can be read without touching baskets
+// shared with another range. Shards are contiguous runs of clusters with (roughly) equal
+// compressed bytes, so no two shards decompress the same basket.
+
+class ClusterInfo {
+public:
+  int fileIndex;
+  int64_t start;           // entry numbers within the file
+  int64_t end;
+  int64_t globalStart;     // entry number counting from the beginning of the first file
+  double compressedBytes;  // baskets that straddle clusters are divided in proportion to their entries
+  ClusterInfo(int fileIndex, int64_t start, int64_t end, int64_t globalStart);
+};
+
+class ShardInfo {
+public:
+  int64_t globalStart;
+  int64_t globalEnd;
+  double compressedBytes;
+  std::vector<ClusterInfo> pieces;  // one per file, merged from adjacent clusters
+};
+
+bool readClusters(std::vector<std::string> &fileLocations, std::string treeLocation, std::vector<ClusterInfo> &clusters, std::string &errorMessage);
+void addBasketBytes(TBranch *tbranch, std::vector<ClusterInfo> &clusters, size_t first, size_t last);
+std::vector<ShardInfo> planShards(std::vector<ClusterInfo> &clusters, int numShards, int64_t start, int64_t end);
+std::string planJSON(std::vector<ShardInfo> &shards, std::vector<std::string> &fileLocations, std::string treeLocation);
+
+#endif // SHARD_PLANNER_H
@@ -0,0 +1,249 @@
+// Copyright 2016 Jim Pivarski
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//     http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// C includes
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "shmRing.h"
+
+///////////////////////////////////////////////////////////////////// waiting and waking
+
+// The waiter reads the signal, says it is waiting, and checks its condition again before
+// sleeping; the other side moves head or tail, increments the signal, and then looks at the
+// waiting flag. With sequentially consistent operations, either the waiter sees the move or
+// the mover sees the flag (and the futex only sleeps if the signal is still what was read).
+
+static void futexWait(uint32_t *address, uint32_t expected) {
+  struct timespec timeout = {0, SHM_RING_WAIT_MS * 1000000L};
+  syscall(SYS_futex, address, FUTEX_WAIT, expected, &timeout, NULL, 0);
+}
+
+static void futexWake(uint32_t *address) {
+  syscall(SYS_futex, address, FUTEX_WAKE, 1, NULL, NULL, 0);
+}
+
+static void notify(uint32_t *signal, uint32_t *waiting) {
+  __atomic_add_fetch(signal, 1, __ATOMIC_SEQ_CST);
+  if (__atomic_load_n(waiting, __ATOMIC_SEQ_CST))
+    futexWake(signal);
+}
+
+static uint64_t load(uint64_t *value) {
+  return __atomic_load_n(value, __ATOMIC_SEQ_CST);
+}
+
+// a process that was killed can't set its closed flag; if its parent hasn't waited for it yet
+// (e.g. the other side started it), it still exists, but as a zombie
+static int gone(uint32_t *closed, int32_t *pid) {
+  if (__atomic_load_n(closed, __ATOMIC_SEQ_CST))
+    return 1;
+  pid_t other = __atomic_load_n(pid, __ATOMIC_SEQ_CST);
+  if (other == 0)
+    return 0;
+  if (kill(other, 0) != 0)
+    return errno == ESRCH;
+
+  char path[32];
+  snprintf(path, sizeof(path), "/proc/%d/stat", (int)other);
+  FILE *stat = fopen(path, "r");
+  if (stat == NULL)
+    return 0;
+  char state = 0;
+  int matched = fscanf(stat, "%*d (%*[^)]) %c", &state);
+  fclose(stat);
+  return matched == 1  &&  state == 'Z';
+}
+
+///////////////////////////////////////////////////////////////////// setting up
+
+static char *segmentName(const char *name) {
+  // shm_open names are "/something"
+  char *out = (char*)malloc(strlen(name) + 2);
+  if (out == NULL) return NULL;
+  out[0] = '/';
+  strcpy(out + (name[0] == '/' ? 0 : 1), name);
+  return out;
+}
+
+static ShmRing *mapSegment(char *name, int fd, size_t size, int producer) {
+  void *address = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (address == MAP_FAILED) {
+    free(name);
+    return NULL;
+  }
+  ShmRing *ring = (ShmRing*)malloc(sizeof(ShmRing));
+  if (ring == NULL) {
+    munmap(address, size);
+    free(name);
+    errno = ENOMEM;
+    return NULL;
+  }
+  ring->name = name;
+  ring->header = (ShmRingHeader*)address;
+  ring->data = (char*)address + sizeof(ShmRingHeader);
+  ring->mappedSize = size;
+  ring->producer = producer;
+  return ring;
+}
+
+ShmRing *shmRingCreate(const char *name, uint64_t capacity) {
+  uint64_t rounded = 4096;
+  while (rounded < capacity)
+    rounded *= 2;
+
+  char *fullName = segmentName(name);
+  if (fullName == NULL) return NULL;
+
+  shm_unlink(fullName);              // a leftover from a consumer that never came
+  int fd = shm_open(fullName, O_CREAT | O_EXCL | O_RDWR, 0600);
+  size_t size = sizeof(ShmRingHeader) + rounded;
+  if (fd == -1  ||  ftruncate(fd, size) != 0) {
+    if (fd != -1) close(fd);
+    free(fullName);
+    return NULL;
+  }
+
+  ShmRing *ring = mapSegment(fullName, fd, size, 1);
+  if (ring == NULL) return NULL;
+  memset(ring->header, 0, sizeof(ShmRingHeader));
+  ring->header->capacity = rounded;
+  ring->header->producerPid = getpid();
+  __atomic_store_n(&ring->header->magic, SHM_RING_MAGIC, __ATOMIC_SEQ_CST);    // last: the consumer checks it
+  return ring;
+}
+
+ShmRing *shmRingOpen(const char *name) {
+  char *fullName = segmentName(name);
+  if (fullName == NULL) return NULL;
+
+  int fd = shm_open(fullName, O_RDWR, 0600);
+  struct stat status;
+  if (fd == -1  ||  fstat(fd, &status) != 0  ||  (size_t)status.st_size < sizeof(ShmRingHeader)) {
+    if (fd != -1) { close(fd); errno = EAGAIN; }
+    free(fullName);
+    return NULL;
+  }
+
+  ShmRing *ring = mapSegment(fullName, fd, status.st_size, 0);
+  if (ring == NULL) return NULL;
+  if (__atomic_load_n(&ring->header->magic, __ATOMIC_SEQ_CST) != SHM_RING_MAGIC  ||
+      sizeof(ShmRingHeader) + ring->header->capacity != ring->mappedSize) {
+    munmap(ring->header, ring->mappedSize);
+    free(ring->name);
+    free(ring);
+    errno = EAGAIN;                  // the producer hasn't finished setting it up
+    return NULL;
+  }
+  __atomic_store_n(&ring->header->consumerPid, getpid(), __ATOMIC_SEQ_CST);
+  return ring;
+}
+
+void shmRingClose(ShmRing *ring) {
+  ShmRingHeader *header = ring->header;
+  if (ring->producer) {
+    __atomic_store_n(&header->producerClosed, 1, __ATOMIC_SEQ_CST);
+    notify(&header->dataSignal, &header->consumerWaiting);
+  }
+  else {
+    __atomic_store_n(&header->consumerClosed, 1, __ATOMIC_SEQ_CST);
+    notify(&header->spaceSignal, &header->producerWaiting);
+    shm_unlink(ring->name);
+  }
+  munmap(ring->header, ring->mappedSize);
+  free(ring->name);
+  free(ring);
+}
+
+///////////////////////////////////////////////////////////////////// moving bytes
+
+int shmRingWrite(ShmRing *ring, const void *data, size_t size) {
+  ShmRingHeader *header = ring->header;
+  uint64_t capacity = header->capacity;
+  const char *in = (const char*)data;
+
+  while (size > 0) {
+    uint64_t head = header->head;    // only this side moves it
+    uint64_t space = capacity - (head - load(&header->tail));
+
+    if (space == 0) {
+      if (gone(&header->consumerClosed, &header->consumerPid))
+        return 0;
+      uint32_t seen = __atomic_load_n(&header->spaceSignal, __ATOMIC_SEQ_CST);
+      __atomic_store_n(&header->producerWaiting, 1, __ATOMIC_SEQ_CST);
+      if (head - load(&header->tail) == capacity  &&  !__atomic_load_n(&header->consumerClosed, __ATOMIC_SEQ_CST))
+        futexWait(&header->spaceSignal, seen);
+      __atomic_store_n(&header->producerWaiting, 0, __ATOMIC_SEQ_CST);
+      continue;
+    }
+
+    size_t n = size < space ? size : space;
+    size_t offset = head & (capacity - 1);
+    size_t first = n < capacity - offset ? n : capacity - offset;
+    memcpy(ring->data + offset, in, first);
+    memcpy(ring->data, in + first, n - first);
+
+    __atomic_store_n(&header->head, head + n, __ATOMIC_SEQ_CST);
+    notify(&header->dataSignal, &header->consumerWaiting);
+    in += n;
+    size -= n;
+  }
+  return 1;
+}
+
+size_t shmRingRead(ShmRing *ring, void *data, size_t size) {
+  ShmRingHeader *header = ring->header;
+  uint64_t capacity = header->capacity;
+  char *out = (char*)data;
+  size_t done = 0;
+
+  while (done < size) {
+    uint64_t tail = header->tail;    // only this side moves it
+    uint64_t available = load(&header->head) - tail;
+
+    if (available == 0) {
+      // closed is set after the last head move, so head has to be checked again after it
+      if (gone(&header->producerClosed, &header->producerPid)  &&  load(&header->head) == tail)
+        return done;
+      uint32_t seen = __atomic_load_n(&header->dataSignal, __ATOMIC_SEQ_CST);
+      __atomic_store_n(&header->consumerWaiting, 1, __ATOMIC_SEQ_CST);
+      if (load(&header->head) == tail  &&  !__atomic_load_n(&header->producerClosed, __ATOMIC_SEQ_CST))
+        futexWait(&header->dataSignal, seen);
+      __atomic_store_n(&header->consumerWaiting, 0, __ATOMIC_SEQ_CST);
+      continue;
+    }
+
+    size_t n = size - done < available ? size - done : available;
+    size_t offset = tail & (capacity - 1);
+    size_t first = n < capacity - offset ? n : capacity - offset;
+    memcpy(out + done, ring->data + offset, first);
+    memcpy(out + done + first, ring->data, n - first);
+
+    __atomic_store_n(&header->tail, tail + n, __ATOMIC_SEQ_CST);
+    notify(&header->spaceSignal, &header->producerWaiting);
+    done += n;
+  }
+  return done;
+}
@@ -0,0 +1,92 @@
+// Copyright 2016 Jim Pivarski
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//     http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef SHM_RING_H
+#define SHM_RING_H
+
+// C includes
+#include <stddef.h>
+#include <stdint.h>
+
+// A single-producer, single-consumer ring of bytes in POSIX shared memory (shm_open), for
+// --transport=shm:NAME: root2avro writes the same byte stream as --mode=dump would write to
+// stdout, and a consumer in another process maps the segment and reads it without a pipe in
+// between. The producer only moves head and the consumer only moves tail (both count bytes
+// since the start, so head - tail is the number of unread bytes); a side that has to wait
+// sleeps on a futex in the segment and is woken by the other only if it said it was waiting.
+// Waits are bounded, so that a side that was killed (and never closed the ring) is noticed by
+// its pid, as a pipe would give EPIPE or end-of-file; both processes must share a pid namespace.
+// 
+// This is plain C so that a consumer can link it (or call it through JNA from the .so).
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SHM_RING_MAGIC 0x31474e4952545352ULL     // "RSTRING1"
+#define SHM_RING_DEFAULT_CAPACITY (64 * 1024 * 1024)
+#define SHM_RING_WAIT_MS 100                     // how often a waiting side checks that the other is alive
+
+typedef struct {
+  // written once by the producer
+  uint64_t magic;
+  uint64_t capacity;                 // bytes of data after this header, a power of 2
+  char pad0[48];
+
+  // producer's cache line
+  uint64_t head;
+  uint32_t dataSignal;               // incremented (and futex-woken) when head moves or the producer closes
+  uint32_t producerWaiting;
+  uint32_t producerClosed;
+  int32_t producerPid;
+  char pad1[40];
+
+  // consumer's cache line
+  uint64_t tail;
+  uint32_t spaceSignal;              // incremented (and futex-woken) when tail moves or the consumer closes
+  uint32_t consumerWaiting;
+  uint32_t consumerClosed;
+  int32_t consumerPid;               // 0 until a consumer has opened the ring
+  char pad2[40];
+} ShmRingHeader;
+
+typedef struct {
+  char *name;
+  ShmRingHeader *header;
+  char *data;
+  size_t mappedSize;
+  int producer;
+} ShmRing;
+
+// producer: creates (or replaces) the segment; NULL and errno on failure
+ShmRing *shmRingCreate(const char *name, uint64_t capacity);
+
+// blocks until all of the bytes are in the ring; 0 if the consumer has closed the ring or died
+int shmRingWrite(ShmRing *ring, const void *data, size_t size);
+
+// consumer: maps an existing segment; NULL and errno on failure (e.g. not created yet)
+ShmRing *shmRingOpen(const char *name);
+
+// blocks until size bytes have been read; returns the number read, which is less than size
+// only if the producer closed the ring or died
+size_t shmRingRead(ShmRing *ring, void *data, size_t size);
+
+// either side: tells the other side, unmaps, and (consumer) removes the name
+void shmRingClose(ShmRing *ring);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // SHM_RING_H
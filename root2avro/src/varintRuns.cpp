@@ -0,0 +1,240 @@
+// Copyright 2016 Jim Pivarski
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//     http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// C includes
+#include <string.h>
+
+#if defined(__x86_64__)  ||  defined(__i386__)
+#define VARINT_X86
+#include <immintrin.h>
+#endif
+
+#include "varintRuns.h"
+
+///////////////////////////////////////////////////////////////////// scalar
+
+static inline size_t putVarint(uint64_t encoded, char *out) {   // as in AvroEncoder::putLong
+  size_t size = 0;
+  while (encoded & ~((uint64_t)0x7f)) {
+    out[size++] = (char)((encoded & 0x7f) | 0x80);
+    encoded >>= 7;
+  }
+  out[size++] = (char)encoded;
+  return size;
+}
+
+template <typename T>
+static size_t scalarRun(const T *items, int numItems, char *out) {
+  size_t size = 0;
+  for (int i = 0;  i < numItems;  i++) {
+    int64_t value = items[i];
+    size += putVarint(((uint64_t)value << 1) ^ (uint64_t)(value >> 63), out + size);
+  }
+  return size;
+}
+
+// not inlined into encodeRun, so that dispatching to the scalar loop runs this very code (a copy at
+// another address measured 30% slower on the same instructions)
+__attribute__((noinline)) size_t encodeVarintsScalar(const int16_t *items, int numItems, char *out) { return scalarRun(items, numItems, out); }
+__attribute__((noinline)) size_t encodeVarintsScalar(const int32_t *items, int numItems, char *out) { return scalarRun(items, numItems, out); }
+__attribute__((noinline)) size_t encodeVarintsScalar(const int64_t *items, int numItems, char *out) { return scalarRun(items, numItems, out); }
+
+#ifdef VARINT_X86
+
+///////////////////////////////////////////////////////////////////// vectorized
+
+// A zig-zagged item z with at most MAXBYTES 7-bit groups becomes one 64-bit word whose byte k
+// is group k, with 0x80 set if any higher group is nonzero; that is exactly its varint, and
+// its length is one more than the number of continuation bits. Shorts need at most 3 bytes,
+// ints 5, and longs are handled this way only if they fit in 8 (z < 2^56).
+
+static inline size_t storeWord(uint64_t word, char *out) {
+  memcpy(out, &word, sizeof(uint64_t));     // the bytes past the varint are overwritten by the next one
+  return 1 + __builtin_popcountll(word & 0x8080808080808080ULL);
+}
+
+__attribute__((target("sse4.1"))) static inline __m128i load2(const int16_t *items) {
+  int32_t pair;
+  memcpy(&pair, items, sizeof(int32_t));
+  return _mm_cvtepi16_epi64(_mm_cvtsi32_si128(pair));
+}
+
+__attribute__((target("sse4.1"))) static inline __m128i load2(const int32_t *items) {
+  return _mm_cvtepi32_epi64(_mm_loadl_epi64((const __m128i*)items));
+}
+
+__attribute__((target("sse4.1"))) static inline __m128i load2(const int64_t *items) {
+  return _mm_loadu_si128((const __m128i*)items);
+}
+
+template <typename T, int MAXBYTES>
+__attribute__((target("sse4.1"))) static size_t sse41Run(const T *items, int numItems, char *out) {
+  const __m128i zero = _mm_setzero_si128();
+  size_t size = 0;
+  int i = 0;
+  for (;  i + 2 <= numItems;  i += 2) {
+    __m128i value = load2(items + i);
+    __m128i z = _mm_xor_si128(_mm_slli_epi64(value, 1), _mm_sub_epi64(zero, _mm_srli_epi64(value, 63)));
+
+    __m128i high = _mm_srli_epi64(z, 7);
+    if (_mm_testz_si128(high, high)) {                // both are one byte: just their low bytes
+      uint16_t bytes = _mm_extract_epi16(_mm_shuffle_epi8(z, _mm_setr_epi8(0, 8, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1)), 0);
+      memcpy(out + size, &bytes, sizeof(uint16_t));
+      size += 2;
+      continue;
+    }
+
+    if (MAXBYTES == 8  &&  !_mm_testz_si128(_mm_srli_epi64(z, 56), _mm_srli_epi64(z, 56))) {
+      size += scalarRun(items + i, 2, out + size);
+      continue;
+    }
+
+    __m128i word = _mm_and_si128(z, _mm_set1_epi64x(0x7f));
+    for (int k = 1;  k < MAXBYTES;  k++) {
+      __m128i group = _mm_and_si128(_mm_sll_epi64(z, _mm_cvtsi32_si128(k)), _mm_set1_epi64x(0x7fLL << (8*k)));
+      __m128i higher = _mm_srl_epi64(z, _mm_cvtsi32_si128(7*k));
+      __m128i continuation = _mm_andnot_si128(_mm_cmpeq_epi64(higher, zero), _mm_set1_epi64x(0x80LL << (8*(k - 1))));
+      word = _mm_or_si128(word, _mm_or_si128(group, continuation));
+    }
+
+    uint64_t words[2];
+    _mm_storeu_si128((__m128i*)words, word);
+    size += storeWord(words[0], out + size);
+    size += storeWord(words[1], out + size);
+  }
+  return size + scalarRun(items + i, numItems - i, out + size);
+}
+
+__attribute__((target("avx2"))) static inline __m256i load4(const int16_t *items) {
+  return _mm256_cvtepi16_epi64(_mm_loadl_epi64((const __m128i*)items));
+}
+
+__attribute__((target("avx2"))) static inline __m256i load4(const int32_t *items) {
+  return _mm256_cvtepi32_epi64(_mm_loadu_si128((const __m128i*)items));
+}
+
+__attribute__((target("avx2"))) static inline __m256i load4(const int64_t *items) {
+  return _mm256_loadu_si256((const __m256i*)items);
+}
+
+template <typename T, int MAXBYTES>
+__attribute__((target("avx2"))) static size_t avx2Run(const T *items, int numItems, char *out) {
+  const __m256i zero = _mm256_setzero_si256();
+  size_t size = 0;
+  int i = 0;
+  for (;  i + 4 <= numItems;  i += 4) {
+    __m256i value = load4(items + i);
+    __m256i z = _mm256_xor_si256(_mm256_slli_epi64(value, 1), _mm256_sub_epi64(zero, _mm256_srli_epi64(value, 63)));
+
+    __m256i high = _mm256_srli_epi64(z, 7);
+    if (_mm256_testz_si256(high, high)) {             // all four are one byte: just their low bytes
+      __m256i low = _mm256_shuffle_epi8(z, _mm256_setr_epi8(0, 8, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+                                                            0, 8, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1));
+      uint32_t bytes = (uint32_t)_mm256_extract_epi16(low, 0) | ((uint32_t)_mm256_extract_epi16(low, 8) << 16);
+      memcpy(out + size, &bytes, sizeof(uint32_t));
+      size += 4;
+      continue;
+    }
+
+    if (MAXBYTES == 8  &&  !_mm256_testz_si256(_mm256_srli_epi64(z, 56), _mm256_srli_epi64(z, 56))) {
+      size += scalarRun(items + i, 4, out + size);
+      continue;
+    }
+
+    __m256i word = _mm256_and_si256(z, _mm256_set1_epi64x(0x7f));
+    for (int k = 1;  k < MAXBYTES;  k++) {
+      __m256i group = _mm256_and_si256(_mm256_sll_epi64(z, _mm_cvtsi32_si128(k)), _mm256_set1_epi64x(0x7fLL << (8*k)));
+      __m256i higher = _mm256_srl_epi64(z, _mm_cvtsi32_si128(7*k));
+      __m256i continuation = _mm256_andnot_si256(_mm256_cmpeq_epi64(higher, zero), _mm256_set1_epi64x(0x80LL << (8*(k - 1))));
+      word = _mm256_or_si256(word, _mm256_or_si256(group, continuation));
+    }
+
+    uint64_t words[4];
+    _mm256_storeu_si256((__m256i*)words, word);
+    size += storeWord(words[0], out + size);
+    size += storeWord(words[1], out + size);
+    size += storeWord(words[2], out + size);
+    size += storeWord(words[3], out + size);
+  }
+  return size + sse41Run<T, MAXBYTES>(items + i, numItems - i, out + size);
+}
+
+#endif // VARINT_X86
+
+///////////////////////////////////////////////////////////////////// dispatch
+
+enum VarintInstructionSet { VarintScalar, VarintSSE41, VarintAVX2 };
+
+static bool cpuHas(VarintInstructionSet which) {
+#ifdef VARINT_X86
+  __builtin_cpu_init();
+  switch (which) {
+    case VarintAVX2:   return __builtin_cpu_supports("avx2");
+    case VarintSSE41:  return __builtin_cpu_supports("sse4.1");
+    default:           return true;
+  }
+#else
+  return which == VarintScalar;
+#endif
+}
+
+// SSE4.1 (2 items at a time) is slower than the scalar loop as soon as items need more than one
+// byte (varintBench: x0.55 for longs up to 10000), so without AVX2 it's the scalar loop
+static VarintInstructionSet detectInstructionSet() {
+  return cpuHas(VarintAVX2) ? VarintAVX2 : VarintScalar;
+}
+
+static VarintInstructionSet &instructionSet() {
+  static VarintInstructionSet which = detectInstructionSet();
+  return which;
+}
+
+template <typename T, int MAXBYTES>
+static size_t encodeRun(const T *items, int numItems, char *out) {
+  switch (instructionSet()) {
+#ifdef VARINT_X86
+    case VarintAVX2:   return avx2Run<T, MAXBYTES>(items, numItems, out);
+    case VarintSSE41:  return sse41Run<T, MAXBYTES>(items, numItems, out);
+#endif
+    default:           return encodeVarintsScalar(items, numItems, out);
+  }
+}
+
+size_t encodeVarints(const int16_t *items, int numItems, char *out) { return encodeRun<int16_t, 3>(items, numItems, out); }
+size_t encodeVarints(const int32_t *items, int numItems, char *out) { return encodeRun<int32_t, 5>(items, numItems, out); }
+size_t encodeVarints(const int64_t *items, int numItems, char *out) { return encodeRun<int64_t, 8>(items, numItems, out); }
+
+const char *varintInstructionSet() {
+  switch (instructionSet()) {
+    case VarintAVX2:   return "avx2";
+    case VarintSSE41:  return "sse4.1";
+    default:           return "scalar";
+  }
+}
+
+bool forceVarintInstructionSet(const char *name) {
+  VarintInstructionSet wanted;
+  if (strcmp(name, "avx2") == 0)
+    wanted = VarintAVX2;
+  else if (strcmp(name, "sse4.1") == 0)
+    wanted = VarintSSE41;
+  else if (strcmp(name, "scalar") == 0)
+    wanted = VarintScalar;
+  else
+    return false;
+  if (!cpuHas(wanted))
+    return false;
+  instructionSet() = wanted;
+  return true;
+}
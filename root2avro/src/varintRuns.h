@@ -0,0 +1,46 @@
+// Copyright 2016 Jim Pivarski
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//     http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef VARINT_RUNS_H
+#define VARINT_RUNS_H
+
+// C includes
+#include <stddef.h>
+#include <stdint.h>
+
+// Avro zig-zag varints for a whole run of integers, the same bytes as AvroEncoder::writeLong
+// for each item. On x86 with AVX2 (checked at runtime), the zig-zag and the splitting into
+// 7-bit groups (with continuation bits) are done on 4 items at a time; each item is then stored
+// as one 8-byte word and the output advances by its length. Longs that need more than 8 bytes go
+// through the scalar loop, as do all items on other CPUs: the SSE4.1 version (2 items at a time)
+// is slower than the scalar loop for items of more than one byte, so it is only run if forced.
+//
+// out must have room for 10 bytes per item (what AvroEncoder::putLong reserves).
+
+size_t encodeVarints(const int16_t *items, int numItems, char *out);
+size_t encodeVarints(const int32_t *items, int numItems, char *out);
+size_t encodeVarints(const int64_t *items, int numItems, char *out);
+
+// the portable loop, for comparison (and for the CPUs without AVX2)
+size_t encodeVarintsScalar(const int16_t *items, int numItems, char *out);
+size_t encodeVarintsScalar(const int32_t *items, int numItems, char *out);
+size_t encodeVarintsScalar(const int64_t *items, int numItems, char *out);
+
+const char *varintInstructionSet();   // "avx2" or "scalar" (or "sse4.1", if forced)
+
+// makes encodeVarints use the named one of these instead (for benchmarks and tests, not while
+// encoding); false if this CPU or build doesn't have it
+bool forceVarintInstructionSet(const char *name);
+
+#endif // VARINT_RUNS_H
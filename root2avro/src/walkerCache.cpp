@@ -0,0 +1,275 @@
+// Copyright 2016 Jim Pivarski
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//     http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+// C includes
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// C++ includes
+#include <map>
+#include <set>
+
+#include "TStreamerInfo.h"
+
+#include "walkerCache.h"
+
+#define WALKER_CACHE_MAGIC "root2avro-walker-cache 1\n"
+
+///////////////////////////////////////////////////////////////////// keys
+
+static uint64_t fnv1a(const std::string &data, uint64_t hash) {
+  for (size_t i = 0;  i < data.size();  i++) {
+    hash ^= (unsigned char)data[i];
+    hash *= 1099511628211ULL;
+  }
+  return hash;
+}
+
+static void describeBranches(TObjArray *branches, std::string &description) {
+  TIter nextBranch(branches);
+  for (TBranch *tbranch = (TBranch*)nextBranch();  tbranch != nullptr;  tbranch = (TBranch*)nextBranch()) {
+    description += std::string("\nbranch ") + tbranch->GetName() + std::string(" ") + tbranch->GetClassName();
+    TIter nextLeaf(tbranch->GetListOfLeaves());
+    for (TLeaf *tleaf = (TLeaf*)nextLeaf();  tleaf != nullptr;  tleaf = (TLeaf*)nextLeaf()) {
+      TLeaf *counter = tleaf->GetLeafCount();
+      description += std::string("\nleaf ") + tleaf->GetName() + std::string(" ") + tleaf->GetTypeName() + std::string(" ") + std::to_string(tleaf->GetLenStatic()) + std::string(" ") + (counter == nullptr ? "" : counter->GetName());
+    }
+    describeBranches(tbranch->GetListOfBranches(), description);
+  }
+}
+
+std::string walkerCacheKey(TFile *file, TTree *ttree, std::string options) {
+  std::string description = options;
+
+  TList *infos = file->GetStreamerInfoList();
+  if (infos != nullptr) {
+    TIter nextInfo(infos);
+    for (TObject *object = nextInfo();  object != nullptr;  object = nextInfo()) {
+      TStreamerInfo *info = dynamic_cast<TStreamerInfo*>(object);     // skip the list of schema rules
+      if (info != nullptr)
+        description += std::string("\nstreamer ") + info->GetName() + std::string(" ") + std::to_string(info->GetClassVersion()) + std::string(" ") + std::to_string(info->GetCheckSum());
+    }
+    infos->Delete();
+    delete infos;
+  }
+
+  description += std::string("\ntree ") + ttree->GetName();
+  describeBranches(ttree->GetListOfBranches(), description);
+
+  // two FNV-1a hashes (as for the Avro sync marker), as 32 hex digits
+  uint64_t hash1 = fnv1a(description, 14695981039346656037ULL);
+  uint64_t hash2 = fnv1a(description, hash1 ^ 0x5bd1e9955bd1e995ULL);
+  char key[33];
+  snprintf(key, sizeof(key), "%016llx%016llx", (unsigned long long)hash1, (unsigned long long)hash2);
+  return std::string(key);
+}
+
+bool walkerCacheKey(std::string url, std::string treeLocation, std::string options, std::string &key, std::string &errorMessage) {
+  TFile *file = TFile::Open(url.c_str());
+  if (file == nullptr  ||  !file->IsOpen()  ||  file->IsZombie()) {
+    errorMessage = std::string("File not found or not a ROOT file: ") + url;
+    return false;
+  }
+  TTree *ttree = dynamic_cast<TTree*>(file->Get(treeLocation.c_str()));
+  if (ttree == nullptr) {
+    errorMessage = std::string("Not a TTree: ") + treeLocation + std::string(" in file: ") + url;
+    file->Close();
+    return false;
+  }
+  key = walkerCacheKey(file, ttree, options);
+  file->Close();
+  return true;
+}
+
+///////////////////////////////////////////////////////////////////// entries
+
+// "name size\n", size bytes, "\n" for each item
+
+static void writeItem(FILE *out, const char *name, const std::string &value) {
+  fprintf(out, "%s %zu\n", name, value.size());
+  fwrite(value.data(), 1, value.size(), out);
+  fputc('\n', out);
+}
+
+bool WalkerCacheEntry::load(std::string directory, std::string key) {
+  FILE *in = fopen((directory + std::string("/walkers/") + key).c_str(), "rb");
+  if (in == nullptr)
+    return false;
+
+  std::string contents;
+  char buffer[65536];
+  size_t size;
+  while ((size = fread(buffer, 1, sizeof(buffer), in)) > 0)
+    contents.append(buffer, size);
+  fclose(in);
+
+  std::string magic(WALKER_CACHE_MAGIC);
+  if (contents.compare(0, magic.size(), magic) != 0)
+    return false;
+
+  WalkerCacheEntry entry;
+  size_t position = magic.size();
+  while (position < contents.size()) {
+    size_t space = contents.find(' ', position);
+    size_t newline = contents.find('\n', position);
+    if (space == std::string::npos  ||  newline == std::string::npos  ||  space > newline)
+      return false;
+    std::string name = contents.substr(position, space - position);
+    size_t length = strtoull(contents.c_str() + space + 1, nullptr, 10);
+    if (newline + 1 + length + 1 > contents.size())
+      return false;
+    std::string value = contents.substr(newline + 1, length);
+    position = newline + 1 + length + 1;
+
+    if (name == std::string("resolution")) {
+      size_t tab = value.find('\t');
+      if (tab == std::string::npos) return false;
+      entry.resolutions.push_back(std::make_pair(value.substr(0, tab), value.substr(tab + 1)));
+    }
+    else if (name == std::string("class"))
+      entry.classNames.push_back(value);
+    else if (name == std::string("code"))
+      entry.code = value;
+    else if (name == std::string("schema"))
+      entry.schema = value;
+    else if (name == std::string("repr"))
+      entry.repr = value;
+  }
+
+  *this = entry;
+  return true;
+}
+
+bool WalkerCacheEntry::save(std::string directory, std::string key, std::string &errorMessage) {
+  std::string walkers = directory + std::string("/walkers");
+  if ((mkdir(directory.c_str(), 0777) != 0  &&  errno != EEXIST)  ||  (mkdir(walkers.c_str(), 0777) != 0  &&  errno != EEXIST)) {
+    errorMessage = std::string("Could not create cache directory ") + walkers + std::string(": ") + strerror(errno);
+    return false;
+  }
+
+  // other processes may be writing the same entry; each renames its own complete file over it
+  std::string path = walkers + std::string("/") + key;
+  std::string temporary = path + std::string(".") + std::to_string(getpid()) + std::string(".tmp");
+  FILE *out = fopen(temporary.c_str(), "wb");
+  if (out == nullptr) {
+    errorMessage = std::string("Could not write cache entry ") + temporary + std::string(": ") + strerror(errno);
+    return false;
+  }
+
+  fwrite(WALKER_CACHE_MAGIC, 1, strlen(WALKER_CACHE_MAGIC), out);
+  for (auto resolution = resolutions.begin();  resolution != resolutions.end();  ++resolution)
+    writeItem(out, "resolution", resolution->first + std::string("\t") + resolution->second);
+  for (auto className = classNames.begin();  className != classNames.end();  ++className)
+    writeItem(out, "class", *className);
+  writeItem(out, "code", code);
+  writeItem(out, "schema", schema);
+  writeItem(out, "repr", repr);
+
+  if (fclose(out) != 0  ||  rename(temporary.c_str(), path.c_str()) != 0) {
+    errorMessage = std::string("Could not write cache entry ") + path + std::string(": ") + strerror(errno);
+    unlink(temporary.c_str());
+    return false;
+  }
+  return true;
+}
+
+///////////////////////////////////////////////////////////////////// resolutions
+
+// Recording and applying visit the walkers in the same order, so that the paths match. When
+// applying, an unresolved TObjArray or TClonesArray with a cached class is resolved as it is
+// reached (as resolve would, from its first item) and then visited like any other.
+
+typedef std::vector<std::pair<std::string, std::string> > Resolutions;
+
+static void visit(FieldWalker *walker, std::string path, std::set<ClassWalker*> &visiting, Resolutions *recorded, const std::map<std::string, std::string> *cached) {
+  if (walker == nullptr)
+    return;
+
+  ClassWalker *classWalker = dynamic_cast<ClassWalker*>(walker);
+  if (classWalker != nullptr) {
+    if (!visiting.insert(classWalker).second)
+      return;
+    for (auto member = classWalker->members.begin();  member != classWalker->members.end();  ++member)
+      visit((*member)->walker, path + std::string(".") + (*member)->fieldName, visiting, recorded, cached);
+    return;
+  }
+
+  PointerWalker *pointerWalker = dynamic_cast<PointerWalker*>(walker);
+  if (pointerWalker != nullptr)
+    return visit(pointerWalker->walker, path + std::string("*"), visiting, recorded, cached);
+
+  StdVectorWalker *stdVectorWalker = dynamic_cast<StdVectorWalker*>(walker);
+  if (stdVectorWalker != nullptr)
+    return visit(stdVectorWalker->walker, path + std::string("[]"), visiting, recorded, cached);
+
+  ArrayWalker *arrayWalker = dynamic_cast<ArrayWalker*>(walker);
+  if (arrayWalker != nullptr)
+    return visit(arrayWalker->walker, path + std::string("[]"), visiting, recorded, cached);
+
+  TObjArrayWalker *tObjArrayWalker = dynamic_cast<TObjArrayWalker*>(walker);
+  if (tObjArrayWalker != nullptr) {
+    if (!tObjArrayWalker->resolved()  &&  cached != nullptr) {
+      auto found = cached->find(path);
+      TClass *tclass = found == cached->end() ? nullptr : TClass::GetClass(found->second.c_str());
+      if (tclass != nullptr) {
+        tObjArrayWalker->classToAssert = tclass;
+        tObjArrayWalker->walker = new ClassWalker(tObjArrayWalker->fieldName, tclass, tObjArrayWalker->avroNamespace, tObjArrayWalker->defs);
+        ((ClassWalker*)tObjArrayWalker->walker)->fill();
+      }
+    }
+    if (tObjArrayWalker->resolved()  &&  recorded != nullptr)
+      recorded->push_back(std::make_pair(path, std::string(tObjArrayWalker->classToAssert->GetName())));
+    return visit(tObjArrayWalker->walker, path + std::string("[]"), visiting, recorded, cached);
+  }
+
+  TClonesArrayWalker *tClonesArrayWalker = dynamic_cast<TClonesArrayWalker*>(walker);
+  if (tClonesArrayWalker != nullptr) {
+    if (!tClonesArrayWalker->resolved()  &&  cached != nullptr) {
+      auto found = cached->find(path);
+      TClass *tclass = found == cached->end() ? nullptr : TClass::GetClass(found->second.c_str());
+      if (tclass != nullptr) {
+        tClonesArrayWalker->walker = new ClassWalker(tClonesArrayWalker->fieldName, tclass, tClonesArrayWalker->avroNamespace, tClonesArrayWalker->defs);
+        ((ClassWalker*)tClonesArrayWalker->walker)->fill();
+      }
+    }
+    if (tClonesArrayWalker->resolved()  &&  recorded != nullptr)
+      recorded->push_back(std::make_pair(path, std::string(((ClassWalker*)tClonesArrayWalker->walker)->tclass->GetName())));
+    return visit(tClonesArrayWalker->walker, path + std::string("[]"), visiting, recorded, cached);
+  }
+}
+
+void recordResolutions(TreeWalker *treeWalker, Resolutions &resolutions) {
+  resolutions.clear();
+  std::set<ClassWalker*> visiting;
+  for (auto field = treeWalker->fields.begin();  field != treeWalker->fields.end();  ++field) {
+    ReaderValueWalker *readerValueWalker = dynamic_cast<ReaderValueWalker*>(*field);
+    if (readerValueWalker != nullptr)    // the only fields that can hold TObjArrays or TClonesArrays
+      visit(readerValueWalker->walker, readerValueWalker->fieldName, visiting, &resolutions, nullptr);
+  }
+}
+
+bool applyResolutions(TreeWalker *treeWalker, const Resolutions &resolutions) {
+  std::map<std::string, std::string> cached(resolutions.begin(), resolutions.end());
+  std::set<ClassWalker*> visiting;
+  for (auto field = treeWalker->fields.begin();  field != treeWalker->fields.end();  ++field) {
+    ReaderValueWalker *readerValueWalker = dynamic_cast<ReaderValueWalker*>(*field);
+    if (readerValueWalker != nullptr)
+      visit(readerValueWalker->walker, readerValueWalker->fieldName, visiting, nullptr, &cached);
+  }
+  return treeWalker->resolved();
+}
@@ -0,0 +1,57 @@
+// Copyright 2016 Jim Pivarski
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//     http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef WALKER_CACHE_H
+#define WALKER_CACHE_H
+
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "TFile.h"
+#include "TTree.h"
+
+#include "datawalker.h"
+
+// An on-disk cache of the startup work that depends only on the file's classes and the TTree's
+// structure (--cache-dir): the classes that TObjArrays and TClonesArrays resolve to (otherwise
+// found by reading entries until every one has been non-empty), the Avro schema and repr, and the
+// C++ code generated by --inferTypes. Entries are keyed by a hash of the file's streamer infos
+// (class names, versions, and checksums), the TTree's branches and leaves, and the options that
+// change the walkers; a file with the same key has the same walkers, so the entry can be used
+// for it without reading any data.
+// 
+// Each entry is one small file, DIRECTORY/walkers/KEY, written to a temporary name and renamed,
+// so that processes sharing the directory see either a whole entry or none.
+
+class WalkerCacheEntry {
+public:
+  std::vector<std::pair<std::string, std::string> > resolutions;   // path of a dynamic field, class name
+  std::vector<std::string> classNames;                               // declared by code (--inferTypes)
+  std::string code;
+  std::string schema;
+  std::string repr;
+
+  bool load(std::string directory, std::string key);
+  bool save(std::string directory, std::string key, std::string &errorMessage);
+};
+
+std::string walkerCacheKey(TFile *file, TTree *ttree, std::string options);
+bool walkerCacheKey(std::string url, std::string treeLocation, std::string options, std::string &key, std::string &errorMessage);
+
+void recordResolutions(TreeWalker *treeWalker, std::vector<std::pair<std::string, std::string> > &resolutions);
+bool applyResolutions(TreeWalker *treeWalker, const std::vector<std::pair<std::string, std::string> > &resolutions);
+
+#endif // WALKER_CACHE_H
@@ -0,0 +1,426 @@
+// Copyright 2016 Jim Pivarski
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//     http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "primitiveRuns.h"
+#include "walkerProgram.h"
+#include "walkerToCode.h"
+
+///////////////////////////////////////////////////////////////////// sinks
+
+// What each output does with the values and structure visited by WalkerProgram::run;
+// the formats are the same as the walkers' printJSON, writeAvro, and copyToBuffer.
+
+class JSONSink {
+public:
+  JSONWriter &stream;
+  FieldWalker *field;                // for printEscapedString
+  JSONSink(JSONWriter &stream, FieldWalker *field) : stream(stream), field(field) { }
+
+  template <typename T> void number(T value) { stream << value; }
+  void string(const char *value) {
+    stream << "\"";
+    field->printEscapedString(value, stream);
+    stream << "\"";
+  }
+  template <typename T> void run(const char *items, int numItems) {
+    for (int i = 0;  i < numItems;  i++) {
+      if (i > 0) stream << ", ";
+      number(((T*)items)[i]);
+    }
+  }
+
+  void member(const std::string &text) { stream << text; }
+  void beginRecord() { stream << "{"; }
+  void endRecord() { stream << "}"; }
+  void null() { stream << "null"; }
+  void beginPointer(const std::string &text) { stream << text; }
+  void endPointer() { stream << "\"}"; }                  // same output as PointerWalker::printJSON
+  void beginSequence(int numItems) { stream << "["; }
+  void nextItem() { stream << ", "; }
+  void endSequence() { stream << "]"; }
+};
+
+template <> void JSONSink::number(bool value) { if (value) stream << "true"; else stream << "false"; }
+template <> void JSONSink::number(char value) { stream << (int)value; }
+template <> void JSONSink::number(unsigned char value) { stream << (int)value; }
+
+#ifdef AVRO
+class AvroSink {
+public:
+  AvroEncoder &encoder;
+  AvroSink(AvroEncoder &encoder) : encoder(encoder) { }
+
+  template <typename T> void number(T value) { encoder.writeLong(value); }
+  void string(const char *value) { encoder.writeString(value); }
+  template <typename T> void run(const char *items, int numItems) { writeAvroRun<T>(encoder, items, numItems); }
+
+  void member(const std::string &text) { }
+  void beginRecord() { }
+  void endRecord() { }
+  void null() { encoder.writeLong(0); }                   // union branch 0: null
+  void beginPointer(const std::string &text) { encoder.writeLong(1); }
+  void endPointer() { }
+  void beginSequence(int numItems) { if (numItems > 0) encoder.writeLong(numItems); }
+  void nextItem() { }
+  void endSequence() { encoder.writeLong(0); }
+};
+
+template <> void AvroSink::number(bool value) { encoder.writeBoolean(value); }
+template <> void AvroSink::number(float value) { encoder.writeFloat(value); }
+template <> void AvroSink::number(double value) { encoder.writeDouble(value); }
+template <> void AvroSink::number(ULong64_t value) { encoder.writeDouble(value); }      // see ULongWalker::writeAvro
+#endif
+
+class BufferSink {
+public:
+  char *ptr;                         // nullptr once the buffer is too small
+  char *limit;
+  BufferSink(void *ptr, void *limit) : ptr((char*)ptr), limit((char*)limit) { }
+
+  bool fits(size_t size) {
+    if (ptr == nullptr  ||  (size_t)(limit - ptr) < size)
+      ptr = nullptr;
+    return ptr != nullptr;
+  }
+
+  template <typename T> void number(T value) {
+    if (fits(sizeof(T))) {
+      memcpy(ptr, &value, sizeof(T));
+      ptr += sizeof(T);
+    }
+  }
+  void string(const char *value) {
+    int length = strlen(value);
+    if (fits(sizeof(int) + length)) {
+      memcpy(ptr, &length, sizeof(int));
+      memcpy(ptr + sizeof(int), value, length);
+      ptr += sizeof(int) + length;
+    }
+  }
+  template <typename T> void run(const char *items, int numItems) { ptr = (char*)copyRunToBuffer<T>(ptr, limit, items, numItems); }
+
+  void member(const std::string &text) { }
+  void beginRecord() { }
+  void endRecord() { }
+  void null() { number<char>(0); }
+  void beginPointer(const std::string &text) { number<char>(1); }
+  void endPointer() { }
+  void beginSequence(int numItems) { number<int>(numItems); }
+  void nextItem() { }
+  void endSequence() { }
+};
+
+template <> void BufferSink::number(bool value) {
+  if (fits(sizeof(bool))) {
+    *((bool*)ptr) = value ? 1 : 0;
+    ptr += sizeof(bool);
+  }
+}
+
+///////////////////////////////////////////////////////////////////// WalkerProgram
+
+WalkerOpCode valueCode(FieldWalker *walker) {
+  if (dynamic_cast<BoolWalker*>(walker) != nullptr)       return OpBool;
+  if (dynamic_cast<CharWalker*>(walker) != nullptr)       return OpChar;
+  if (dynamic_cast<UCharWalker*>(walker) != nullptr)      return OpUChar;
+  if (dynamic_cast<ShortWalker*>(walker) != nullptr)      return OpShort;
+  if (dynamic_cast<UShortWalker*>(walker) != nullptr)     return OpUShort;
+  if (dynamic_cast<IntWalker*>(walker) != nullptr)        return OpInt;
+  if (dynamic_cast<UIntWalker*>(walker) != nullptr)       return OpUInt;
+  if (dynamic_cast<LongWalker*>(walker) != nullptr)       return OpLong;
+  if (dynamic_cast<ULongWalker*>(walker) != nullptr)      return OpULong;
+  if (dynamic_cast<FloatWalker*>(walker) != nullptr)      return OpFloat;
+  if (dynamic_cast<DoubleWalker*>(walker) != nullptr)     return OpDouble;
+  if (dynamic_cast<CStringWalker*>(walker) != nullptr)    return OpCString;
+  if (dynamic_cast<StdStringWalker*>(walker) != nullptr)  return OpStdString;
+  if (dynamic_cast<TStringWalker*>(walker) != nullptr)    return OpTString;
+  return OpEnd;
+}
+
+WalkerProgram::WalkerProgram(ExtractableWalker *field, FieldWalker *walker) : field(field) {
+  compile(walker, 0);
+  ops.push_back(WalkerOp(OpEnd));
+
+  // class bodies go after the end, once each, and are linked to every OpRecord that runs them
+  for (size_t i = 0;  i < calls.size();  i++) {
+    ClassWalker *classWalker = calls[i].second;
+    if (classes.find(classWalker) == classes.end()) {
+      classes[classWalker] = ops.size();
+      bool first = true;
+      for (auto iter = classWalker->members.begin();  iter != classWalker->members.end();  ++iter) {
+        WalkerOp member(OpMember);
+        member.text = std::string(first ? "\"" : ", \"") + (*iter)->fieldName + std::string("\": ");
+        ops.push_back(member);
+        compile((*iter)->walker, (*iter)->offset);
+        first = false;
+      }
+      ops.push_back(WalkerOp(OpReturn));
+    }
+    ops[calls[i].first].jump = classes[classWalker];
+  }
+}
+
+void WalkerProgram::compile(FieldWalker *walker, size_t offset) {
+  WalkerOpCode code = valueCode(walker);
+  if (code != OpEnd) {
+    ops.push_back(WalkerOp(code, offset));
+    return;
+  }
+
+  ClassWalker *classWalker = dynamic_cast<ClassWalker*>(walker);
+  if (classWalker != nullptr) {
+    calls.push_back(std::make_pair((int)ops.size(), classWalker));
+    ops.push_back(WalkerOp(OpRecord, offset));
+    return;
+  }
+
+  if (dynamic_cast<StdVectorBoolWalker*>(walker) != nullptr) {
+    ops.push_back(WalkerOp(OpVectorBool, offset));
+    return;
+  }
+
+  int begin = ops.size();
+
+  PointerWalker *pointerWalker = dynamic_cast<PointerWalker*>(walker);
+  if (pointerWalker != nullptr) {
+    WalkerOp op(OpPointer, offset);
+    op.text = std::string("{\"") + pointerWalker->walker->avroTypeName() + std::string("\": ");
+    ops.push_back(op);
+    compile(pointerWalker->walker, 0);
+    ops.push_back(WalkerOp(OpEndPointer));
+    ops[begin].jump = ops.size();
+    return;
+  }
+
+  // serializable() leaves only sequences with items
+  WalkerOp op(OpClones, offset);
+  FieldWalker *itemWalker;
+  StdVectorWalker *stdVectorWalker = dynamic_cast<StdVectorWalker*>(walker);
+  ArrayWalker *arrayWalker = dynamic_cast<ArrayWalker*>(walker);
+  if (stdVectorWalker != nullptr) {
+    op.code = OpVector;
+    itemWalker = stdVectorWalker->walker;
+  }
+  else if (arrayWalker != nullptr) {
+    op.code = OpArray;
+    op.numItems = arrayWalker->numItems;
+    itemWalker = arrayWalker->walker;
+  }
+  else
+    itemWalker = ((TClonesArrayWalker*)walker)->walker;
+
+  op.itemSize = itemWalker->sizeOf();
+  WalkerOpCode itemCode = valueCode(itemWalker);
+  if (op.code != OpClones  &&  OpChar <= itemCode  &&  itemCode <= OpDouble)
+    op.item = itemCode;
+
+  ops.push_back(op);
+  if (op.item == OpEnd) {
+    compile(itemWalker, 0);
+    ops.push_back(WalkerOp(OpNext));
+  }
+  ops[begin].jump = ops.size();
+}
+
+template <typename SINK>
+inline void runOf(WalkerOpCode code, const char *items, int numItems, SINK &sink) {
+  switch (code) {
+    case OpChar:    sink.template run<char>(items, numItems);             break;
+    case OpUChar:   sink.template run<unsigned char>(items, numItems);    break;
+    case OpShort:   sink.template run<short>(items, numItems);            break;
+    case OpUShort:  sink.template run<unsigned short>(items, numItems);   break;
+    case OpInt:     sink.template run<int>(items, numItems);              break;
+    case OpUInt:    sink.template run<unsigned int>(items, numItems);     break;
+    case OpLong:    sink.template run<Long64_t>(items, numItems);         break;
+    case OpULong:   sink.template run<ULong64_t>(items, numItems);        break;
+    case OpFloat:   sink.template run<float>(items, numItems);            break;
+    case OpDouble:  sink.template run<double>(items, numItems);           break;
+    default:        break;
+  }
+}
+
+template <typename SINK>
+void WalkerProgram::run(void *address, SINK &sink) {
+  char *base = (char*)address;
+  int pc = 0;
+  stack.clear();
+
+  while (true) {
+    const WalkerOp &op = ops[pc];
+    char *at = base + op.offset;
+
+    switch (op.code) {
+      case OpBool:       sink.number(*((bool*)at));                       pc++;  break;
+      case OpChar:       sink.number(*((char*)at));                       pc++;  break;
+      case OpUChar:      sink.number(*((unsigned char*)at));              pc++;  break;
+      case OpShort:      sink.number(*((short*)at));                      pc++;  break;
+      case OpUShort:     sink.number(*((unsigned short*)at));             pc++;  break;
+      case OpInt:        sink.number(*((int*)at));                        pc++;  break;
+      case OpUInt:       sink.number(*((unsigned int*)at));               pc++;  break;
+      case OpLong:       sink.number(*((Long64_t*)at));                   pc++;  break;
+      case OpULong:      sink.number(*((ULong64_t*)at));                  pc++;  break;
+      case OpFloat:      sink.number(*((float*)at));                      pc++;  break;
+      case OpDouble:     sink.number(*((double*)at));                     pc++;  break;
+      case OpCString:    sink.string(at);                                 pc++;  break;
+      case OpStdString:  sink.string(((std::string*)at)->c_str());        pc++;  break;
+      case OpTString:    sink.string(((TString*)at)->Data());             pc++;  break;
+
+      case OpMember:
+        sink.member(op.text);
+        pc++;
+        break;
+
+      case OpRecord:
+        stack.push_back(ProgramFrame{base, pc + 1, nullptr, 0, 0});
+        sink.beginRecord();
+        base = at;
+        pc = op.jump;
+        break;
+
+      case OpReturn:
+        sink.endRecord();
+        base = stack.back().base;
+        pc = stack.back().pc;
+        stack.pop_back();
+        break;
+
+      case OpPointer: {
+        char *dereferenced = *((char**)at);
+        if (dereferenced == nullptr) {
+          sink.null();
+          pc = op.jump;
+        }
+        else {
+          sink.beginPointer(op.text);
+          stack.push_back(ProgramFrame{base, pc, nullptr, 0, 0});
+          base = dereferenced;
+          pc++;
+        }
+        break;
+      }
+
+      case OpEndPointer:
+        sink.endPointer();
+        base = stack.back().base;
+        stack.pop_back();
+        pc++;
+        break;
+
+      case OpVector:
+      case OpArray:
+      case OpClones: {
+        char *items;
+        int numItems;
+        if (op.code == OpVector) {
+          std::vector<char> *generic = (std::vector<char>*)at;
+          items = generic->data();
+          numItems = generic->size() / op.itemSize;
+        }
+        else if (op.code == OpArray) {
+          items = at;
+          numItems = op.numItems;
+        }
+        else {
+          items = at;
+          numItems = ((TClonesArray*)at)->GetEntries();
+        }
+
+        sink.beginSequence(numItems);
+        if (op.item != OpEnd  ||  numItems == 0) {
+          runOf(op.item, items, numItems, sink);
+          sink.endSequence();
+          pc = op.jump;
+        }
+        else {
+          stack.push_back(ProgramFrame{base, pc, items, 0, numItems});
+          base = op.code == OpClones ? (char*)((TClonesArray*)items)->UncheckedAt(0) : items;
+          pc++;
+        }
+        break;
+      }
+
+      case OpNext: {
+        ProgramFrame &frame = stack.back();
+        frame.index++;
+        if (frame.index < frame.numItems) {
+          sink.nextItem();
+          const WalkerOp &begin = ops[frame.pc];
+          if (begin.code == OpClones)
+            base = (char*)((TClonesArray*)frame.items)->UncheckedAt(frame.index);
+          else
+            base = frame.items + frame.index * begin.itemSize;
+          pc = frame.pc + 1;
+        }
+        else {
+          sink.endSequence();
+          base = frame.base;
+          stack.pop_back();
+          pc++;
+        }
+        break;
+      }
+
+      case OpVectorBool: {
+        std::vector<bool> *vectorBool = (std::vector<bool>*)at;
+        int numItems = vectorBool->size();
+        sink.beginSequence(numItems);
+        for (int i = 0;  i < numItems;  i++) {
+          if (i > 0) sink.nextItem();
+          sink.number((bool)(*vectorBool)[i]);
+        }
+        sink.endSequence();
+        pc++;
+        break;
+      }
+
+      case OpEnd:
+        return;
+    }
+  }
+}
+
+void WalkerProgram::printJSON(void *address, JSONWriter &stream) {
+  stream << "\"" << field->fieldName << "\": ";
+  JSONSink sink(stream, field);
+  run(address, sink);
+}
+
+#ifdef AVRO
+bool WalkerProgram::writeAvro(void *address, AvroEncoder &encoder) {
+  AvroSink sink(encoder);
+  run(address, sink);
+  return true;
+}
+#endif
+
+void *WalkerProgram::copyToBuffer(void *ptr, void *limit, void *address) {
+  BufferSink sink(ptr, limit);
+  run(address, sink);
+  return sink.ptr;
+}
+
+void compilePrograms(TreeWalker *treeWalker) {
+  for (auto iter = treeWalker->programs.begin();  iter != treeWalker->programs.end();  ++iter)
+    delete *iter;
+  treeWalker->programs.clear();
+
+  for (auto iter = treeWalker->fields.begin();  iter != treeWalker->fields.end();  ++iter) {
+    FieldWalker *walker = extractedWalker(*iter);
+    std::set<ClassWalker*> visiting;
+    if (serializable(walker, visiting))
+      treeWalker->programs.push_back(new WalkerProgram(*iter, walker));
+    else
+      treeWalker->programs.push_back(nullptr);
+  }
+}
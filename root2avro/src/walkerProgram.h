@@ -0,0 +1,105 @@
+// Copyright 2016 Jim Pivarski
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//     http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef WALKER_PROGRAM_H
+#define WALKER_PROGRAM_H
+
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "datawalker.h"
+
+// A resolved top-level field flattened into a list of operations, executed by one
+// switch loop for every output (JSON, Avro binary, and the copyToBuffer layout) without
+// virtual calls. The same fields are handled as by walkerToCode.h; the others stay with
+// their walkers.
+
+enum WalkerOpCode {
+  OpBool,            // numbers and strings at base + offset
+  OpChar,
+  OpUChar,
+  OpShort,
+  OpUShort,
+  OpInt,
+  OpUInt,
+  OpLong,
+  OpULong,
+  OpFloat,
+  OpDouble,
+  OpCString,
+  OpStdString,
+  OpTString,
+
+  OpMember,          // text is the member's name and separator (for JSON)
+  OpRecord,          // run the class body at jump with base + offset, as a subroutine
+  OpReturn,          // end of a class body
+
+  OpPointer,         // dereference base + offset: nullptr skips to jump, anything else becomes the base until OpEndPointer
+  OpEndPointer,
+
+  OpVector,          // std::vector<T> at base + offset: each item becomes the base for the ops up to OpNext;
+  OpArray,           //     if item is a number (other than bool), the items are handled as one run instead
+  OpClones,          // TClonesArray at base + offset, with items up to OpNext
+  OpVectorBool,      // std::vector<bool> at base + offset, in one op
+  OpNext,            // next item of the innermost sequence
+
+  OpEnd,
+};
+
+class WalkerOp {
+public:
+  WalkerOpCode code;
+  size_t offset = 0;
+  int jump = -1;
+  size_t itemSize = 0;
+  int numItems = 0;                  // OpArray
+  WalkerOpCode item = OpEnd;         // sequences of numbers: the item type, if handled as a run
+  std::string text;                  // OpMember, OpPointer
+  WalkerOp(WalkerOpCode code, size_t offset = 0) : code(code), offset(offset) { }
+};
+
+class ProgramFrame {
+public:
+  char *base;                        // to restore
+  int pc;                            // OpRecord: where to return; sequences: the op that began it
+  char *items;
+  int index;
+  int numItems;
+};
+
+class WalkerProgram {
+public:
+  ExtractableWalker *field;
+  std::vector<WalkerOp> ops;
+  std::map<ClassWalker*, int> classes;                  // start of each class body
+  std::vector<std::pair<int, ClassWalker*> > calls;     // OpRecords to link to class bodies
+  std::vector<ProgramFrame> stack;
+
+  WalkerProgram(ExtractableWalker *field, FieldWalker *walker);
+  void compile(FieldWalker *walker, size_t offset);
+
+  template <typename SINK> void run(void *address, SINK &sink);
+  void printJSON(void *address, JSONWriter &stream);
+#ifdef AVRO
+  bool writeAvro(void *address, AvroEncoder &encoder);
+#endif
+  void *copyToBuffer(void *ptr, void *limit, void *address);
+};
+
+WalkerOpCode valueCode(FieldWalker *walker);
+void compilePrograms(TreeWalker *treeWalker);
+
+#endif // WALKER_PROGRAM_H
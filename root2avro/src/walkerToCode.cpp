@@ -0,0 +1,664 @@
+// Copyright 2016 Jim Pivarski
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//     http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "walkerToCode.h"
+
+// Declared once per process; the generated code refers to these helpers. Encoder has the
+// same layout as AvroEncoder (and grows its buffer the same way), and Writer the same
+// layout and number formatting as JSONWriter, so that those can be passed to the generated
+// functions directly.
+const char *serializerPrelude = R"(
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#if __cplusplus >= 201703L
+#include <charconv>
+#endif
+#include <string>
+#include <vector>
+#include "TClonesArray.h"
+#include "TString.h"
+
+namespace root2avro_jit {
+  struct Encoder {
+    char *buffer;
+    size_t size;
+    size_t capacity;
+  };
+
+  inline void reserve(Encoder *encoder, size_t extra) {
+    if (encoder->size + extra > encoder->capacity) {
+      while (encoder->size + extra > encoder->capacity)
+        encoder->capacity *= 2;
+      encoder->buffer = (char*)realloc(encoder->buffer, encoder->capacity);
+    }
+  }
+
+  inline void writeBoolean(Encoder *encoder, bool value) {
+    reserve(encoder, 1);
+    encoder->buffer[encoder->size++] = value ? 1 : 0;
+  }
+
+  inline void writeLong(Encoder *encoder, int64_t value) {
+    reserve(encoder, 10);
+    uint64_t encoded = ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+    while (encoded & ~((uint64_t)0x7f)) {
+      encoder->buffer[encoder->size++] = (char)((encoded & 0x7f) | 0x80);
+      encoded >>= 7;
+    }
+    encoder->buffer[encoder->size++] = (char)encoded;
+  }
+
+  inline void writeBytes(Encoder *encoder, const void *data, size_t length) {
+    reserve(encoder, length);
+    memcpy(encoder->buffer + encoder->size, data, length);
+    encoder->size += length;
+  }
+
+  inline void writeFloat(Encoder *encoder, float value) { writeBytes(encoder, &value, sizeof(float)); }
+
+  inline void writeDouble(Encoder *encoder, double value) { writeBytes(encoder, &value, sizeof(double)); }
+
+  inline void writeString(Encoder *encoder, const char *string) {
+    size_t length = strlen(string);
+    writeLong(encoder, length);
+    writeBytes(encoder, string, length);
+  }
+
+  struct Writer {
+    std::string buffer;
+  };
+
+  inline Writer &operator<<(Writer &writer, const char *string) { writer.buffer.append(string); return writer; }
+  inline Writer &operator<<(Writer &writer, char c) { writer.buffer.push_back(c); return writer; }
+
+  template <typename T> inline Writer &integer(Writer &writer, T value) {
+#if __cplusplus >= 201703L
+    char digits[24];
+    writer.buffer.append(digits, std::to_chars(digits, digits + sizeof(digits), value).ptr - digits);
+#else
+    writer.buffer.append(std::to_string(value));
+#endif
+    return writer;
+  }
+
+  template <typename T, int MINDIGITS, int MAXDIGITS> inline Writer &floating(Writer &writer, T value) {
+    char digits[32];
+#if defined(__cpp_lib_to_chars)
+    writer.buffer.append(digits, std::to_chars(digits, digits + sizeof(digits), value).ptr - digits);
+#else
+    int length = 0;
+    for (int precision = MINDIGITS;  precision <= MAXDIGITS;  precision++) {
+      length = snprintf(digits, sizeof(digits), "%.*g", precision, (double)value);
+      if ((T)strtod(digits, nullptr) == value)
+        break;
+    }
+    writer.buffer.append(digits, length);
+#endif
+    return writer;
+  }
+
+  inline Writer &operator<<(Writer &writer, short value) { return integer(writer, value); }
+  inline Writer &operator<<(Writer &writer, unsigned short value) { return integer(writer, value); }
+  inline Writer &operator<<(Writer &writer, int value) { return integer(writer, value); }
+  inline Writer &operator<<(Writer &writer, unsigned int value) { return integer(writer, value); }
+  inline Writer &operator<<(Writer &writer, long value) { return integer(writer, value); }
+  inline Writer &operator<<(Writer &writer, unsigned long value) { return integer(writer, value); }
+  inline Writer &operator<<(Writer &writer, long long value) { return integer(writer, value); }
+  inline Writer &operator<<(Writer &writer, unsigned long long value) { return integer(writer, value); }
+  inline Writer &operator<<(Writer &writer, float value) { return floating<float, 6, 9>(writer, value); }
+  inline Writer &operator<<(Writer &writer, double value) { return floating<double, 15, 17>(writer, value); }
+
+  inline void printEscapedString(const char *string, Writer &stream) {
+    static const char hex[] = "0123456789abcdef";
+    const char *run = string;
+    for (const char *c = string;  *c != 0;  c++) {
+      if (*c != '"'  &&  *c != '\\'  &&  !('\x00' <= *c  &&  *c <= '\x1f'))
+        continue;
+      stream.buffer.append(run, c - run);
+      run = c + 1;
+      switch (*c) {
+        case '"': stream.buffer.append("\\\""); break;
+        case '\\': stream.buffer.append("\\\\"); break;
+        case '\b': stream.buffer.append("\\b"); break;
+        case '\f': stream.buffer.append("\\f"); break;
+        case '\n': stream.buffer.append("\\n"); break;
+        case '\r': stream.buffer.append("\\r"); break;
+        case '\t': stream.buffer.append("\\t"); break;
+        default:
+          char escape[6] = {'\\', 'u', '0', '0', hex[(*c >> 4) & 0xf], hex[*c & 0xf]};
+          stream.buffer.append(escape, 6);
+      }
+    }
+    stream.buffer.append(run);
+  }
+}
+)";
+
+// C++ type of a number walker's data, or "" if it is not a number
+std::string primitiveType(FieldWalker *walker) {
+  if (dynamic_cast<BoolWalker*>(walker) != nullptr)    return "bool";
+  if (dynamic_cast<CharWalker*>(walker) != nullptr)    return "char";
+  if (dynamic_cast<UCharWalker*>(walker) != nullptr)   return "unsigned char";
+  if (dynamic_cast<ShortWalker*>(walker) != nullptr)   return "short";
+  if (dynamic_cast<UShortWalker*>(walker) != nullptr)  return "unsigned short";
+  if (dynamic_cast<IntWalker*>(walker) != nullptr)     return "int";
+  if (dynamic_cast<UIntWalker*>(walker) != nullptr)    return "unsigned int";
+  if (dynamic_cast<LongWalker*>(walker) != nullptr)    return "Long64_t";
+  if (dynamic_cast<ULongWalker*>(walker) != nullptr)   return "ULong64_t";
+  if (dynamic_cast<FloatWalker*>(walker) != nullptr)   return "float";
+  if (dynamic_cast<DoubleWalker*>(walker) != nullptr)  return "double";
+  return "";
+}
+
+// expression for the null-terminated characters of a string walker's data, or "" if it is not a string
+std::string stringData(FieldWalker *walker, std::string address) {
+  if (dynamic_cast<CStringWalker*>(walker) != nullptr)    return "((const char*)(" + address + "))";
+  if (dynamic_cast<StdStringWalker*>(walker) != nullptr)  return "((std::string*)(" + address + "))->c_str()";
+  if (dynamic_cast<TStringWalker*>(walker) != nullptr)    return "((TString*)(" + address + "))->Data()";
+  return "";
+}
+
+// contents of a C++ string literal that evaluates to text
+std::string cppString(std::string text) {
+  std::string out;
+  for (size_t i = 0;  i < text.size();  i++) {
+    if (text[i] == '"'  ||  text[i] == '\\')
+      out += '\\';
+    out += text[i];
+  }
+  return out;
+}
+
+std::string bufferCheck(std::string size, std::string ind) {
+  return ind + "if (p == nullptr  ||  (size_t)((char*)limit - p) < " + size + ")\n" +
+         ind + "  return nullptr;\n";
+}
+
+FieldWalker *extractedWalker(ExtractableWalker *field) {
+  LeafWalker *leafWalker = dynamic_cast<LeafWalker*>(field);
+  if (leafWalker != nullptr)
+    return leafWalker->dimensions == 0 ? leafWalker->walker : nullptr;
+
+  ReaderValueWalker *readerValueWalker = dynamic_cast<ReaderValueWalker*>(field);
+  if (readerValueWalker != nullptr)
+    return readerValueWalker->walker;
+
+  RawTBranchWalker *rawTBranchWalker = dynamic_cast<RawTBranchWalker*>(field);
+  if (rawTBranchWalker != nullptr)
+    return rawTBranchWalker->walker;
+
+  return nullptr;
+}
+
+// whether the generated code (or a WalkerProgram) handles everything in this walker
+bool serializable(FieldWalker *walker, std::set<ClassWalker*> &visiting) {
+  if (walker == nullptr)
+    return false;
+
+  if (!primitiveType(walker).empty()  ||  !stringData(walker, "").empty())
+    return true;
+
+  ClassWalker *classWalker = dynamic_cast<ClassWalker*>(walker);
+  if (classWalker != nullptr) {
+    if (visiting.find(classWalker) != visiting.end())
+      return true;
+    visiting.insert(classWalker);
+    for (auto iter = classWalker->members.begin();  iter != classWalker->members.end();  ++iter)
+      if (!serializable((*iter)->walker, visiting))
+        return false;
+    return true;
+  }
+
+  PointerWalker *pointerWalker = dynamic_cast<PointerWalker*>(walker);
+  if (pointerWalker != nullptr)
+    return serializable(pointerWalker->walker, visiting);
+
+  StdVectorWalker *stdVectorWalker = dynamic_cast<StdVectorWalker*>(walker);
+  if (stdVectorWalker != nullptr)
+    return serializable(stdVectorWalker->walker, visiting);
+
+  if (dynamic_cast<StdVectorBoolWalker*>(walker) != nullptr)
+    return true;
+
+  ArrayWalker *arrayWalker = dynamic_cast<ArrayWalker*>(walker);
+  if (arrayWalker != nullptr)
+    return serializable(arrayWalker->walker, visiting);
+
+  TClonesArrayWalker *tClonesArrayWalker = dynamic_cast<TClonesArrayWalker*>(walker);
+  if (tClonesArrayWalker != nullptr)
+    return tClonesArrayWalker->resolved()  &&  serializable(tClonesArrayWalker->walker, visiting);
+
+  return false;    // TObjArray, TRef, TRefArray are left to the walkers
+}
+
+SerializerCode::SerializerCode(std::string ns) : ns(ns), numTemporaries(0) { }
+
+std::string SerializerCode::temporary(std::string prefix) {
+  return prefix + std::to_string(numTemporaries++);
+}
+
+int SerializerCode::classFunctions(ClassWalker *classWalker) {
+  auto found = classes.find(classWalker);
+  if (found != classes.end())
+    return found->second;
+
+  int index = classes.size();
+  classes[classWalker] = index;    // before the members, which may refer back to this class
+  std::string name = std::to_string(index);
+
+  declarations.push_back("void json" + name + "(void *address, root2avro_jit::Writer &stream);\n" +
+                         "void avro" + name + "(void *address, root2avro_jit::Encoder *encoder);\n" +
+                         "char *buffer" + name + "(char *p, void *limit, void *address);\n");
+
+  std::string jsonBody, avroBody, bufferBody;
+  bool first = true;
+  for (auto iter = classWalker->members.begin();  iter != classWalker->members.end();  ++iter) {
+    std::string address = "((char*)address + " + std::to_string((*iter)->offset) + ")";
+    jsonBody += std::string("  stream << \"") + cppString((first ? "\"" : ", \"") + (*iter)->fieldName + "\": ") + "\";\n";
+    jsonBody += json((*iter)->walker, address, 2);
+    avroBody += avro((*iter)->walker, address, 2);
+    bufferBody += buffer((*iter)->walker, address, 2);
+    first = false;
+  }
+
+  definitions.push_back("// " + classWalker->typeName + "\n" +
+                        "void json" + name + "(void *address, root2avro_jit::Writer &stream) {\n" +
+                        "  stream << \"{\";\n" + jsonBody + "  stream << \"}\";\n}\n\n" +
+                        "void avro" + name + "(void *address, root2avro_jit::Encoder *encoder) {\n" +
+                        avroBody + "}\n\n" +
+                        "char *buffer" + name + "(char *p, void *limit, void *address) {\n" +
+                        bufferBody + "  return p;\n}\n");
+  return index;
+}
+
+// std::vector<T> and T[N] items are contiguous, so sequences of them are visited by index
+FieldWalker *contiguous(FieldWalker *walker, std::string address, std::string numItems, std::string items, std::string ind, std::string &setup) {
+  StdVectorWalker *stdVectorWalker = dynamic_cast<StdVectorWalker*>(walker);
+  if (stdVectorWalker != nullptr) {
+    std::string itemSize = std::to_string(stdVectorWalker->walker->sizeOf());
+    setup = ind + "  std::vector<char> *" + items + "Vector = (std::vector<char>*)(" + address + ");\n" +
+            ind + "  int " + numItems + " = " + items + "Vector->size() / " + itemSize + ";\n" +
+            ind + "  char *" + items + " = " + items + "Vector->data();\n";
+    return stdVectorWalker->walker;
+  }
+
+  ArrayWalker *arrayWalker = dynamic_cast<ArrayWalker*>(walker);
+  if (arrayWalker != nullptr) {
+    setup = ind + "  int " + numItems + " = " + std::to_string(arrayWalker->numItems) + ";\n" +
+            ind + "  char *" + items + " = (char*)(" + address + ");\n";
+    return arrayWalker->walker;
+  }
+
+  return nullptr;
+}
+
+std::string SerializerCode::json(FieldWalker *walker, std::string address, int indent) {
+  std::string ind(indent, ' ');
+  std::string type = primitiveType(walker);
+  std::string string = stringData(walker, address);
+
+  if (type == "bool")
+    return ind + "stream << (*((bool*)(" + address + ")) ? \"true\" : \"false\");\n";
+
+  if (type == "char"  ||  type == "unsigned char")
+    return ind + "stream << ((int)(*((" + type + "*)(" + address + "))));\n";
+
+  if (!type.empty())
+    return ind + "stream << *((" + type + "*)(" + address + "));\n";
+
+  if (!string.empty())
+    return ind + "stream << \"\\\"\";\n" +
+           ind + "root2avro_jit::printEscapedString(" + string + ", stream);\n" +
+           ind + "stream << \"\\\"\";\n";
+
+  ClassWalker *classWalker = dynamic_cast<ClassWalker*>(walker);
+  if (classWalker != nullptr)
+    return ind + "json" + std::to_string(classFunctions(classWalker)) + "(" + address + ", stream);\n";
+
+  PointerWalker *pointerWalker = dynamic_cast<PointerWalker*>(walker);
+  if (pointerWalker != nullptr) {
+    std::string dereferenced = temporary("dereferenced");
+    return ind + "{\n" +
+           ind + "  void *" + dereferenced + " = *((void**)(" + address + "));\n" +
+           ind + "  if (" + dereferenced + " == nullptr)\n" +
+           ind + "    stream << \"null\";\n" +
+           ind + "  else {\n" +
+           ind + "    stream << \"" + cppString("{\"" + pointerWalker->walker->avroTypeName() + "\": ") + "\";\n" +
+           json(pointerWalker->walker, dereferenced, indent + 4) +
+           ind + "    stream << \"\\\"}\";\n" +      // same output as PointerWalker::printJSON
+           ind + "  }\n" +
+           ind + "}\n";
+  }
+
+  std::string numItems = temporary("numItems");
+  std::string items = temporary("items");
+  std::string i = temporary("i");
+  std::string setup;
+  FieldWalker *itemWalker = contiguous(walker, address, numItems, items, ind, setup);
+  if (itemWalker != nullptr)
+    return ind + "{\n" + setup +
+           ind + "  stream << \"[\";\n" +
+           ind + "  for (int " + i + " = 0;  " + i + " < " + numItems + ";  " + i + "++) {\n" +
+           ind + "    if (" + i + " > 0) stream << \", \";\n" +
+           json(itemWalker, items + " + (size_t)" + i + " * " + std::to_string(itemWalker->sizeOf()), indent + 4) +
+           ind + "  }\n" +
+           ind + "  stream << \"]\";\n" +
+           ind + "}\n";
+
+  if (dynamic_cast<StdVectorBoolWalker*>(walker) != nullptr)
+    return ind + "{\n" +
+           ind + "  std::vector<bool> *" + items + " = (std::vector<bool>*)(" + address + ");\n" +
+           ind + "  int " + numItems + " = " + items + "->size();\n" +
+           ind + "  stream << \"[\";\n" +
+           ind + "  for (int " + i + " = 0;  " + i + " < " + numItems + ";  " + i + "++) {\n" +
+           ind + "    if (" + i + " > 0) stream << \", \";\n" +
+           ind + "    stream << ((*" + items + ")[" + i + "] ? \"true\" : \"false\");\n" +
+           ind + "  }\n" +
+           ind + "  stream << \"]\";\n" +
+           ind + "}\n";
+
+  TClonesArrayWalker *tClonesArrayWalker = dynamic_cast<TClonesArrayWalker*>(walker);
+  if (tClonesArrayWalker != nullptr) {
+    std::string item = temporary("item");
+    return ind + "{\n" +
+           ind + "  TIter " + items + "((TClonesArray*)(" + address + "));\n" +
+           ind + "  bool " + i + " = true;\n" +
+           ind + "  stream << \"[\";\n" +
+           ind + "  for (void *" + item + " = (void*)" + items + "();  " + item + " != nullptr;  " + item + " = (void*)" + items + "()) {\n" +
+           ind + "    if (" + i + ") " + i + " = false; else stream << \", \";\n" +
+           json(tClonesArrayWalker->walker, item, indent + 4) +
+           ind + "  }\n" +
+           ind + "  stream << \"]\";\n" +
+           ind + "}\n";
+  }
+
+  return "";
+}
+
+std::string SerializerCode::avro(FieldWalker *walker, std::string address, int indent) {
+  std::string ind(indent, ' ');
+  std::string type = primitiveType(walker);
+  std::string string = stringData(walker, address);
+
+  if (type == "bool")
+    return ind + "root2avro_jit::writeBoolean(encoder, *((bool*)(" + address + ")));\n";
+
+  if (type == "float")
+    return ind + "root2avro_jit::writeFloat(encoder, *((float*)(" + address + ")));\n";
+
+  if (type == "double"  ||  type == "ULong64_t")    // see ULongWalker::writeAvro
+    return ind + "root2avro_jit::writeDouble(encoder, *((" + type + "*)(" + address + ")));\n";
+
+  if (!type.empty())
+    return ind + "root2avro_jit::writeLong(encoder, *((" + type + "*)(" + address + ")));\n";
+
+  if (!string.empty())
+    return ind + "root2avro_jit::writeString(encoder, " + string + ");\n";
+
+  ClassWalker *classWalker = dynamic_cast<ClassWalker*>(walker);
+  if (classWalker != nullptr)
+    return ind + "avro" + std::to_string(classFunctions(classWalker)) + "(" + address + ", encoder);\n";
+
+  PointerWalker *pointerWalker = dynamic_cast<PointerWalker*>(walker);
+  if (pointerWalker != nullptr) {
+    std::string dereferenced = temporary("dereferenced");
+    return ind + "{\n" +
+           ind + "  void *" + dereferenced + " = *((void**)(" + address + "));\n" +
+           ind + "  if (" + dereferenced + " == nullptr)\n" +
+           ind + "    root2avro_jit::writeLong(encoder, 0);\n" +
+           ind + "  else {\n" +
+           ind + "    root2avro_jit::writeLong(encoder, 1);\n" +
+           avro(pointerWalker->walker, dereferenced, indent + 4) +
+           ind + "  }\n" +
+           ind + "}\n";
+  }
+
+  // all items in one Avro block: count, items, and a zero count (just the zero if empty)
+  std::string numItems = temporary("numItems");
+  std::string items = temporary("items");
+  std::string i = temporary("i");
+  std::string setup;
+  FieldWalker *itemWalker = contiguous(walker, address, numItems, items, ind, setup);
+  if (itemWalker != nullptr) {
+    std::string itemType = primitiveType(itemWalker);
+    std::string itemSize = std::to_string(itemWalker->sizeOf());
+    std::string loop;
+    if (itemType == "float"  ||  itemType == "double")    // Avro's floating point is the in-memory (little-endian) format
+      loop = ind + "  root2avro_jit::writeBytes(encoder, " + items + ", (size_t)" + numItems + " * " + itemSize + ");\n";
+    else
+      loop = ind + "  for (int " + i + " = 0;  " + i + " < " + numItems + ";  " + i + "++) {\n" +
+             avro(itemWalker, items + " + (size_t)" + i + " * " + itemSize, indent + 4) +
+             ind + "  }\n";
+    return ind + "{\n" + setup +
+           ind + "  if (" + numItems + " > 0)\n" +
+           ind + "    root2avro_jit::writeLong(encoder, " + numItems + ");\n" +
+           loop +
+           ind + "  root2avro_jit::writeLong(encoder, 0);\n" +
+           ind + "}\n";
+  }
+
+  if (dynamic_cast<StdVectorBoolWalker*>(walker) != nullptr)
+    return ind + "{\n" +
+           ind + "  std::vector<bool> *" + items + " = (std::vector<bool>*)(" + address + ");\n" +
+           ind + "  int " + numItems + " = " + items + "->size();\n" +
+           ind + "  if (" + numItems + " > 0)\n" +
+           ind + "    root2avro_jit::writeLong(encoder, " + numItems + ");\n" +
+           ind + "  for (int " + i + " = 0;  " + i + " < " + numItems + ";  " + i + "++)\n" +
+           ind + "    root2avro_jit::writeBoolean(encoder, (*" + items + ")[" + i + "]);\n" +
+           ind + "  root2avro_jit::writeLong(encoder, 0);\n" +
+           ind + "}\n";
+
+  TClonesArrayWalker *tClonesArrayWalker = dynamic_cast<TClonesArrayWalker*>(walker);
+  if (tClonesArrayWalker != nullptr) {
+    std::string item = temporary("item");
+    return ind + "{\n" +
+           ind + "  int " + numItems + " = ((TClonesArray*)(" + address + "))->GetEntries();\n" +
+           ind + "  if (" + numItems + " > 0)\n" +
+           ind + "    root2avro_jit::writeLong(encoder, " + numItems + ");\n" +
+           ind + "  TIter " + items + "((TClonesArray*)(" + address + "));\n" +
+           ind + "  for (void *" + item + " = (void*)" + items + "();  " + item + " != nullptr;  " + item + " = (void*)" + items + "()) {\n" +
+           avro(tClonesArrayWalker->walker, item, indent + 4) +
+           ind + "  }\n" +
+           ind + "  root2avro_jit::writeLong(encoder, 0);\n" +
+           ind + "}\n";
+  }
+
+  return "";
+}
+
+std::string SerializerCode::buffer(FieldWalker *walker, std::string address, int indent) {
+  std::string ind(indent, ' ');
+  std::string type = primitiveType(walker);
+  std::string string = stringData(walker, address);
+
+  if (type == "bool")
+    return bufferCheck("sizeof(bool)", ind) +
+           ind + "*((bool*)p) = *((bool*)(" + address + ")) ? 1 : 0;\n" +
+           ind + "p += sizeof(bool);\n";
+
+  if (!type.empty())
+    return bufferCheck("sizeof(" + type + ")", ind) +
+           ind + "memcpy(p, " + address + ", sizeof(" + type + "));\n" +
+           ind + "p += sizeof(" + type + ");\n";
+
+  if (!string.empty()) {
+    std::string characters = temporary("characters");
+    std::string length = temporary("length");
+    return ind + "{\n" +
+           ind + "  const char *" + characters + " = " + string + ";\n" +
+           ind + "  int " + length + " = strlen(" + characters + ");\n" +
+           bufferCheck("sizeof(int) + " + length, ind + "  ") +
+           ind + "  memcpy(p, &" + length + ", sizeof(int));\n" +
+           ind + "  memcpy(p + sizeof(int), " + characters + ", " + length + ");\n" +
+           ind + "  p += sizeof(int) + " + length + ";\n" +
+           ind + "}\n";
+  }
+
+  ClassWalker *classWalker = dynamic_cast<ClassWalker*>(walker);
+  if (classWalker != nullptr)
+    return ind + "p = buffer" + std::to_string(classFunctions(classWalker)) + "(p, limit, " + address + ");\n" +
+           ind + "if (p == nullptr)\n" +
+           ind + "  return nullptr;\n";
+
+  PointerWalker *pointerWalker = dynamic_cast<PointerWalker*>(walker);
+  if (pointerWalker != nullptr) {
+    std::string dereferenced = temporary("dereferenced");
+    return ind + "{\n" +
+           ind + "  void *" + dereferenced + " = *((void**)(" + address + "));\n" +
+           bufferCheck("sizeof(char)", ind + "  ") +
+           ind + "  *p = " + dereferenced + " == nullptr ? 0 : 1;\n" +
+           ind + "  p += sizeof(char);\n" +
+           ind + "  if (" + dereferenced + " != nullptr) {\n" +
+           buffer(pointerWalker->walker, dereferenced, indent + 4) +
+           ind + "  }\n" +
+           ind + "}\n";
+  }
+
+  std::string numItems = temporary("numItems");
+  std::string items = temporary("items");
+  std::string i = temporary("i");
+  std::string setup;
+  FieldWalker *itemWalker = contiguous(walker, address, numItems, items, ind, setup);
+  if (itemWalker != nullptr)
+    return ind + "{\n" + setup +
+           bufferCheck("sizeof(int)", ind + "  ") +
+           ind + "  memcpy(p, &" + numItems + ", sizeof(int));\n" +
+           ind + "  p += sizeof(int);\n" +
+           bufferRun(itemWalker, numItems, items, indent + 2) +
+           ind + "}\n";
+
+  if (dynamic_cast<StdVectorBoolWalker*>(walker) != nullptr)
+    return ind + "{\n" +
+           ind + "  std::vector<bool> *" + items + " = (std::vector<bool>*)(" + address + ");\n" +
+           ind + "  int " + numItems + " = " + items + "->size();\n" +
+           bufferCheck("sizeof(int) + " + numItems + " * sizeof(bool)", ind + "  ") +
+           ind + "  memcpy(p, &" + numItems + ", sizeof(int));\n" +
+           ind + "  p += sizeof(int);\n" +
+           ind + "  for (int " + i + " = 0;  " + i + " < " + numItems + ";  " + i + "++)\n" +
+           ind + "    *((bool*)p++) = (*" + items + ")[" + i + "] ? 1 : 0;\n" +
+           ind + "}\n";
+
+  TClonesArrayWalker *tClonesArrayWalker = dynamic_cast<TClonesArrayWalker*>(walker);
+  if (tClonesArrayWalker != nullptr) {
+    std::string item = temporary("item");
+    return ind + "{\n" +
+           ind + "  int " + numItems + " = ((TClonesArray*)(" + address + "))->GetEntries();\n" +
+           bufferCheck("sizeof(int)", ind + "  ") +
+           ind + "  memcpy(p, &" + numItems + ", sizeof(int));\n" +
+           ind + "  p += sizeof(int);\n" +
+           ind + "  TIter " + items + "((TClonesArray*)(" + address + "));\n" +
+           ind + "  for (void *" + item + " = (void*)" + items + "();  " + item + " != nullptr;  " + item + " = (void*)" + items + "()) {\n" +
+           buffer(tClonesArrayWalker->walker, item, indent + 4) +
+           ind + "  }\n" +
+           ind + "}\n";
+  }
+
+  return "";
+}
+
+std::string SerializerCode::bufferRun(FieldWalker *walker, std::string numItems, std::string items, int indent) {
+  std::string ind(indent, ' ');
+  std::string type = primitiveType(walker);
+  std::string itemSize = std::to_string(walker->sizeOf());
+
+  // numbers (other than bool, which is normalized to 0 or 1) are copied as one block
+  if (!type.empty()  &&  type != "bool")
+    return bufferCheck("(size_t)" + numItems + " * " + itemSize, ind) +
+           ind + "memcpy(p, " + items + ", (size_t)" + numItems + " * " + itemSize + ");\n" +
+           ind + "p += (size_t)" + numItems + " * " + itemSize + ";\n";
+
+  std::string i = temporary("i");
+  return ind + "for (int " + i + " = 0;  " + i + " < " + numItems + ";  " + i + "++) {\n" +
+         buffer(walker, items + " + (size_t)" + i + " * " + itemSize, indent + 2) +
+         ind + "}\n";
+}
+
+std::string SerializerCode::cpp() {
+  std::string out = "#pragma cling optimize(3)\n\nnamespace " + ns + " {\n\n";
+  for (auto iter = declarations.begin();  iter != declarations.end();  ++iter)
+    out += *iter;
+  out += "\n";
+  for (auto iter = definitions.begin();  iter != definitions.end();  ++iter)
+    out += *iter + "\n";
+  out += "}\n";
+  return out;
+}
+
+std::string generateSerializers(TreeWalker *treeWalker, std::string ns, std::vector<bool> &compiled) {
+  SerializerCode code(ns);
+
+  for (size_t index = 0;  index < treeWalker->fields.size();  index++) {
+    ExtractableWalker *field = treeWalker->fields[index];
+    FieldWalker *walker = extractedWalker(field);
+    std::set<ClassWalker*> visiting;
+    if (!serializable(walker, visiting)) {
+      compiled.push_back(false);
+      continue;
+    }
+    compiled.push_back(true);
+
+    std::string name = std::to_string(index);
+    code.definitions.push_back("// " + field->fieldName + "\n" +
+                               "void jsonField" + name + "(void *address, root2avro_jit::Writer &stream) {\n" +
+                               "  stream << \"" + cppString("\"" + field->fieldName + "\": ") + "\";\n" +
+                               code.json(walker, "address", 2) + "}\n\n" +
+                               "bool avroField" + name + "(void *address, void *encoderAddress) {\n" +
+                               "  root2avro_jit::Encoder *encoder = (root2avro_jit::Encoder*)encoderAddress;\n" +
+                               code.avro(walker, "address", 2) + "  return true;\n}\n\n" +
+                               "void *bufferField" + name + "(void *ptr, void *limit, void *address) {\n" +
+                               "  char *p = (char*)ptr;\n" +
+                               code.buffer(walker, "address", 2) + "  return p;\n}\n");
+  }
+
+  return code.cpp();
+}
+
+bool compileSerializers(TreeWalker *treeWalker, std::string &errorMessage) {
+  static bool preludeDeclared = false;
+  static int numCompiled = 0;
+
+  if (!preludeDeclared) {
+    if (!gInterpreter->Declare(serializerPrelude)) {
+      errorMessage = std::string("Could not compile serializer helpers.");
+      return false;
+    }
+    preludeDeclared = true;
+  }
+
+  // a new namespace each time, since Cling cannot redefine functions
+  std::string ns = std::string("root2avro_jit_") + std::to_string(numCompiled++);
+  std::vector<bool> compiled;
+  std::string code = generateSerializers(treeWalker, ns, compiled);
+
+  if (!gInterpreter->Declare(code.c_str())) {
+    errorMessage = std::string("Could not compile generated serializers.");
+    return false;
+  }
+
+  treeWalker->jitJSON.assign(compiled.size(), nullptr);
+  treeWalker->jitAvro.assign(compiled.size(), nullptr);
+  treeWalker->jitBuffer.assign(compiled.size(), nullptr);
+  for (size_t index = 0;  index < compiled.size();  index++)
+    if (compiled[index]) {
+      std::string prefix = std::string("(long)&") + ns + std::string("::");
+      std::string name = std::to_string(index);
+      treeWalker->jitJSON[index] = (JSONSerializer)gInterpreter->Calc((prefix + "jsonField" + name).c_str());
+      treeWalker->jitAvro[index] = (AvroSerializer)gInterpreter->Calc((prefix + "avroField" + name).c_str());
+      treeWalker->jitBuffer[index] = (BufferSerializer)gInterpreter->Calc((prefix + "bufferField" + name).c_str());
+    }
+
+  return true;
+}
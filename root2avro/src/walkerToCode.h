@@ -0,0 +1,56 @@
+// Copyright 2016 Jim Pivarski
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//     http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef WALKER_TO_CODE_H
+#define WALKER_TO_CODE_H
+
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "TInterpreter.h"
+
+#include "datawalker.h"
+
+// Generates straight-line C++ for a resolved TreeWalker (JSON, Avro binary, and the
+// copyToBuffer layout), with member offsets, item sizes, and fixed array lengths written
+// in as constants, and compiles it once with Cling. Each top-level field gets its own
+// three functions; a field containing anything not handled here (multidimensional leaves,
+// TObjArray, TRef, TRefArray) gets none and stays with the interpreted walkers.
+
+class SerializerCode {
+public:
+  std::string ns;
+  std::vector<std::string> declarations;
+  std::vector<std::string> definitions;
+  std::map<ClassWalker*, int> classes;
+  int numTemporaries;
+
+  SerializerCode(std::string ns);
+  std::string temporary(std::string prefix);
+  int classFunctions(ClassWalker *classWalker);
+  std::string json(FieldWalker *walker, std::string address, int indent);
+  std::string avro(FieldWalker *walker, std::string address, int indent);
+  std::string buffer(FieldWalker *walker, std::string address, int indent);
+  std::string bufferRun(FieldWalker *walker, std::string numItems, std::string address, int indent);
+  std::string cpp();
+};
+
+FieldWalker *extractedWalker(ExtractableWalker *field);
+bool serializable(FieldWalker *walker, std::set<ClassWalker*> &visiting);
+std::string generateSerializers(TreeWalker *treeWalker, std::string ns, std::vector<bool> &compiled);
+bool compileSerializers(TreeWalker *treeWalker, std::string &errorMessage);
+
+#endif // WALKER_TO_CODE_H
@@ -0,0 +1,238 @@
+// Copyright 2016 Jim Pivarski
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//     http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+// Tests of the Avro container code that don't need ROOT: records are made up, not converted.
+// A conversion interrupted partway and resumed with a checkpoint must give the same bytes as one
+// that wasn't interrupted, and an index of the output must lead to the block holding any entry.
+// Build and run with "make containertests".
+
+// C includes
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// C++ includes
+#include <algorithm>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "../src/avroContainer.h"
+#include "../src/avroIndex.h"
+#include "../src/checkpoint.h"
+
+#define NUM_ENTRIES 200000
+#define SCHEMA "{\"type\": \"string\"}"
+
+// a string record naming its entry, as Avro encodes it (short enough for a one-byte length)
+static size_t encodeRecord(int64_t entry, char *record) {
+  int size = snprintf(record + 1, 60, "entry %lld", (long long)entry);
+  record[0] = (char)(2 * size);
+  return 1 + size;
+}
+
+// like a --cut, so that block boundaries don't follow entry numbers
+static bool passes(int64_t entry) {
+  return entry % 7 != 3;
+}
+
+static std::string readFile(std::string path) {
+  std::string out;
+  FILE *in = fopen(path.c_str(), "rb");
+  if (in == nullptr)
+    return out;
+  char buffer[65536];
+  size_t size;
+  while ((size = fread(buffer, 1, sizeof(buffer), in)) > 0)
+    out.append(buffer, size);
+  fclose(in);
+  return out;
+}
+
+///////////////////////////////////////////////////////////////////// checkpoints
+
+#define CHECKPOINT_OUTPUT "build/containerTests-checkpointed.avro"
+#define CHECKPOINT_FILE "build/containerTests-checkpoint"
+
+// as root2avro's startAvro and convert do it; dies (like a killed process) at entry crashAt
+static bool convertWithCheckpoint(std::string path, int codecThreads, int64_t crashAt) {
+  FILE *out = fopen(path.c_str(), "ab");          // as with >>
+  Checkpoint checkpoint(CHECKPOINT_FILE, 12345);
+  if (out == nullptr  ||  !checkpoint.resume(out)) {
+    std::cerr << "could not resume: " << checkpoint.errorMessage << std::endl;
+    return false;
+  }
+  checkpoint.fileStarted(0, 0);
+  checkpoint.fileStarted(1, NUM_ENTRIES / 2);
+
+  AvroBlockWriter writer(checkpoint.resumed ? nullptr : out, SCHEMA, "deflate", 4096, codecThreads);
+  if (checkpoint.resumed)
+    writer.continueFile(out);
+  else
+    checkpoint.blockWritten(out, 0);
+  writer.checkpoint = &checkpoint;
+
+  char record[64];
+  for (int64_t entry = checkpoint.resumed ? checkpoint.nextEntry : 0;  entry < NUM_ENTRIES;  entry++) {
+    if (entry == crashAt) {
+      fputs("part of a block", out);                // whatever was written after the last checkpoint
+      fflush(out);
+      _exit(3);
+    }
+    if (passes(entry))
+      writer.append(record, encodeRecord(entry, record), entry);
+  }
+
+  bool ok = writer.close()  &&  checkpoint.finish();
+  fclose(out);
+  return ok;
+}
+
+static bool testCheckpoint(int crashThreads, int resumeThreads, int64_t crashAt) {
+  unlink(CHECKPOINT_OUTPUT);
+  unlink(CHECKPOINT_FILE);
+  if (!convertWithCheckpoint(CHECKPOINT_OUTPUT, 0, -1))
+    return false;
+  std::string expected = readFile(CHECKPOINT_OUTPUT);
+
+  unlink(CHECKPOINT_OUTPUT);
+  pid_t pid = fork();
+  if (pid == 0)
+    _exit(convertWithCheckpoint(CHECKPOINT_OUTPUT, crashThreads, crashAt) ? 0 : 1);
+  int status;
+  waitpid(pid, &status, 0);
+  if (!WIFEXITED(status)  ||  WEXITSTATUS(status) != 3  ||  access(CHECKPOINT_FILE, F_OK) != 0)
+    return false;
+
+  if (!convertWithCheckpoint(CHECKPOINT_OUTPUT, resumeThreads, -1))
+    return false;
+  return readFile(CHECKPOINT_OUTPUT) == expected  &&  access(CHECKPOINT_FILE, F_OK) != 0;
+}
+
+///////////////////////////////////////////////////////////////////// index
+
+#define INDEX_OUTPUT "build/containerTests-indexed.avro"
+#define INDEX_FILE "build/containerTests-index"
+
+// the entry numbers of the records in an (uncompressed) block
+static std::vector<int64_t> blockEntries(const std::string &data, int64_t numRecords) {
+  std::vector<int64_t> out;
+  size_t position = 0;
+  for (int64_t i = 0;  i < numRecords  &&  position < data.size();  i++) {
+    size_t size = (unsigned char)data[position] / 2;
+    out.push_back(atoll(data.substr(position + 1 + 6, size - 6).c_str()));     // after "entry "
+    position += 1 + size;
+  }
+  return out;
+}
+
+static bool testIndex(int codecThreads) {
+  FILE *out = fopen(INDEX_OUTPUT, "wb");
+  AvroIndexWriter indexWriter(INDEX_FILE);
+  if (out == nullptr  ||  !indexWriter.valid)
+    return false;
+  indexWriter.fileStarted(0, 0);
+  indexWriter.fileStarted(1, NUM_ENTRIES / 2);
+
+  AvroBlockWriter writer(out, SCHEMA, "null", 4096, codecThreads);
+  writer.index = &indexWriter;
+  char record[64];
+  for (int64_t entry = 0;  entry < NUM_ENTRIES;  entry++)
+    if (passes(entry))
+      writer.append(record, encodeRecord(entry, record), entry);
+  if (!writer.close()  ||  !indexWriter.close())
+    return false;
+  fclose(out);
+
+  AvroIndex index(INDEX_FILE);
+  FILE *in = fopen(INDEX_OUTPUT, "rb");
+  AvroContainerReader reader(in);
+  if (!index.valid  ||  !reader.valid  ||  memcmp(index.sync, reader.sync, AVRO_SYNC_SIZE) != 0)
+    return false;
+
+  bool ok = true;
+  for (int64_t entry = 0;  entry < NUM_ENTRIES  &&  ok;  entry += 997) {
+    int64_t block = index.find(entry);
+    if (!passes(entry))
+      continue;                                     // may be between blocks
+    int64_t numRecords;
+    std::string data;
+    if (block < 0  ||  !readIndexedBlock(reader, index.blocks[block], numRecords, data))
+      return false;
+
+    const AvroIndexEntry &indexed = index.blocks[block];
+    std::vector<int64_t> entries = blockEntries(data, numRecords);
+    ok = numRecords == indexed.numRecords  &&  entries.front() == indexed.firstEntry  &&  entries.back() == indexed.lastEntry  &&
+         std::find(entries.begin(), entries.end(), entry) != entries.end()  &&
+         indexed.fileIndex == (indexed.firstEntry < NUM_ENTRIES / 2 ? 0 : 1)  &&
+         indexed.treeEntry == indexed.firstEntry - (indexed.fileIndex == 0 ? 0 : NUM_ENTRIES / 2);
+  }
+  fclose(in);
+  return ok  &&  index.find(NUM_ENTRIES) == -1;
+}
+
+// an index that can't be written: the blocks it doesn't have aren't written either, and its
+// error is the one reported
+static bool testIndexFailure(int codecThreads) {
+  FILE *out = fopen(INDEX_OUTPUT, "wb");
+  AvroIndexWriter indexWriter("/dev/full");
+  if (out == nullptr  ||  !indexWriter.valid)
+    return false;
+  indexWriter.fileStarted(0, 0);
+
+  AvroBlockWriter writer(out, SCHEMA, "null", 4096, codecThreads);
+  writer.index = &indexWriter;
+  char record[64];
+  int64_t numAppended = 0;
+  for (int64_t entry = 0;  entry < NUM_ENTRIES;  entry++)
+    if (writer.append(record, encodeRecord(entry, record), entry))
+      numAppended++;
+  if (writer.close()  ||  writer.errorMessage != indexWriter.errorMessage  ||  writer.errorMessage.empty())
+    return false;
+  fclose(out);
+
+  // every block in the container is whole, and there are fewer records than were appended
+  FILE *in = fopen(INDEX_OUTPUT, "rb");
+  AvroContainerReader reader(in);
+  int64_t numRecords = 0;
+  int64_t numObjects;
+  std::string data;
+  while (reader.valid  &&  reader.nextBlock(numObjects, data))
+    numRecords += numObjects;
+  bool ok = reader.valid  &&  reader.errorMessage.empty()  &&  numRecords > 0  &&  numRecords < numAppended;
+  fclose(in);
+  return ok;
+}
+
+///////////////////////////////////////////////////////////////////// main
+
+static bool report(const char *name, bool ok) {
+  std::cout << name << (ok ? "  ok" : "  FAILED") << std::endl;
+  return ok;
+}
+
+int main(int argc, char **argv) {
+  bool ok = true;
+  ok = report("checkpoint: interrupted and resumed           ", testCheckpoint(0, 0, 123457))  &&  ok;
+  ok = report("checkpoint: resumed with other codec threads  ", testCheckpoint(4, 2, 54321))  &&  ok;
+  ok = report("checkpoint: interrupted before the first block", testCheckpoint(0, 0, 10))  &&  ok;
+  ok = report("index: every entry's block                    ", testIndex(0))  &&  ok;
+  ok = report("index: with codec threads                     ", testIndex(4))  &&  ok;
+  ok = report("index: unwritable, so the blocks stop too     ", testIndexFailure(0))  &&  ok;
+  ok = report("index: unwritable, with codec threads         ", testIndexFailure(4))  &&  ok;
+  return ok ? 0 : 1;
+}
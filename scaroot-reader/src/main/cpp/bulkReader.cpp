@@ -0,0 +1 @@
+../../../../root2avro/src/bulkReader.cpp
\ No newline at end of file
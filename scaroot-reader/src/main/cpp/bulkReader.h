@@ -0,0 +1 @@
+../../../../root2avro/src/bulkReader.h
\ No newline at end of file
@@ -0,0 +1 @@
+../../../../root2avro/src/jsonWriter.h
\ No newline at end of file
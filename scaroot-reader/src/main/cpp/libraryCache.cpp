@@ -0,0 +1 @@
+../../../../root2avro/src/libraryCache.cpp
\ No newline at end of file
@@ -0,0 +1 @@
+../../../../root2avro/src/libraryCache.h
\ No newline at end of file
@@ -0,0 +1 @@
+../../../../root2avro/src/primitiveRuns.h
\ No newline at end of file
@@ -0,0 +1 @@
+../../../../root2avro/src/shardPlanner.cpp
\ No newline at end of file
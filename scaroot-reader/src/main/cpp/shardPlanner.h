@@ -0,0 +1 @@
+../../../../root2avro/src/shardPlanner.h
\ No newline at end of file
@@ -0,0 +1 @@
+../../../../root2avro/src/shmRing.c
\ No newline at end of file
@@ -0,0 +1 @@
+../../../../root2avro/src/shmRing.h
\ No newline at end of file
@@ -13,11 +13,43 @@
 // limitations under the License.
 
 #include "datawalker.h"
+#include "libraryCache.h"
+#include "shardPlanner.h"
 #include "staticlib.h"
 #include "streamerToCode.h"
+#include "walkerToCode.h"
+#include "walkerProgram.h"
+#include "walkerCache.h"
 
-void *newTreeWalker(const char *fileLocation, const char *treeLocation, const char *avroNamespace) {
-  TreeWalker *out = new TreeWalker(std::string(fileLocation), std::string(treeLocation), std::string(""), std::string(avroNamespace));
+std::vector<std::string> splitByComma(const char *in) {
+  std::vector<std::string> out;
+  std::stringstream ss(in);
+  std::string item;
+  while (std::getline(ss, item, ','))
+    out.push_back(item);
+  return out;
+}
+
+// loadLibrary with C++ sources compiled once into cacheDir (see libraryCache.h); includes is
+// comma-separated, and the result is an error message or empty
+const char *loadLibraryCached(const char *lib, const char *cacheDir, const char *includes) {
+  static std::string errorMessage;
+  if (loadCachedLibrary(std::string(cacheDir), std::string(lib), splitByComma(includes), errorMessage))
+    return "";
+  return errorMessage.c_str();
+}
+
+// what lib contributes to the walker cache options: a C++ source by its contents and the headers
+// it includes (libraryCacheKey), a compiled library by its size and modification time
+const char *libraryCacheOption(const char *lib, const char *includes) {
+  static std::string out;
+  out = libraryCacheDescription(std::string(lib), splitByComma(includes));
+  return out.c_str();
+}
+
+// branches and excludeBranches are comma-separated glob patterns (empty for no selection)
+void *newTreeWalker(const char *fileLocation, const char *treeLocation, const char *avroNamespace, const char *branches, const char *excludeBranches) {
+  TreeWalker *out = new TreeWalker(std::string(fileLocation), std::string(treeLocation), std::string(""), std::string(avroNamespace), splitByComma(branches), splitByComma(excludeBranches));
   return out;
 }
 
@@ -26,6 +58,22 @@ void reset(void *treeWalker, const char *fileLocation) {
   tw->reset(std::string(fileLocation));
 }
 
+void openAhead(void *treeWalker, const char *fileLocation) {
+  // ROOT I/O from more than one thread needs its global locks turned on first
+  static bool threadSafe = false;
+  if (!threadSafe) {
+    ROOT::EnableThreadSafety();
+    threadSafe = true;
+  }
+  TreeWalker *tw = (TreeWalker*)treeWalker;
+  tw->openAhead(std::string(fileLocation));
+}
+
+void setCache(void *treeWalker, int64_t cacheSize, int cacheLearnEntries, bool prefetch) {
+  TreeWalker *tw = (TreeWalker*)treeWalker;
+  tw->setCache(cacheSize, cacheLearnEntries, prefetch);
+}
+
 bool valid(void *treeWalker) {
   TreeWalker *tw = (TreeWalker*)treeWalker;
   return tw->valid;
@@ -61,6 +109,20 @@ void resolve(void *treeWalker) {
   tw->resolve();
 }
 
+// compile serializers for the resolved types (copyToBuffer uses them afterward); on failure,
+// errorMessage is set and the walkers are used as before
+bool jit(void *treeWalker) {
+  TreeWalker *tw = (TreeWalker*)treeWalker;
+  return compileSerializers(tw, tw->errorMessage);
+}
+
+// flatten the resolved types into walker programs (copyToBuffer uses them afterward,
+// except for fields that jit has compiled)
+void program(void *treeWalker) {
+  TreeWalker *tw = (TreeWalker*)treeWalker;
+  compilePrograms(tw);
+}
+
 const char *repr(void *treeWalker) {
   TreeWalker *tw = (TreeWalker*)treeWalker;
   tw->stringHolder = tw->repr();
@@ -70,6 +132,7 @@ const char *repr(void *treeWalker) {
 void printJSON(void *treeWalker) {
   TreeWalker *tw = (TreeWalker*)treeWalker;
   tw->printJSON();
+  tw->flushJSON();
 }
 
 const char *stringJSON(void *treeWalker) {
@@ -98,6 +161,12 @@ void copyToBuffer(void *treeWalker, int64_t entry, int microBatchSize, void *buf
   tw->copyToBuffer(entry, microBatchSize, buffer, (size_t)size);
 }
 
+// after copyToBuffer marks an entry StatusTooSmall: the buffer size that entry needs
+long bufferSizeNeeded(void *treeWalker) {
+  TreeWalker *tw = (TreeWalker*)treeWalker;
+  return (long)tw->sizeNeeded;
+}
+
 XRootD::XRootD(const char *urlstr) : url(urlstr) {
   fs = new TNetXNGSystem(url.c_str());
 }
@@ -170,3 +239,66 @@ const char *inferTypes(const char *fileLocation, const char *treeLocation) {
   declareClasses(code, classNames);
   return "";
 }
+
+// the same as inferTypes, but the generated code is kept in cacheDir (see walkerCache.h); options
+// are whatever else the caller's walkers depend on
+const char *inferTypesCached(const char *fileLocation, const char *treeLocation, const char *cacheDir, const char *options) {
+  static std::string errorMessage;
+  std::string key;
+  if (!walkerCacheKey(std::string(fileLocation), std::string(treeLocation), std::string(options), key, errorMessage))
+    return errorMessage.c_str();
+
+  WalkerCacheEntry entry;
+  entry.load(std::string(cacheDir), key);
+  if (entry.code.empty()) {
+    entry.code = generateCodeFromStreamers(std::string(fileLocation), std::string(treeLocation), entry.classNames, errorMessage);
+    if (entry.code.empty())
+      return errorMessage.c_str();
+    std::string ignored;             // the cache only saves work
+    entry.save(std::string(cacheDir), key, ignored);
+  }
+  declareClasses(entry.code, entry.classNames);
+  return "";
+}
+
+// before the resolve loop: true if the cache knew all of the dynamic types
+bool resolveFromCache(void *treeWalker, const char *cacheDir, const char *options) {
+  TreeWalker *tw = (TreeWalker*)treeWalker;
+  WalkerCacheEntry entry;
+  if (!entry.load(std::string(cacheDir), walkerCacheKey(tw->file, tw->reader->GetTree(), std::string(options)))  ||  entry.repr.empty())
+    return false;
+  return applyResolutions(tw, entry.resolutions);
+}
+
+// after the resolve loop, if resolveFromCache returned false
+void saveToCache(void *treeWalker, const char *cacheDir, const char *options) {
+  TreeWalker *tw = (TreeWalker*)treeWalker;
+  std::string key = walkerCacheKey(tw->file, tw->reader->GetTree(), std::string(options));
+  WalkerCacheEntry entry;
+  entry.load(std::string(cacheDir), key);      // keeps the code from inferTypesCached
+  recordResolutions(tw, entry.resolutions);
+  entry.repr = tw->repr();
+  std::string ignored;
+  entry.save(std::string(cacheDir), key, ignored);
+}
+
+const char *shardPlan(const char *fileLocations, const char *treeLocation, int numShards) {
+  // fileLocations is newline-separated; the result is a JSON plan or an error message starting with "!"
+  static std::string out;
+  std::vector<std::string> locations;
+  std::stringstream ss(fileLocations);
+  std::string item;
+  while (std::getline(ss, item, '\n'))
+    if (!item.empty())
+      locations.push_back(item);
+
+  std::vector<ClusterInfo> clusters;
+  std::string errorMessage;
+  if (!readClusters(locations, std::string(treeLocation), clusters, errorMessage))
+    out = std::string("!") + errorMessage;
+  else {
+    std::vector<ShardInfo> plan = planShards(clusters, numShards, -1, -1);
+    out = planJSON(plan, locations, std::string(treeLocation));
+  }
+  return out.c_str();
+}
@@ -28,9 +28,13 @@ extern "C" {
   void resetSignals();
   void addInclude(const char *include);
   void loadLibrary(const char *lib);
+  const char *loadLibraryCached(const char *lib, const char *cacheDir, const char *includes);
+  const char *libraryCacheOption(const char *lib, const char *includes);
 
-  void *newTreeWalker(const char *fileLocation, const char *treeLocation, const char *avroNamespace);
+  void *newTreeWalker(const char *fileLocation, const char *treeLocation, const char *avroNamespace, const char *branches, const char *excludeBranches);
   void reset(void *treeWalker, const char *fileLocation);
+  void openAhead(void *treeWalker, const char *fileLocation);
+  void setCache(void *treeWalker, int64_t cacheSize, int cacheLearnEntries, bool prefetch);
   bool valid(void *treeWalker);
   const char *errorMessage(void *treeWalker);
 
@@ -40,6 +44,8 @@ extern "C" {
 
   bool resolved(void *treeWalker);
   void resolve(void *treeWalker);
+  bool jit(void *treeWalker);
+  void program(void *treeWalker);
   const char *repr(void *treeWalker);
   void printJSON(void *treeWalker);
   const char *stringJSON(void *treeWalker);
@@ -48,6 +54,7 @@ extern "C" {
   int getDataSize(const void *fieldWalker, const void *address);
   const void *getData(const void *fieldWalker, const void *address, int index);
   void copyToBuffer(void *treeWalker, int64_t entry, int microBatchSize, void *buffer, long size);
+  long bufferSizeNeeded(void *treeWalker);
 
   void *xrootdFileSystem(const char *url);
   long xrootdFileSize(void *fs, const char *path);
@@ -57,6 +64,10 @@ extern "C" {
   const char *xrootdLocate(void *fs, const char *path);
 
   const char *inferTypes(const char *fileLocation, const char *treeLocation);
+  const char *inferTypesCached(const char *fileLocation, const char *treeLocation, const char *cacheDir, const char *options);
+  bool resolveFromCache(void *treeWalker, const char *cacheDir, const char *options);
+  void saveToCache(void *treeWalker, const char *cacheDir, const char *options);
+  const char *shardPlan(const char *fileLocations, const char *treeLocation, int numShards);
 }
 
 class XRootD {
@@ -0,0 +1 @@
+../../../../root2avro/src/varintRuns.cpp
\ No newline at end of file
@@ -0,0 +1 @@
+../../../../root2avro/src/varintRuns.h
\ No newline at end of file
@@ -0,0 +1 @@
+../../../../root2avro/src/walkerCache.cpp
\ No newline at end of file
@@ -0,0 +1 @@
+../../../../root2avro/src/walkerCache.h
\ No newline at end of file
@@ -0,0 +1 @@
+../../../../root2avro/src/walkerProgram.cpp
\ No newline at end of file
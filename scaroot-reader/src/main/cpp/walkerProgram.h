@@ -0,0 +1 @@
+../../../../root2avro/src/walkerProgram.h
\ No newline at end of file
@@ -0,0 +1 @@
+../../../../root2avro/src/walkerToCode.cpp
\ No newline at end of file
@@ -0,0 +1 @@
+../../../../root2avro/src/walkerToCode.h
\ No newline at end of file
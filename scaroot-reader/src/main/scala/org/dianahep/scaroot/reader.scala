@@ -140,9 +140,16 @@ package reader {
       }
     }
 
-    def apply(lib: String) {
+    // with a cacheDir, C++ sources are compiled once and reused by later processes
+    def apply(lib: String, cacheDir: String = "") {
       if (!(loadedLibraries contains lib)) {
-        RootReaderCPPLibrary.loadLibrary(lib)
+        if (cacheDir.isEmpty)
+          RootReaderCPPLibrary.loadLibrary(lib)
+        else {
+          val errorMessage: String = RootReaderCPPLibrary.loadLibraryCached(lib, cacheDir, includeDirs.mkString(","))
+          if (!errorMessage.isEmpty)
+            throw new RuntimeException(errorMessage)
+        }
         loadedLibraries += lib
       }
     }
@@ -156,7 +163,10 @@ package reader {
                                                   myclasses: Map[String, My[_]] = Map[String, My[_]](),
                                                   start: Long = 0L,
                                                   end: Long = -1L,
-                                                  microBatchSize: Int = 10) extends Iterator[TYPE] {
+                                                  microBatchSize: Int = 10,
+                                                  branches: Seq[String] = Nil,
+                                                  excludeBranches: Seq[String] = Nil,
+                                                  cacheDir: String = "") extends Iterator[TYPE] {
     if (fileLocations.isEmpty)
       throw new RuntimeException("Cannot build RootTreeIterator over an empty set of files.")
     if (start < 0)
@@ -169,10 +179,19 @@ package reader {
     val loadLibsOnce = LoadLibsOnce
     while (!loadLibsOnce.ready) { Thread.sleep(1) }
     includes foreach {dir => loadLibsOnce.include(dir)}
-    libs foreach {lib => loadLibsOnce(lib)}
+    libs foreach {lib => loadLibsOnce(lib, cacheDir)}
+
+    // what the walkers depend on besides the file itself (see walkerCache.h), with libs described
+    // as libraryCacheDescription does (C++ sources by their contents and included headers)
+    private val cacheOptions = s"scaroot\ntree $treeLocation\ninferTypes $inferTypes\nbranches ${branches.mkString(",")}\nexclude ${excludeBranches.mkString(",")}\nincludes ${includes.mkString(",")}" +
+      libs.map(lib => "\nlib " + RootReaderCPPLibrary.libraryCacheOption(lib, includes.mkString(","))).mkString
 
     if (inferTypes) {
-      val errorMessage: String = RootReaderCPPLibrary.inferTypes(fileLocations(0), treeLocation)
+      val errorMessage: String =
+        if (cacheDir.isEmpty)
+          RootReaderCPPLibrary.inferTypes(fileLocations(0), treeLocation)
+        else
+          RootReaderCPPLibrary.inferTypesCached(fileLocations(0), treeLocation, cacheDir, cacheOptions)
       if (!errorMessage.isEmpty)
         throw new RuntimeException(errorMessage)
     }
@@ -250,17 +269,22 @@ package reader {
     }
 
     val schema: SchemaClass = {
-      treeWalker = RootReaderCPPLibrary.newTreeWalker(fileLocations(0), treeLocation, "")
+      treeWalker = RootReaderCPPLibrary.newTreeWalker(fileLocations(0), treeLocation, "", branches.mkString(","), excludeBranches.mkString(","))
 
       if (RootReaderCPPLibrary.valid(treeWalker) == 0)
         throw new RuntimeException(RootReaderCPPLibrary.errorMessage(treeWalker))
 
+      val cached = !cacheDir.isEmpty  &&  RootReaderCPPLibrary.resolveFromCache(treeWalker, cacheDir, cacheOptions) != 0
+
       done = (RootReaderCPPLibrary.next(treeWalker) == 0)
       while (!done  &&  RootReaderCPPLibrary.resolved(treeWalker) == 0) {
         RootReaderCPPLibrary.resolve(treeWalker)
         done = (RootReaderCPPLibrary.next(treeWalker) == 0)
       }
 
+      if (!cacheDir.isEmpty  &&  !cached  &&  RootReaderCPPLibrary.resolved(treeWalker) != 0)
+        RootReaderCPPLibrary.saveToCache(treeWalker, cacheDir, cacheOptions)
+
       Schema(treeWalker)
     }
 
@@ -305,8 +329,10 @@ package reader {
       // Check the status byte to find out if copying failed due to a buffer that's too small (the only error we handle).
       statusByte = byteBuffer.get
       while (statusByte == 2) {
-        // Get a new, bigger buffer (and let the old one be garbage collected).
-        bufferSize = new NativeLong(bufferSize.longValue * 2L)
+        // Get a new buffer big enough for this entry (and let the old one be garbage collected).
+        // The entries before it in the micro-batch have already been used, and C++ has kept
+        // this one's serialized bytes, so nothing is read twice.
+        bufferSize = new NativeLong(Math.max(bufferSize.longValue * 2L, RootReaderCPPLibrary.bufferSizeNeeded(treeWalker).longValue))
         buffer = new Memory(bufferSize.longValue)
         byteBuffer = buffer.getByteBuffer(0, bufferSize.longValue)
         byteBufferDataStream = new ByteBufferDataStream(byteBuffer)
@@ -338,8 +364,11 @@ package reader {
                                        myclasses: Map[String, My[_]] = Map[String, My[_]](),
                                        start: Long = 0L,
                                        end: Long = -1L,
-                                       microBatchSize: Int = 10) =
-      new RootTreeIterator(fileLocations, treeLocation, includes, libs, inferTypes, myclasses, start, end, microBatchSize)
+                                       microBatchSize: Int = 10,
+                                       branches: Seq[String] = Nil,
+                                       excludeBranches: Seq[String] = Nil,
+                                       cacheDir: String = "") =
+      new RootTreeIterator(fileLocations, treeLocation, includes, libs, inferTypes, myclasses, start, end, microBatchSize, branches, excludeBranches, cacheDir)
   }
 
   /////////////////////////////////////////////////// interface to XRootD for creating file sets and splits
@@ -399,6 +428,7 @@ package reader {
         throw new IllegalArgumentException(s"""Not an XRootD URL: "$globurl"""")
     }
 
+    // Balances whole files by file size; see plan (below) for cluster-aligned entry ranges.
     def balance(globurl: String, partitions: Int): Seq[Seq[File]] = {
       val out = Array.fill(partitions)(mutable.ListBuffer[File]())
 
@@ -424,6 +454,45 @@ package reader {
       out.map(_.toList).toSeq
     }
 
+    case class Piece(url: String, start: Long, end: Long)
+    case class Shard(start: Long, end: Long, compressedBytes: Long, pieces: Seq[Piece])
+
+    // Entry ranges aligned to TTree cluster boundaries and balanced by compressed bytes, so that no two
+    // partitions decompress the same baskets. Shard.start and Shard.end are global entry numbers over
+    // fileLocations (in the order given), suitable for RootTreeIterator's start and end.
+    def plan(fileLocations: Seq[String], treeLocation: String, partitions: Int): Seq[Shard] = {
+      import org.dianahep.scaroot.reader.json._
+      val ensureResetSignals = LoadLibsOnce
+      val result: String = RootReaderCPPLibrary.shardPlan(fileLocations.mkString("\n"), treeLocation, partitions)
+      if (result.startsWith("!"))
+        throw new RuntimeException(result.substring(1))
+
+      def field(obj: Json, name: String): Json = obj match {
+        case JsonObject(pairs @ _*) => pairs.collectFirst({case (JsonString(k), v) if (k == name) => v}).get
+        case _ => throw new JsonFormatException(obj, "shard plan")
+      }
+      def long(x: Json): Long = x match {
+        case JsonInt(v) => v
+        case JsonFloat(v) => v.toLong
+        case _ => throw new JsonFormatException(x, "shard plan")
+      }
+
+      Json.parse(result) match {
+        case Some(json) =>
+          val JsonArray(shards @ _*) = field(json, "shards")
+          shards map {shard =>
+            val JsonArray(pieces @ _*) = field(shard, "files")
+            Shard(long(field(shard, "start")), long(field(shard, "end")), long(field(shard, "compressedBytes")),
+              pieces map {piece => val JsonString(url) = field(piece, "file"); Piece(url, long(field(piece, "start")), long(field(piece, "end")))})
+          }
+        case None =>
+          throw new RuntimeException(s"""Could not parse shard plan: $result""")
+      }
+    }
+
+    def plan(globurl: String, treeLocation: String, partitions: Int): Seq[Shard] =
+      plan(apply(globurl).map(_.url).sorted, treeLocation, partitions)
+
     // http://stackoverflow.com/a/17369948/1623645
     private def globToRegex(pattern: String): (String, Boolean) = {
       val sb = new java.lang.StringBuilder
@@ -85,7 +85,7 @@ Options:
       }
 
       // Build a TreeWalker.
-      val treeWalker = RootReaderCPPLibrary.newTreeWalker(fileLocation, treeLocation, "")
+      val treeWalker = RootReaderCPPLibrary.newTreeWalker(fileLocation, treeLocation, "", "", "")
       if (RootReaderCPPLibrary.valid(treeWalker) == 0)
         throw new RuntimeException(RootReaderCPPLibrary.errorMessage(treeWalker))
 